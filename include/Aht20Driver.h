@@ -0,0 +1,71 @@
+#ifndef AHT20_DRIVER_H
+#define AHT20_DRIVER_H
+
+#include "SensorDriver.h"
+
+// Aosong AHT20 temperature and humidity sensor on I2C. A conversion takes
+// 80 ms; the status byte says whether it has finished and a CRC covers the
+// reading.
+template <class Bus>
+class Aht20Driver
+{
+public:
+  static const uint8_t CHANNELS = 2;
+  static constexpr SensorChannel CHANNEL_INFO[CHANNELS] = {
+      {"temperature", "t", "degC", SENSOR_TEMPERATURE},
+      {"humidity", "h", "%RH", SENSOR_HUMIDITY},
+  };
+  static constexpr const char *NAME = "AHT20";
+  static const uint8_t ADDRESS = 0x38;
+  static const uint32_t CONVERSION_MS = 80;
+
+  explicit Aht20Driver(Bus &bus = Bus::shared(), uint8_t address = ADDRESS) : _bus(bus), _address(address) {}
+
+  bool begin()
+  {
+    _bus.begin();
+    uint8_t status;
+    if (!_bus.read(_address, &status, 1))
+      return false;
+    // Load the calibration if the chip has not done so since power-up
+    if (!(status & 0x08))
+    {
+      static const uint8_t calibrate[] = {0xBE, 0x08, 0x00};
+      if (!_bus.write(_address, calibrate, sizeof(calibrate)))
+        return false;
+      _bus.wait(10);
+    }
+    return true;
+  }
+
+  uint32_t trigger()
+  {
+    static const uint8_t measure[] = {0xAC, 0x33, 0x00};
+    _triggered = _bus.write(_address, measure, sizeof(measure));
+    return CONVERSION_MS;
+  }
+
+  SensorStatus collect(float *values)
+  {
+    uint8_t data[7];
+    if (!_triggered || !_bus.read(_address, data, sizeof(data)))
+      return SENSOR_ERROR;
+    if (data[0] & 0x80)
+      return SENSOR_BUSY;
+    if (sensorCrc8(data, 6) != data[6])
+      return SENSOR_ERROR;
+
+    uint32_t humidity = ((uint32_t)data[1] << 12) | ((uint32_t)data[2] << 4) | (data[3] >> 4);
+    uint32_t temperature = ((uint32_t)(data[3] & 0x0F) << 16) | ((uint32_t)data[4] << 8) | data[5];
+    values[0] = temperature * (200.0f / 1048576) - 50;
+    values[1] = humidity * (100.0f / 1048576);
+    return SENSOR_READY;
+  }
+
+private:
+  Bus &_bus;
+  uint8_t _address;
+  bool _triggered = false;
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef BACKFILL_SERVER_H
+#define BACKFILL_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "SampleHistory.h"
+
+// Answers backfill requests from SampleHistory. Requests are queued and served
+// one at a time, a batch of samples per message, ending with a completion
+// marker that says how many samples were sent and how far back the history
+// reaches. Messages are produced the same way as LeafTable's: formatNext()
+// writes the next one, commitNext() moves on once it has been published.
+// formatNext() returns 0 while a time range is still being skipped to; call
+// it again on a later pass.
+struct BackfillRequest
+{
+  char id[24];   // Echoed back so the requester can match the replies
+  bool byTime;   // Range is Unix time rather than sequence numbers
+  uint32_t from; // Inclusive
+  uint32_t to;   // Inclusive
+};
+
+class BackfillServer
+{
+public:
+  static const uint8_t QUEUE_SIZE = 4;
+  static const uint8_t BATCH = 8; // Samples per message
+  // History reads per formatNext(); each opens a segment file several times.
+  // A time range may have to skip many samples first, which is spread over
+  // as many passes as it takes.
+  static const uint8_t READS_PER_PASS = 2;
+
+  bool request(const BackfillRequest &request); // false when the queue is full
+  bool active() const { return _count > 0; }
+
+  size_t formatNext(SampleHistory &history, char *buffer, size_t size);
+  void commitNext();
+
+private:
+  struct Job
+  {
+    BackfillRequest request;
+    uint32_t cursor; // Highest seq already looked at
+    uint32_t sent;
+  };
+
+  Job _queue[QUEUE_SIZE];
+  uint8_t _first = 0;
+  uint8_t _count = 0;
+
+  // What the last formatNext() covered, applied by commitNext()
+  uint32_t _nextCursor = 0;
+  uint32_t _nextSent = 0;
+  bool _nextDone = false;
+};
+
+#endif
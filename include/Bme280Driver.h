@@ -0,0 +1,162 @@
+#ifndef BME280_DRIVER_H
+#define BME280_DRIVER_H
+
+#include "SensorDriver.h"
+
+// Bosch BME280 temperature, humidity and pressure sensor on I2C, in forced
+// mode with 1x oversampling (a conversion takes under 10 ms). The raw values
+// are compensated with the integer formulas from the datasheet.
+template <class Bus>
+class Bme280Driver
+{
+public:
+  static const uint8_t CHANNELS = 3;
+  static constexpr SensorChannel CHANNEL_INFO[CHANNELS] = {
+      {"temperature", "t", "degC", SENSOR_TEMPERATURE},
+      {"humidity", "h", "%RH", SENSOR_HUMIDITY},
+      {"pressure", "p", "hPa", SENSOR_PRESSURE},
+  };
+  static constexpr const char *NAME = "BME280";
+  static const uint8_t ADDRESS = 0x76; // 0x77 with SDO pulled high
+  static const uint8_t CHIP_ID = 0x60;
+  static const uint32_t CONVERSION_MS = 10;
+
+  // Factory trimming values read from the chip
+  struct Calibration
+  {
+    uint16_t t1;
+    int16_t t2, t3;
+    uint16_t p1;
+    int16_t p2, p3, p4, p5, p6, p7, p8, p9;
+    uint8_t h1, h3;
+    int16_t h2, h4, h5;
+    int8_t h6;
+  };
+
+  explicit Bme280Driver(Bus &bus = Bus::shared(), uint8_t address = ADDRESS) : _bus(bus), _address(address) {}
+
+  bool begin()
+  {
+    _bus.begin();
+    uint8_t id;
+    if (!readRegisters(0xD0, &id, 1) || id != CHIP_ID)
+      return false;
+    if (!writeRegister(0xE0, 0xB6)) // Soft reset
+      return false;
+    _bus.wait(3);
+
+    uint8_t c[26];
+    uint8_t h[7];
+    if (!readRegisters(0x88, c, sizeof(c)) || !readRegisters(0xE1, h, sizeof(h)))
+      return false;
+    _cal.t1 = c[0] | (c[1] << 8);
+    _cal.t2 = c[2] | (c[3] << 8);
+    _cal.t3 = c[4] | (c[5] << 8);
+    _cal.p1 = c[6] | (c[7] << 8);
+    _cal.p2 = c[8] | (c[9] << 8);
+    _cal.p3 = c[10] | (c[11] << 8);
+    _cal.p4 = c[12] | (c[13] << 8);
+    _cal.p5 = c[14] | (c[15] << 8);
+    _cal.p6 = c[16] | (c[17] << 8);
+    _cal.p7 = c[18] | (c[19] << 8);
+    _cal.p8 = c[20] | (c[21] << 8);
+    _cal.p9 = c[22] | (c[23] << 8);
+    _cal.h1 = c[25];
+    _cal.h2 = h[0] | (h[1] << 8);
+    _cal.h3 = h[2];
+    _cal.h4 = (int16_t)((int8_t)h[3] * 16) | (h[4] & 0x0F);
+    _cal.h5 = (int16_t)((int8_t)h[5] * 16) | (h[4] >> 4);
+    _cal.h6 = (int8_t)h[6];
+
+    // Humidity oversampling only takes effect with the next ctrl_meas write
+    return writeRegister(0xF2, 0x01) && writeRegister(0xF5, 0x00);
+  }
+
+  uint32_t trigger()
+  {
+    _triggered = writeRegister(0xF4, 0x25); // 1x temperature and pressure, forced mode
+    return CONVERSION_MS;
+  }
+
+  SensorStatus collect(float *values)
+  {
+    uint8_t status;
+    if (!_triggered || !readRegisters(0xF3, &status, 1))
+      return SENSOR_ERROR;
+    if (status & 0x08)
+      return SENSOR_BUSY;
+    uint8_t d[8];
+    if (!readRegisters(0xF7, d, sizeof(d)))
+      return SENSOR_ERROR;
+
+    int32_t adcP = ((int32_t)d[0] << 12) | ((int32_t)d[1] << 4) | (d[2] >> 4);
+    int32_t adcT = ((int32_t)d[3] << 12) | ((int32_t)d[4] << 4) | (d[5] >> 4);
+    int32_t adcH = ((int32_t)d[6] << 8) | d[7];
+    int32_t tFine;
+    values[0] = compensateTemperature(_cal, adcT, tFine) / 100.0f;
+    values[1] = compensateHumidity(_cal, adcH, tFine) / 1024.0f;
+    values[2] = compensatePressure(_cal, adcP, tFine) / 25600.0f;
+    return SENSOR_READY;
+  }
+
+  const Calibration &calibration() const { return _cal; }
+
+  // Datasheet compensation: centi-degC, Pa in Q24.8 and %RH in Q22.10
+  static int32_t compensateTemperature(const Calibration &cal, int32_t adcT, int32_t &tFine)
+  {
+    int32_t var1 = ((((adcT >> 3) - ((int32_t)cal.t1 << 1))) * ((int32_t)cal.t2)) >> 11;
+    int32_t var2 = (((((adcT >> 4) - ((int32_t)cal.t1)) * ((adcT >> 4) - ((int32_t)cal.t1))) >> 12) *
+                    ((int32_t)cal.t3)) >> 14;
+    tFine = var1 + var2;
+    return (tFine * 5 + 128) >> 8;
+  }
+
+  static uint32_t compensatePressure(const Calibration &cal, int32_t adcP, int32_t tFine)
+  {
+    int64_t var1 = (int64_t)tFine - 128000;
+    int64_t var2 = var1 * var1 * (int64_t)cal.p6;
+    var2 = var2 + ((var1 * (int64_t)cal.p5) * 131072);
+    var2 = var2 + ((int64_t)cal.p4 * 34359738368LL);
+    var1 = ((var1 * var1 * (int64_t)cal.p3) >> 8) + ((var1 * (int64_t)cal.p2) * 4096);
+    var1 = ((((int64_t)1) << 47) + var1) * ((int64_t)cal.p1) >> 33;
+    if (var1 == 0)
+      return 0;
+    int64_t p = 1048576 - adcP;
+    p = (((p * 2147483648LL) - var2) * 3125) / var1;
+    var1 = (((int64_t)cal.p9) * (p >> 13) * (p >> 13)) >> 25;
+    var2 = (((int64_t)cal.p8) * p) >> 19;
+    p = ((p + var1 + var2) >> 8) + (((int64_t)cal.p7) * 16);
+    return (uint32_t)p;
+  }
+
+  static uint32_t compensateHumidity(const Calibration &cal, int32_t adcH, int32_t tFine)
+  {
+    int32_t v = tFine - 76800;
+    v = (((((adcH * 16384) - (((int32_t)cal.h4) * 1048576) - (((int32_t)cal.h5) * v)) + 16384) >> 15) *
+         (((((((v * ((int32_t)cal.h6)) >> 10) * (((v * ((int32_t)cal.h3)) >> 11) + 32768)) >> 10) + 2097152) *
+               ((int32_t)cal.h2) + 8192) >> 14));
+    v = v - (((((v >> 15) * (v >> 15)) >> 7) * ((int32_t)cal.h1)) >> 4);
+    v = v < 0 ? 0 : v;
+    v = v > 419430400 ? 419430400 : v;
+    return (uint32_t)(v >> 12);
+  }
+
+private:
+  bool readRegisters(uint8_t reg, uint8_t *data, size_t length)
+  {
+    return _bus.write(_address, &reg, 1) && _bus.read(_address, data, length);
+  }
+
+  bool writeRegister(uint8_t reg, uint8_t value)
+  {
+    uint8_t data[] = {reg, value};
+    return _bus.write(_address, data, sizeof(data));
+  }
+
+  Bus &_bus;
+  uint8_t _address;
+  bool _triggered = false;
+  Calibration _cal = {};
+};
+
+#endif
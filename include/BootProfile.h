@@ -0,0 +1,49 @@
+#ifndef BOOT_PROFILE_H
+#define BOOT_PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Where boot time goes: setup() marks the end of each phase with micros() and
+// the CPU cycle counter, into a fixed array so profiling allocates nothing.
+// A phase lasts from the previous mark (or from reset, for the first one) to
+// its own. The cycle count wraps after 2^32 cycles (53 s at 80 MHz), so for
+// longer phases, such as a config portal, only the microseconds hold.
+// The caller passes the clocks in.
+class BootProfile
+{
+public:
+  static const uint8_t MAX_PHASES = 16;
+
+  // name must be a string literal; marks beyond MAX_PHASES are dropped
+  void mark(const char *name, uint32_t nowUs, uint32_t cycles);
+
+  uint8_t count() const { return _count; }
+  uint32_t totalUs() const { return _count > 0 ? _phase[_count - 1].endUs : 0; }
+
+  // Free heap and largest free block once setup() is done, for the report
+  void heap(uint32_t freeBytes, uint32_t maxBlock);
+
+  // JSON report: reset reason, total, heap and one entry per phase. Phases
+  // that do not fit are left out and counted in "phases_dropped", so the
+  // document is always complete; 0 if not even the header fits.
+  size_t format(char *buffer, size_t size, const char *resetReason, uint32_t resetCode) const;
+
+  // One line for the serial log: "core 71.2, serial 0.3, ... ms"
+  size_t formatSummary(char *buffer, size_t size) const;
+
+private:
+  struct Phase
+  {
+    const char *name;
+    uint32_t endUs;
+    uint32_t endCycles;
+  };
+
+  Phase _phase[MAX_PHASES];
+  uint8_t _count = 0;
+  uint32_t _heapFree = 0;
+  uint32_t _heapMaxBlock = 0;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef BROKER_LIST_H
+#define BROKER_LIST_H
+
+#include <Arduino.h>
+
+#define MAX_BROKERS 4
+#define BROKER_HOST_LEN 48
+
+struct BrokerEndpoint
+{
+  char host[BROKER_HOST_LEN];
+  uint16_t port;
+  uint16_t connectLatencyMs;   // Smoothed CONNECT-to-CONNACK time of successful connects
+  uint8_t recentFailures;      // Consecutive failures, forgotten after FAILURE_MEMORY_MS
+  unsigned long lastFailureTime;
+};
+
+// Ordered list of broker endpoints with a health score per endpoint. The first
+// entry is the preferred broker; others are used when it is failing and the
+// list falls back to it once a probe shows it is reachable again.
+class BrokerList
+{
+public:
+  // Parse "host[:port],host[:port],..." using defaultPort where none is given
+  uint8_t parse(const char *list, uint16_t defaultPort);
+
+  uint8_t count() const { return _count; }
+  const BrokerEndpoint &endpoint(uint8_t index) const { return _endpoints[index]; }
+
+  // Index of the healthiest endpoint, preferring earlier entries on a tie
+  uint8_t select(unsigned long now) const;
+  // Lower is better: config order, connect latency and recent failures
+  uint32_t score(uint8_t index, unsigned long now) const;
+
+  void reportSuccess(uint8_t index, unsigned long latencyMs);
+  void reportFailure(uint8_t index, unsigned long now);
+  void clearFailures(uint8_t index) { _endpoints[index].recentFailures = 0; }
+
+  // True when connected to a fallback and it is time to probe the preferred broker
+  bool shouldProbePreferred(uint8_t current, unsigned long now);
+
+private:
+  static const unsigned long FAILURE_MEMORY_MS = 300000;
+  static const unsigned long FAILBACK_PROBE_INTERVAL_MS = 120000;
+  static const uint32_t ORDER_PENALTY_MS = 1000;
+  static const uint32_t FAILURE_PENALTY_MS = 5000;
+
+  BrokerEndpoint _endpoints[MAX_BROKERS];
+  uint8_t _count = 0;
+  unsigned long _lastProbeTime = 0;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef DELTA_PATCHER_H
+#define DELTA_PATCHER_H
+
+#include <Arduino.h>
+#include <functional>
+
+// Streaming decoder for delta firmware patches made by tools/delta_ota.py.
+// The new image is rebuilt from the running image (read back from flash) and
+// the patch, a few hundred bytes at a time, so RAM use does not depend on the
+// image size.
+//
+// Patch format, integers little endian:
+//   header  "SDL1", u32 old size, u32 new size, 16-byte MD5 of the old image
+//   0x01 COPY   u32 old offset, u32 length
+//   0x02 ADD    u32 old offset, u32 length, then runs of
+//               u8 unchanged bytes, u8 n, n bytes added to the old bytes
+//   0x03 INSERT u32 length, then the literal bytes
+//   0x00 END
+class DeltaPatcher
+{
+public:
+  typedef std::function<bool(uint32_t offset, uint8_t *data, size_t length)> ReadOld;
+  typedef std::function<bool(const uint8_t *data, size_t length)> WriteNew;
+  // Called once the header is in; return false to reject the patch
+  typedef std::function<bool(uint32_t oldSize, uint32_t newSize, const uint8_t oldMd5[16])> HeaderCheck;
+
+  void begin(ReadOld readOld, WriteNew writeNew, HeaderCheck headerCheck);
+
+  // Decode input, producing at most about outputBudget bytes of new image.
+  // Returns how much input was consumed; call again with the rest.
+  size_t feed(const uint8_t *data, size_t length, size_t outputBudget);
+
+  bool done() const { return _state == DONE; }
+  bool failed() const { return _state == FAILED; }
+  uint32_t written() const { return _written; }
+  uint32_t newSize() const { return _newSize; }
+
+private:
+  enum State
+  {
+    HEADER,
+    OPCODE,
+    ARGS,
+    COPY,
+    ADD_RUN,
+    ADD_UNCHANGED,
+    ADD_BYTES,
+    INSERT,
+    DONE,
+    FAILED
+  };
+
+  static const size_t BUFFER_SIZE = 256;
+
+  bool emit(const uint8_t *data, size_t length);
+  bool flush();
+  bool copyOld(uint32_t length, size_t &budget);
+  void startOp();
+  void fail() { _state = FAILED; }
+
+  ReadOld _readOld;
+  WriteNew _writeNew;
+  HeaderCheck _headerCheck;
+
+  State _state = DONE;
+  uint8_t _opcode = 0;
+  uint8_t _args[28];
+  size_t _argsNeeded = 0;
+  size_t _argsHave = 0;
+
+  uint32_t _oldSize = 0;
+  uint32_t _newSize = 0;
+  uint32_t _oldPos = 0;    // Next byte of the old image used by COPY/ADD
+  uint32_t _remaining = 0; // Bytes left in the current operation
+  uint8_t _runRemaining = 0;
+  uint32_t _written = 0;
+
+  uint8_t _out[BUFFER_SIZE];
+  size_t _outLen = 0;
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include <Arduino.h>
+
+// Resolved broker addresses, kept in RTC memory so reconnects and deep-sleep
+// wakes skip the DNS round trip. The Arduino resolver does not report record
+// TTLs, so entries are trusted for DNS_CACHE_TTL_MS and re-resolved after that
+// or as soon as a connect to the cached address fails.
+#define DNS_CACHE_TTL_MS 3600000UL
+
+// Resolve host, from the cache when possible. dnsMs is set to the time spent
+// in the resolver (0 on a cache hit or for a numeric address).
+bool dnsResolve(const char *host, IPAddress &ip, uint32_t &dnsMs);
+
+// Drop the cached address for host so the next dnsResolve() asks the resolver
+void dnsInvalidate(const char *host);
+
+#endif
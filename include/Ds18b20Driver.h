@@ -0,0 +1,81 @@
+#ifndef DS18B20_DRIVER_H
+#define DS18B20_DRIVER_H
+
+#include "SensorDriver.h"
+
+// Maxim DS18B20 temperature probe, alone on a 1-Wire bus (addressed with
+// SKIP ROM) and powered from VDD rather than parasitically, so that it
+// answers read slots with 0 until a conversion is done. A 12-bit conversion
+// takes up to 750 ms. The bus class provides reset() (true when a device
+// answered), skip(), write(byte), read(), readBit() and wait(ms), as
+// OneWireBus does.
+template <class Bus>
+class Ds18b20Driver
+{
+public:
+  static const uint8_t CHANNELS = 1;
+  static constexpr SensorChannel CHANNEL_INFO[CHANNELS] = {
+      {"temperature", "t", "degC", SENSOR_TEMPERATURE},
+  };
+  static constexpr const char *NAME = "DS18B20";
+  static const uint32_t CONVERSION_MS = 750;
+
+  explicit Ds18b20Driver(Bus &bus = Bus::shared()) : _bus(bus) {}
+
+  bool begin()
+  {
+    _bus.begin();
+    return _bus.reset();
+  }
+
+  uint32_t trigger()
+  {
+    _triggered = _bus.reset();
+    if (_triggered)
+    {
+      _bus.skip();
+      _bus.write(0x44); // CONVERT T
+    }
+    return CONVERSION_MS;
+  }
+
+  SensorStatus collect(float *values)
+  {
+    if (!_triggered)
+      return SENSOR_ERROR;
+    if (!_bus.readBit())
+      return SENSOR_BUSY;
+    _triggered = false;
+    if (!_bus.reset())
+      return SENSOR_ERROR;
+    _bus.skip();
+    _bus.write(0xBE); // READ SCRATCHPAD
+    uint8_t data[9];
+    for (uint8_t i = 0; i < sizeof(data); i++)
+      data[i] = _bus.read();
+    if (crc8(data, 8) != data[8])
+      return SENSOR_ERROR;
+
+    values[0] = (int16_t)(data[0] | (data[1] << 8)) / 16.0f;
+    return SENSOR_READY;
+  }
+
+  // Dallas/Maxim CRC-8: polynomial 0x31 reflected, initial 0
+  static uint8_t crc8(const uint8_t *data, size_t length)
+  {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+      crc ^= data[i];
+      for (uint8_t bit = 0; bit < 8; bit++)
+        crc = crc & 0x01 ? (crc >> 1) ^ 0x8C : crc >> 1;
+    }
+    return crc;
+  }
+
+private:
+  Bus &_bus;
+  bool _triggered = false;
+};
+
+#endif
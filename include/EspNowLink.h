@@ -0,0 +1,39 @@
+#ifndef ESP_NOW_LINK_H
+#define ESP_NOW_LINK_H
+
+#include <Arduino.h>
+
+// Leaf-to-gateway link over ESP-NOW. A leaf wakes, sends one reading as a
+// single vendor action frame and sleeps again, with no association, DHCP or
+// TCP. The gateway stays on its access point's channel, so leaves must be
+// configured with that channel.
+#define ESP_NOW_READING_VERSION 1
+#define ESP_NOW_SENSOR_FAULT 0x01 // flags: the leaf could not read its sensor
+
+struct __attribute__((packed)) EspNowReading
+{
+  uint8_t version;
+  uint8_t flags;       // ESP_NOW_SENSOR_FAULT, other bits reserved, 0
+  uint32_t seq;        // Counts up on every wake, lets the gateway drop repeats
+  int16_t temperature; // Hundredths of a degC, 0 on a sensor fault
+  uint16_t humidity;   // Hundredths of a %RH, 0 on a sensor fault
+};
+
+struct EspNowFrame
+{
+  uint8_t mac[6];
+  EspNowReading reading;
+  unsigned long receivedAt; // millis() on the gateway
+};
+
+// Leaf side: send one reading and wait for the gateway's MAC-layer
+// acknowledgement. An empty or invalid gateway MAC broadcasts instead, which
+// is never acknowledged.
+bool espNowSend(const char *gatewayMac, uint8_t channel, const EspNowReading &reading, unsigned long timeoutMs);
+
+// Gateway side: start receiving; readings are queued until espNowReceive()
+bool espNowStartGateway();
+bool espNowReceive(EspNowFrame &frame);
+uint32_t espNowDropped(); // Readings lost because the queue was full
+
+#endif
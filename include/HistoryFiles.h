@@ -0,0 +1,19 @@
+#ifndef HISTORY_FILES_H
+#define HISTORY_FILES_H
+
+#include <Arduino.h>
+#include "SampleHistory.h"
+
+// SampleHistory segments as LittleFS files "/hist<n>.bin" of packed records.
+// Segments are only appended to or removed, which LittleFS handles without
+// rewriting existing blocks.
+class HistoryFiles : public HistoryStorage
+{
+public:
+  uint16_t count(uint8_t segment) override;
+  bool append(uint8_t segment, const HistoryRecord *records, uint16_t n) override;
+  bool read(uint8_t segment, uint16_t index, HistoryRecord *records, uint16_t n) override;
+  void clear(uint8_t segment) override;
+};
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef LEAF_TABLE_H
+#define LEAF_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Per-leaf state held by an ESP-NOW gateway: the latest reading, the last
+// sequence number (to drop retransmits) and a rollup of the readings since
+// the last publish. Slots live in one fixed open-addressing table with linear
+// probing, keyed by the leaf's MAC, so an update is a hash and usually a
+// single probe with no allocation. Time is passed in.
+struct LeafState
+{
+  uint8_t mac[6];
+  uint8_t used;
+  uint8_t faults;         // Sensor faults reported since the last publish
+  uint16_t count;         // Readings rolled up since the last publish, 0 = nothing new
+  int16_t temperature;    // Latest reading, hundredths of a degC
+  uint16_t humidity;      // Latest reading, hundredths of a %RH
+  int16_t temperatureMin; // Rollup since the last publish
+  int16_t temperatureMax;
+  uint32_t seq;
+  int32_t temperatureSum;
+  uint32_t humiditySum;
+  uint32_t lastSeen; // Milliseconds
+};
+
+class LeafTable
+{
+public:
+  enum Result
+  {
+    ADDED,
+    UPDATED,
+    DUPLICATE, // Retransmit or late copy of a reading already counted
+    FULL       // New leaf but no free slot
+  };
+
+  // Allocate the slots once; capacity is rounded up to a power of two and
+  // should leave a quarter of the table free to keep probe chains short
+  bool begin(uint16_t capacity);
+
+  // A reading with sensorFault set carries no values; it is counted in the
+  // leaf's faults and leaves the latest reading and the rollup alone
+  Result update(const uint8_t mac[6], uint32_t seq, int16_t temperature, uint16_t humidity, uint32_t nowMs,
+                bool sensorFault = false);
+  const LeafState *find(const uint8_t mac[6]) const;
+
+  // Drop leaves not heard from for maxSilenceMs; not during a publish round
+  uint16_t expire(uint32_t nowMs, uint32_t maxSilenceMs);
+
+  // Combined publish, a round at a time: formatNext() writes as many leaves
+  // with new readings as fit, commitNext() clears their rollups once the
+  // message is out. formatNext() returns 0 when the round is complete.
+  // A document is {"gateway": id, "leaves": [...]}; each leaf carries its
+  // chip ID as "leaf" (device_id "ESP8266-" + leaf), seq, the latest t and h,
+  // age_ms, and n with the rollup only when it covers more than one reading.
+  // A leaf that reported sensor faults adds "faults"; with no good reading
+  // since the last publish it has no t and h.
+  void startRound() { _cursor = 0; }
+  bool roundActive() const { return _cursor < _capacity; }
+  size_t formatNext(char *buffer, size_t size, const char *gatewayId, uint32_t nowMs);
+  void commitNext();
+
+  uint16_t size() const { return _size; }
+  uint16_t capacity() const { return _capacity; }
+  size_t memoryUsed() const { return sizeof(LeafState) * _capacity; }
+  uint32_t duplicates() const { return _duplicates; }
+  uint32_t rejected() const { return _rejected; }
+
+private:
+  uint16_t slotFor(const uint8_t mac[6]) const;
+  uint16_t probe(const uint8_t mac[6]) const;
+  void remove(uint16_t slot);
+
+  LeafState *_slots = nullptr;
+  uint16_t _capacity = 0;
+  uint16_t _size = 0;
+  uint16_t _cursor = 0;
+  uint16_t _next = 0;
+  uint32_t _duplicates = 0;
+  uint32_t _rejected = 0;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef MQTT5_CLIENT_H
+#define MQTT5_CLIENT_H
+
+#include <Arduino.h>
+#include <Client.h>
+#include <functional>
+
+#define MQTT5_BUFFER_SIZE 1024
+#define MQTT5_MAX_ALIASES 4
+#define MQTT5_MAX_TOPIC_LEN 64
+#define MQTT5_MAX_PUBLISH_PROPERTIES 8 // Message expiry (5) and topic alias (3)
+
+// Connection states, matching PubSubClient's values
+#define MQTT5_CONNECTION_TIMEOUT -4
+#define MQTT5_CONNECTION_LOST -3
+#define MQTT5_CONNECT_FAILED -2
+#define MQTT5_DISCONNECTED -1
+#define MQTT5_CONNECTED 0
+
+// Small MQTT 5 client with the same shape as PubSubClient (QoS 0 publish, QoS 0
+// or 1 subscribe, keepalive handling). It adds what MQTT 3.1.1 cannot do: topic
+// aliases, so a repeated topic is sent once per connection and then replaced
+// by a 2-byte alias, and a message expiry interval on each publish.
+class Mqtt5Client
+{
+public:
+  typedef std::function<void(char *, uint8_t *, unsigned int)> Callback;
+
+  explicit Mqtt5Client(Client &client) : _client(client) {}
+
+  void setServer(IPAddress ip, uint16_t port);
+  void setKeepAlive(uint16_t seconds) { _keepAlive = seconds; }
+  void setSocketTimeout(uint16_t seconds) { _socketTimeout = seconds; }
+  void setCallback(Callback callback) { _callback = callback; }
+
+  // Keeps alias 1 for this topic on every connection. Other topics get the
+  // remaining aliases first come, first served, so without this the topic
+  // published most can be left without one.
+  void reserveAlias(const char *topic);
+
+  // sessionExpiry > 0 asks the broker to keep the session after a disconnect
+  bool connect(const char *id, const char *user, const char *pass, bool cleanStart, uint32_t sessionExpiry);
+  void disconnect();
+  bool connected();
+  int state() const { return _state; }
+
+  // expirySeconds = 0 sends no message expiry interval
+  bool publish(const char *topic, const uint8_t *payload, size_t length, bool retained, uint32_t expirySeconds);
+  bool subscribe(const char *topic, uint8_t qos = 0);
+  bool loop();
+
+  bool sessionPresent() const { return _sessionPresent; }
+  uint16_t topicAliasMaximum() const { return _aliasMax; }
+
+private:
+  bool allocateBuffer();
+  bool writeBuffer(size_t length);
+  bool readByte(uint8_t &value);
+  bool readPacket(uint8_t &header, size_t &length);
+  void handlePacket(uint8_t header, size_t length);
+  bool parseConnack(size_t length);
+  uint16_t aliasFor(const char *topic, bool &firstUse);
+  void closeWithState(int state);
+
+  Client &_client;
+  IPAddress _ip;
+  uint16_t _port = 1883;
+  uint16_t _keepAlive = 15;       // Configured, sent in CONNECT
+  uint16_t _activeKeepAlive = 15; // In use on this connection, see parseConnack()
+  uint16_t _socketTimeout = 5;
+  Callback _callback;
+
+  uint8_t *_buffer = nullptr; // Allocated on first connect
+  unsigned long _lastOutbound = 0;
+  unsigned long _lastInbound = 0;
+  bool _pingOutstanding = false;
+  uint16_t _nextPacketId = 1;
+  int _state = MQTT5_DISCONNECTED;
+  bool _sessionPresent = false;
+
+  // Aliases are per connection and limited by the broker's Topic Alias Maximum
+  uint16_t _aliasMax = 0;
+  char _aliasTopics[MQTT5_MAX_ALIASES][MQTT5_MAX_TOPIC_LEN + 1];
+  uint8_t _aliasCount = 0;
+  uint8_t _aliasNamed = 0; // Bit per alias, set once its topic name went out
+  char _reservedTopic[MQTT5_MAX_TOPIC_LEN + 1] = "";
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef MQTT_SN_CLIENT_H
+#define MQTT_SN_CLIENT_H
+
+#include <Arduino.h>
+#include <Udp.h>
+
+// Minimal MQTT-SN publisher. Messages go out as QoS -1 PUBLISH packets to a
+// pre-defined topic ID, which needs no CONNECT or REGISTER exchange: the
+// gateway maps the ID to the full topic name from its own configuration.
+class MqttSnClient
+{
+public:
+  explicit MqttSnClient(UDP &udp) : _udp(udp) {}
+
+  void setGateway(IPAddress ip, uint16_t port);
+  bool publish(uint16_t topicId, const uint8_t *payload, size_t length);
+
+  // Size of the last PUBLISH datagram, including the MQTT-SN header
+  size_t lastPacketSize() const { return _lastPacketSize; }
+
+private:
+  static const uint8_t PUBLISH = 0x0C;
+  static const uint8_t FLAG_QOS_MINUS_ONE = 0x60;
+  static const uint8_t FLAG_TOPIC_PREDEFINED = 0x01;
+
+  UDP &_udp;
+  IPAddress _gatewayIp;
+  uint16_t _gatewayPort = 0;
+  size_t _lastPacketSize = 0;
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef MQTT_TLS_H
+#define MQTT_TLS_H
+
+#include <Arduino.h>
+#include <Client.h>
+
+// BearSSL client for MQTT over TLS. The negotiated session is kept in RTC
+// memory so reconnects, resets and deep-sleep wakes resume it with an
+// abbreviated handshake instead of a full key exchange.
+
+// Set up the secure client once and return it; false in ok if no trust
+// anchor is configured
+Client &tlsBegin(unsigned long socketTimeoutMs, bool &ok);
+
+// Apply buffer sizes and the cached session for this server before connect.
+// The connect goes by host name, which has to stay valid until it is done.
+void tlsPrepareConnect(const char *host, IPAddress ip, uint16_t port);
+
+// Keep or forget the session after a connect attempt and log what it cost,
+// full handshakes and resumptions apart
+void tlsConnectDone(IPAddress ip, bool connected, uint32_t heapBefore);
+
+#endif
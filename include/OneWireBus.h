@@ -0,0 +1,33 @@
+#ifndef ONE_WIRE_BUS_H
+#define ONE_WIRE_BUS_H
+
+#include <Arduino.h>
+#include <OneWire.h>
+
+#ifndef SENSOR_ONEWIRE_PIN
+#define SENSOR_ONEWIRE_PIN 13 // D7 on a D1 mini
+#endif
+
+// 1-Wire bus class for the DS18B20 driver, on the OneWire library
+class OneWireBus
+{
+public:
+  static OneWireBus &shared()
+  {
+    static OneWireBus bus;
+    return bus;
+  }
+
+  void begin() { _wire.begin(SENSOR_ONEWIRE_PIN); }
+  bool reset() { return _wire.reset() == 1; }
+  void skip() { _wire.skip(); }
+  void write(uint8_t value) { _wire.write(value); }
+  uint8_t read() { return _wire.read(); }
+  bool readBit() { return _wire.read_bit(); }
+  void wait(uint32_t ms) { delay(ms); }
+
+private:
+  OneWire _wire;
+};
+
+#endif
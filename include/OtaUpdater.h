@@ -0,0 +1,67 @@
+#ifndef OTA_UPDATER_H
+#define OTA_UPDATER_H
+
+#include <Arduino.h>
+#include "DeltaPatcher.h"
+
+#ifndef FIRMWARE_VERSION
+#define FIRMWARE_VERSION "dev"
+#endif
+
+// Streams a firmware image from an HTTP server straight into the update
+// partition. service() moves at most a few small chunks per call, so the main
+// loop keeps sampling and publishing while the download runs. The image is
+// checked against its MD5 before it is accepted, so an update without one is
+// refused.
+//
+// With delta set the download is a patch against the running image (see
+// tools/delta_ota.py) and the new image is rebuilt from it on the way into
+// flash; the MD5 is still that of the new image.
+class OtaUpdater
+{
+public:
+  enum State
+  {
+    IDLE,
+    DOWNLOADING,
+    SUCCEEDED,
+    FAILED
+  };
+
+  // expectedSize 0 takes the size from the Content-Length header; for a delta
+  // update it is the size of the patch
+  bool begin(const char *url, const char *md5, size_t expectedSize, bool delta = false);
+  State service();
+  void reset();
+
+  State state() const { return _state; }
+  const char *error() const { return _error; }
+  size_t received() const { return _received; }
+  size_t total() const { return _total; }
+  size_t imageSize() const { return _delta ? _patcher.newSize() : _total; }
+  bool delta() const { return _delta; }
+  unsigned long elapsedMs() const { return _finishTime - _startTime; }
+
+private:
+  void fail(const char *error);
+  bool checkPatch(uint32_t oldSize, uint32_t newSize, const uint8_t oldMd5[16]);
+  bool feedPatch();
+  void releasePatch();
+
+  State _state = IDLE;
+  const char *_error = "";
+  size_t _received = 0;
+  size_t _total = 0;
+  unsigned long _startTime = 0;
+  unsigned long _finishTime = 0;
+  unsigned long _lastDataTime = 0;
+
+  bool _delta = false;
+  DeltaPatcher _patcher;
+  char _md5[33] = "";
+  uint8_t *_patch = nullptr; // Downloaded patch bytes not yet decoded, delta only
+  size_t _patchLength = 0;
+  size_t _patchPos = 0;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef PSYCHROMETRICS_H
+#define PSYCHROMETRICS_H
+
+#include <stdint.h>
+
+// Values derived from temperature and relative humidity, in integer
+// arithmetic with two small lookup tables instead of soft-float log() and
+// exp(). Inputs and outputs are in hundredths: centi-degC, centi-%RH and
+// centi-g/m3.
+//
+// Reference formulas (tools/psychro_check.cpp checks against them):
+//   saturation vapour pressure  es = 6.112 hPa * exp(17.62 T / (243.12 + T))
+//   dew point                   g = ln(RH / 100) + 17.62 T / (243.12 + T),
+//                               Td = 243.12 g / (17.62 - g)
+//   absolute humidity           AH = 216.7 * es * RH / 100 / (T + 273.15)
+//   heat index                  NWS: the simple formula, or the Rothfusz
+//                               regression with its two adjustments once
+//                               the simple value averaged with T is 80 degF
+
+// Bits of the "derived" setting
+#define PSYCHRO_DEW_POINT 0x01
+#define PSYCHRO_ABS_HUMIDITY 0x02
+#define PSYCHRO_HEAT_INDEX 0x04
+
+// Humidity below 0.01 %RH is taken as 0.01 %RH, where the dew point is
+// about -100 degC, since at 0 there is none
+int32_t psychroDewPoint(int32_t temperature, int32_t humidity);
+int32_t psychroAbsoluteHumidity(int32_t temperature, int32_t humidity);
+int32_t psychroHeatIndex(int32_t temperature, int32_t humidity);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef RTC_STATE_H
+#define RTC_STATE_H
+
+#include <Arduino.h>
+
+// State kept in the RTC user memory, which survives resets and deep sleep but
+// not a power loss. The whole block is checked with a CRC on boot and starts
+// out zeroed when it is missing or corrupt.
+#define RTC_STATE_MAGIC 0x52544331 // "RTC1"
+#define DNS_CACHE_SLOTS 4
+#define TLS_PROBE_SLOTS 4
+
+struct DnsCacheEntry
+{
+  uint32_t hostHash;   // FNV-1a of the host name, 0 = empty slot
+  uint32_t ip;
+  uint32_t resolvedAt; // rtcClockNow() when the address was resolved
+};
+
+struct TlsProbeEntry
+{
+  uint32_t ip;       // Server the max fragment length probe was run against, 0 = empty slot
+  uint32_t probedAt; // rtcClockNow() when it was run
+  uint16_t port;
+  uint8_t smallFragments; // 1 when the server accepted small records
+  uint8_t unused;
+};
+
+struct RtcData
+{
+  uint32_t magic;
+  uint32_t crc;
+  uint32_t clockMs; // Milliseconds counted across resets, see rtcClockNow()
+  DnsCacheEntry dns[DNS_CACHE_SLOTS];
+
+  // TLS session for resumption, the whole BearSSL::Session object
+  uint32_t tlsSessionIp; // Server the session belongs to, 0 = none
+  uint8_t tlsSession[91];
+  TlsProbeEntry tlsProbes[TLS_PROBE_SLOTS]; // One per broker endpoint
+
+  uint32_t sampleSeq; // Last sample sequence number, see SampleSequence
+
+  // Broker, client ID, topics and QoS the persistent MQTT session was last
+  // subscribed with (FNV-1a), see subscribeTopics()
+  uint32_t mqttSubscriptionHash;
+
+  // ESP-NOW leaf state, see runLeaf()
+  uint8_t leafFailures; // Wakes in a row the gateway did not acknowledge
+
+  // What a leaf needs after a deep sleep wake, saved before every sleep so the
+  // wake can skip the filesystem and config; see restoreLeafWake()
+  uint8_t wakeReady; // 1 when the fields below are valid
+  uint8_t wakeLogLevel;
+  uint8_t wakeEspNowChannel;
+  char wakeEspNowGateway[18];
+  uint32_t wakeInterval;
+  uint32_t wakeSequenceBoot;     // SampleSequence boot and reservation as stored
+  uint32_t wakeSequenceReserved; // in flash, kept in step by saveSequence()
+};
+
+extern RtcData rtcData;
+
+// Load the block, returning false (and starting fresh) if it was not valid
+bool rtcLoad();
+void rtcSave();
+
+// Milliseconds since the RTC block was created, continuing across resets.
+// Time spent in reset is not counted; deep sleep is added by rtcAdvanceClock().
+uint32_t rtcClockNow();
+void rtcAdvanceClock(uint32_t ms);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef SAMPLE_HISTORY_H
+#define SAMPLE_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Recent samples kept for backfill. Records go into a few fixed-size
+// segments used as a ring: the newest segment is appended to, and when it is
+// full the oldest one is emptied and reused, so flash only ever sees appends
+// and whole-segment erases. New records are staged in RAM and written a block
+// at a time to spare the flash. Sequence numbers only go up, so records are
+// ordered by seq from the oldest segment to the staging buffer.
+struct HistoryRecord
+{
+  uint32_t seq;
+  uint32_t time;       // Unix time, 0 = clock not set yet
+  int16_t temperature; // Hundredths of a degC
+  uint16_t humidity;   // Hundredths of a %RH
+};
+
+// Where segments are kept: files on the device, memory on the host
+class HistoryStorage
+{
+public:
+  virtual ~HistoryStorage() {}
+  virtual uint16_t count(uint8_t segment) = 0;
+  virtual bool append(uint8_t segment, const HistoryRecord *records, uint16_t n) = 0;
+  virtual bool read(uint8_t segment, uint16_t index, HistoryRecord *records, uint16_t n) = 0;
+  virtual void clear(uint8_t segment) = 0;
+};
+
+class SampleHistory
+{
+public:
+  static const uint8_t SEGMENTS = 4;
+  static const uint16_t SEGMENT_RECORDS = 512;
+  static const uint8_t STAGED_RECORDS = 16; // Written to flash together
+
+  // Pick up the segments left by the previous boot
+  void begin(HistoryStorage &storage);
+
+  void add(const HistoryRecord &record);
+  void flush();
+
+  // Copy up to max records with a seq above afterSeq, oldest first
+  uint16_t read(uint32_t afterSeq, HistoryRecord *records, uint16_t max);
+
+  uint32_t oldestSeq() const; // 0 when empty
+  uint32_t size() const;
+
+private:
+  uint8_t segmentAt(uint8_t age) const { return (_head + 1 + age) % SEGMENTS; } // age 0 = oldest
+  uint16_t lowerBound(uint8_t segment, uint32_t afterSeq);
+
+  HistoryStorage *_storage = nullptr;
+  uint8_t _head = 0; // Segment being appended to
+  uint16_t _count[SEGMENTS] = {};
+  uint32_t _firstSeq[SEGMENTS] = {};
+  HistoryRecord _staged[STAGED_RECORDS];
+  uint8_t _stagedCount = 0;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SAMPLE_SEQUENCE_H
+#define SAMPLE_SEQUENCE_H
+
+#include <stdint.h>
+
+// Per-device sample sequence numbers and boot counter. The sequence goes up by
+// one for every sample, never repeats and never goes backwards, so a consumer
+// can tell lost and duplicated messages apart from a reboot.
+//
+// The current number lives in RTC memory, which is cheap to write on every
+// sample but lost on power-off. Flash only holds a reservation: numbers below
+// it may have been used. When the sequence reaches it a new block of
+// RESERVE_BLOCK numbers is reserved, and after a power loss counting restarts
+// at the reservation. Flash is therefore written once per block and once per
+// boot, and a power loss skips at most one block of numbers.
+class SampleSequence
+{
+public:
+  static const uint32_t RESERVE_BLOCK = 256;
+
+  // rtcSeq is the number kept in RTC memory, ignored unless rtcValid; keep it
+  // equal to current() from here on. A deep sleep wake continues the current
+  // boot, any other reset (or losing the RTC memory) starts a new one.
+  void begin(bool rtcValid, uint32_t rtcSeq, bool deepSleepWake, uint32_t storedBoot, uint32_t storedReserved);
+
+  // Next sequence number. When storeDue() is set afterwards, boot() and
+  // reserved() must be written to flash before the number is published.
+  uint32_t next();
+
+  bool storeDue() const { return _storeDue; }
+  void stored() { _storeDue = false; }
+
+  uint32_t boot() const { return _boot; }
+  uint32_t current() const { return _seq; }
+  uint32_t reserved() const { return _reserved; }
+
+private:
+  uint32_t _boot = 0;
+  uint32_t _seq = 0;
+  uint32_t _reserved = 0;
+  bool _storeDue = false;
+};
+
+#endif
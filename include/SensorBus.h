@@ -0,0 +1,178 @@
+#ifndef SENSOR_BUS_H
+#define SENSOR_BUS_H
+
+#include <math.h>
+#include <new>
+#include "SensorDriver.h"
+
+#define TCA9548A_ADDRESS 0x70
+
+// View of one TCA9548A channel as a bus of its own, for the sensor drivers.
+// Channel 0xFF is the main bus with every mux channel switched off. The
+// channel last selected is shared by all views of the same mux, so a
+// transaction only costs an extra mux write when the channel changes.
+template <class Bus>
+class MuxChannelBus
+{
+public:
+  MuxChannelBus(Bus &bus, uint8_t muxAddress, uint8_t channel, uint8_t *selected)
+      : _bus(bus), _muxAddress(muxAddress), _channel(channel), _selected(selected)
+  {
+  }
+
+  void begin() { _bus.begin(); }
+
+  bool write(uint8_t address, const uint8_t *data, size_t length)
+  {
+    return select() && _bus.write(address, data, length);
+  }
+
+  bool read(uint8_t address, uint8_t *data, size_t length) { return select() && _bus.read(address, data, length); }
+
+  void wait(uint32_t ms) { _bus.wait(ms); }
+
+  uint8_t channel() const { return _channel; }
+
+private:
+  bool select()
+  {
+    uint8_t mask = _channel == 0xFF ? 0 : 1 << _channel;
+    if (*_selected == mask)
+      return true;
+    // Without a mux only the main bus is reachable
+    if (!_bus.write(_muxAddress, &mask, 1) && _channel != 0xFF)
+      return false;
+    *_selected = mask;
+    return true;
+  }
+
+  Bus &_bus;
+  uint8_t _muxAddress;
+  uint8_t _channel;
+  uint8_t *_selected;
+};
+
+// Channel metadata of one driver repeated for MAX sensors
+template <class Single, uint8_t MAX>
+struct RepeatedChannels
+{
+  constexpr RepeatedChannels() : channel()
+  {
+    for (uint8_t i = 0; i < Single::CHANNELS * MAX; i++)
+      channel[i] = Single::CHANNEL_INFO[i % Single::CHANNELS];
+  }
+
+  SensorChannel channel[Single::CHANNELS * MAX];
+};
+
+// Up to MAX sensors of one type on an I2C bus: on the bus itself and on each
+// channel of a TCA9548A mux, which is how several chips with the same fixed
+// address (like the AHT20) share a bus. begin() finds them; it succeeds if
+// there is at least one. Found sensors fill the channels from the start,
+// the channels of the rest read NAN. A sensor on the main bus answers
+// whichever mux channel is selected, so when there is one the mux channels
+// are not searched.
+//
+// trigger() starts every conversion back to back before any result is read,
+// so the conversions overlap: a cycle takes one conversion time plus the bus
+// time of the transfers, rather than a conversion time per sensor. collect()
+// reads the sensors in the order they were triggered, which is the order
+// they finish in, and skips those already read this cycle.
+template <class Bus, template <class> class Driver, uint8_t MAX>
+class SensorBus
+{
+  static_assert(MAX >= 1 && MAX <= 9, "the main bus and 8 mux channels hold at most 9 sensors of a type");
+  typedef Driver<MuxChannelBus<Bus>> Single;
+  static constexpr RepeatedChannels<Single, MAX> INFO = {};
+
+public:
+  static const uint8_t CHANNELS = Single::CHANNELS * MAX;
+  static constexpr const SensorChannel *CHANNEL_INFO = INFO.channel;
+  static constexpr const char *NAME = Single::NAME;
+
+  explicit SensorBus(Bus &bus = Bus::shared(), uint8_t muxAddress = TCA9548A_ADDRESS) : _bus(bus), _muxAddress(muxAddress) {}
+
+  ~SensorBus()
+  {
+    for (uint8_t i = 0; i < _count; i++)
+      sensor(i).~Single();
+  }
+
+  // Probes the main bus, then mux channels 0 to 7
+  bool begin()
+  {
+    _bus.begin();
+    for (uint8_t i = 0; i < _count; i++)
+      sensor(i).~Single();
+    _count = 0;
+    _selected = 0xFF; // Unknown, forces a mux write
+    for (uint16_t channel = 0xFF; _count < MAX; channel = channel == 0xFF ? 0 : channel + 1)
+    {
+      if (channel != 0xFF && channel >= 8)
+        break;
+      MuxChannelBus<Bus> *view = new (_views[_count]) MuxChannelBus<Bus>(_bus, _muxAddress, channel, &_selected);
+      Single *single = new (_sensors[_count]) Single(*view);
+      if (single->begin())
+        _count++;
+      else
+        single->~Single();
+      if (channel == 0xFF && _count > 0)
+        break;
+    }
+    return _count > 0;
+  }
+
+  uint32_t trigger()
+  {
+    uint32_t wait = 0;
+    for (uint8_t i = 0; i < _count; i++)
+    {
+      uint32_t sensorWait = sensor(i).trigger();
+      wait = sensorWait > wait ? sensorWait : wait;
+    }
+    _done = 0;
+    return wait;
+  }
+
+  SensorStatus collect(float *values)
+  {
+    SensorStatus status = SENSOR_READY;
+    for (uint8_t i = 0; i < MAX; i++)
+    {
+      float *sensorValues = values + i * Single::CHANNELS;
+      if (i >= _count)
+      {
+        for (uint8_t c = 0; c < Single::CHANNELS; c++)
+          sensorValues[c] = NAN;
+        continue;
+      }
+      if (_done & (1UL << i))
+        continue;
+      SensorStatus sensorStatus = sensor(i).collect(sensorValues);
+      if (sensorStatus == SENSOR_READY)
+        _done |= 1UL << i;
+      status = sensorStatus > status ? sensorStatus : status;
+    }
+    return status;
+  }
+
+  uint8_t count() const { return _count; }
+
+  // Mux channel sensor i was found on, 0xFF for the main bus
+  uint8_t muxChannel(uint8_t i) const { return view(i).channel(); }
+
+private:
+  Single &sensor(uint8_t i) { return *reinterpret_cast<Single *>(_sensors[i]); }
+  const MuxChannelBus<Bus> &view(uint8_t i) const { return *reinterpret_cast<const MuxChannelBus<Bus> *>(_views[i]); }
+
+  Bus &_bus;
+  uint8_t _muxAddress;
+  uint8_t _selected = 0xFF;
+  uint8_t _count = 0;
+  uint32_t _done = 0; // Bit per sensor read this cycle
+  // Constructed in begin(), for the sensors found
+  alignas(MuxChannelBus<Bus>) uint8_t _views[MAX][sizeof(MuxChannelBus<Bus>)];
+  alignas(Single) uint8_t _sensors[MAX][sizeof(Single)];
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef SENSOR_DRIVER_H
+#define SENSOR_DRIVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Sensor drivers are plain classes picked at compile time, with no virtual
+// calls and nothing built for a driver that is not selected (see Sensors.h).
+// Every driver provides:
+//
+//   static const uint8_t CHANNELS;                 values it produces
+//   static constexpr SensorChannel CHANNEL_INFO[]; what each value is
+//   static constexpr const char *NAME;
+//   bool begin();                 probe and set up the chip, may wait briefly
+//   uint32_t trigger();           start a conversion, returns the milliseconds
+//                                 until collect() should be called
+//   SensorStatus collect(float *values);  fill values[0..CHANNELS), or report
+//                                 that the conversion is still running
+//
+// Drivers talk to the chip through a bus class passed in as a template
+// parameter, so the same driver code runs against Wire on the device and
+// against the simulated buses in tools/sim_sensors.h on the host.
+
+enum SensorQuantity : uint8_t
+{
+  SENSOR_TEMPERATURE,
+  SENSOR_HUMIDITY,
+  SENSOR_PRESSURE
+};
+
+struct SensorChannel
+{
+  const char *key;      // JSON key of a single reading
+  const char *shortKey; // JSON key inside a batch
+  const char *unit;
+  SensorQuantity quantity;
+};
+
+enum SensorStatus : uint8_t
+{
+  SENSOR_READY,
+  SENSOR_BUSY, // Conversion still running, call collect() again shortly
+  SENSOR_ERROR
+};
+
+// CRC-8 used by Sensirion and Aosong chips: polynomial 0x31, initial 0xFF
+inline uint8_t sensorCrc8(const uint8_t *data, size_t length)
+{
+  uint8_t crc = 0xFF;
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++)
+      crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+  }
+  return crc;
+}
+
+// Placeholder for a driver slot that is not built in
+class NoSensor
+{
+public:
+  static const uint8_t CHANNELS = 0;
+};
+
+// The drivers of one build, handled as one sensor: channels are numbered
+// across the drivers in order, trigger() starts every conversion and
+// collect() returns SENSOR_READY once every driver has delivered.
+template <class... Drivers>
+class SensorSet;
+
+template <>
+class SensorSet<>
+{
+public:
+  static const uint8_t CHANNELS = 0;
+
+  bool begin() { return true; }
+  uint32_t trigger() { return 0; }
+  SensorStatus collect(float *) { return SENSOR_READY; }
+  const char *failed() const { return nullptr; }
+  static constexpr SensorChannel NONE = {"", "", "", SENSOR_TEMPERATURE};
+  static constexpr const SensorChannel &channel(uint8_t) { return NONE; }
+  static constexpr int find(SensorQuantity, int = 0) { return -1; }
+};
+
+template <class... Rest>
+class SensorSet<NoSensor, Rest...> : public SensorSet<Rest...>
+{
+};
+
+template <class Driver, class... Rest>
+class SensorSet<Driver, Rest...>
+{
+public:
+  static const uint8_t CHANNELS = Driver::CHANNELS + SensorSet<Rest...>::CHANNELS;
+
+  // Returns false if any driver did not find its chip, see failed()
+  bool begin()
+  {
+    _found = _driver.begin();
+    bool rest = _rest.begin();
+    return _found && rest;
+  }
+
+  uint32_t trigger()
+  {
+    _done = false;
+    uint32_t wait = _driver.trigger();
+    uint32_t restWait = _rest.trigger();
+    return wait > restWait ? wait : restWait;
+  }
+
+  SensorStatus collect(float *values)
+  {
+    SensorStatus status = SENSOR_READY;
+    if (!_done)
+    {
+      status = _driver.collect(values);
+      _done = status == SENSOR_READY;
+    }
+    SensorStatus rest = _rest.collect(values + Driver::CHANNELS);
+    return status > rest ? status : rest;
+  }
+
+  // Name of the first driver whose chip was missing at begin()
+  const char *failed() const { return _found ? _rest.failed() : Driver::NAME; }
+
+  static constexpr const SensorChannel &channel(uint8_t index)
+  {
+    return index < Driver::CHANNELS ? Driver::CHANNEL_INFO[index]
+                                    : SensorSet<Rest...>::channel(index - Driver::CHANNELS);
+  }
+
+  // Index of the first channel measuring quantity, or -1
+  static constexpr int find(SensorQuantity quantity, int offset = 0)
+  {
+    return findIn(quantity, 0) >= 0 ? offset + findIn(quantity, 0)
+                                    : SensorSet<Rest...>::find(quantity, offset + Driver::CHANNELS);
+  }
+
+private:
+  static constexpr int findIn(SensorQuantity quantity, uint8_t index)
+  {
+    return index >= Driver::CHANNELS ? -1
+                                     : (Driver::CHANNEL_INFO[index].quantity == quantity ? index : findIn(quantity, index + 1));
+  }
+
+  Driver _driver;
+  SensorSet<Rest...> _rest;
+  bool _found = false;
+  bool _done = false;
+};
+
+#endif
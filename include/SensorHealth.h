@@ -0,0 +1,62 @@
+#ifndef SENSOR_HEALTH_H
+#define SENSOR_HEALTH_H
+
+#include <stdint.h>
+
+// Sensor presence, kept in the background so the device runs on without its
+// sensors. A sensor that is not found at boot, or that fails several reads
+// in a row, is in fault: sampling stops and the bus is probed again with a
+// backoff that doubles from minBackoff up to maxBackoff, until begin()
+// succeeds. A single failed read is only counted, as the I2C path recovers
+// most glitches on its own. Every change of state sets changed() so a status
+// message can be sent.
+class SensorHealth
+{
+public:
+  enum State : uint8_t
+  {
+    PROBING, // Not found yet since boot
+    OK,
+    FAULT // Was working, then failed reads or a probe
+  };
+
+  void configure(uint32_t minBackoffMs, uint32_t maxBackoffMs, uint8_t failuresToFault);
+
+  // The first probe is due at once
+  bool probeDue(uint32_t nowMs) const;
+  void probed(bool found, uint32_t nowMs);
+
+  // Outcome of a sample, while ok()
+  void sampled(bool ok, uint32_t nowMs);
+
+  bool ok() const { return _state == OK; }
+  State state() const { return _state; }
+  const char *stateName() const;
+
+  // Set on every change of state, until clearChanged()
+  bool changed() const { return _changed; }
+  void clearChanged() { _changed = false; }
+
+  uint32_t probes() const { return _probes; }        // Failed probes since the sensor was last ok
+  uint32_t failedReads() const { return _failedReads; } // Since boot
+  uint32_t faults() const { return _faults; }        // Times a working sensor went to fault
+  uint32_t nextProbeIn(uint32_t nowMs) const;
+
+private:
+  void enter(State state, uint32_t nowMs);
+
+  uint32_t _minBackoff = 1000;
+  uint32_t _maxBackoff = 60000;
+  uint8_t _failuresToFault = 3;
+
+  State _state = PROBING;
+  bool _changed = true;
+  uint32_t _backoff = 0; // 0 until a probe has failed, so the next one is due at once
+  uint32_t _lastProbe = 0;
+  uint8_t _failuresInRow = 0;
+  uint32_t _probes = 0;
+  uint32_t _failedReads = 0;
+  uint32_t _faults = 0;
+};
+
+#endif
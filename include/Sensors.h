@@ -0,0 +1,79 @@
+#ifndef SENSORS_H
+#define SENSORS_H
+
+#include "SensorDriver.h"
+
+// The sensor drivers built into the firmware, chosen with build flags:
+//   -D SENSOR_AHT20 -D SENSOR_SHT3X -D SENSOR_BME280 -D SENSOR_DS18B20
+// in any combination (see the environments in platformio.ini); with none of
+// them set the AHT20 is used. Drivers left out are not compiled at all.
+// For several I2C sensors of one type, on the channels of a TCA9548A mux,
+// give their maximum number instead (up to 9, see SensorBus.h):
+//   -D SENSOR_AHT20=8
+// The mux is expected at its default address, TCA9548A_ADDRESS.
+// The bus classes can be replaced as well, which tools/sensor_sizes.sh uses
+// to build the same selection on the host.
+
+#if !defined(SENSOR_AHT20) && !defined(SENSOR_SHT3X) && !defined(SENSOR_BME280) && !defined(SENSOR_DS18B20)
+#define SENSOR_AHT20
+#endif
+
+#if defined(SENSOR_AHT20) || defined(SENSOR_SHT3X) || defined(SENSOR_BME280)
+#ifndef SENSOR_I2C_BUS
+#include "WireBus.h"
+#define SENSOR_I2C_BUS WireBus
+#endif
+#include "SensorBus.h"
+
+// A lone sensor uses its driver directly, several go through a SensorBus.
+// The flag is empty (1 once defined) or the number of sensors.
+#define SENSOR_COUNT(flag) (flag + 0 ? flag + 0 : 1)
+
+template <class Bus, template <class> class Driver, uint8_t COUNT>
+struct SensorSlot
+{
+  typedef SensorBus<Bus, Driver, COUNT> Type;
+};
+
+template <class Bus, template <class> class Driver>
+struct SensorSlot<Bus, Driver, 1>
+{
+  typedef Driver<Bus> Type;
+};
+#endif
+
+#ifdef SENSOR_AHT20
+#include "Aht20Driver.h"
+typedef SensorSlot<SENSOR_I2C_BUS, Aht20Driver, SENSOR_COUNT(SENSOR_AHT20)>::Type Aht20Slot;
+#else
+typedef NoSensor Aht20Slot;
+#endif
+
+#ifdef SENSOR_SHT3X
+#include "Sht3xDriver.h"
+typedef SensorSlot<SENSOR_I2C_BUS, Sht3xDriver, SENSOR_COUNT(SENSOR_SHT3X)>::Type Sht3xSlot;
+#else
+typedef NoSensor Sht3xSlot;
+#endif
+
+#ifdef SENSOR_BME280
+#include "Bme280Driver.h"
+typedef SensorSlot<SENSOR_I2C_BUS, Bme280Driver, SENSOR_COUNT(SENSOR_BME280)>::Type Bme280Slot;
+#else
+typedef NoSensor Bme280Slot;
+#endif
+
+#ifdef SENSOR_DS18B20
+#ifndef SENSOR_ONEWIRE_BUS
+#include "OneWireBus.h"
+#define SENSOR_ONEWIRE_BUS OneWireBus
+#endif
+#include "Ds18b20Driver.h"
+typedef Ds18b20Driver<SENSOR_ONEWIRE_BUS> Ds18b20Slot;
+#else
+typedef NoSensor Ds18b20Slot;
+#endif
+
+typedef SensorSet<Aht20Slot, Sht3xSlot, Bme280Slot, Ds18b20Slot> Sensors;
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef SHT3X_DRIVER_H
+#define SHT3X_DRIVER_H
+
+#include "SensorDriver.h"
+
+// Sensirion SHT30/31/35 temperature and humidity sensor on I2C, in single
+// shot mode without clock stretching: the chip NACKs reads until the
+// conversion (at most 15.5 ms at high repeatability) has finished.
+template <class Bus>
+class Sht3xDriver
+{
+public:
+  static const uint8_t CHANNELS = 2;
+  static constexpr SensorChannel CHANNEL_INFO[CHANNELS] = {
+      {"temperature", "t", "degC", SENSOR_TEMPERATURE},
+      {"humidity", "h", "%RH", SENSOR_HUMIDITY},
+  };
+  static constexpr const char *NAME = "SHT3x";
+  static const uint8_t ADDRESS = 0x44; // 0x45 with ADDR pulled high
+  static const uint32_t CONVERSION_MS = 16;
+
+  explicit Sht3xDriver(Bus &bus = Bus::shared(), uint8_t address = ADDRESS) : _bus(bus), _address(address) {}
+
+  bool begin()
+  {
+    _bus.begin();
+    static const uint8_t softReset[] = {0x30, 0xA2};
+    if (!_bus.write(_address, softReset, sizeof(softReset)))
+      return false;
+    _bus.wait(2);
+    return true;
+  }
+
+  uint32_t trigger()
+  {
+    static const uint8_t measure[] = {0x24, 0x00}; // High repeatability
+    _triggered = _bus.write(_address, measure, sizeof(measure));
+    return CONVERSION_MS;
+  }
+
+  SensorStatus collect(float *values)
+  {
+    if (!_triggered)
+      return SENSOR_ERROR;
+    uint8_t data[6];
+    if (!_bus.read(_address, data, sizeof(data)))
+      return SENSOR_BUSY;
+    if (sensorCrc8(data, 2) != data[2] || sensorCrc8(data + 3, 2) != data[5])
+      return SENSOR_ERROR;
+
+    uint16_t temperature = ((uint16_t)data[0] << 8) | data[1];
+    uint16_t humidity = ((uint16_t)data[3] << 8) | data[4];
+    values[0] = temperature * (175.0f / 65535) - 45;
+    values[1] = humidity * (100.0f / 65535);
+    _triggered = false;
+    return SENSOR_READY;
+  }
+
+private:
+  Bus &_bus;
+  uint8_t _address;
+  bool _triggered = false;
+};
+
+#endif
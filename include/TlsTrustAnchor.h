@@ -0,0 +1,17 @@
+#ifndef TLS_TRUST_ANCHOR_H
+#define TLS_TRUST_ANCHOR_H
+
+#include <Arduino.h>
+
+// Trust material for MQTT over TLS, compiled into the firmware so no
+// certificate store is needed. Fill in one of the two:
+//  - MQTT_TLS_CA_CERT: PEM of the CA that signed the broker certificate
+//  - MQTT_TLS_PINNED_KEY: PEM of the broker's public key
+// The pinned key is checked first. A broker configured by host name is
+// connected to by that name, so it goes out as SNI and, with the CA, the
+// certificate is checked against it; a broker given as an address is checked
+// against this anchor only.
+static const char MQTT_TLS_CA_CERT[] PROGMEM = "";
+static const char MQTT_TLS_PINNED_KEY[] PROGMEM = "";
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef TOKEN_BUCKET_H
+#define TOKEN_BUCKET_H
+
+#include <Arduino.h>
+
+// Token bucket rate limiter: tokens refill at a steady rate up to the burst
+// size, and each message takes one. Time is passed in so it can be driven
+// from millis() or a simulated clock.
+class TokenBucket
+{
+public:
+  void configure(float ratePerSecond, float burst);
+  bool tryConsume(unsigned long nowMs);
+  float available(unsigned long nowMs);
+  // Set the tokens in hand, up to the burst size
+  void setTokens(float tokens);
+  // Give back the token of a send that failed after tryConsume()
+  void refund();
+
+  float rate() const { return _rate; }
+  float burst() const { return _burst; }
+
+  // Accounting since the last resetStats()
+  uint32_t sent() const { return _sent; }
+  uint32_t throttled() const { return _throttled; }           // Times a caller had to wait
+  uint32_t throttleTimeMs() const { return _throttleTimeMs; } // Time callers spent waiting for a token
+  float peakBurst() const { return _peakBurst; }              // Most tokens drawn down from a full bucket
+  void resetStats();
+
+private:
+  void refill(unsigned long nowMs);
+
+  float _rate = 1;
+  float _burst = 1;
+  float _tokens = 1;
+  unsigned long _lastRefill = 0;
+
+  uint32_t _sent = 0;
+  uint32_t _throttled = 0;
+  uint32_t _throttleTimeMs = 0;
+  float _peakBurst = 0;
+  bool _waiting = false;
+  unsigned long _waitStart = 0;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef TRACKING_CLIENT_H
+#define TRACKING_CLIENT_H
+
+#include <Arduino.h>
+#include <Client.h>
+
+// Pass-through Client that sits between PubSubClient and the network client.
+// It counts bytes in each direction and watches the CONNACK that follows a
+// connect, because PubSubClient does not expose the session-present flag.
+class TrackingClient : public Client
+{
+public:
+  explicit TrackingClient(Client &inner);
+
+  void setInner(Client &inner) { _inner = &inner; }
+
+  int connect(IPAddress ip, uint16_t port) override;
+  int connect(const char *host, uint16_t port) override;
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t *buf, size_t size) override;
+  int available() override;
+  int read() override;
+  int read(uint8_t *buf, size_t size) override;
+  int peek() override;
+  void flush() override;
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override;
+
+  // True when the last CONNACK reported that the broker kept our session
+  bool sessionPresent() const { return _sessionPresent; }
+
+  uint32_t bytesSent() const { return _bytesSent; }
+  uint32_t bytesReceived() const { return _bytesReceived; }
+  void resetCounters();
+
+private:
+  void observe(uint8_t b);
+
+  Client *_inner;
+  uint32_t _bytesSent = 0;
+  uint32_t _bytesReceived = 0;
+  uint8_t _connackPos = 0; // bytes of the CONNACK seen so far, 0xFF once done
+  bool _sessionPresent = false;
+};
+
+#endif
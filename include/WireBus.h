@@ -0,0 +1,129 @@
+#ifndef WIRE_BUS_H
+#define WIRE_BUS_H
+
+#include <Arduino.h>
+#include <Wire.h>
+
+#ifndef SENSOR_I2C_SDA
+#define SENSOR_I2C_SDA 4 // D2 on a D1 mini
+#endif
+#ifndef SENSOR_I2C_SCL
+#define SENSOR_I2C_SCL 5 // D1 on a D1 mini
+#endif
+#ifndef SENSOR_I2C_CLOCK
+#define SENSOR_I2C_CLOCK 400000 // Fast mode; every supported sensor allows it
+#endif
+#ifndef SENSOR_I2C_STRETCH_LIMIT
+#define SENSOR_I2C_STRETCH_LIMIT 1000 // Microseconds a slave may hold SCL low
+#endif
+
+// I2C bus class for the sensor drivers, on the Arduino Wire library. The
+// ESP8266 bit-bangs I2C, so the clock is raised to fast mode and a slave
+// stretching the clock longer than the limit fails the transfer rather than
+// stalling the loop. A transfer that fails with a line held low (a slave
+// left mid-byte by a reset or a glitch keeps SDA low forever) clocks the
+// bus free and is retried once; a plain NACK is not an error of the bus and
+// is returned as it is. Everything is inline so a build without I2C sensors
+// does not link Wire at all.
+class WireBus
+{
+public:
+  static WireBus &shared()
+  {
+    static WireBus bus;
+    return bus;
+  }
+
+  void begin()
+  {
+    if (_started)
+      return;
+    recover();
+    _started = true;
+  }
+
+  bool write(uint8_t address, const uint8_t *data, size_t length)
+  {
+    for (uint8_t attempt = 0;; attempt++)
+    {
+      Wire.beginTransmission(address);
+      Wire.write(data, length);
+      if (Wire.endTransmission() == 0)
+        return true;
+      if (attempt > 0 || !stuck())
+        return false;
+      recover();
+    }
+  }
+
+  // Fails when the device NACKs its address
+  bool read(uint8_t address, uint8_t *data, size_t length)
+  {
+    for (uint8_t attempt = 0;; attempt++)
+    {
+      if (Wire.requestFrom(address, (uint8_t)length) == length)
+        break;
+      if (attempt > 0 || !stuck())
+        return false;
+      recover();
+    }
+    for (size_t i = 0; i < length; i++)
+      data[i] = Wire.read();
+    return true;
+  }
+
+  void wait(uint32_t ms) { delay(ms); }
+
+  // Changes the clock, for the benchmark
+  void setClock(uint32_t hz)
+  {
+    _clock = hz;
+    Wire.setClock(hz);
+  }
+
+  // Times a slave was found holding SDA low and clocked free, since boot
+  uint32_t recoveries() const { return _recoveries; }
+
+private:
+  // Either line low between transfers means a slave is holding it
+  bool stuck()
+  {
+    return digitalRead(SENSOR_I2C_SDA) == LOW || digitalRead(SENSOR_I2C_SCL) == LOW;
+  }
+
+  // Clocks SCL until the slave holding SDA has shifted out its byte (at most
+  // nine clocks, with the ACK), sends a STOP and restarts Wire
+  void recover()
+  {
+    pinMode(SENSOR_I2C_SDA, INPUT_PULLUP);
+    pinMode(SENSOR_I2C_SCL, OUTPUT_OPEN_DRAIN);
+    digitalWrite(SENSOR_I2C_SCL, HIGH);
+    delayMicroseconds(5);
+    if (digitalRead(SENSOR_I2C_SDA) == LOW)
+      _recoveries++;
+    for (uint8_t i = 0; i < 9 && digitalRead(SENSOR_I2C_SDA) == LOW; i++)
+    {
+      digitalWrite(SENSOR_I2C_SCL, LOW);
+      delayMicroseconds(5);
+      digitalWrite(SENSOR_I2C_SCL, HIGH);
+      delayMicroseconds(5);
+    }
+    // START then STOP, SDA falling and rising while SCL is high, to reset
+    // every slave's state machine
+    pinMode(SENSOR_I2C_SDA, OUTPUT_OPEN_DRAIN);
+    digitalWrite(SENSOR_I2C_SDA, LOW);
+    delayMicroseconds(5);
+    digitalWrite(SENSOR_I2C_SDA, HIGH);
+    delayMicroseconds(5);
+
+    Wire.begin(SENSOR_I2C_SDA, SENSOR_I2C_SCL);
+    Wire.setClock(_clock);
+    Wire.setClockStretchLimit(SENSOR_I2C_STRETCH_LIMIT);
+  }
+
+  bool _started = false;
+  uint32_t _clock = SENSOR_I2C_CLOCK;
+  uint32_t _recoveries = 0;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <string.h>
+#include "BackfillServer.h"
+
+bool BackfillServer::request(const BackfillRequest &request)
+{
+  if (_count == QUEUE_SIZE)
+    return false;
+  Job &job = _queue[(_first + _count) % QUEUE_SIZE];
+  job.request = request;
+  job.cursor = request.byTime || request.from == 0 ? 0 : request.from - 1;
+  job.sent = 0;
+  _count++;
+  return true;
+}
+
+size_t BackfillServer::formatNext(SampleHistory &history, char *buffer, size_t size)
+{
+  if (_count == 0)
+    return 0;
+
+  Job &job = _queue[_first];
+  const BackfillRequest &request = job.request;
+  size_t len = snprintf(buffer, size, "{\"id\": \"%s\", \"samples\": [", request.id);
+  uint8_t written = 0;
+  uint32_t cursor = job.cursor;
+  bool done = false;
+  bool full = false;
+
+  // Samples outside a time range are skipped, so this may read more than a
+  // batch; the reads are capped and the scan goes on from the cursor next pass
+  HistoryRecord records[BATCH];
+  uint8_t reads = 0;
+  while (written < BATCH && !done && !full && reads < READS_PER_PASS)
+  {
+    reads++;
+    uint16_t found = history.read(cursor, records, BATCH - written);
+    if (found == 0)
+    {
+      done = true; // Caught up with the newest sample
+      break;
+    }
+    for (uint16_t i = 0; i < found; i++)
+    {
+      const HistoryRecord &record = records[i];
+      uint32_t key = request.byTime ? record.time : record.seq;
+      if (key > request.to)
+      {
+        done = true;
+        break;
+      }
+      if (key < request.from || (request.byTime && record.time == 0))
+      {
+        cursor = record.seq;
+        continue;
+      }
+
+      char entry[96];
+      size_t entryLen = snprintf(entry, sizeof(entry), "%s{\"seq\": %lu, \"time\": %lu, \"t\": %.2f, \"h\": %.2f}",
+                                 written > 0 ? ", " : "", (unsigned long)record.seq, (unsigned long)record.time,
+                                 record.temperature / 100.0, record.humidity / 100.0);
+      // Keep room for the closing "]}"; a record that does not fit starts the next message
+      if (len + entryLen + 3 > size)
+      {
+        full = true;
+        break;
+      }
+      memcpy(buffer + len, entry, entryLen + 1);
+      len += entryLen;
+      written++;
+      cursor = record.seq;
+    }
+  }
+
+  if (written == 0 && !done && !full)
+  {
+    // Nothing in the range yet; the skipped samples need no message
+    job.cursor = cursor;
+    return 0;
+  }
+
+  _nextCursor = cursor;
+  _nextSent = job.sent + written;
+  _nextDone = written == 0;
+  if (_nextDone)
+  {
+    // Completion marker; oldest_seq tells whether the range reached further
+    // back than the history
+    return snprintf(buffer, size, "{\"id\": \"%s\", \"done\": true, \"sent\": %lu, \"oldest_seq\": %lu}", request.id,
+                    (unsigned long)job.sent, (unsigned long)history.oldestSeq());
+  }
+  return len + snprintf(buffer + len, size - len, "]}");
+}
+
+void BackfillServer::commitNext()
+{
+  if (_count == 0)
+    return;
+  Job &job = _queue[_first];
+  if (_nextDone)
+  {
+    _first = (_first + 1) % QUEUE_SIZE;
+    _count--;
+    return;
+  }
+  job.cursor = _nextCursor;
+  job.sent = _nextSent;
+}
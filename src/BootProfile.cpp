@@ -0,0 +1,69 @@
+#include "BootProfile.h"
+#include <stdio.h>
+#include <string.h>
+
+// Room kept for the longest closing of the report
+static const size_t CLOSING_SIZE = sizeof("], \"phases_dropped\": 255}");
+
+void BootProfile::mark(const char *name, uint32_t nowUs, uint32_t cycles)
+{
+  if (_count >= MAX_PHASES)
+    return;
+  _phase[_count++] = {name, nowUs, cycles};
+}
+
+void BootProfile::heap(uint32_t freeBytes, uint32_t maxBlock)
+{
+  _heapFree = freeBytes;
+  _heapMaxBlock = maxBlock;
+}
+
+size_t BootProfile::format(char *buffer, size_t size, const char *resetReason, uint32_t resetCode) const
+{
+  size_t len = snprintf(buffer, size,
+                        "{\"reset\": \"%s\", \"reset_code\": %lu, \"total_us\": %lu, \"heap_free\": %lu, "
+                        "\"heap_max_block\": %lu, \"phases\": [",
+                        resetReason, (unsigned long)resetCode, (unsigned long)totalUs(), (unsigned long)_heapFree,
+                        (unsigned long)_heapMaxBlock);
+  if (len + CLOSING_SIZE > size)
+  {
+    if (size > 0)
+      buffer[0] = '\0';
+    return 0;
+  }
+
+  uint8_t i = 0;
+  for (; i < _count; i++)
+  {
+    // The first phase runs from reset, where both clocks start at zero
+    uint32_t us = _phase[i].endUs - (i > 0 ? _phase[i - 1].endUs : 0);
+    uint32_t cycles = _phase[i].endCycles - (i > 0 ? _phase[i - 1].endCycles : 0);
+    char entry[96];
+    size_t entryLen = snprintf(entry, sizeof(entry), "%s{\"name\": \"%s\", \"us\": %lu, \"cycles\": %lu}",
+                               i > 0 ? ", " : "", _phase[i].name, (unsigned long)us, (unsigned long)cycles);
+    if (entryLen >= sizeof(entry) || len + entryLen + CLOSING_SIZE > size)
+      break;
+    memcpy(buffer + len, entry, entryLen + 1);
+    len += entryLen;
+  }
+  if (i < _count)
+    len += snprintf(buffer + len, size - len, "], \"phases_dropped\": %u}", _count - i);
+  else
+    len += snprintf(buffer + len, size - len, "]}");
+  return len;
+}
+
+size_t BootProfile::formatSummary(char *buffer, size_t size) const
+{
+  size_t len = 0;
+  buffer[0] = '\0';
+  for (uint8_t i = 0; i < _count && len < size; i++)
+  {
+    uint32_t us = _phase[i].endUs - (i > 0 ? _phase[i - 1].endUs : 0);
+    len += snprintf(buffer + len, size - len, "%s%s %lu.%lu", i > 0 ? ", " : "", _phase[i].name,
+                    (unsigned long)us / 1000, (unsigned long)us % 1000 / 100);
+  }
+  if (len < size)
+    len += snprintf(buffer + len, size - len, " ms");
+  return len < size ? len : size - 1;
+}
@@ -0,0 +1,107 @@
+#include "BrokerList.h"
+
+uint8_t BrokerList::parse(const char *list, uint16_t defaultPort)
+{
+  _count = 0;
+  const char *entry = list;
+  while (*entry != '\0' && _count < MAX_BROKERS)
+  {
+    const char *end = strchr(entry, ',');
+    size_t len = end ? (size_t)(end - entry) : strlen(entry);
+
+    // Trim spaces around the entry
+    while (len > 0 && *entry == ' ')
+    {
+      entry++;
+      len--;
+    }
+    while (len > 0 && entry[len - 1] == ' ')
+      len--;
+
+    if (len > 0 && len < BROKER_HOST_LEN)
+    {
+      BrokerEndpoint &endpoint = _endpoints[_count++];
+      memcpy(endpoint.host, entry, len);
+      endpoint.host[len] = '\0';
+      endpoint.port = defaultPort;
+      endpoint.connectLatencyMs = 0;
+      endpoint.recentFailures = 0;
+      endpoint.lastFailureTime = 0;
+
+      char *colon = strchr(endpoint.host, ':');
+      if (colon != nullptr)
+      {
+        *colon = '\0';
+        long port = atol(colon + 1);
+        if (port > 0 && port <= 65535)
+          endpoint.port = (uint16_t)port;
+      }
+    }
+
+    if (end == nullptr)
+      break;
+    entry = end + 1;
+  }
+  return _count;
+}
+
+uint32_t BrokerList::score(uint8_t index, unsigned long now) const
+{
+  const BrokerEndpoint &endpoint = _endpoints[index];
+  uint32_t score = index * ORDER_PENALTY_MS + endpoint.connectLatencyMs;
+  if (endpoint.recentFailures > 0 && now - endpoint.lastFailureTime < FAILURE_MEMORY_MS)
+  {
+    score += endpoint.recentFailures * FAILURE_PENALTY_MS;
+  }
+  return score;
+}
+
+uint8_t BrokerList::select(unsigned long now) const
+{
+  uint8_t best = 0;
+  uint32_t bestScore = UINT32_MAX;
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    uint32_t s = score(i, now);
+    if (s < bestScore)
+    {
+      best = i;
+      bestScore = s;
+    }
+  }
+  return best;
+}
+
+void BrokerList::reportSuccess(uint8_t index, unsigned long latencyMs)
+{
+  BrokerEndpoint &endpoint = _endpoints[index];
+  if (latencyMs > 60000)
+    latencyMs = 60000;
+
+  // Exponential moving average with weight 1/4 on the new sample
+  if (endpoint.connectLatencyMs == 0)
+    endpoint.connectLatencyMs = latencyMs;
+  else
+    endpoint.connectLatencyMs = (endpoint.connectLatencyMs * 3 + latencyMs) / 4;
+  endpoint.recentFailures = 0;
+}
+
+void BrokerList::reportFailure(uint8_t index, unsigned long now)
+{
+  BrokerEndpoint &endpoint = _endpoints[index];
+  if (now - endpoint.lastFailureTime >= FAILURE_MEMORY_MS)
+    endpoint.recentFailures = 0;
+  if (endpoint.recentFailures < 255)
+    endpoint.recentFailures++;
+  endpoint.lastFailureTime = now;
+}
+
+bool BrokerList::shouldProbePreferred(uint8_t current, unsigned long now)
+{
+  if (current == 0 || _count < 2)
+    return false;
+  if (now - _lastProbeTime < FAILBACK_PROBE_INTERVAL_MS)
+    return false;
+  _lastProbeTime = now;
+  return true;
+}
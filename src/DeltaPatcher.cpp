@@ -0,0 +1,258 @@
+#include "DeltaPatcher.h"
+
+#define DELTA_OP_END 0x00
+#define DELTA_OP_COPY 0x01
+#define DELTA_OP_ADD 0x02
+#define DELTA_OP_INSERT 0x03
+#define DELTA_HEADER_SIZE 28
+
+static uint32_t readU32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void DeltaPatcher::begin(ReadOld readOld, WriteNew writeNew, HeaderCheck headerCheck)
+{
+  _readOld = readOld;
+  _writeNew = writeNew;
+  _headerCheck = headerCheck;
+  _state = HEADER;
+  _argsNeeded = DELTA_HEADER_SIZE;
+  _argsHave = 0;
+  _written = 0;
+  _outLen = 0;
+}
+
+bool DeltaPatcher::emit(const uint8_t *data, size_t length)
+{
+  if (_written + _outLen + length > _newSize)
+    return false;
+  while (length > 0)
+  {
+    size_t n = BUFFER_SIZE - _outLen;
+    if (n > length)
+      n = length;
+    memcpy(_out + _outLen, data, n);
+    _outLen += n;
+    data += n;
+    length -= n;
+    if (_outLen == BUFFER_SIZE && !flush())
+      return false;
+  }
+  return true;
+}
+
+bool DeltaPatcher::flush()
+{
+  if (_outLen == 0)
+    return true;
+  if (!_writeNew(_out, _outLen))
+    return false;
+  _written += _outLen;
+  _outLen = 0;
+  return true;
+}
+
+// Copy old bytes unchanged, as far as the output budget allows
+bool DeltaPatcher::copyOld(uint32_t length, size_t &budget)
+{
+  uint8_t block[64];
+  while (length > 0 && budget > 0)
+  {
+    size_t n = length < sizeof(block) ? length : sizeof(block);
+    if (_oldPos + n > _oldSize || !_readOld(_oldPos, block, n) || !emit(block, n))
+      return false;
+    _oldPos += n;
+    length -= n;
+    _remaining -= n;
+    budget = budget > n ? budget - n : 0;
+  }
+  return true;
+}
+
+void DeltaPatcher::startOp()
+{
+  switch (_opcode)
+  {
+  case DELTA_OP_COPY:
+    _oldPos = readU32(_args);
+    _remaining = readU32(_args + 4);
+    _state = COPY;
+    break;
+  case DELTA_OP_ADD:
+    _oldPos = readU32(_args);
+    _remaining = readU32(_args + 4);
+    _argsNeeded = 2;
+    _argsHave = 0;
+    _state = _remaining > 0 ? ADD_RUN : OPCODE;
+    break;
+  case DELTA_OP_INSERT:
+    _remaining = readU32(_args);
+    _state = _remaining > 0 ? INSERT : OPCODE;
+    break;
+  }
+}
+
+size_t DeltaPatcher::feed(const uint8_t *data, size_t length, size_t outputBudget)
+{
+  size_t pos = 0;
+  while (_state != DONE && _state != FAILED && outputBudget > 0)
+  {
+    switch (_state)
+    {
+    case HEADER:
+    case ARGS:
+    {
+      if (pos == length)
+        return pos;
+      size_t n = _argsNeeded - _argsHave;
+      if (n > length - pos)
+        n = length - pos;
+      memcpy(_args + _argsHave, data + pos, n);
+      _argsHave += n;
+      pos += n;
+      if (_argsHave < _argsNeeded)
+        return pos;
+
+      if (_state == ARGS)
+      {
+        startOp();
+        break;
+      }
+      if (memcmp(_args, "SDL1", 4) != 0)
+      {
+        fail();
+        break;
+      }
+      _oldSize = readU32(_args + 4);
+      _newSize = readU32(_args + 8);
+      if (!_headerCheck(_oldSize, _newSize, _args + 12))
+      {
+        fail();
+        break;
+      }
+      _state = OPCODE;
+      break;
+    }
+
+    case OPCODE:
+      if (pos == length)
+        return pos;
+      _opcode = data[pos++];
+      if (_opcode == DELTA_OP_END)
+      {
+        if (!flush() || _written != _newSize)
+          fail();
+        else
+          _state = DONE;
+        break;
+      }
+      if (_opcode > DELTA_OP_INSERT)
+      {
+        fail();
+        break;
+      }
+      _argsNeeded = _opcode == DELTA_OP_INSERT ? 4 : 8;
+      _argsHave = 0;
+      _state = ARGS;
+      break;
+
+    case COPY:
+      if (!copyOld(_remaining, outputBudget))
+        fail();
+      else if (_remaining == 0)
+        _state = OPCODE;
+      break;
+
+    case ADD_RUN:
+      // Run header: unchanged count, then count of changed bytes
+      if (pos == length)
+        return pos;
+      _args[_argsHave++] = data[pos++];
+      if (_argsHave < 2)
+        break;
+      _argsHave = 0;
+      if ((uint32_t)_args[0] + _args[1] > _remaining || (_args[0] == 0 && _args[1] == 0))
+      {
+        fail();
+        break;
+      }
+      _runRemaining = _args[1];
+      _state = ADD_UNCHANGED;
+      _args[2] = _args[0]; // Unchanged bytes still to copy
+      break;
+
+    case ADD_UNCHANGED:
+    {
+      uint32_t before = _remaining;
+      if (!copyOld(_args[2], outputBudget))
+      {
+        fail();
+        break;
+      }
+      _args[2] -= before - _remaining;
+      if (_args[2] == 0)
+        _state = _runRemaining > 0 ? ADD_BYTES : (_remaining > 0 ? ADD_RUN : OPCODE);
+      break;
+    }
+
+    case ADD_BYTES:
+    {
+      if (pos == length)
+        return pos;
+      size_t n = _runRemaining;
+      if (n > length - pos)
+        n = length - pos;
+      if (n > 64)
+        n = 64;
+      uint8_t block[64];
+      if (_oldPos + n > _oldSize || !_readOld(_oldPos, block, n))
+      {
+        fail();
+        break;
+      }
+      for (size_t i = 0; i < n; i++)
+        block[i] += data[pos + i];
+      if (!emit(block, n))
+      {
+        fail();
+        break;
+      }
+      pos += n;
+      _oldPos += n;
+      _remaining -= n;
+      _runRemaining -= n;
+      outputBudget = outputBudget > n ? outputBudget - n : 0;
+      if (_runRemaining == 0)
+        _state = _remaining > 0 ? ADD_RUN : OPCODE;
+      break;
+    }
+
+    case INSERT:
+    {
+      if (pos == length)
+        return pos;
+      size_t n = _remaining;
+      if (n > length - pos)
+        n = length - pos;
+      if (n > outputBudget)
+        n = outputBudget;
+      if (!emit(data + pos, n))
+      {
+        fail();
+        break;
+      }
+      pos += n;
+      _remaining -= n;
+      outputBudget -= n;
+      if (_remaining == 0)
+        _state = OPCODE;
+      break;
+    }
+
+    default:
+      break;
+    }
+  }
+  return pos;
+}
@@ -0,0 +1,77 @@
+#include <ESP8266WiFi.h>
+#include "DnsCache.h"
+#include "RtcState.h"
+
+static uint32_t hostHash(const char *host)
+{
+  uint32_t hash = 2166136261UL;
+  while (*host != '\0')
+  {
+    hash ^= (uint8_t)*host++;
+    hash *= 16777619UL;
+  }
+  return hash == 0 ? 1 : hash;
+}
+
+static DnsCacheEntry *findEntry(uint32_t hash)
+{
+  for (DnsCacheEntry &entry : rtcData.dns)
+  {
+    if (entry.hostHash == hash)
+      return &entry;
+  }
+  return nullptr;
+}
+
+bool dnsResolve(const char *host, IPAddress &ip, uint32_t &dnsMs)
+{
+  dnsMs = 0;
+  if (ip.fromString(host))
+    return true;
+
+  uint32_t hash = hostHash(host);
+  uint32_t now = rtcClockNow();
+  DnsCacheEntry *entry = findEntry(hash);
+  if (entry != nullptr && now - entry->resolvedAt < DNS_CACHE_TTL_MS)
+  {
+    ip = IPAddress(entry->ip);
+    return true;
+  }
+
+  unsigned long start = millis();
+  bool resolved = WiFi.hostByName(host, ip) == 1;
+  dnsMs = millis() - start;
+  if (!resolved)
+    return false;
+
+  // Reuse the host's slot, otherwise replace the oldest entry
+  if (entry == nullptr)
+  {
+    entry = &rtcData.dns[0];
+    for (DnsCacheEntry &candidate : rtcData.dns)
+    {
+      if (candidate.hostHash == 0)
+      {
+        entry = &candidate;
+        break;
+      }
+      if (now - candidate.resolvedAt > now - entry->resolvedAt)
+        entry = &candidate;
+    }
+  }
+  entry->hostHash = hash;
+  entry->ip = (uint32_t)ip;
+  entry->resolvedAt = now;
+  rtcSave();
+  return true;
+}
+
+void dnsInvalidate(const char *host)
+{
+  DnsCacheEntry *entry = findEntry(hostHash(host));
+  if (entry != nullptr)
+  {
+    entry->hostHash = 0;
+    rtcSave();
+  }
+}
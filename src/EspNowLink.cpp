@@ -0,0 +1,101 @@
+#include <ESP8266WiFi.h>
+#include <espnow.h>
+extern "C"
+{
+#include <user_interface.h>
+}
+#include "EspNowLink.h"
+
+#define ESP_NOW_QUEUE_SIZE 16
+
+// Receive callbacks run in the WiFi task, so they only copy into this ring
+static EspNowFrame espNowQueue[ESP_NOW_QUEUE_SIZE];
+static volatile uint8_t espNowHead = 0;
+static volatile uint8_t espNowTail = 0;
+static volatile uint32_t espNowDroppedCount = 0;
+
+static volatile bool espNowSendDone = false;
+static volatile bool espNowSendOk = false;
+
+static bool parseMac(const char *text, uint8_t mac[6])
+{
+  unsigned int bytes[6];
+  if (sscanf(text, "%x:%x:%x:%x:%x:%x", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5]) != 6)
+    return false;
+  for (int i = 0; i < 6; i++)
+  {
+    if (bytes[i] > 0xFF)
+      return false;
+    mac[i] = bytes[i];
+  }
+  return true;
+}
+
+static void onSent(uint8_t *mac, uint8_t status)
+{
+  espNowSendOk = status == 0;
+  espNowSendDone = true;
+}
+
+static void onReceived(uint8_t *mac, uint8_t *data, uint8_t length)
+{
+  if (length != sizeof(EspNowReading) || data[0] != ESP_NOW_READING_VERSION)
+    return;
+
+  uint8_t next = (espNowHead + 1) % ESP_NOW_QUEUE_SIZE;
+  if (next == espNowTail)
+  {
+    espNowDroppedCount++;
+    return;
+  }
+  EspNowFrame &frame = espNowQueue[espNowHead];
+  memcpy(frame.mac, mac, sizeof(frame.mac));
+  memcpy(&frame.reading, data, sizeof(frame.reading));
+  frame.receivedAt = millis();
+  espNowHead = next;
+}
+
+bool espNowSend(const char *gatewayMac, uint8_t channel, const EspNowReading &reading, unsigned long timeoutMs)
+{
+  uint8_t peer[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+  parseMac(gatewayMac, peer);
+
+  WiFi.mode(WIFI_STA);
+  wifi_set_channel(channel);
+  if (esp_now_init() != 0)
+    return false;
+  esp_now_set_self_role(ESP_NOW_ROLE_CONTROLLER);
+  esp_now_register_send_cb(onSent);
+  esp_now_add_peer(peer, ESP_NOW_ROLE_SLAVE, channel, nullptr, 0);
+
+  espNowSendDone = false;
+  if (esp_now_send(peer, (uint8_t *)&reading, sizeof(reading)) != 0)
+    return false;
+  unsigned long start = millis();
+  while (!espNowSendDone && millis() - start < timeoutMs)
+    delay(1);
+  return espNowSendDone && espNowSendOk;
+}
+
+bool espNowStartGateway()
+{
+  if (esp_now_init() != 0)
+    return false;
+  esp_now_set_self_role(ESP_NOW_ROLE_SLAVE);
+  esp_now_register_recv_cb(onReceived);
+  return true;
+}
+
+bool espNowReceive(EspNowFrame &frame)
+{
+  if (espNowTail == espNowHead)
+    return false;
+  frame = espNowQueue[espNowTail];
+  espNowTail = (espNowTail + 1) % ESP_NOW_QUEUE_SIZE;
+  return true;
+}
+
+uint32_t espNowDropped()
+{
+  return espNowDroppedCount;
+}
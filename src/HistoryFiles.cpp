@@ -0,0 +1,62 @@
+#include <LittleFS.h>
+#include "HistoryFiles.h"
+
+static void segmentPath(uint8_t segment, char *path, size_t size)
+{
+  snprintf(path, size, "/hist%u.bin", segment);
+}
+
+uint16_t HistoryFiles::count(uint8_t segment)
+{
+  char path[16];
+  segmentPath(segment, path, sizeof(path));
+  File file = LittleFS.open(path, "r");
+  if (!file)
+    return 0;
+  // A record cut short by a reset during a write is ignored
+  uint16_t records = file.size() / sizeof(HistoryRecord);
+  file.close();
+  return records;
+}
+
+bool HistoryFiles::append(uint8_t segment, const HistoryRecord *records, uint16_t n)
+{
+  char path[16];
+  segmentPath(segment, path, sizeof(path));
+  File file = LittleFS.open(path, "a");
+  if (!file)
+    return false;
+  // Drop a partial record left by an interrupted write so records stay aligned
+  size_t aligned = file.size() - file.size() % sizeof(HistoryRecord);
+  if (aligned != file.size())
+  {
+    file.close();
+    file = LittleFS.open(path, "r+");
+    if (!file || !file.truncate(aligned) || !file.seek(aligned))
+      return false;
+  }
+  size_t length = sizeof(HistoryRecord) * n;
+  bool ok = file.write((const uint8_t *)records, length) == length;
+  file.close();
+  return ok;
+}
+
+bool HistoryFiles::read(uint8_t segment, uint16_t index, HistoryRecord *records, uint16_t n)
+{
+  char path[16];
+  segmentPath(segment, path, sizeof(path));
+  File file = LittleFS.open(path, "r");
+  if (!file)
+    return false;
+  size_t length = sizeof(HistoryRecord) * n;
+  bool ok = file.seek(sizeof(HistoryRecord) * index) && file.read((uint8_t *)records, length) == (int)length;
+  file.close();
+  return ok;
+}
+
+void HistoryFiles::clear(uint8_t segment)
+{
+  char path[16];
+  segmentPath(segment, path, sizeof(path));
+  LittleFS.remove(path);
+}
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "LeafTable.h"
+
+bool LeafTable::begin(uint16_t capacity)
+{
+  uint16_t rounded = 1;
+  while (rounded < capacity && rounded < 0x8000)
+    rounded <<= 1;
+
+  free(_slots);
+  _slots = (LeafState *)calloc(rounded, sizeof(LeafState));
+  _capacity = _slots != nullptr ? rounded : 0;
+  _size = 0;
+  _cursor = _capacity;
+  return _slots != nullptr;
+}
+
+// Home slot of a MAC (FNV-1a)
+uint16_t LeafTable::slotFor(const uint8_t mac[6]) const
+{
+  uint32_t hash = 2166136261UL;
+  for (int i = 0; i < 6; i++)
+  {
+    hash ^= mac[i];
+    hash *= 16777619UL;
+  }
+  return (hash ^ (hash >> 16)) & (_capacity - 1);
+}
+
+// Slot holding the MAC, or the free slot where it would go
+uint16_t LeafTable::probe(const uint8_t mac[6]) const
+{
+  uint16_t slot = slotFor(mac);
+  for (uint16_t i = 0; i < _capacity; i++)
+  {
+    const LeafState &leaf = _slots[slot];
+    if (!leaf.used || memcmp(leaf.mac, mac, 6) == 0)
+      return slot;
+    slot = (slot + 1) & (_capacity - 1);
+  }
+  return _capacity;
+}
+
+LeafTable::Result LeafTable::update(const uint8_t mac[6], uint32_t seq, int16_t temperature, uint16_t humidity,
+                                    uint32_t nowMs, bool sensorFault)
+{
+  if (_capacity == 0)
+    return FULL;
+
+  uint16_t slot = probe(mac);
+  Result result = UPDATED;
+  if (slot == _capacity || (!_slots[slot].used && _size + 1 >= _capacity))
+  {
+    // One slot always stays free so lookups of unknown leaves terminate early
+    _rejected++;
+    return FULL;
+  }
+
+  LeafState &leaf = _slots[slot];
+  if (!leaf.used)
+  {
+    memset(&leaf, 0, sizeof(leaf));
+    memcpy(leaf.mac, mac, 6);
+    leaf.used = 1;
+    _size++;
+    result = ADDED;
+  }
+  else if (seq == leaf.seq)
+  {
+    // A leaf sends each reading once, so the same number again is a copy
+    // retransmitted after a lost acknowledgement. Going backwards means the
+    // leaf lost its RTC memory and started counting again.
+    _duplicates++;
+    return DUPLICATE;
+  }
+
+  leaf.seq = seq;
+  leaf.lastSeen = nowMs;
+  if (sensorFault)
+  {
+    if (leaf.faults < 0xFF)
+      leaf.faults++;
+    return result;
+  }
+
+  leaf.temperature = temperature;
+  leaf.humidity = humidity;
+  if (leaf.count == 0)
+  {
+    leaf.temperatureMin = temperature;
+    leaf.temperatureMax = temperature;
+    leaf.temperatureSum = 0;
+    leaf.humiditySum = 0;
+  }
+  if (temperature < leaf.temperatureMin)
+    leaf.temperatureMin = temperature;
+  if (temperature > leaf.temperatureMax)
+    leaf.temperatureMax = temperature;
+  leaf.temperatureSum += temperature;
+  leaf.humiditySum += humidity;
+  if (leaf.count < 0xFFFF)
+    leaf.count++;
+  return result;
+}
+
+const LeafState *LeafTable::find(const uint8_t mac[6]) const
+{
+  if (_capacity == 0)
+    return nullptr;
+  uint16_t slot = probe(mac);
+  return slot < _capacity && _slots[slot].used ? &_slots[slot] : nullptr;
+}
+
+// Backward-shift deletion: later entries of the probe chain move up into the
+// gap, so no tombstones are needed and lookups stay as short as before
+void LeafTable::remove(uint16_t slot)
+{
+  uint16_t mask = _capacity - 1;
+  uint16_t gap = slot;
+  uint16_t next = (gap + 1) & mask;
+  while (_slots[next].used)
+  {
+    uint16_t home = slotFor(_slots[next].mac);
+    // Move the entry only if the gap lies on its way from its home slot
+    if (((next - home) & mask) >= ((next - gap) & mask))
+    {
+      _slots[gap] = _slots[next];
+      gap = next;
+    }
+    next = (next + 1) & mask;
+  }
+  _slots[gap].used = 0;
+  _size--;
+}
+
+uint16_t LeafTable::expire(uint32_t nowMs, uint32_t maxSilenceMs)
+{
+  uint16_t removed = 0;
+  uint16_t slot = 0;
+  while (slot < _capacity)
+  {
+    // A removal can shift a later entry into this slot, so check it again
+    if (_slots[slot].used && nowMs - _slots[slot].lastSeen > maxSilenceMs)
+    {
+      remove(slot);
+      removed++;
+    }
+    else
+    {
+      slot++;
+    }
+  }
+  return removed;
+}
+
+size_t LeafTable::formatNext(char *buffer, size_t size, const char *gatewayId, uint32_t nowMs)
+{
+  size_t len = snprintf(buffer, size, "{\"gateway\": \"%s\", \"leaves\": [", gatewayId);
+  uint16_t written = 0;
+  uint16_t slot = _cursor;
+  for (; slot < _capacity; slot++)
+  {
+    const LeafState &leaf = _slots[slot];
+    if (!leaf.used || (leaf.count == 0 && leaf.faults == 0))
+      continue;
+
+    // Only what differs per leaf: the id is the chip ID part of the leaf's
+    // device_id, and with a single reading the rollup would repeat it
+    char entry[240];
+    size_t entryLen = snprintf(entry, sizeof(entry), "%s{\"leaf\": \"%02X%02X%02X\", \"seq\": %lu",
+                               written > 0 ? ", " : "", leaf.mac[3], leaf.mac[4], leaf.mac[5], (unsigned long)leaf.seq);
+    if (leaf.count > 0)
+    {
+      entryLen += snprintf(entry + entryLen, sizeof(entry) - entryLen, ", \"t\": %.2f, \"h\": %.2f",
+                           leaf.temperature / 100.0, leaf.humidity / 100.0);
+    }
+    if (leaf.faults > 0)
+      entryLen += snprintf(entry + entryLen, sizeof(entry) - entryLen, ", \"faults\": %u", leaf.faults);
+    if (leaf.count > 1)
+    {
+      entryLen += snprintf(entry + entryLen, sizeof(entry) - entryLen,
+                           ", \"n\": %u, \"t_avg\": %.2f, \"h_avg\": %.2f, \"t_min\": %.2f, \"t_max\": %.2f", leaf.count,
+                           leaf.temperatureSum / 100.0 / leaf.count, leaf.humiditySum / 100.0 / leaf.count,
+                           leaf.temperatureMin / 100.0, leaf.temperatureMax / 100.0);
+    }
+    entryLen += snprintf(entry + entryLen, sizeof(entry) - entryLen, ", \"age_ms\": %lu}",
+                         (unsigned long)(nowMs - leaf.lastSeen));
+    // Keep room for the closing "]}"
+    if (len + entryLen + 3 > size)
+      break;
+    memcpy(buffer + len, entry, entryLen + 1);
+    len += entryLen;
+    written++;
+  }
+
+  _next = slot;
+  if (written == 0)
+  {
+    // Nothing left to send (or a buffer too small for a single leaf)
+    _cursor = _capacity;
+    return 0;
+  }
+  len += snprintf(buffer + len, size - len, "]}");
+  return len;
+}
+
+void LeafTable::commitNext()
+{
+  for (uint16_t slot = _cursor; slot < _next && slot < _capacity; slot++)
+  {
+    _slots[slot].count = 0;
+    _slots[slot].faults = 0;
+  }
+  _cursor = _next;
+}
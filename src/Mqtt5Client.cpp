@@ -0,0 +1,484 @@
+#include "Mqtt5Client.h"
+
+// Packet types (upper nibble of the fixed header)
+#define MQTT5_CONNECT 0x10
+#define MQTT5_CONNACK 0x20
+#define MQTT5_PUBLISH 0x30
+#define MQTT5_PUBACK 0x40
+#define MQTT5_SUBSCRIBE 0x82
+#define MQTT5_PINGREQ 0xC0
+#define MQTT5_DISCONNECT 0xE0
+
+// Property identifiers used here
+#define PROP_MESSAGE_EXPIRY 0x02
+#define PROP_SESSION_EXPIRY 0x11
+#define PROP_SERVER_KEEP_ALIVE 0x13
+#define PROP_TOPIC_ALIAS_MAXIMUM 0x22
+#define PROP_TOPIC_ALIAS 0x23
+
+static size_t putVarInt(uint8_t *out, uint32_t value)
+{
+  size_t n = 0;
+  do
+  {
+    uint8_t b = value & 0x7F;
+    value >>= 7;
+    out[n++] = value > 0 ? (b | 0x80) : b;
+  } while (value > 0);
+  return n;
+}
+
+static size_t getVarInt(const uint8_t *in, size_t available, uint32_t &value)
+{
+  value = 0;
+  for (size_t i = 0; i < 4 && i < available; i++)
+  {
+    value |= (uint32_t)(in[i] & 0x7F) << (7 * i);
+    if ((in[i] & 0x80) == 0)
+      return i + 1;
+  }
+  return 0;
+}
+
+static size_t putU16(uint8_t *out, uint16_t value)
+{
+  out[0] = value >> 8;
+  out[1] = value;
+  return 2;
+}
+
+static size_t putU32(uint8_t *out, uint32_t value)
+{
+  out[0] = value >> 24;
+  out[1] = value >> 16;
+  out[2] = value >> 8;
+  out[3] = value;
+  return 4;
+}
+
+static size_t putString(uint8_t *out, const char *value, size_t length)
+{
+  putU16(out, length);
+  memcpy(out + 2, value, length);
+  return 2 + length;
+}
+
+// Size of a property value after its identifier, 0 if unknown
+static size_t propertyLength(uint8_t id, const uint8_t *value, size_t available)
+{
+  switch (id)
+  {
+  case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A:
+    return 1;
+  case 0x13: case 0x21: case 0x22: case 0x23:
+    return 2;
+  case 0x02: case 0x11: case 0x18: case 0x27:
+    return 4;
+  case 0x0B:
+  {
+    uint32_t ignored;
+    return getVarInt(value, available, ignored);
+  }
+  case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1A: case 0x1C: case 0x1F:
+    return available >= 2 ? 2 + ((value[0] << 8) | value[1]) : 0;
+  case 0x26:
+  {
+    // User property: two strings
+    if (available < 2)
+      return 0;
+    size_t first = 2 + ((value[0] << 8) | value[1]);
+    if (available < first + 2)
+      return 0;
+    return first + 2 + ((value[first] << 8) | value[first + 1]);
+  }
+  default:
+    return 0;
+  }
+}
+
+void Mqtt5Client::setServer(IPAddress ip, uint16_t port)
+{
+  _ip = ip;
+  _port = port;
+}
+
+bool Mqtt5Client::allocateBuffer()
+{
+  if (_buffer == nullptr)
+    _buffer = (uint8_t *)malloc(MQTT5_BUFFER_SIZE);
+  return _buffer != nullptr;
+}
+
+bool Mqtt5Client::connect(const char *id, const char *user, const char *pass, bool cleanStart, uint32_t sessionExpiry)
+{
+  if (connected())
+    return true;
+  if (!allocateBuffer())
+    return false;
+
+  size_t idLen = strlen(id);
+  size_t userLen = user ? strlen(user) : 0;
+  size_t passLen = pass ? strlen(pass) : 0;
+  if (idLen + userLen + passLen + 40 > MQTT5_BUFFER_SIZE)
+    return false;
+
+  if (!_client.connect(_ip, _port))
+  {
+    _state = MQTT5_CONNECT_FAILED;
+    return false;
+  }
+
+  // Variable header and payload are built after a 5-byte gap for the fixed header
+  uint8_t *body = _buffer + 5;
+  size_t n = 0;
+  n += putString(body + n, "MQTT", 4);
+  body[n++] = 5; // Protocol version
+  uint8_t flags = cleanStart ? 0x02 : 0x00;
+  if (user)
+    flags |= 0x80;
+  if (pass)
+    flags |= 0x40;
+  body[n++] = flags;
+  n += putU16(body + n, _keepAlive);
+  if (sessionExpiry > 0)
+  {
+    body[n++] = 5;
+    body[n++] = PROP_SESSION_EXPIRY;
+    n += putU32(body + n, sessionExpiry);
+  }
+  else
+  {
+    body[n++] = 0;
+  }
+  n += putString(body + n, id, idLen);
+  if (user)
+    n += putString(body + n, user, userLen);
+  if (pass)
+    n += putString(body + n, pass, passLen);
+
+  uint8_t fixed[5];
+  fixed[0] = MQTT5_CONNECT;
+  size_t fixedLen = 1 + putVarInt(fixed + 1, n);
+  memcpy(body - fixedLen, fixed, fixedLen);
+  if (_client.write(body - fixedLen, fixedLen + n) != fixedLen + n)
+  {
+    closeWithState(MQTT5_CONNECT_FAILED);
+    return false;
+  }
+  _lastOutbound = millis();
+
+  uint8_t header;
+  size_t length;
+  if (!readPacket(header, length) || (header & 0xF0) != MQTT5_CONNACK)
+  {
+    closeWithState(MQTT5_CONNECTION_TIMEOUT);
+    return false;
+  }
+  if (!parseConnack(length))
+  {
+    closeWithState(MQTT5_CONNECT_FAILED);
+    return false;
+  }
+
+  _lastInbound = millis();
+  _pingOutstanding = false;
+  _aliasCount = 0;
+  _aliasNamed = 0;
+  if (_reservedTopic[0] != '\0' && _aliasMax > 0)
+    strcpy(_aliasTopics[_aliasCount++], _reservedTopic);
+  _state = MQTT5_CONNECTED;
+  return true;
+}
+
+bool Mqtt5Client::parseConnack(size_t length)
+{
+  if (length < 2 || _buffer[1] >= 0x80)
+    return false;
+
+  _sessionPresent = (_buffer[0] & 0x01) != 0;
+  _aliasMax = 0;
+  _activeKeepAlive = _keepAlive;
+  if (length == 2)
+    return true;
+
+  uint32_t propsLen;
+  size_t pos = 2;
+  size_t lenBytes = getVarInt(_buffer + pos, length - pos, propsLen);
+  if (lenBytes == 0)
+    return false;
+  pos += lenBytes;
+  size_t end = pos + propsLen;
+  if (end > length)
+    return false;
+
+  while (pos < end)
+  {
+    uint8_t id = _buffer[pos++];
+    size_t valueLen = propertyLength(id, _buffer + pos, end - pos);
+    if (valueLen == 0 || pos + valueLen > end)
+      break;
+    if (id == PROP_TOPIC_ALIAS_MAXIMUM)
+      _aliasMax = (_buffer[pos] << 8) | _buffer[pos + 1];
+    else if (id == PROP_SERVER_KEEP_ALIVE)
+    {
+      // Pinging more often than the server asks is allowed, so a longer or
+      // zero server value keeps the configured one and dead peers are still
+      // found in time; the configured value is sent again on the next CONNECT
+      uint16_t serverKeepAlive = (_buffer[pos] << 8) | _buffer[pos + 1];
+      if (serverKeepAlive > 0 && (serverKeepAlive < _keepAlive || _keepAlive == 0))
+        _activeKeepAlive = serverKeepAlive;
+    }
+    pos += valueLen;
+  }
+  return true;
+}
+
+void Mqtt5Client::disconnect()
+{
+  if (_state == MQTT5_CONNECTED && _buffer != nullptr)
+  {
+    _buffer[0] = MQTT5_DISCONNECT;
+    _buffer[1] = 0;
+    writeBuffer(2);
+  }
+  closeWithState(MQTT5_DISCONNECTED);
+}
+
+void Mqtt5Client::closeWithState(int state)
+{
+  _client.stop();
+  _state = state;
+}
+
+bool Mqtt5Client::connected()
+{
+  if (_state != MQTT5_CONNECTED)
+    return false;
+  if (!_client.connected())
+  {
+    closeWithState(MQTT5_CONNECTION_LOST);
+    return false;
+  }
+  return true;
+}
+
+void Mqtt5Client::reserveAlias(const char *topic)
+{
+  if (strlen(topic) > MQTT5_MAX_TOPIC_LEN)
+    _reservedTopic[0] = '\0';
+  else
+    strcpy(_reservedTopic, topic);
+}
+
+uint16_t Mqtt5Client::aliasFor(const char *topic, bool &firstUse)
+{
+  firstUse = false;
+  if (strlen(topic) > MQTT5_MAX_TOPIC_LEN)
+    return 0;
+  uint8_t i = 0;
+  while (i < _aliasCount && strcmp(_aliasTopics[i], topic) != 0)
+    i++;
+  if (i == _aliasCount)
+  {
+    if (_aliasCount >= MQTT5_MAX_ALIASES || _aliasCount >= _aliasMax)
+      return 0;
+    strcpy(_aliasTopics[_aliasCount++], topic);
+  }
+  // The first publish with an alias also carries the topic name
+  firstUse = !(_aliasNamed & (1 << i));
+  _aliasNamed |= 1 << i;
+  return i + 1;
+}
+
+bool Mqtt5Client::publish(const char *topic, const uint8_t *payload, size_t length, bool retained, uint32_t expirySeconds)
+{
+  if (!connected())
+    return false;
+
+  bool firstUse;
+  uint16_t alias = aliasFor(topic, firstUse);
+  size_t topicLen = (alias != 0 && !firstUse) ? 0 : strlen(topic);
+
+  uint8_t props[MQTT5_MAX_PUBLISH_PROPERTIES];
+  size_t propsLen = 0;
+  if (expirySeconds > 0)
+  {
+    props[propsLen++] = PROP_MESSAGE_EXPIRY;
+    propsLen += putU32(props + propsLen, expirySeconds);
+  }
+  if (alias != 0)
+  {
+    props[propsLen++] = PROP_TOPIC_ALIAS;
+    propsLen += putU16(props + propsLen, alias);
+  }
+
+  size_t remaining = 2 + topicLen + 1 + propsLen + length;
+  if (remaining + 5 > MQTT5_BUFFER_SIZE)
+    return false;
+
+  size_t n = 0;
+  _buffer[n++] = MQTT5_PUBLISH | (retained ? 0x01 : 0x00);
+  n += putVarInt(_buffer + n, remaining);
+  n += putString(_buffer + n, topic, topicLen);
+  _buffer[n++] = propsLen;
+  memcpy(_buffer + n, props, propsLen);
+  n += propsLen;
+  memcpy(_buffer + n, payload, length);
+  n += length;
+  return writeBuffer(n);
+}
+
+bool Mqtt5Client::subscribe(const char *topic, uint8_t qos)
+{
+  if (!connected() || qos > 1)
+    return false;
+
+  size_t topicLen = strlen(topic);
+  size_t remaining = 2 + 1 + 2 + topicLen + 1;
+  if (remaining + 5 > MQTT5_BUFFER_SIZE)
+    return false;
+
+  size_t n = 0;
+  _buffer[n++] = MQTT5_SUBSCRIBE;
+  n += putVarInt(_buffer + n, remaining);
+  n += putU16(_buffer + n, _nextPacketId++);
+  if (_nextPacketId == 0)
+    _nextPacketId = 1;
+  _buffer[n++] = 0; // No properties
+  n += putString(_buffer + n, topic, topicLen);
+  _buffer[n++] = qos; // Subscription options: maximum QoS
+  return writeBuffer(n);
+}
+
+bool Mqtt5Client::loop()
+{
+  if (!connected())
+    return false;
+
+  unsigned long now = millis();
+  unsigned long keepAliveMs = _activeKeepAlive * 1000UL;
+  if (keepAliveMs > 0 && (now - _lastInbound > keepAliveMs || now - _lastOutbound > keepAliveMs))
+  {
+    if (_pingOutstanding)
+    {
+      closeWithState(MQTT5_CONNECTION_TIMEOUT);
+      return false;
+    }
+    _buffer[0] = MQTT5_PINGREQ;
+    _buffer[1] = 0;
+    if (!writeBuffer(2))
+      return false;
+    _lastInbound = now;
+    _pingOutstanding = true;
+  }
+
+  while (_client.available())
+  {
+    uint8_t header;
+    size_t length;
+    if (!readPacket(header, length))
+      return connected();
+    _lastInbound = millis();
+    _pingOutstanding = false;
+    handlePacket(header, length);
+  }
+  return true;
+}
+
+void Mqtt5Client::handlePacket(uint8_t header, size_t length)
+{
+  if ((header & 0xF0) == MQTT5_DISCONNECT)
+  {
+    closeWithState(MQTT5_CONNECTION_LOST);
+    return;
+  }
+  if ((header & 0xF0) != MQTT5_PUBLISH || length < 3)
+    return;
+
+  uint8_t qos = (header >> 1) & 0x03;
+  size_t topicLen = (_buffer[0] << 8) | _buffer[1];
+  size_t pos = 2 + topicLen;
+  if (pos > length) // Topic runs past the packet
+    return;
+  uint16_t packetId = 0;
+  if (qos > 0)
+  {
+    if (pos + 2 > length)
+      return;
+    packetId = (_buffer[pos] << 8) | _buffer[pos + 1];
+    pos += 2;
+  }
+  uint32_t propsLen;
+  size_t lenBytes = getVarInt(_buffer + pos, length - pos, propsLen);
+  if (lenBytes == 0 || pos + lenBytes + propsLen > length)
+    return;
+  pos += lenBytes + propsLen;
+
+  // The topic moves over its length prefix so it can be NUL terminated
+  memmove(_buffer, _buffer + 2, topicLen);
+  _buffer[topicLen] = '\0';
+  if (_callback)
+    _callback((char *)_buffer, _buffer + pos, length - pos);
+
+  if (qos == 1)
+  {
+    _buffer[0] = MQTT5_PUBACK;
+    _buffer[1] = 2;
+    putU16(_buffer + 2, packetId);
+    writeBuffer(4);
+  }
+}
+
+bool Mqtt5Client::writeBuffer(size_t length)
+{
+  if (_client.write(_buffer, length) != length)
+  {
+    closeWithState(MQTT5_CONNECTION_LOST);
+    return false;
+  }
+  _lastOutbound = millis();
+  return true;
+}
+
+bool Mqtt5Client::readByte(uint8_t &value)
+{
+  unsigned long start = millis();
+  while (!_client.available())
+  {
+    if (millis() - start >= _socketTimeout * 1000UL)
+      return false;
+    delay(1);
+  }
+  value = _client.read();
+  return true;
+}
+
+bool Mqtt5Client::readPacket(uint8_t &header, size_t &length)
+{
+  if (!readByte(header))
+    return false;
+
+  uint32_t remaining = 0;
+  for (uint8_t i = 0;; i++)
+  {
+    uint8_t b;
+    if (i == 4 || !readByte(b))
+      return false;
+    remaining |= (uint32_t)(b & 0x7F) << (7 * i);
+    if ((b & 0x80) == 0)
+      break;
+  }
+
+  // Packets that do not fit are read and dropped
+  bool fits = remaining <= MQTT5_BUFFER_SIZE;
+  for (uint32_t i = 0; i < remaining; i++)
+  {
+    uint8_t b;
+    if (!readByte(b))
+      return false;
+    if (fits)
+      _buffer[i] = b;
+  }
+  length = remaining;
+  return fits;
+}
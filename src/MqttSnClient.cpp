@@ -0,0 +1,44 @@
+#include "MqttSnClient.h"
+
+void MqttSnClient::setGateway(IPAddress ip, uint16_t port)
+{
+  _gatewayIp = ip;
+  _gatewayPort = port;
+}
+
+bool MqttSnClient::publish(uint16_t topicId, const uint8_t *payload, size_t length)
+{
+  // Length(1 or 3) MsgType Flags TopicId(2) MsgId(2) Data
+  uint8_t header[9];
+  size_t headerLen = 0;
+  size_t total = 7 + length;
+  if (total <= 255)
+  {
+    header[headerLen++] = (uint8_t)total;
+  }
+  else
+  {
+    total += 2;
+    if (total > 65535)
+      return false;
+    header[headerLen++] = 0x01;
+    header[headerLen++] = (uint8_t)(total >> 8);
+    header[headerLen++] = (uint8_t)total;
+  }
+  header[headerLen++] = PUBLISH;
+  header[headerLen++] = FLAG_QOS_MINUS_ONE | FLAG_TOPIC_PREDEFINED;
+  header[headerLen++] = (uint8_t)(topicId >> 8);
+  header[headerLen++] = (uint8_t)topicId;
+  header[headerLen++] = 0; // MsgId is unused at QoS -1
+  header[headerLen++] = 0;
+
+  if (!_udp.beginPacket(_gatewayIp, _gatewayPort))
+    return false;
+  _udp.write(header, headerLen);
+  _udp.write(payload, length);
+  if (!_udp.endPacket())
+    return false;
+
+  _lastPacketSize = total;
+  return true;
+}
@@ -0,0 +1,203 @@
+#include <ESP8266WiFi.h>
+#include <WiFiClientSecureBearSSL.h>
+#include <type_traits>
+#include "MqttTls.h"
+#include "RtcState.h"
+#include "TlsTrustAnchor.h"
+
+// Reduced record buffers, used when the broker accepts the max fragment
+// length extension. Otherwise the receive buffer has to hold a full 16 KB
+// record (~17 KB with overhead); what is sent is ours to fragment.
+#define TLS_FRAGMENT_SIZE 512
+#define TLS_FULL_RECORD_SIZE 16384
+
+// Secure client that connects by host name when it has one, so the name goes
+// out as SNI and the certificate is checked against it. Connecting by address
+// alone does neither.
+class NamedSecureClient : public BearSSL::WiFiClientSecure
+{
+public:
+  using BearSSL::WiFiClientSecure::connect;
+
+  void setHostName(const char *hostName) { _hostName = hostName; }
+
+  int connect(IPAddress ip, uint16_t port) override
+  {
+    if (_hostName == nullptr)
+      return BearSSL::WiFiClientSecure::connect(ip, port);
+    return BearSSL::WiFiClientSecure::connect(_hostName, port);
+  }
+
+private:
+  const char *_hostName = nullptr;
+};
+
+// Connect cost of each handshake kind, for the log
+struct TlsHandshakeStats
+{
+  uint32_t count;
+  uint32_t totalMs;
+  int32_t totalHeap;
+};
+
+static NamedSecureClient secureClient;
+static BearSSL::Session tlsSession;
+static BearSSL::X509List *trustAnchor = nullptr;
+static BearSSL::PublicKey *pinnedKey = nullptr;
+
+// Session offered in the ClientHello, to tell a resumption from a full
+// handshake. The parameters inside BearSSL::Session are only open to the
+// secure client, so sessions are compared and saved as whole objects; a
+// resumption leaves the session as it was offered.
+static BearSSL::Session offeredSession;
+static const BearSSL::Session noSession;
+
+static TlsProbeEntry *currentProbe = nullptr;
+static unsigned long connectStartTime = 0;
+static TlsHandshakeStats fullStats = {0, 0, 0};
+static TlsHandshakeStats resumedStats = {0, 0, 0};
+
+// Probe slot of this server, or the one to reuse for it: an empty slot,
+// otherwise the oldest
+static TlsProbeEntry *findProbe(uint32_t ip, uint16_t port, bool &found)
+{
+  uint32_t now = rtcClockNow();
+  TlsProbeEntry *slot = &rtcData.tlsProbes[0];
+  found = false;
+  for (TlsProbeEntry &candidate : rtcData.tlsProbes)
+  {
+    if (candidate.ip == ip && candidate.port == port)
+    {
+      found = true;
+      return &candidate;
+    }
+    if (slot->ip != 0 && (candidate.ip == 0 || now - candidate.probedAt > now - slot->probedAt))
+      slot = &candidate;
+  }
+  return slot;
+}
+
+static void logHandshakeStats(const char *kind, const TlsHandshakeStats &stats)
+{
+  Serial.print(kind);
+  Serial.print(stats.count);
+  if (stats.count == 0)
+    return;
+  Serial.print(", avg ");
+  Serial.print(stats.totalMs / stats.count);
+  Serial.print(" ms, ");
+  Serial.print(stats.totalHeap / (int32_t)stats.count);
+  Serial.print(" bytes");
+}
+
+Client &tlsBegin(unsigned long socketTimeoutMs, bool &ok)
+{
+  static_assert(sizeof(BearSSL::Session) <= sizeof(rtcData.tlsSession), "TLS session does not fit RTC block");
+  static_assert(std::is_trivially_copyable<BearSSL::Session>::value, "TLS session cannot be copied to RTC");
+
+  ok = true;
+  if (pinnedKey == nullptr && trustAnchor == nullptr)
+  {
+    if (strlen_P(MQTT_TLS_PINNED_KEY) > 0)
+    {
+      pinnedKey = new BearSSL::PublicKey(MQTT_TLS_PINNED_KEY);
+      secureClient.setKnownKey(pinnedKey);
+    }
+    else if (strlen_P(MQTT_TLS_CA_CERT) > 0)
+    {
+      trustAnchor = new BearSSL::X509List(MQTT_TLS_CA_CERT);
+      secureClient.setTrustAnchors(trustAnchor);
+    }
+    else
+    {
+      Serial.println("TLS enabled but no CA or pinned key compiled in.");
+      ok = false;
+    }
+
+    secureClient.setSession(&tlsSession);
+    if (rtcData.tlsSessionIp != 0)
+    {
+      memcpy(&tlsSession, rtcData.tlsSession, sizeof(tlsSession));
+    }
+  }
+  secureClient.setTimeout(socketTimeoutMs);
+  return secureClient;
+}
+
+void tlsPrepareConnect(const char *host, IPAddress ip, uint16_t port)
+{
+  // A session is only valid with the server that issued it
+  if (rtcData.tlsSessionIp != (uint32_t)ip)
+  {
+    tlsSession = BearSSL::Session();
+  }
+  offeredSession = tlsSession;
+
+  // An address literal has no name to send or check
+  IPAddress literal;
+  secureClient.setHostName(literal.fromString(host) ? nullptr : host);
+
+  // Probing costs an extra TCP connect, so the answer is remembered per server
+  bool found;
+  currentProbe = findProbe((uint32_t)ip, port, found);
+  if (!found)
+  {
+    currentProbe->ip = (uint32_t)ip;
+    currentProbe->port = port;
+    currentProbe->probedAt = rtcClockNow();
+    currentProbe->smallFragments = BearSSL::WiFiClientSecure::probeMaxFragmentLength(ip, port, TLS_FRAGMENT_SIZE);
+    rtcSave();
+  }
+
+  // Set every time: the sizes stay with the client from one connect to the next
+  secureClient.setBufferSizes(currentProbe->smallFragments ? TLS_FRAGMENT_SIZE : TLS_FULL_RECORD_SIZE,
+                              TLS_FRAGMENT_SIZE);
+  connectStartTime = millis();
+}
+
+void tlsConnectDone(IPAddress ip, bool connected, uint32_t heapBefore)
+{
+  if (!connected)
+  {
+    // Start over with a full handshake and a new probe in case either was the problem
+    rtcData.tlsSessionIp = 0;
+    if (currentProbe != nullptr)
+    {
+      currentProbe->ip = 0;
+    }
+    rtcSave();
+    tlsSession = BearSSL::Session();
+    return;
+  }
+
+  bool resumed = memcmp(&offeredSession, &noSession, sizeof(noSession)) != 0 &&
+                 memcmp(&tlsSession, &offeredSession, sizeof(tlsSession)) == 0;
+  uint32_t connectMs = millis() - connectStartTime;
+  int32_t heapUsed = (int32_t)(heapBefore - ESP.getFreeHeap());
+  TlsHandshakeStats &stats = resumed ? resumedStats : fullStats;
+  stats.count++;
+  stats.totalMs += connectMs;
+  stats.totalHeap += heapUsed;
+
+  Serial.print(resumed ? "TLS session resumed" : "TLS full handshake");
+  Serial.print(" in ");
+  Serial.print(connectMs);
+  Serial.print(" ms with ");
+  Serial.print(currentProbe != nullptr && currentProbe->smallFragments ? "small" : "full");
+  Serial.print(" records, heap used by connection: ");
+  Serial.print(heapUsed);
+  Serial.print(" bytes, free: ");
+  Serial.print(ESP.getFreeHeap());
+  Serial.print(", largest block: ");
+  Serial.println(ESP.getMaxFreeBlockSize());
+  logHandshakeStats("TLS handshakes since boot: full ", fullStats);
+  logHandshakeStats("; resumed ", resumedStats);
+  Serial.println();
+
+  if (!resumed || rtcData.tlsSessionIp != (uint32_t)ip)
+  {
+    memcpy(rtcData.tlsSession, &tlsSession, sizeof(tlsSession));
+    rtcData.tlsSessionIp = (uint32_t)ip;
+    rtcSave();
+  }
+}
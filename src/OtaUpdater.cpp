@@ -0,0 +1,232 @@
+#include <ESP8266WiFi.h>
+#include <ESP8266HTTPClient.h>
+#include <Updater.h>
+#include "OtaUpdater.h"
+
+#define OTA_CHUNK_SIZE 512
+#define OTA_SERVICE_BUDGET_MS 20 // Longest a service() call keeps the loop
+#define OTA_STALL_TIMEOUT 15000  // Give up when the server sends nothing for this long
+#define OTA_PATCH_OUTPUT 1024    // Image bytes rebuilt per patch decoding step
+
+static WiFiClient otaClient;
+static HTTPClient otaHttp;
+
+bool OtaUpdater::begin(const char *url, const char *md5, size_t expectedSize, bool delta)
+{
+  if (_state == DOWNLOADING)
+    return false;
+
+  _received = 0;
+  _total = 0;
+  _error = "";
+  _startTime = millis();
+  _finishTime = _startTime;
+  _lastDataTime = _startTime;
+  _state = DOWNLOADING;
+  _delta = delta;
+  strlcpy(_md5, md5 != nullptr ? md5 : "", sizeof(_md5));
+
+  // Without an MD5 nothing tells a complete image from a cut-off one
+  if (strlen(_md5) != 32)
+  {
+    fail("MD5 required");
+    return false;
+  }
+  if (!otaHttp.begin(otaClient, url))
+  {
+    fail("bad URL");
+    return false;
+  }
+  int code = otaHttp.GET();
+  if (code != HTTP_CODE_OK)
+  {
+    fail("HTTP error");
+    return false;
+  }
+
+  int contentLength = otaHttp.getSize();
+  _total = expectedSize > 0 ? expectedSize : (contentLength > 0 ? (size_t)contentLength : 0);
+  if (_total == 0 || (contentLength > 0 && (size_t)contentLength != _total))
+  {
+    fail("size mismatch");
+    return false;
+  }
+
+  // The new image size is only known once the patch header is in
+  if (_delta)
+  {
+    _patch = (uint8_t *)malloc(OTA_CHUNK_SIZE);
+    if (_patch == nullptr)
+    {
+      fail("out of memory");
+      return false;
+    }
+    _patchLength = 0;
+    _patchPos = 0;
+    _patcher.begin([](uint32_t offset, uint8_t *data, size_t length)
+                   { return ESP.flashRead(offset, data, length); },
+                   [](const uint8_t *data, size_t length)
+                   { return Update.write(const_cast<uint8_t *>(data), length) == length; },
+                   [this](uint32_t oldSize, uint32_t newSize, const uint8_t oldMd5[16])
+                   { return checkPatch(oldSize, newSize, oldMd5); });
+    return true;
+  }
+
+  if (!Update.begin(_total))
+  {
+    fail("not enough space");
+    return false;
+  }
+  if (!Update.setMD5(_md5))
+  {
+    fail("bad MD5");
+    return false;
+  }
+  return true;
+}
+
+// Method to accept a patch only when it was made against the running image.
+// The running sketch starts at flash offset 0, which is where the patch reads
+// its old bytes from.
+bool OtaUpdater::checkPatch(uint32_t oldSize, uint32_t newSize, const uint8_t oldMd5[16])
+{
+  char hex[33];
+  for (int i = 0; i < 16; i++)
+    snprintf(hex + i * 2, 3, "%02x", oldMd5[i]);
+  if (oldSize != ESP.getSketchSize() || ESP.getSketchMD5() != hex)
+  {
+    fail("patch is for a different image");
+    return false;
+  }
+  if (!Update.begin(newSize))
+  {
+    fail("not enough space");
+    return false;
+  }
+  if (!Update.setMD5(_md5))
+  {
+    fail("bad MD5");
+    return false;
+  }
+  return true;
+}
+
+// Method to decode buffered patch bytes into the update partition
+bool OtaUpdater::feedPatch()
+{
+  _patchPos += _patcher.feed(_patch + _patchPos, _patchLength - _patchPos, OTA_PATCH_OUTPUT);
+  if (_patcher.failed())
+  {
+    if (_state != FAILED)
+      fail(Update.hasError() ? "flash write failed" : "bad patch");
+    return false;
+  }
+  return true;
+}
+
+OtaUpdater::State OtaUpdater::service()
+{
+  if (_state != DOWNLOADING)
+    return _state;
+
+  WiFiClient *stream = otaHttp.getStreamPtr();
+  unsigned long start = millis();
+  uint8_t chunk[OTA_CHUNK_SIZE];
+  while (millis() - start < OTA_SERVICE_BUDGET_MS)
+  {
+    // Patch bytes left from the last read are decoded before reading more
+    if (_delta && _patchPos < _patchLength)
+    {
+      if (!feedPatch())
+        return _state;
+      continue;
+    }
+    if (_received >= _total)
+      break;
+
+    size_t available = stream ? stream->available() : 0;
+    if (available == 0)
+    {
+      if (stream == nullptr || (!stream->connected() && stream->available() == 0))
+      {
+        fail("connection lost");
+        return _state;
+      }
+      break;
+    }
+
+    size_t want = _total - _received;
+    if (want > sizeof(chunk))
+      want = sizeof(chunk);
+    if (want > available)
+      want = available;
+    size_t got = stream->readBytes(_delta ? _patch : chunk, want);
+    if (got == 0)
+      break;
+    if (_delta)
+    {
+      _patchLength = got;
+      _patchPos = 0;
+    }
+    else if (Update.write(chunk, got) != got)
+    {
+      fail("flash write failed");
+      return _state;
+    }
+    _received += got;
+    _lastDataTime = millis();
+  }
+
+  if (_received < _total)
+  {
+    if (millis() - _lastDataTime > OTA_STALL_TIMEOUT)
+      fail("download stalled");
+    return _state;
+  }
+  if (_delta && !_patcher.done())
+  {
+    // The whole patch is in but did not end the image
+    if (_patchPos >= _patchLength)
+      fail("patch truncated");
+    return _state;
+  }
+
+  // Update.end() checks the MD5 and marks the new image for the bootloader
+  _finishTime = millis();
+  otaHttp.end();
+  releasePatch();
+  if (!Update.end())
+  {
+    fail("verification failed");
+    return _state;
+  }
+  _state = SUCCEEDED;
+  return _state;
+}
+
+void OtaUpdater::fail(const char *error)
+{
+  _error = error;
+  _finishTime = millis();
+  _state = FAILED;
+  otaHttp.end();
+  releasePatch();
+  // Without evenIfRemaining, end() drops a partial image instead of
+  // installing what came so far
+  if (Update.isRunning())
+    Update.end();
+}
+
+void OtaUpdater::releasePatch()
+{
+  free(_patch);
+  _patch = nullptr;
+  _patchLength = 0;
+  _patchPos = 0;
+}
+
+void OtaUpdater::reset()
+{
+  if (_state != DOWNLOADING)
+    _state = IDLE;
+}
@@ -0,0 +1,171 @@
+#include "Psychrometrics.h"
+
+#ifdef ARDUINO
+#include <pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_dword(address) (*(const uint32_t *)(address))
+#endif
+
+// Magnus coefficients (Sonntag 1990) in the fixed-point units used below
+#define MAGNUS_B_Q24 295614546LL        // 17.62 * 2^24
+#define MAGNUS_B_CENTI 1762
+#define MAGNUS_C_CENTI 24312            // 243.12 degC
+#define LN2_Q24 11629080                // ln(2) * 2^24
+#define LN10000_Q24 154523870           // ln(10000) * 2^24, turns ln(centi-%RH) into ln(RH / 100)
+#define INV_LN2_Q24 24204406LL          // 2^24 / ln(2)
+#define ABS_HUMIDITY_SCALE 13244704LL   // 216.7 * 6.112 * 10^4
+
+// ln(1 + i/64) * 2^24, for interpolating ln() of the mantissa
+static const uint32_t LN_TABLE[65] PROGMEM = {
+    0, 260117, 516263, 768556, 1017112, 1262040,
+    1503443, 1741421, 1976071, 2207485, 2435750, 2660951,
+    2883169, 3102482, 3318965, 3532691, 3743728, 3952143,
+    4158001, 4361364, 4562291, 4760840, 4957067, 5151025,
+    5342767, 5532342, 5719799, 5905184, 6088544, 6269921,
+    6449358, 6626896, 6802576, 6976434, 7148510, 7318838,
+    7487455, 7654394, 7819688, 7983370, 8145469, 8306018,
+    8465045, 8622579, 8778647, 8933277, 9086495, 9238326,
+    9388795, 9537927, 9685745, 9832271, 9977530, 10121541,
+    10264327, 10405907, 10546303, 10685534, 10823619, 10960577,
+    11096425, 11231183, 11364866, 11497493, 11629080,
+};
+
+// 2^(i/64) * 2^30, for interpolating 2^x of the fraction
+static const uint32_t EXP2_TABLE[65] PROGMEM = {
+    1073741824, 1085434106, 1097253708, 1109202018, 1121280436, 1133490379,
+    1145833280, 1158310587, 1170923762, 1183674286, 1196563654, 1209593378,
+    1222764986, 1236080024, 1249540052, 1263146652, 1276901417, 1290805962,
+    1304861917, 1319070932, 1333434672, 1347954824, 1362633090, 1377471191,
+    1392470869, 1407633882, 1422962010, 1438457051, 1454120821, 1469955159,
+    1485961921, 1502142985, 1518500250, 1535035634, 1551751076, 1568648537,
+    1585730000, 1602997467, 1620452965, 1638098541, 1655936265, 1673968228,
+    1692196547, 1710623359, 1729250827, 1748081133, 1767116489, 1786359126,
+    1805811301, 1825475297, 1845353420, 1865448001, 1885761398, 1906295993,
+    1927054196, 1948038440, 1969251188, 1990694927, 2012372174, 2034285470,
+    2056437387, 2078830522, 2101467502, 2124350982, 2147483648,
+};
+
+// Divide rounding to nearest, for a positive divisor
+static int64_t divRound(int64_t a, int64_t b)
+{
+  return a >= 0 ? (a + b / 2) / b : -((-a + b / 2) / b);
+}
+
+// Method to get ln(x) * 2^24 for x >= 1
+static int32_t lnQ24(uint32_t x)
+{
+  int e = 31 - __builtin_clz(x);
+  // Mantissa fraction in Q24 (x < 2^24 always holds for the inputs here)
+  uint32_t f = (x << (24 - e)) - (1UL << 24);
+  uint32_t i = f >> 18;
+  uint32_t lo = pgm_read_dword(&LN_TABLE[i]);
+  uint32_t hi = pgm_read_dword(&LN_TABLE[i + 1]);
+  return e * LN2_Q24 + lo + (((hi - lo) * ((f & 0x3FFFF) >> 6)) >> 12);
+}
+
+// Method to get 2^y, y in Q24, as a Q24 value; y stays within -8..7 here
+static int64_t exp2Q24(int64_t y)
+{
+  int32_t k = (int32_t)(y >> 24); // Floor, also for negative y
+  uint32_t f = (uint32_t)(y & 0xFFFFFF);
+  uint32_t i = f >> 18;
+  uint32_t lo = pgm_read_dword(&EXP2_TABLE[i]);
+  uint32_t hi = pgm_read_dword(&EXP2_TABLE[i + 1]);
+  int64_t v = lo + (((uint64_t)(hi - lo) * (f & 0x3FFFF)) >> 18); // Q30
+  return k >= 6 ? v << (k - 6) : v >> (6 - k);
+}
+
+// Method to get 17.62 T / (243.12 + T) in Q24, the exponent shared by the
+// saturation pressure and the dew point
+static int64_t magnusQ24(int32_t temperature)
+{
+  return divRound((int64_t)MAGNUS_B_CENTI * temperature * (1LL << 24), 100LL * (MAGNUS_C_CENTI + temperature));
+}
+
+// Method to calculate the dew point in centi-degC
+int32_t psychroDewPoint(int32_t temperature, int32_t humidity)
+{
+  if (humidity < 1)
+    humidity = 1;
+  int64_t gamma = (int64_t)lnQ24(humidity) - LN10000_Q24 + magnusQ24(temperature);
+  return (int32_t)divRound(MAGNUS_C_CENTI * gamma, MAGNUS_B_Q24 - gamma);
+}
+
+// Method to calculate the absolute humidity in centi-g/m3
+int32_t psychroAbsoluteHumidity(int32_t temperature, int32_t humidity)
+{
+  if (humidity <= 0)
+    return 0;
+  // exp(x) = 2^(x / ln 2)
+  int64_t es = exp2Q24(magnusQ24(temperature) * INV_LN2_Q24 >> 24);
+  int64_t scaled = (es * humidity) >> 12; // Keeps the product below within 64 bits
+  return (int32_t)divRound(scaled * ABS_HUMIDITY_SCALE, 10000LL * 4096 * (27315 + temperature));
+}
+
+// Method to get the integer square root
+static uint32_t isqrt64(uint64_t x)
+{
+  uint64_t root = 0;
+  uint64_t bit = 1ULL << 62;
+  while (bit > x)
+    bit >>= 2;
+  while (bit != 0)
+  {
+    if (x >= root + bit)
+    {
+      x -= root + bit;
+      root = (root >> 1) + bit;
+    }
+    else
+    {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint32_t)root;
+}
+
+// Method to calculate the heat index in centi-degC. The NWS formulas are in
+// degF and %RH; here t is milli-degF (exact from centi-degC), r centi-%RH and
+// the sum is in nano-degF, with every term ordered to stay within 64 bits.
+int32_t psychroHeatIndex(int32_t temperature, int32_t humidity)
+{
+  int64_t t = 18LL * temperature + 32000;
+  int64_t r = humidity;
+  int64_t hi;
+
+  // (simple + T) / 2 >= 80 degF, i.e. 2.1 T + 0.047 RH >= 170.3
+  if (210 * t + 47 * r < 17030000)
+  {
+    // 0.5 * (T + 61 + (T - 68) * 1.2 + RH * 0.094)
+    hi = 1100000 * t - 10300000000LL + 470000 * r;
+  }
+  else
+  {
+    int64_t tr = t * r;
+    hi = -42379000000LL
+         + 2049015230LL * t / 1000
+         + 10143331270LL * r / 100
+         - 224755410LL * tr / 100000
+         - 6837830LL * t * t / 1000000
+         - 54817170LL * r * r / 10000
+         + 1228740LL * (t * t / 1000) * r / 100000
+         + 852820LL * (tr / 100) * r / 100000
+         - 1990LL * (tr / 1000) * (tr / 1000) / 10000;
+
+    if (r < 1300 && t >= 80000 && t <= 112000)
+    {
+      // - (13 - RH) / 4 * sqrt((17 - |T - 95|) / 17)
+      int64_t d = t > 95000 ? t - 95000 : 95000 - t;
+      uint32_t root = isqrt64(((uint64_t)(17000 - d) << 40) / 17000); // Q20
+      hi -= ((1300 - r) * root * 2500000) >> 20;
+    }
+    else if (r > 8500 && t >= 80000 && t <= 87000)
+    {
+      // + (RH - 85) / 10 * (87 - T) / 5
+      hi += (r - 8500) * (87000 - t) * 200;
+    }
+  }
+  return (int32_t)divRound((hi - 32000000000LL) * 5, 90000000);
+}
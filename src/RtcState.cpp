@@ -0,0 +1,54 @@
+#include "RtcState.h"
+
+RtcData rtcData;
+
+// rtcData.clockMs as it was at boot; millis() is added on top of it
+static uint32_t rtcClockBase = 0;
+
+static uint32_t rtcChecksum()
+{
+  // CRC-32 over everything after the crc field
+  const uint8_t *data = (const uint8_t *)&rtcData + offsetof(RtcData, clockMs);
+  size_t len = sizeof(RtcData) - offsetof(RtcData, clockMs);
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; i++)
+  {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+bool rtcLoad()
+{
+  static_assert(sizeof(RtcData) <= 512, "RTC user memory is 512 bytes");
+  static_assert(sizeof(RtcData) % 4 == 0, "RTC user memory is word addressed");
+
+  bool valid = ESP.rtcUserMemoryRead(0, (uint32_t *)&rtcData, sizeof(rtcData)) &&
+               rtcData.magic == RTC_STATE_MAGIC && rtcData.crc == rtcChecksum();
+  if (!valid)
+  {
+    memset(&rtcData, 0, sizeof(rtcData));
+    rtcData.magic = RTC_STATE_MAGIC;
+  }
+  rtcClockBase = rtcData.clockMs;
+  return valid;
+}
+
+void rtcSave()
+{
+  rtcData.clockMs = rtcClockNow();
+  rtcData.crc = rtcChecksum();
+  ESP.rtcUserMemoryWrite(0, (uint32_t *)&rtcData, sizeof(rtcData));
+}
+
+uint32_t rtcClockNow()
+{
+  return rtcClockBase + millis();
+}
+
+void rtcAdvanceClock(uint32_t ms)
+{
+  rtcClockBase += ms;
+}
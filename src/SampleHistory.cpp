@@ -0,0 +1,136 @@
+#include "SampleHistory.h"
+
+void SampleHistory::begin(HistoryStorage &storage)
+{
+  _storage = &storage;
+  _stagedCount = 0;
+  _head = 0;
+
+  // The segment holding the highest sequence number was the one in use
+  uint32_t newestSeq = 0;
+  for (uint8_t segment = 0; segment < SEGMENTS; segment++)
+  {
+    _count[segment] = storage.count(segment);
+    _firstSeq[segment] = 0;
+    HistoryRecord record;
+    if (_count[segment] == 0 || !storage.read(segment, 0, &record, 1))
+    {
+      _count[segment] = 0;
+      continue;
+    }
+    _firstSeq[segment] = record.seq;
+    if (storage.read(segment, _count[segment] - 1, &record, 1) && record.seq >= newestSeq)
+    {
+      newestSeq = record.seq;
+      _head = segment;
+    }
+  }
+}
+
+void SampleHistory::add(const HistoryRecord &record)
+{
+  _staged[_stagedCount++] = record;
+  if (_stagedCount == STAGED_RECORDS)
+    flush();
+}
+
+void SampleHistory::flush()
+{
+  if (_storage == nullptr)
+    return;
+
+  uint8_t written = 0;
+  while (written < _stagedCount)
+  {
+    if (_count[_head] == SEGMENT_RECORDS)
+    {
+      // Reuse the oldest segment
+      _head = (_head + 1) % SEGMENTS;
+      _storage->clear(_head);
+      _count[_head] = 0;
+    }
+    uint16_t n = SEGMENT_RECORDS - _count[_head];
+    if (n > _stagedCount - written)
+      n = _stagedCount - written;
+    if (!_storage->append(_head, _staged + written, n))
+      break; // Keep what is left staged, the next flush retries
+    if (_count[_head] == 0)
+      _firstSeq[_head] = _staged[written].seq;
+    _count[_head] += n;
+    written += n;
+  }
+
+  for (uint8_t i = written; i < _stagedCount; i++)
+    _staged[i - written] = _staged[i];
+  _stagedCount -= written;
+}
+
+// Index of the first record in a segment with a seq above afterSeq
+uint16_t SampleHistory::lowerBound(uint8_t segment, uint32_t afterSeq)
+{
+  uint16_t low = 0;
+  uint16_t high = _count[segment];
+  while (low < high)
+  {
+    uint16_t middle = (low + high) / 2;
+    HistoryRecord record;
+    if (!_storage->read(segment, middle, &record, 1))
+      return _count[segment];
+    if (record.seq > afterSeq)
+      high = middle;
+    else
+      low = middle + 1;
+  }
+  return low;
+}
+
+uint16_t SampleHistory::read(uint32_t afterSeq, HistoryRecord *records, uint16_t max)
+{
+  uint16_t found = 0;
+  for (uint8_t age = 0; age < SEGMENTS && found < max && _storage != nullptr; age++)
+  {
+    uint8_t segment = segmentAt(age);
+    if (_count[segment] == 0)
+      continue;
+    // Skip segments that end before the cursor without touching flash
+    uint8_t nextSegment = segmentAt(age + 1);
+    if (age + 1 < SEGMENTS && _count[nextSegment] > 0 && _firstSeq[nextSegment] <= afterSeq + 1)
+      continue;
+
+    uint16_t index = lowerBound(segment, afterSeq);
+    uint16_t n = _count[segment] - index;
+    if (n > max - found)
+      n = max - found;
+    if (n > 0 && !_storage->read(segment, index, records + found, n))
+      break;
+    found += n;
+    if (found > 0)
+      afterSeq = records[found - 1].seq;
+  }
+
+  for (uint8_t i = 0; i < _stagedCount && found < max; i++)
+  {
+    if (_staged[i].seq > afterSeq)
+      records[found++] = _staged[i];
+  }
+  return found;
+}
+
+uint32_t SampleHistory::oldestSeq() const
+{
+  for (uint8_t age = 0; age < SEGMENTS; age++)
+  {
+    uint8_t segment = segmentAt(age);
+    if (_count[segment] > 0)
+      return _firstSeq[segment];
+  }
+  return _stagedCount > 0 ? _staged[0].seq : 0;
+}
+
+uint32_t SampleHistory::size() const
+{
+  uint32_t total = _stagedCount;
+  for (uint8_t segment = 0; segment < SEGMENTS; segment++)
+    total += _count[segment];
+  return total;
+}
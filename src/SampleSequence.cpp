@@ -0,0 +1,35 @@
+#include "SampleSequence.h"
+
+void SampleSequence::begin(bool rtcValid, uint32_t rtcSeq, bool deepSleepWake, uint32_t storedBoot,
+                           uint32_t storedReserved)
+{
+  _reserved = storedReserved;
+  _storeDue = false;
+
+  if (deepSleepWake && rtcValid)
+  {
+    _boot = storedBoot;
+  }
+  else
+  {
+    _boot = storedBoot + 1;
+    _storeDue = true;
+  }
+
+  // Without the RTC copy, anything below the reservation may have been used
+  if (rtcValid)
+    _seq = rtcSeq;
+  else
+    _seq = storedReserved > 0 ? storedReserved - 1 : 0;
+}
+
+uint32_t SampleSequence::next()
+{
+  _seq++;
+  if (_seq >= _reserved)
+  {
+    _reserved = _seq + RESERVE_BLOCK;
+    _storeDue = true;
+  }
+  return _seq;
+}
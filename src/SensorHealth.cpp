@@ -0,0 +1,82 @@
+#include "SensorHealth.h"
+
+void SensorHealth::configure(uint32_t minBackoffMs, uint32_t maxBackoffMs, uint8_t failuresToFault)
+{
+  _minBackoff = minBackoffMs;
+  _maxBackoff = maxBackoffMs < minBackoffMs ? minBackoffMs : maxBackoffMs;
+  _failuresToFault = failuresToFault < 1 ? 1 : failuresToFault;
+}
+
+bool SensorHealth::probeDue(uint32_t nowMs) const
+{
+  return _state != OK && nowMs - _lastProbe >= _backoff;
+}
+
+uint32_t SensorHealth::nextProbeIn(uint32_t nowMs) const
+{
+  if (_state == OK)
+    return 0;
+  uint32_t elapsed = nowMs - _lastProbe;
+  return elapsed >= _backoff ? 0 : _backoff - elapsed;
+}
+
+void SensorHealth::probed(bool found, uint32_t nowMs)
+{
+  _lastProbe = nowMs;
+  if (found)
+  {
+    enter(OK, nowMs);
+    return;
+  }
+  _probes++;
+  // The first retry comes after minBackoff, then each wait doubles
+  _backoff = _backoff == 0 ? _minBackoff : (_backoff > _maxBackoff / 2 ? _maxBackoff : _backoff * 2);
+}
+
+void SensorHealth::sampled(bool ok, uint32_t nowMs)
+{
+  if (_state != OK)
+    return;
+  if (ok)
+  {
+    _failuresInRow = 0;
+    return;
+  }
+  _failedReads++;
+  if (++_failuresInRow >= _failuresToFault)
+  {
+    _faults++;
+    enter(FAULT, nowMs);
+  }
+}
+
+void SensorHealth::enter(State state, uint32_t nowMs)
+{
+  _changed = _changed || state != _state;
+  _state = state;
+  _failuresInRow = 0;
+  if (state == OK)
+  {
+    _probes = 0;
+    _backoff = 0;
+  }
+  else
+  {
+    // Probe again straight away: a bus recovery may already have fixed it
+    _lastProbe = nowMs;
+    _backoff = 0;
+  }
+}
+
+const char *SensorHealth::stateName() const
+{
+  switch (_state)
+  {
+  case OK:
+    return "ok";
+  case FAULT:
+    return "fault";
+  default:
+    return "probing";
+  }
+}
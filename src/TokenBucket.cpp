@@ -0,0 +1,71 @@
+#include "TokenBucket.h"
+
+void TokenBucket::configure(float ratePerSecond, float burst)
+{
+  _rate = ratePerSecond;
+  _burst = burst < 1 ? 1 : burst;
+  if (_tokens > _burst)
+    _tokens = _burst;
+}
+
+void TokenBucket::refill(unsigned long nowMs)
+{
+  unsigned long elapsed = nowMs - _lastRefill;
+  _lastRefill = nowMs;
+  _tokens += elapsed * _rate / 1000.0f;
+  if (_tokens > _burst)
+    _tokens = _burst;
+}
+
+void TokenBucket::setTokens(float tokens)
+{
+  _tokens = tokens > _burst ? _burst : tokens;
+}
+
+void TokenBucket::refund()
+{
+  _tokens = _tokens + 1 > _burst ? _burst : _tokens + 1;
+  if (_sent > 0)
+    _sent--;
+}
+
+float TokenBucket::available(unsigned long nowMs)
+{
+  refill(nowMs);
+  return _tokens;
+}
+
+bool TokenBucket::tryConsume(unsigned long nowMs)
+{
+  refill(nowMs);
+  if (_tokens < 1)
+  {
+    // Repeated attempts while waiting count as one throttling episode
+    if (!_waiting)
+    {
+      _waiting = true;
+      _waitStart = nowMs;
+      _throttled++;
+    }
+    return false;
+  }
+
+  if (_waiting)
+  {
+    _waiting = false;
+    _throttleTimeMs += nowMs - _waitStart;
+  }
+  _tokens -= 1;
+  _sent++;
+  if (_burst - _tokens > _peakBurst)
+    _peakBurst = _burst - _tokens;
+  return true;
+}
+
+void TokenBucket::resetStats()
+{
+  _sent = 0;
+  _throttled = 0;
+  _throttleTimeMs = 0;
+  _peakBurst = 0;
+}
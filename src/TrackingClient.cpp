@@ -0,0 +1,114 @@
+#include "TrackingClient.h"
+
+TrackingClient::TrackingClient(Client &inner) : _inner(&inner)
+{
+}
+
+int TrackingClient::connect(IPAddress ip, uint16_t port)
+{
+  _connackPos = 0;
+  _sessionPresent = false;
+  return _inner->connect(ip, port);
+}
+
+int TrackingClient::connect(const char *host, uint16_t port)
+{
+  _connackPos = 0;
+  _sessionPresent = false;
+  return _inner->connect(host, port);
+}
+
+size_t TrackingClient::write(uint8_t b)
+{
+  size_t n = _inner->write(b);
+  _bytesSent += n;
+  return n;
+}
+
+size_t TrackingClient::write(const uint8_t *buf, size_t size)
+{
+  size_t n = _inner->write(buf, size);
+  _bytesSent += n;
+  return n;
+}
+
+int TrackingClient::available()
+{
+  return _inner->available();
+}
+
+int TrackingClient::read()
+{
+  int b = _inner->read();
+  if (b >= 0)
+  {
+    _bytesReceived++;
+    observe((uint8_t)b);
+  }
+  return b;
+}
+
+int TrackingClient::read(uint8_t *buf, size_t size)
+{
+  int n = _inner->read(buf, size);
+  for (int i = 0; i < n; i++)
+  {
+    observe(buf[i]);
+  }
+  if (n > 0)
+  {
+    _bytesReceived += n;
+  }
+  return n;
+}
+
+int TrackingClient::peek()
+{
+  return _inner->peek();
+}
+
+void TrackingClient::flush()
+{
+  _inner->flush();
+}
+
+void TrackingClient::stop()
+{
+  _inner->stop();
+}
+
+uint8_t TrackingClient::connected()
+{
+  return _inner->connected();
+}
+
+TrackingClient::operator bool()
+{
+  return (bool)*_inner;
+}
+
+void TrackingClient::resetCounters()
+{
+  _bytesSent = 0;
+  _bytesReceived = 0;
+}
+
+// CONNACK is always the first packet after connect: 0x20 0x02 <flags> <rc>
+void TrackingClient::observe(uint8_t b)
+{
+  switch (_connackPos)
+  {
+  case 0:
+    _connackPos = (b == 0x20) ? 1 : 0xFF;
+    break;
+  case 1:
+    _connackPos = (b == 0x02) ? 2 : 0xFF;
+    break;
+  case 2:
+    _sessionPresent = (b & 0x01) != 0;
+    _connackPos = 0xFF;
+    break;
+  default:
+    break;
+  }
+}
@@ -2,60 +2,451 @@
 #include <ESP8266WiFi.h>
 #include <ESP8266WebServer.h>
 #include <PubSubClient.h>
-#include <Adafruit_AHTX0.h>
 #include <LittleFS.h> // Use LittleFS for file system
 #include <WiFiManager.h>
+#include <ArduinoJson.h>
+#include <time.h>
+#include "TrackingClient.h"
+#include "BrokerList.h"
+#include "RtcState.h"
+#include "DnsCache.h"
+#include "MqttTls.h"
+#include "MqttSnClient.h"
+#include "Mqtt5Client.h"
+#include "TokenBucket.h"
+#include "OtaUpdater.h"
+#include "EspNowLink.h"
+#include "LeafTable.h"
+#include "SampleSequence.h"
+#include "SampleHistory.h"
+#include "HistoryFiles.h"
+#include "BackfillServer.h"
+#include "Psychrometrics.h"
+#include "Sensors.h"
+#include "SensorHealth.h"
+#include "BootProfile.h"
 
-// AHT20 Sensor
-Adafruit_AHTX0 aht;
+// Sensor drivers, chosen at build time (see Sensors.h). A sample starts a
+// conversion on every sensor and is taken once they have all finished, so
+// loop() keeps running while they convert.
+#define SENSOR_CHANNELS Sensors::CHANNELS
+#define SENSOR_POLL_INTERVAL 5 // Milliseconds between checks of a conversion that is not done yet
+#define SENSOR_TIMEOUT 1000    // A conversion still running after this long has failed
+Sensors sensors;
+const int temperatureChannel = Sensors::find(SENSOR_TEMPERATURE); // -1 if no sensor measures it
+const int humidityChannel = Sensors::find(SENSOR_HUMIDITY);
+bool sensorConverting = false;
+unsigned long conversionStartTime = 0;
+uint32_t conversionWait = 0;
+
+// WiFi joins the stored network in the background from early in setup(), while
+// the sensors start and take the first sample; WiFiManager and its portal only
+// run when there is no stored network or joining it fails
+#define WIFI_CONNECT_TIMEOUT 15000 // Longest wait for the stored network before falling back
+bool wifiEarlyStarted = false;
+unsigned long wifiStartTime = 0;
+
+// Boot phases, timed in setup() and published once to
+// "<mqttTopic>/<client id>/boot" after the first MQTT connect
+BootProfile bootProfile;
+char bootTopic[128];
+bool bootReportPending = false;
+bool bootReportQueued = false;
+
+// Sensors missing at boot or failing later are probed again in the background
+// while everything else keeps running; "<mqttTopic>/<client id>/sensor" gets
+// the state on every change.
+#define SENSOR_RETRY_MIN 1000        // First wait before probing again, doubling each time
+#define SENSOR_RETRY_MAX 60000       // Longest wait between probes
+#define SENSOR_FAILURES_TO_FAULT 3   // Failed samples in a row that put the sensors in fault
+SensorHealth sensorHealth;
+char sensorStatusTopic[128];
+char sensorStatus[192];
+bool sensorStatusPending = false;
 
 // Button setup
 #define MODE_BUTTON_PIN 16 // GPIO16 for the mode button
 
 // MQTT settings (to be configured via WiFiManager)
-char mqttServer[40] = "default.mqtt.server";
+char mqttServer[100] = "default.mqtt.server"; // One or more "host[:port]", comma separated, preferred first
 char mqttUser[40] = "defaultuser";
 char mqttPassword[40] = "defaultpass";
 char mqttTopic[64] = "sensor/aht20"; // Default topic
 char deviceId[40] = "ESP8266Client"; // Default device ID
+char mqttPersistentSession[2] = "0"; // "1" = connect with clean session off
+char mqttPort[6] = "1883";
+char mqttKeepAlive[6] = "15";    // Seconds between PINGREQs on an idle connection
+char mqttSocketTimeout[4] = "5"; // Seconds before a blocked connect/read/write gives up
+char mqttTls[2] = "0";           // "1" = MQTT over TLS (set the port to 8883 as well)
+char mqttTransport[4] = "tcp";   // "tcp" = MQTT via PubSubClient, "sn" = MQTT-SN over UDP (readings only)
+char mqttSnGateway[48] = "";     // MQTT-SN gateway "host[:port]"
+char mqttSnTopicId[6] = "1";     // Pre-defined topic ID the gateway maps to mqttTopic
+char mqttVersion[2] = "3";       // "3" = MQTT 3.1.1 (PubSubClient), "5" = MQTT 5 with topic aliases
+char mqttMessageExpiry[8] = "0"; // MQTT 5 only: seconds a reading may wait at the broker, 0 = forever
+char nodeMode[8] = "wifi";       // "wifi" = publish directly, "leaf"/"gateway" = ESP-NOW mesh roles
+char espNowGateway[18] = "";     // Leaf only: gateway MAC "aa:bb:cc:dd:ee:ff", empty = broadcast
+char espNowChannel[3] = "1";     // Leaf only: WiFi channel of the gateway's access point
+
+// Sampling settings, also adjustable remotely over MQTT (see handleConfigMessage)
+char settingInterval[8] = "5000"; // Milliseconds between samples
+char settingDeadband[8] = "0";    // Skip samples that moved less than this (degC and %RH), 0 = off
+char settingBatch[4] = "1";       // Samples per published message
+char settingLogLevel[2] = "3";    // 0 = quiet, 1 = errors, 2 = info, 3 = every publish
+char settingFilterAlpha[6] = "1"; // Weight of a new sample in the moving average, 1 = unfiltered
+char settingShaperRate[8] = "0";  // Messages per second allowed out, 0 = one per batch interval
+char settingShaperBurst[4] = "3"; // Messages that may go out back to back
+char settingDerived[2] = "0";     // Derived values to publish: 1 = dew point, 2 = absolute humidity, 4 = heat index
+
+// Config file layout: one value per line, in this order. New settings are
+// only ever appended so older config files still load.
+struct ConfigField
+{
+  const char *label;
+  char *value;
+  size_t size;
+};
+
+ConfigField configFields[] = {
+    {"MQTT Server", mqttServer, sizeof(mqttServer)},
+    {"MQTT User", mqttUser, sizeof(mqttUser)},
+    {"MQTT Password", mqttPassword, sizeof(mqttPassword)}, // Caution: printing passwords is a potential security risk
+    {"MQTT Topic", mqttTopic, sizeof(mqttTopic)},
+    {"Device ID", deviceId, sizeof(deviceId)},
+    {"Persistent Session", mqttPersistentSession, sizeof(mqttPersistentSession)},
+    {"MQTT Port", mqttPort, sizeof(mqttPort)},
+    {"MQTT Keepalive", mqttKeepAlive, sizeof(mqttKeepAlive)},
+    {"MQTT Socket Timeout", mqttSocketTimeout, sizeof(mqttSocketTimeout)},
+    {"MQTT TLS", mqttTls, sizeof(mqttTls)},
+    {"MQTT Transport", mqttTransport, sizeof(mqttTransport)},
+    {"MQTT-SN Gateway", mqttSnGateway, sizeof(mqttSnGateway)},
+    {"MQTT-SN Topic ID", mqttSnTopicId, sizeof(mqttSnTopicId)},
+    {"MQTT Version", mqttVersion, sizeof(mqttVersion)},
+    {"MQTT Message Expiry", mqttMessageExpiry, sizeof(mqttMessageExpiry)},
+    {"Sample Interval", settingInterval, sizeof(settingInterval)},
+    {"Deadband", settingDeadband, sizeof(settingDeadband)},
+    {"Batch Size", settingBatch, sizeof(settingBatch)},
+    {"Log Level", settingLogLevel, sizeof(settingLogLevel)},
+    {"Filter Alpha", settingFilterAlpha, sizeof(settingFilterAlpha)},
+    {"Shaper Rate", settingShaperRate, sizeof(settingShaperRate)},
+    {"Shaper Burst", settingShaperBurst, sizeof(settingShaperBurst)},
+    {"Node Mode", nodeMode, sizeof(nodeMode)},
+    {"ESP-NOW Gateway", espNowGateway, sizeof(espNowGateway)},
+    {"ESP-NOW Channel", espNowChannel, sizeof(espNowChannel)},
+    {"Derived Values", settingDerived, sizeof(settingDerived)},
+};
+
+// Settings that can be changed over MQTT, with their JSON key and valid range
+struct RemoteSetting
+{
+  const char *key;
+  char *value;
+  size_t size;
+  float minValue;
+  float maxValue;
+  bool integer;
+};
+
+RemoteSetting remoteSettings[] = {
+    {"interval", settingInterval, sizeof(settingInterval), 1000, 3600000, true},
+    {"deadband", settingDeadband, sizeof(settingDeadband), 0, 10, false},
+    {"batch", settingBatch, sizeof(settingBatch), 1, 10, true},
+    {"log_level", settingLogLevel, sizeof(settingLogLevel), 0, 3, true},
+    {"filter_alpha", settingFilterAlpha, sizeof(settingFilterAlpha), 0.01, 1, false},
+    {"shaper_rate", settingShaperRate, sizeof(settingShaperRate), 0, 100, false},
+    {"shaper_burst", settingShaperBurst, sizeof(settingShaperBurst), 1, 50, true},
+    {"derived", settingDerived, sizeof(settingDerived), 0, 7, true},
+};
 
 WiFiClient espClient;
-PubSubClient client(espClient);
+TrackingClient trackingClient(espClient);
+PubSubClient client(trackingClient);
+
+// MQTT 5 client, used instead of PubSubClient when mqttVersion is "5"
+#define MQTT5_SESSION_EXPIRY 86400 // Seconds the broker keeps a persistent session
+Mqtt5Client client5(trackingClient);
+bool mqtt5 = false;
+uint32_t messageExpiry = 0;
+
+// Stable MQTT client identity, derived once from deviceId (or the chip ID)
+char mqttClientId[40];
+unsigned long mqttConnectStartTime = 0;
+bool firstPublishPending = false;
+
+// Reconnects are attempted from loop() without blocking it. While some brokers
+// in the list are still untried the next one is attempted almost immediately.
+#define MQTT_RETRY_INTERVAL 5000
+#define MQTT_FAILOVER_RETRY_INTERVAL 500
+unsigned long lastMqttAttemptTime = 0;
+unsigned long mqttRetryDelay = 0;
+uint8_t failedMqttAttempts = 0;
+
+bool tlsEnabled = false;
+
+// MQTT-SN transport: no connection, each reading is a single UDP datagram
+#define MQTT_SN_DEFAULT_PORT 1884
+WiFiUDP snUdp;
+MqttSnClient snClient(snUdp);
+bool snTransport = false;
+uint16_t snTopicId = 1;
+
+// Broker endpoints, health scores and failover timing
+BrokerList brokers;
+uint8_t currentBroker = 0;
+bool mqttWasConnected = false;
+unsigned long mqttLostTime = 0;
 
 unsigned long lastPublishTime = 0;
 unsigned long publishInterval = 5000; // Publish every 5 seconds
 
-// WiFiManager custom parameters
-WiFiManagerParameter custom_mqtt_server("server", "MQTT Server", mqttServer, 40);
-WiFiManagerParameter custom_mqtt_user("user", "MQTT Username", mqttUser, 40);
-WiFiManagerParameter custom_mqtt_password("password", "MQTT Password", mqttPassword, 40);
-WiFiManagerParameter custom_mqtt_topic("topic", "MQTT Topic", mqttTopic, 64);
-WiFiManagerParameter custom_device_id("deviceid", "Device ID", deviceId, 40);
+// Parsed sampling settings
+#define LOG_ERROR 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+#define MAX_BATCH 10
+#define DEADBAND_HEARTBEAT 10 // Publish at least every this many samples
+float deadband = 0;
+uint8_t batchSize = 1;
+uint8_t logLevel = LOG_DEBUG;
+float filterAlpha = 1;
+uint8_t derivedFields = 0; // PSYCHRO_* bits
+
+struct Sample
+{
+  float value[SENSOR_CHANNELS]; // In sensor channel order
+  unsigned long time; // millis() of the newest sample merged into this one
+  uint16_t count;     // Samples averaged into this one by rollupBatch()
+  uint32_t seq;       // Sequence number of the oldest sample merged into this one
+};
+
+Sample batch[MAX_BATCH];
+uint8_t batchCount = 0;
+bool batchSplit = false; // The rest of a batch too big for one message is still to go
+bool filterPrimed = false;
+float filtered[SENSOR_CHANNELS];
+float lastSent[SENSOR_CHANNELS];
+uint8_t samplesSinceSent = 0;
+
+// Every sample that enters the batch takes the next sequence number. Messages
+// carry the boot counter and the number of their first sample; the samples in
+// a message follow on consecutively, n numbers each, so a gap or repeat in the
+// numbers is a lost or duplicated message. A reboot may skip numbers but
+// never reuses them, see SampleSequence.
+#define SEQUENCE_FILE "/seq.txt"
+SampleSequence sequence;
+
+// Recent samples are kept in flash so that gaps can be backfilled. Requests on
+// "<mqttTopic>/<client id>/backfill" look like {"id": "r1", "from_seq": 100,
+// "to_seq": 300} or {"id": "r2", "from_time": <unix>, "to_time": <unix>}. The
+// samples go to ".../backfill/data" in batches paced by their own token bucket,
+// so live data keeps flowing, followed by {"id": "r1", "done": true, ...}. A
+// bucket set on the control topic caps everything the device sends, so while
+// one is set backfill takes its tokens from the publish shaper instead.
+#define BACKFILL_RATE 2.0f // Backfill messages per second
+#define BACKFILL_BURST 2
+#define CLOCK_VALID_AFTER 1600000000UL // Unix time below this means NTP has not synced yet
+HistoryFiles historyFiles;
+SampleHistory history;
+BackfillServer backfill;
+TokenBucket backfillShaper;
+TokenBucket *backfillBucket = &backfillShaper; // The bucket backfill draws from, see configureShaper()
+char backfillTopic[128];
+char backfillDataTopic[128];
+
+// Remote configuration topics, "<mqttTopic>/<client id>/config[/ack]"
+char configTopic[128];
+char configAckTopic[128];
+bool configAckPending = false;
+bool configChanged = false;
+const char *configError = nullptr;
+
+// Every outgoing message takes a token from publishShaper, sized by the shaper
+// settings and the fleet-wide rate control on "<mqttTopic>/control". While it
+// is empty samples keep accumulating in the batch and are rolled up rather
+// than dropped; other messages are retried from loop(). A report interval
+// with throttling in it is sent to "<mqttTopic>/<client id>/shaper".
+#define SHAPER_REPORT_INTERVAL 60000
+char controlTopic[80];
+TokenBucket publishShaper;
+float shaperRate = 0;
+float shaperBurst = 3;
+float rateMultiplier = 1;     // Scales the configured rate
+float controlBucketRate = 0;  // Messages per second set by the control topic, 0 = use the configured rate
+float controlBucketBurst = 0; // Burst set by the control topic, 0 = use the configured burst
+unsigned long lastShaperReportTime = 0;
+char shaperStatusTopic[128];
+char shaperStatus[160];
+bool shaperStatusPending = false;
+
+// Firmware updates streamed over HTTP, triggered on "<mqttTopic>/<client id>/ota".
+// With "delta": true the URL serves a patch against the running image made by
+// tools/delta_ota.py, which is a fraction of the full image size.
+// The ESP8266 has no second bootable slot, so rollback means flashing the
+// previous image again: a new image that does not reach the broker within a
+// few boots is replaced from the rollback URL given with the update.
+#define OTA_STATE_FILE "/ota.txt"
+#define OTA_MAX_UNCONFIRMED_BOOTS 3
+#define OTA_CONFIRM_TIMEOUT 300000 // Reboot an unconfirmed image that has not connected by then
+#define OTA_RESTART_DELAY 2000     // Time to get the final status out before rebooting
+char otaTopic[128];
+char otaStatusTopic[128];
+OtaUpdater ota;
+char otaStatus[160];
+bool otaStatusPending = false;
+unsigned long otaRestartTime = 0;
+bool otaUnconfirmed = false; // Running a new image that has not reached the broker yet
+bool otaRollbackDue = false;
+char otaRollbackUrl[160] = "";
+char otaRollbackMd5[33] = "";
+
+// ESP-NOW mesh. A leaf samples once per wake, sends the reading to its gateway
+// and deep sleeps for the sample interval, never joining WiFi. A gateway runs
+// like a normal node and also keeps the latest reading and a rollup per leaf,
+// published to mqttTopic as combined documents once per sample interval.
+// Waking from deep sleep needs GPIO16 wired to RST, which is also the mode
+// button pin, so a leaf that keeps missing its gateway boots as a normal WiFi
+// node instead, where the portal and remote config can reach it.
+#define LEAF_ACK_TIMEOUT 50  // Milliseconds to wait for the gateway to acknowledge a reading
+#define LEAF_MAX_FAILURES 5  // Unacknowledged wakes in a row before falling back to WiFi
+#define LEAF_RELAY_RATE 1.0f // Extra messages per second a gateway may send for its leaves
+#define LEAF_TABLE_CAPACITY 64 // Leaves a gateway tracks; keep a quarter of it free
+#define LEAF_EXPIRY 3600000    // Forget leaves not heard from for this long
+#define LEAF_PAYLOAD_SIZE 896  // Combined documents are split to stay below this
+bool gatewayMode = false;
+LeafTable leafTable;
+char *leafPayload = nullptr;
+unsigned long lastLeafRoundTime = 0;
+
+// WiFiManager custom parameters. Only the table lives on: the parameters,
+// which copy their ids, labels and values into RAM, are built from it while
+// the portal runs and freed afterwards. The strings are kept in flash.
+struct PortalField
+{
+  char id[12];
+  char label[30];
+  char *value;
+  size_t size; // Of the value buffer, terminator included
+};
+
+const PortalField portalFields[] PROGMEM = {
+    {"server", "MQTT Server(s)", mqttServer, sizeof(mqttServer)},
+    {"user", "MQTT Username", mqttUser, sizeof(mqttUser)},
+    {"password", "MQTT Password", mqttPassword, sizeof(mqttPassword)},
+    {"topic", "MQTT Topic", mqttTopic, sizeof(mqttTopic)},
+    {"deviceid", "Device ID", deviceId, sizeof(deviceId)},
+    {"persistent", "Persistent Session (0/1)", mqttPersistentSession, sizeof(mqttPersistentSession)},
+    {"port", "MQTT Port", mqttPort, sizeof(mqttPort)},
+    {"keepalive", "MQTT Keepalive (s)", mqttKeepAlive, sizeof(mqttKeepAlive)},
+    {"timeout", "MQTT Socket Timeout (s)", mqttSocketTimeout, sizeof(mqttSocketTimeout)},
+    {"tls", "MQTT TLS (0/1)", mqttTls, sizeof(mqttTls)},
+    {"transport", "Transport (tcp/sn)", mqttTransport, sizeof(mqttTransport)},
+    {"sngateway", "MQTT-SN Gateway", mqttSnGateway, sizeof(mqttSnGateway)},
+    {"sntopicid", "MQTT-SN Topic ID", mqttSnTopicId, sizeof(mqttSnTopicId)},
+    {"version", "MQTT Version (3/5)", mqttVersion, sizeof(mqttVersion)},
+    {"expiry", "MQTT 5 Message Expiry (s)", mqttMessageExpiry, sizeof(mqttMessageExpiry)},
+    {"nodemode", "Node Mode (wifi/leaf/gateway)", nodeMode, sizeof(nodeMode)},
+    {"espnowgw", "ESP-NOW Gateway MAC (leaf)", espNowGateway, sizeof(espNowGateway)},
+    {"espnowch", "ESP-NOW Channel (leaf)", espNowChannel, sizeof(espNowChannel)},
+};
+const size_t PORTAL_FIELD_COUNT = sizeof(portalFields) / sizeof(portalFields[0]);
 
 // Method declarations
 void initializeSensor();
-void connectToMQTT();
-void publishSensorData();
+void probeSensors();
+void bootMark(const char *phase);
+void publishBootReport();
+void serviceSensorHealth();
+#ifdef SENSOR_I2C_BENCHMARK
+void benchmarkSensorBus();
+#endif
+bool connectToMQTT(int8_t brokerIndex = -1);
+void configureMQTT();
+bool mqttConnected();
+void mqttLoop();
+void checkBrokerFailback();
+uint16_t configNumber(const char *value, uint16_t fallback);
+void buildClientId();
+void subscribeTopics(bool sessionPresent);
+uint32_t subscriptionHash(uint8_t qos);
+uint8_t mqttSubscribeQos();
+void startConversion();
+void serviceConversion();
+void publishSensorData(const float *values);
+uint8_t publishSamples();
+size_t maxReadingPayload();
+size_t maxPayload(const char *topic);
+void flushBatch();
+void rollupBatch();
+void configureShaper();
+void reportShaperStats();
+bool shapedPublish(const char *topic, const char *payload);
+void handleControlMessage(const uint8_t *payload, unsigned int length);
+bool mqttPublish(const char *topic, const char *payload);
+bool mqttSubscribe(const char *topic);
+void mqttMessageReceived(char *topic, uint8_t *payload, unsigned int length);
+void handleConfigMessage(const uint8_t *payload, unsigned int length);
+void publishConfigAck();
+void handleOtaMessage(const uint8_t *payload, unsigned int length);
+void serviceOta();
+void setOtaStatus(const char *status, const char *detail);
+void writeOtaState(int boots);
+void checkOtaBoot();
+void confirmOtaBoot();
+void applySettings();
+uint32_t settingsHash();
+bool publishReading(const char *payload);
+size_t mqttPublishSize(size_t topicLength, size_t payloadLength);
 bool saveConfigToFlash();
 bool loadConfigFromFlash();
+void readConfigLine(File &configFile, char *value, size_t size);
 void printConfigToSerial();
 void configModeCallback(WiFiManager *myWiFiManager);
 void startWiFiManagerConfig(); // Start WiFiManager config portal
+void startWiFiEarly();
+bool waitForWiFi();
 void checkModeButton();        // Check if button is pressed during boot
+void loadSequence(bool rtcValid);
+bool saveSequence();
+uint32_t nextSequence();
+void handleBackfillMessage(const uint8_t *payload, unsigned int length);
+void serviceBackfill();
+void runLeaf();
+void restoreLeafWake();
+bool mountFilesystem();
+void startGateway();
+void serviceGateway();
 
 void setup()
 {
+  bootMark("core");
   Serial.begin(115200);
+  bootMark("serial");
+
+  // Restore state kept in RTC memory across resets and deep sleep
+  bool rtcValid = rtcLoad();
+  if (!rtcValid)
+  {
+    Serial.println("RTC state not valid, starting fresh.");
+  }
+
+  // A leaf waking from deep sleep takes its settings from RTC memory and goes
+  // straight to sampling; the filesystem is only mounted if a write needs it
+  bool leafFellBack = false;
+  if (rtcValid && rtcData.wakeReady && ESP.getResetInfoPtr()->reason == REASON_DEEP_SLEEP_AWAKE)
+  {
+    restoreLeafWake();
+    bootMark("restore");
+    runLeaf();
+    leafFellBack = true; // Only back here to carry on as a WiFi node
+  }
 
   // Initialize button pin for mode change (GPIO16)
   pinMode(MODE_BUTTON_PIN, INPUT_PULLUP);
+  bootMark("rtc");
 
   // Initialize LittleFS
-  if (!LittleFS.begin())
+  if (mountFilesystem())
   {
-    Serial.println("Failed to mount LittleFS. Formatting...");
-    LittleFS.format();
-    LittleFS.begin(); // Retry after formatting
+    bootMark("littlefs");
   }
 
   // Load config from LittleFS
@@ -63,65 +454,211 @@ void setup()
   {
     Serial.println("Using default configuration...");
   }
+  applySettings();
+  bootMark("config");
 
-  // Initialize AHT20 sensor
-  initializeSensor();
+  // Leaves send one reading and go back to sleep without touching WiFi or MQTT
+  bool leaf = strcmp(nodeMode, "leaf") == 0 && !leafFellBack;
+  if (!leaf)
+  {
+    startWiFiEarly();
+  }
+  checkOtaBoot();
+  loadSequence(rtcValid);
+  bootMark("state");
+
+  if (leaf)
+  {
+    runLeaf();
+    startWiFiEarly();
+  }
+
+  // Initialize AHT20 sensor, unless a leaf wake that fell back already did
+  if (!leaf && !leafFellBack)
+  {
+    initializeSensor();
+    bootMark("sensor");
+  }
+#ifdef SENSOR_I2C_BENCHMARK
+  benchmarkSensorBus();
+#endif
 
   // Check if the mode button is pressed during boot
   checkModeButton(); // Call the method to check button status
+  bootMark("button");
+
+  // The first sample and the history load run while WiFi is still joining
+  if (sensorHealth.ok())
+  {
+    startConversion();
+    lastPublishTime = millis();
+  }
+
+  // Samples are kept for backfill, stamped with Unix time once NTP has synced
+  history.begin(historyFiles);
+  configTime(0, 0, "pool.ntp.org", "time.nist.gov");
+  bootMark("history");
 
   // Start WiFiManager for automatic connection or configuration
-  startWiFiManagerConfig();
+  if (!waitForWiFi())
+  {
+    startWiFiManagerConfig();
+  }
+  bootMark("wifi");
+
+  // An image that keeps failing to reach the broker is replaced by the previous one
+  if (otaRollbackDue)
+  {
+    Serial.println("Rolling back firmware update...");
+    ota.begin(otaRollbackUrl, otaRollbackMd5, 0);
+
+    // The restored image is not rolled back any further
+    otaRollbackUrl[0] = '\0';
+    otaRollbackMd5[0] = '\0';
+  }
+
+  if (strcmp(nodeMode, "gateway") == 0)
+  {
+    startGateway();
+  }
 
-  // Connect to MQTT after WiFi is connected
-  connectToMQTT();
+  // Connect to MQTT after WiFi is connected; MQTT-SN publishes need no
+  // connection, so a broker on the TCP port is not tried then
+  configureMQTT();
+  if (!snTransport)
+  {
+    connectToMQTT();
+  }
+
+  // What is left for buffers and queues in normal operation
+  uint32_t heapFree = ESP.getFreeHeap();
+  uint32_t heapMaxBlock = ESP.getMaxFreeBlockSize();
+  bootProfile.heap(heapFree, heapMaxBlock);
+  Serial.print("Free heap after boot: ");
+  Serial.print(heapFree);
+  Serial.print(" bytes, largest block ");
+  Serial.println(heapMaxBlock);
 }
 
 void loop()
 {
-  // Reconnect to MQTT if not connected
-  if (!client.connected())
+  // Reconnect to MQTT if not connected, without stalling the rest of loop()
+  if (snTransport)
   {
-    connectToMQTT();
+    // MQTT-SN publishes are connectionless
+  }
+  else if (!mqttConnected())
+  {
+    if (mqttWasConnected)
+    {
+      mqttWasConnected = false;
+      mqttLostTime = millis();
+      Serial.println("MQTT connection lost.");
+    }
+    if (millis() - lastMqttAttemptTime > mqttRetryDelay)
+    {
+      connectToMQTT();
+    }
+  }
+  else
+  {
+    checkBrokerFailback();
+    if (configAckPending)
+    {
+      publishConfigAck();
+    }
+    if (otaStatusPending && shapedPublish(otaStatusTopic, otaStatus))
+    {
+      otaStatusPending = false;
+    }
+    if (sensorStatusPending && shapedPublish(sensorStatusTopic, sensorStatus))
+    {
+      sensorStatusPending = false;
+    }
+    if (shaperStatusPending && shapedPublish(shaperStatusTopic, shaperStatus))
+    {
+      shaperStatusPending = false;
+    }
+    if (bootReportPending)
+    {
+      publishBootReport();
+    }
   }
 
-  // Publish sensor data at intervals
+  // Sample at intervals; the sample is published once the sensors have converted
+  serviceSensorHealth();
   unsigned long currentMillis = millis();
-  if (currentMillis - lastPublishTime > publishInterval)
+  if (sensorHealth.ok() && !sensorConverting && currentMillis - lastPublishTime > publishInterval)
   {
-    publishSensorData();
+    startConversion();
     lastPublishTime = currentMillis;
   }
+  serviceConversion();
+  flushBatch();
+  serviceBackfill();
+  serviceGateway();
+  reportShaperStats();
+  serviceOta();
 
-  client.loop();
+  if (!snTransport)
+  {
+    mqttLoop();
+  }
 }
 
-// Method to start WiFiManager configuration portal
+// Method to start WiFiManager configuration portal. Its parameters are
+// built here from the current settings and freed again before returning.
 void startWiFiManagerConfig()
 {
-  WiFiManager wifiManager;
-  wifiManager.setAPCallback(configModeCallback); // Set callback for when AP mode is entered
-
-  // Add custom parameters for MQTT configuration
-  wifiManager.addParameter(&custom_mqtt_server);
-  wifiManager.addParameter(&custom_mqtt_user);
-  wifiManager.addParameter(&custom_mqtt_password);
-  wifiManager.addParameter(&custom_mqtt_topic);
-  wifiManager.addParameter(&custom_device_id);
+  // WiFiManager keeps the id and label pointers, so the copy of the table
+  // stays until the parameters are gone
+  uint32_t heapBefore = ESP.getFreeHeap();
+  PortalField *fields = (PortalField *)malloc(sizeof(portalFields));
+  if (!fields)
+  {
+    Serial.println("Not enough memory for the config portal. Restarting...");
+    ESP.restart();
+    return;
+  }
+  memcpy_P(fields, portalFields, sizeof(portalFields));
+  WiFiManagerParameter *parameters[PORTAL_FIELD_COUNT];
+  for (size_t i = 0; i < PORTAL_FIELD_COUNT; i++)
+  {
+    // The length is in characters; WiFiManager adds the terminator
+    parameters[i] = new WiFiManagerParameter(fields[i].id, fields[i].label, fields[i].value, fields[i].size - 1);
+  }
+  uint32_t heapBuilt = ESP.getFreeHeap();
+  Serial.printf("Portal parameters: %lu bytes of heap, %lu bytes free\n", (unsigned long)(heapBefore - heapBuilt),
+                (unsigned long)heapBuilt);
 
-  // Automatically connect or start the AP for configuration
-  if (!wifiManager.autoConnect("Sensor AP"))
+  // The manager goes before its parameters
   {
-    Serial.println("Failed to connect to WiFi. Restarting...");
-    ESP.restart(); // Restart if WiFi connection fails
+    WiFiManager wifiManager;
+    wifiManager.setAPCallback(configModeCallback); // Set callback for when AP mode is entered
+
+    // Add custom parameters for MQTT configuration
+    for (WiFiManagerParameter *parameter : parameters)
+    {
+      wifiManager.addParameter(parameter);
+    }
+
+    // Automatically connect or start the AP for configuration
+    if (!wifiManager.autoConnect("Sensor AP"))
+    {
+      Serial.println("Failed to connect to WiFi. Restarting...");
+      ESP.restart(); // Restart if WiFi connection fails
+    }
   }
 
   // Save custom parameters after WiFi connection
-  strcpy(mqttServer, custom_mqtt_server.getValue());
-  strcpy(mqttUser, custom_mqtt_user.getValue());
-  strcpy(mqttPassword, custom_mqtt_password.getValue());
-  strcpy(mqttTopic, custom_mqtt_topic.getValue());
-  strcpy(deviceId, custom_device_id.getValue());
+  for (size_t i = 0; i < PORTAL_FIELD_COUNT; i++)
+  {
+    strlcpy(fields[i].value, parameters[i]->getValue(), fields[i].size);
+    delete parameters[i];
+  }
+  free(fields);
+  Serial.printf("Portal parameters freed, %lu bytes free (%ld against before the portal)\n",
+                (unsigned long)ESP.getFreeHeap(), (long)ESP.getFreeHeap() - (long)heapBefore);
 
   if (saveConfigToFlash())
   {
@@ -136,6 +673,47 @@ void startWiFiManagerConfig()
   printConfigToSerial();
 }
 
+// Method to start joining the network stored by WiFiManager, without waiting.
+// The SDK may already be joining it on its own from power-up, in which case
+// it is left to carry on.
+void startWiFiEarly()
+{
+  if (WiFi.SSID().length() == 0)
+    return;
+  WiFi.mode(WIFI_STA);
+  if (WiFi.status() == WL_IDLE_STATUS)
+  {
+    WiFi.begin();
+  }
+  wifiEarlyStarted = true;
+  wifiStartTime = millis();
+}
+
+// Method to wait for the network joined by startWiFiEarly(), collecting the
+// first sample meanwhile. Returns false when WiFiManager has to take over.
+bool waitForWiFi()
+{
+  if (!wifiEarlyStarted)
+    return false;
+  // Serial output is slow, so the config goes out while the radio works
+  printConfigToSerial();
+  while (WiFi.status() != WL_CONNECTED && millis() - wifiStartTime < WIFI_CONNECT_TIMEOUT)
+  {
+    serviceConversion();
+    delay(5);
+  }
+  if (WiFi.status() != WL_CONNECTED)
+  {
+    Serial.println("Stored WiFi network not joined, starting WiFiManager...");
+    return false;
+  }
+  Serial.print("WiFi connected in ");
+  Serial.print(millis() - wifiStartTime);
+  Serial.print(" ms, IP ");
+  Serial.println(WiFi.localIP());
+  return true;
+}
+
 // Method to check if the mode button is pressed during boot
 void checkModeButton()
 {
@@ -152,122 +730,1568 @@ void checkModeButton()
   }
 }
 
-// Method to initialize the AHT20 sensor
+// Method to initialize the sensors built into this firmware. Missing sensors
+// do not stop the boot; serviceSensorHealth() keeps looking for them.
 void initializeSensor()
 {
-  if (!aht.begin())
+  sensorHealth.configure(SENSOR_RETRY_MIN, SENSOR_RETRY_MAX, SENSOR_FAILURES_TO_FAULT);
+  probeSensors();
+}
+
+// Method to look for the sensors on their buses once
+void probeSensors()
+{
+  bool found = sensors.begin();
+  sensorHealth.probed(found, millis());
+  if (!found)
+  {
+    if (logLevel >= LOG_ERROR)
+      Serial.printf("Failed to find %s sensor, probing again in %lu ms.\n", sensors.failed(),
+                    (unsigned long)sensorHealth.nextProbeIn(millis()));
+    return;
+  }
+  // Leaves skip the list, as they do the config dump
+  if (strcmp(nodeMode, "leaf") == 0)
+    return;
+  Serial.print("Sensors found, channels:");
+  for (uint8_t i = 0; i < SENSOR_CHANNELS; i++)
   {
-    Serial.println("Failed to find AHT20 sensor!");
-    while (1)
-      delay(10);
+    Serial.printf(" %s (%s)", Sensors::channel(i).key, Sensors::channel(i).unit);
   }
-  Serial.println("AHT20 sensor found.");
+  Serial.println();
+}
+
+// Method to probe for missing or failed sensors when the backoff allows, and
+// queue a status message when their state changes
+void serviceSensorHealth()
+{
+  if (!sensorConverting && sensorHealth.probeDue(millis()))
+    probeSensors();
+  if (!sensorHealth.changed())
+    return;
+  sensorHealth.clearChanged();
+
+  const char *missing = sensorHealth.ok() ? nullptr : sensors.failed();
+  snprintf(sensorStatus, sizeof(sensorStatus),
+           "{\"status\": \"%s\", \"sensor\": \"%s\", \"failed_reads\": %lu, \"faults\": %lu, \"probes\": %lu}",
+           sensorHealth.stateName(), missing ? missing : "", (unsigned long)sensorHealth.failedReads(),
+           (unsigned long)sensorHealth.faults(), (unsigned long)sensorHealth.probes());
+  sensorStatusPending = true;
+  Serial.print("Sensor status: ");
+  Serial.println(sensorStatus);
 }
 
-// Method to connect to the MQTT server
-void connectToMQTT()
+#ifdef SENSOR_I2C_BENCHMARK
+// Method to print the CPU cycles the I2C sensors take per sample at the
+// standard and the fast clock, with interrupts and WiFi running as usual.
+// Build with -D SENSOR_I2C_BENCHMARK (env d1_mini_i2c_benchmark).
+void benchmarkSensorBus()
 {
-  client.setServer(mqttServer, 1883);
-  while (!client.connected())
+  static const uint32_t clocks[] = {100000, SENSOR_I2C_CLOCK};
+  const uint8_t rounds = 50;
+  float values[SENSOR_CHANNELS];
+  for (uint32_t clock : clocks)
   {
-    Serial.println("Connecting to MQTT...");
-    if (client.connect(deviceId, mqttUser, mqttPassword))
+    WireBus::shared().setClock(clock);
+    uint32_t triggerCycles = 0;
+    uint32_t collectCycles = 0;
+    uint32_t worst = 0;
+    uint8_t failed = 0;
+    for (uint8_t i = 0; i < rounds; i++)
     {
-      Serial.println("Connected to MQTT.");
+      uint32_t start = ESP.getCycleCount();
+      uint32_t wait = sensors.trigger();
+      triggerCycles += ESP.getCycleCount() - start;
+      delay(wait);
+      start = ESP.getCycleCount();
+      failed += sensors.collect(values) != SENSOR_READY;
+      uint32_t cycles = ESP.getCycleCount() - start;
+      collectCycles += cycles;
+      worst = cycles > worst ? cycles : worst;
     }
-    else
+    Serial.printf("I2C at %lu kHz: trigger %lu cycles, collect %lu cycles (worst %lu), %lu us per sample, %u failed\n",
+                  (unsigned long)clock / 1000, (unsigned long)triggerCycles / rounds,
+                  (unsigned long)collectCycles / rounds, (unsigned long)worst,
+                  (unsigned long)((triggerCycles + collectCycles) / rounds / ESP.getCpuFreqMHz()), failed);
+  }
+  WireBus::shared().setClock(SENSOR_I2C_CLOCK);
+}
+#endif
+
+// Method to take one sample, waiting for the conversion (leaf wakes only)
+bool readSensors(float *values)
+{
+  unsigned long start = millis();
+  delay(sensors.trigger());
+  SensorStatus status;
+  while ((status = sensors.collect(values)) == SENSOR_BUSY && millis() - start < SENSOR_TIMEOUT)
+    delay(SENSOR_POLL_INTERVAL);
+  return status == SENSOR_READY;
+}
+
+// Method to get a sample value by channel, or 0 for a quantity no sensor
+// measures or a sensor that was not found
+float channelValue(const float *values, int channel)
+{
+  return channel >= 0 && !isnan(values[channel]) ? values[channel] : 0;
+}
+
+// Method to run one leaf wake: sample, hand the reading to the gateway and
+// deep sleep until the next sample. Only returns when the gateway has been
+// unreachable for several wakes, to carry on as a normal WiFi node.
+void runLeaf()
+{
+  initializeSensor();
+  float values[SENSOR_CHANNELS];
+  bool sensorFault = !readSensors(values);
+  if (sensorFault)
+  {
+    // Still send, flagged, so the gateway can tell a failed sensor from a
+    // leaf that has gone quiet
+    Serial.println("Sensor read failed.");
+    memset(values, 0, sizeof(values));
+  }
+  bootMark("sample");
+
+  EspNowReading reading = {ESP_NOW_READING_VERSION, (uint8_t)(sensorFault ? ESP_NOW_SENSOR_FAULT : 0), nextSequence(),
+                           (int16_t)lroundf(channelValue(values, temperatureChannel) * 100),
+                           (uint16_t)lroundf(channelValue(values, humidityChannel) * 100)};
+  bool sent = espNowSend(espNowGateway, configNumber(espNowChannel, 1), reading, LEAF_ACK_TIMEOUT);
+  bootMark("send");
+  if (sent)
+  {
+    rtcData.leafFailures = 0;
+  }
+  else if (++rtcData.leafFailures >= LEAF_MAX_FAILURES)
+  {
+    rtcData.leafFailures = 0;
+    rtcSave();
+    Serial.println("ESP-NOW gateway not reachable, starting as a WiFi node.");
+    return;
+  }
+
+  Serial.print("Leaf awake for ");
+  Serial.print(millis());
+  Serial.println(" ms.");
+  if (logLevel >= LOG_DEBUG)
+  {
+    char summary[192];
+    bootProfile.formatSummary(summary, sizeof(summary));
+    Serial.println(summary);
+  }
+
+  // Everything the next wake needs, so it can skip the filesystem
+  rtcData.wakeReady = 1;
+  rtcData.wakeLogLevel = logLevel;
+  rtcData.wakeEspNowChannel = configNumber(espNowChannel, 1);
+  strlcpy(rtcData.wakeEspNowGateway, espNowGateway, sizeof(rtcData.wakeEspNowGateway));
+  rtcData.wakeInterval = publishInterval;
+  rtcData.wakeSequenceBoot = sequence.boot();
+  rtcData.wakeSequenceReserved = sequence.reserved();
+  rtcAdvanceClock(publishInterval);
+  rtcSave();
+  ESP.deepSleep(publishInterval * 1000ULL);
+}
+
+// Method to restore the leaf settings and sample sequence saved in RTC memory
+// before the last deep sleep, in place of mounting LittleFS and reading the
+// config, OTA state and sequence files
+void restoreLeafWake()
+{
+  strlcpy(nodeMode, "leaf", sizeof(nodeMode));
+  strlcpy(espNowGateway, rtcData.wakeEspNowGateway, sizeof(espNowGateway));
+  snprintf(espNowChannel, sizeof(espNowChannel), "%u", rtcData.wakeEspNowChannel);
+  publishInterval = rtcData.wakeInterval;
+  logLevel = rtcData.wakeLogLevel;
+  sequence.begin(true, rtcData.sampleSeq, true, rtcData.wakeSequenceBoot, rtcData.wakeSequenceReserved);
+}
+
+// Method to mount LittleFS once, formatting it if it cannot be mounted. A
+// failed mount is tried again on the next call, but formatted only once.
+bool mountFilesystem()
+{
+  static bool mounted = false;
+  static bool formatted = false;
+  if (mounted)
+    return true;
+  if (LittleFS.begin())
+  {
+    mounted = true;
+    return true;
+  }
+  if (formatted)
+    return false;
+  formatted = true;
+  Serial.println("Failed to mount LittleFS. Formatting...");
+  mounted = LittleFS.format() && LittleFS.begin(); // Retry after formatting
+  bootMark("format");
+  if (!mounted)
+    Serial.println("LittleFS not available.");
+  return mounted;
+}
+
+// Method to start receiving readings from ESP-NOW leaves
+void startGateway()
+{
+  leafPayload = (char *)malloc(LEAF_PAYLOAD_SIZE);
+  gatewayMode = leafPayload != nullptr && leafTable.begin(LEAF_TABLE_CAPACITY) && espNowStartGateway();
+  if (!gatewayMode)
+  {
+    Serial.println("Failed to start ESP-NOW, not relaying for leaves.");
+    return;
+  }
+  configureShaper();
+  Serial.print("Leaf table: ");
+  Serial.print(leafTable.capacity());
+  Serial.print(" slots, ");
+  Serial.print(leafTable.memoryUsed());
+  Serial.println(" bytes");
+
+  // Leaves must be set to this channel, and to this MAC to get acknowledgements
+  Serial.print("ESP-NOW gateway on channel ");
+  Serial.print(WiFi.channel());
+  Serial.print(", MAC ");
+  Serial.println(WiFi.macAddress());
+}
+
+// Method to fold leaf readings into the leaf table and publish it as combined
+// documents once per sample interval, one message at a time as the shaper allows
+void serviceGateway()
+{
+  if (!gatewayMode)
+    return;
+
+  EspNowFrame frame;
+  while (espNowReceive(frame))
+  {
+    if (leafTable.update(frame.mac, frame.reading.seq, frame.reading.temperature, frame.reading.humidity,
+                         frame.receivedAt, frame.reading.flags & ESP_NOW_SENSOR_FAULT) == LeafTable::FULL &&
+        logLevel >= LOG_ERROR)
     {
-      Serial.print("Failed MQTT connection, rc=");
-      Serial.println(client.state());
-      delay(5000);
+      Serial.println("Leaf table full, ignoring a new leaf.");
     }
   }
+
+  if (!leafTable.roundActive())
+  {
+    if (millis() - lastLeafRoundTime < publishInterval)
+      return;
+    lastLeafRoundTime = millis();
+    leafTable.expire(millis(), LEAF_EXPIRY);
+    leafTable.startRound();
+  }
+
+  if ((!snTransport && !mqttConnected()) || publishShaper.available(millis()) < 1)
+    return;
+  size_t length = leafTable.formatNext(leafPayload, LEAF_PAYLOAD_SIZE, mqttClientId, millis());
+  if (length == 0 || !publishShaper.tryConsume(millis()))
+    return;
+  if (!publishReading(leafPayload))
+  {
+    publishShaper.refund();
+    return;
+  }
+  leafTable.commitNext();
+
+  if (logLevel >= LOG_DEBUG)
+  {
+    Serial.print("Published leaf table: ");
+    Serial.print(length);
+    Serial.print(" bytes, ");
+    Serial.print(leafTable.size());
+    Serial.print(" leaves, ");
+    Serial.print(leafTable.duplicates());
+    Serial.print(" duplicates, ");
+    Serial.print(leafTable.rejected() + espNowDropped());
+    Serial.println(" readings dropped");
+  }
 }
 
-// Method to publish sensor data to the MQTT topic
-void publishSensorData()
+// Method to set up the sample sequence from RTC memory and the copy in flash
+void loadSequence(bool rtcValid)
 {
-  sensors_event_t humidity, temp;
-  aht.getEvent(&humidity, &temp);
+  char boot[12] = "0";
+  char reserved[12] = "0";
+  File sequenceFile = LittleFS.open(SEQUENCE_FILE, "r");
+  if (sequenceFile)
+  {
+    readConfigLine(sequenceFile, boot, sizeof(boot));
+    readConfigLine(sequenceFile, reserved, sizeof(reserved));
+    sequenceFile.close();
+  }
 
-  char payload[100];
-  snprintf(payload, sizeof(payload), "{\"device_id\": \"%s\", \"temperature\": %.2f, \"humidity\": %.2f}", deviceId, temp.temperature, humidity.relative_humidity);
+  bool deepSleepWake = ESP.getResetInfoPtr()->reason == REASON_DEEP_SLEEP_AWAKE;
+  sequence.begin(rtcValid, rtcData.sampleSeq, deepSleepWake, strtoul(boot, nullptr, 10), strtoul(reserved, nullptr, 10));
+  if (sequence.storeDue())
+  {
+    saveSequence();
+  }
+  rtcData.sampleSeq = sequence.current();
+  rtcSave();
 
-  Serial.print("Publishing to MQTT: ");
-  Serial.println(payload);
-  client.publish(mqttTopic, payload);
+  Serial.print("Boot ");
+  Serial.print(sequence.boot());
+  Serial.print(", sample sequence at ");
+  Serial.println(sequence.current());
 }
 
-// Method to save WiFi, MQTT, and device settings to flash (LittleFS)
-bool saveConfigToFlash()
+// Method to save the boot counter and sequence reservation to flash
+bool saveSequence()
 {
-  File configFile = LittleFS.open("/config.txt", "w");
-  if (!configFile)
+  mountFilesystem();
+  File sequenceFile = LittleFS.open(SEQUENCE_FILE, "w");
+  if (!sequenceFile)
   {
-    Serial.println("Failed to open config file for writing.");
+    Serial.println("Failed to save sample sequence.");
     return false;
   }
+  sequenceFile.println(sequence.boot());
+  sequenceFile.println(sequence.reserved());
+  sequenceFile.close();
+  sequence.stored();
+  rtcData.wakeSequenceBoot = sequence.boot();
+  rtcData.wakeSequenceReserved = sequence.reserved();
+  return true;
+}
 
-  // Write each parameter as a separate line
-  configFile.println(mqttServer);
-  configFile.println(mqttUser);
-  configFile.println(mqttPassword);
-  configFile.println(mqttTopic);
-  configFile.println(deviceId);
+// Method to take the next sample sequence number. It is reserved in flash and
+// kept in RTC memory before it can be published, so no reset can reuse it.
+uint32_t nextSequence()
+{
+  uint32_t seq = sequence.next();
+  if (sequence.storeDue())
+  {
+    saveSequence();
+  }
+  rtcData.sampleSeq = seq;
+  rtcSave();
+  return seq;
+}
 
-  configFile.close();
-  Serial.println("Config saved to LittleFS.");
-  return true;
+// Method to build a client ID that stays the same across reconnects and reboots.
+// A persistent session is keyed by client ID, so the shared default device ID
+// is replaced by one derived from the chip ID.
+void buildClientId()
+{
+  if (strcmp(deviceId, "ESP8266Client") == 0 || deviceId[0] == '\0')
+  {
+    snprintf(mqttClientId, sizeof(mqttClientId), "ESP8266-%06X", ESP.getChipId());
+  }
+  else
+  {
+    strlcpy(mqttClientId, deviceId, sizeof(mqttClientId));
+  }
 }
 
-// Method to load WiFi, MQTT, and device settings from flash (LittleFS)
-bool loadConfigFromFlash()
+// Method to hash what a persistent session is subscribed to: the broker, the
+// client ID and every topic with its QoS (FNV-1a)
+uint32_t subscriptionHash(uint8_t qos)
 {
-  if (!LittleFS.exists("/config.txt"))
+  const char *parts[] = {brokers.endpoint(currentBroker).host, mqttClientId, configTopic, controlTopic, otaTopic,
+                         backfillTopic};
+  uint32_t hash = 2166136261UL;
+  for (const char *part : parts)
   {
-    Serial.println("Config file does not exist. Using default settings.");
-    return false;
+    for (const char *c = part; *c != '\0'; c++)
+    {
+      hash ^= (uint8_t)*c;
+      hash *= 16777619UL;
+    }
+    hash ^= '\n';
+    hash *= 16777619UL;
   }
+  hash ^= qos;
+  hash *= 16777619UL;
+  return hash;
+}
 
-  File configFile = LittleFS.open("/config.txt", "r");
-  if (!configFile)
+// Method to (re)establish MQTT subscriptions. A resumed session keeps them, so
+// they are only sent again when the broker has no session or the topic set
+// changed since they were made (a new mqttTopic, a new firmware's topics).
+void subscribeTopics(bool sessionPresent)
+{
+  uint32_t hash = subscriptionHash(mqttSubscribeQos());
+  if (sessionPresent && rtcData.mqttSubscriptionHash == hash)
+    return;
+
+  bool subscribed = true;
+  if (!mqttSubscribe(configTopic))
   {
-    Serial.println("Failed to open config file for reading.");
-    return false;
+    Serial.println("Failed to subscribe to the config topic.");
+    subscribed = false;
+  }
+  if (!mqttSubscribe(controlTopic))
+  {
+    Serial.println("Failed to subscribe to the control topic.");
+    subscribed = false;
+  }
+  if (!mqttSubscribe(otaTopic))
+  {
+    Serial.println("Failed to subscribe to the OTA topic.");
+    subscribed = false;
+  }
+  if (!mqttSubscribe(backfillTopic))
+  {
+    Serial.println("Failed to subscribe to the backfill topic.");
+    subscribed = false;
   }
 
-  // Read each line and store it in the corresponding variable
-  if (configFile.available())
-    configFile.readBytesUntil('\n', mqttServer, sizeof(mqttServer));
-  if (configFile.available())
-    configFile.readBytesUntil('\n', mqttUser, sizeof(mqttUser));
-  if (configFile.available())
-    configFile.readBytesUntil('\n', mqttPassword, sizeof(mqttPassword));
-  if (configFile.available())
-    configFile.readBytesUntil('\n', mqttTopic, sizeof(mqttTopic));
-  if (configFile.available())
-    configFile.readBytesUntil('\n', deviceId, sizeof(deviceId));
+  // A partial set is sent again in full on the next connect
+  uint32_t stored = subscribed ? hash : 0;
+  if (rtcData.mqttSubscriptionHash != stored)
+  {
+    rtcData.mqttSubscriptionHash = stored;
+    rtcSave();
+  }
+}
 
-  configFile.close();
-  Serial.println("Config loaded from LittleFS.");
-  printConfigToSerial();
-  return true;
+// Method to parse a numeric config value, falling back on empty or invalid input
+uint16_t configNumber(const char *value, uint16_t fallback)
+{
+  long number = atol(value);
+  if (number <= 0 || number > 65535)
+    return fallback;
+  return (uint16_t)number;
 }
 
-// Method to print the configuration (WiFi, MQTT, and device settings) to the serial console
-void printConfigToSerial()
+// Method to apply the broker list, port, keepalive and socket timeouts from config.
+// A short socket timeout bounds how long a dead TCP peer can block connect or
+// publish; the keepalive decides how quickly an idle dead peer is noticed.
+void configureMQTT()
 {
-  Serial.println("=== Current Configuration ===");
-  Serial.print("MQTT Server: ");
-  Serial.println(mqttServer);
-  Serial.print("MQTT User: ");
-  Serial.println(mqttUser);
-  Serial.print("MQTT Password: ");
-  Serial.println(mqttPassword); // Caution: printing passwords is a potential security risk
-  Serial.print("MQTT Topic: ");
-  Serial.println(mqttTopic);
-  Serial.print("Device ID: ");
-  Serial.println(deviceId);
+  uint16_t socketTimeout = configNumber(mqttSocketTimeout, 5);
+
+  if (brokers.parse(mqttServer, configNumber(mqttPort, 1883)) == 0)
+  {
+    Serial.println("No valid MQTT server configured.");
+  }
+  client.setKeepAlive(configNumber(mqttKeepAlive, 15));
+  client.setSocketTimeout(socketTimeout);
+  client.setBufferSize(1024); // A batch that does not fit is split, see publishSamples()
+  client.setCallback(mqttMessageReceived);
+  client5.setCallback(mqttMessageReceived);
+  client5.setKeepAlive(configNumber(mqttKeepAlive, 15));
+  client5.setSocketTimeout(socketTimeout);
+  client5.reserveAlias(mqttTopic); // Readings, by far the most published topic
+  mqtt5 = mqttVersion[0] == '5';
+  messageExpiry = atol(mqttMessageExpiry);
+  espClient.setTimeout(socketTimeout * 1000UL);
+
+  tlsEnabled = false;
+  if (mqttTls[0] == '1')
+  {
+    Client &secureClient = tlsBegin(socketTimeout * 1000UL, tlsEnabled);
+    if (tlsEnabled)
+    {
+      trackingClient.setInner(secureClient);
+    }
+  }
+  if (!tlsEnabled)
+  {
+    trackingClient.setInner(espClient);
+  }
+
+  snTransport = false;
+  if (strcmp(mqttTransport, "sn") == 0)
+  {
+    BrokerList gateway;
+    IPAddress gatewayIp;
+    uint32_t dnsMs;
+    if (gateway.parse(mqttSnGateway, MQTT_SN_DEFAULT_PORT) > 0 &&
+        dnsResolve(gateway.endpoint(0).host, gatewayIp, dnsMs))
+    {
+      snClient.setGateway(gatewayIp, gateway.endpoint(0).port);
+      snTopicId = configNumber(mqttSnTopicId, 1);
+      snTransport = true;
+      Serial.println("Using MQTT-SN transport.");
+      // Only the data topic has a pre-defined topic ID, and QoS -1 has no
+      // subscriptions, so whatever needs either stays with MQTT over TCP
+      Serial.println("MQTT-SN carries readings and leaf documents only; remote config, control, OTA, backfill, "
+                     "the boot report and status messages need MQTT over TCP.");
+    }
+    else
+    {
+      Serial.println("MQTT-SN gateway not usable, falling back to MQTT over TCP.");
+    }
+  }
+}
+
+// Method to make one attempt at connecting to the MQTT server, to the given
+// broker or, with -1, to the healthiest one
+bool connectToMQTT(int8_t brokerIndex)
+{
+  bool cleanSession = mqttPersistentSession[0] != '1';
+
+  if (brokers.count() == 0)
+    return false;
+
+  buildClientId();
+  snprintf(configTopic, sizeof(configTopic), "%s/%s/config", mqttTopic, mqttClientId);
+  snprintf(configAckTopic, sizeof(configAckTopic), "%s/ack", configTopic);
+  snprintf(controlTopic, sizeof(controlTopic), "%s/control", mqttTopic);
+  snprintf(otaTopic, sizeof(otaTopic), "%s/%s/ota", mqttTopic, mqttClientId);
+  snprintf(otaStatusTopic, sizeof(otaStatusTopic), "%s/status", otaTopic);
+  snprintf(sensorStatusTopic, sizeof(sensorStatusTopic), "%s/%s/sensor", mqttTopic, mqttClientId);
+  snprintf(shaperStatusTopic, sizeof(shaperStatusTopic), "%s/%s/shaper", mqttTopic, mqttClientId);
+  snprintf(bootTopic, sizeof(bootTopic), "%s/%s/boot", mqttTopic, mqttClientId);
+  snprintf(backfillTopic, sizeof(backfillTopic), "%s/%s/backfill", mqttTopic, mqttClientId);
+  snprintf(backfillDataTopic, sizeof(backfillDataTopic), "%s/data", backfillTopic);
+  lastMqttAttemptTime = millis();
+  mqttConnectStartTime = lastMqttAttemptTime;
+
+  currentBroker = brokerIndex >= 0 ? brokerIndex : brokers.select(lastMqttAttemptTime);
+  const BrokerEndpoint &broker = brokers.endpoint(currentBroker);
+
+  Serial.print("Connecting to MQTT at ");
+  Serial.print(broker.host);
+  Serial.print(":");
+  Serial.print(broker.port);
+  Serial.println("...");
+
+  // Connect by address so a cached resolution skips the DNS round trip; TLS
+  // still connects by name to check the certificate, see tlsPrepareConnect()
+  IPAddress brokerIp;
+  uint32_t dnsMs;
+  bool connected = dnsResolve(broker.host, brokerIp, dnsMs);
+  unsigned long connectStart = millis();
+  if (!connected)
+  {
+    Serial.println("DNS lookup failed.");
+  }
+  else
+  {
+    uint32_t heapBefore = ESP.getFreeHeap();
+    if (tlsEnabled)
+    {
+      tlsPrepareConnect(broker.host, brokerIp, broker.port);
+    }
+    if (mqtt5)
+    {
+      client5.setServer(brokerIp, broker.port);
+      connected = client5.connect(mqttClientId, mqttUser, mqttPassword, cleanSession,
+                                  cleanSession ? 0 : MQTT5_SESSION_EXPIRY);
+    }
+    else
+    {
+      client.setServer(brokerIp, broker.port);
+      connected = client.connect(mqttClientId, mqttUser, mqttPassword, nullptr, 0, false, nullptr, cleanSession);
+    }
+    if (tlsEnabled)
+    {
+      tlsConnectDone(brokerIp, connected, heapBefore);
+    }
+  }
+  Serial.print("MQTT connect timing: DNS ");
+  Serial.print(dnsMs);
+  Serial.print(" ms, connect ");
+  Serial.print(millis() - connectStart);
+  Serial.println(" ms");
+
+  if (!connected)
+  {
+    Serial.print("Failed MQTT connection, rc=");
+    Serial.println(mqtt5 ? client5.state() : client.state());
+    brokers.reportFailure(currentBroker, millis());
+
+    // The cached address may be stale, resolve afresh next time
+    dnsInvalidate(broker.host);
+
+    // Try the remaining brokers quickly, then back off for a full interval
+    failedMqttAttempts++;
+    if (failedMqttAttempts < brokers.count())
+    {
+      mqttRetryDelay = MQTT_FAILOVER_RETRY_INTERVAL;
+    }
+    else
+    {
+      failedMqttAttempts = 0;
+      mqttRetryDelay = MQTT_RETRY_INTERVAL;
+    }
+    return false;
+  }
+
+  brokers.reportSuccess(currentBroker, millis() - mqttConnectStartTime);
+  failedMqttAttempts = 0;
+  mqttRetryDelay = MQTT_RETRY_INTERVAL;
+  mqttWasConnected = true;
+  if (mqttLostTime != 0)
+  {
+    Serial.print("MQTT failover: reconnected ");
+    Serial.print(millis() - mqttLostTime);
+    Serial.println(" ms after connection loss.");
+    mqttLostTime = 0;
+  }
+
+  bool sessionPresent = !cleanSession && (mqtt5 ? client5.sessionPresent() : trackingClient.sessionPresent());
+  Serial.print("Connected to MQTT as ");
+  Serial.print(mqttClientId);
+  Serial.println(sessionPresent ? " (session resumed)." : " (new session).");
+  if (mqtt5)
+  {
+    Serial.print("MQTT 5 topic alias maximum: ");
+    Serial.println(client5.topicAliasMaximum());
+  }
+  subscribeTopics(sessionPresent);
+  firstPublishPending = true;
+  confirmOtaBoot();
+  if (!bootReportQueued)
+  {
+    // The first connect ends the boot, however many attempts it took
+    bootMark("mqtt");
+    bootReportQueued = true;
+    bootReportPending = true;
+  }
+  return true;
+}
+
+// Method to record the end of a boot phase
+void bootMark(const char *phase)
+{
+  bootProfile.mark(phase, micros(), ESP.getCycleCount());
+}
+
+// Method to publish the boot phase timings with the reset reason, once
+void publishBootReport()
+{
+  // Room for every phase with its heap fields; format() drops the phases that
+  // would not fit in one message on the boot topic
+  static char report[BootProfile::MAX_PHASES * 64 + 192];
+  size_t size = min(sizeof(report), maxPayload(bootTopic) + 1);
+  bootProfile.format(report, size, ESP.getResetReason().c_str(), ESP.getResetInfoPtr()->reason);
+  if (!shapedPublish(bootTopic, report))
+    return;
+  bootReportPending = false;
+  Serial.print("Boot report: ");
+  Serial.println(report);
+}
+
+// Method to move back to the preferred broker once it is reachable again. The
+// probe is a bare TCP connect so the current session is left alone if it fails.
+void checkBrokerFailback()
+{
+  if (!brokers.shouldProbePreferred(currentBroker, millis()))
+    return;
+
+  const BrokerEndpoint &preferred = brokers.endpoint(0);
+  IPAddress preferredIp;
+  uint32_t dnsMs;
+  WiFiClient probe;
+  probe.setTimeout(1000);
+  if (!dnsResolve(preferred.host, preferredIp, dnsMs) || !probe.connect(preferredIp, preferred.port))
+  {
+    brokers.reportFailure(0, millis());
+    return;
+  }
+  probe.stop();
+
+  // Straight to the preferred broker: select() would still rank it below the
+  // fallback while its latency average is more than the order penalty
+  Serial.println("Preferred MQTT broker is reachable again, failing back.");
+  brokers.clearFailures(0);
+  if (mqtt5)
+    client5.disconnect();
+  else
+    client.disconnect();
+  connectToMQTT(0);
+}
+
+// Method to start a conversion on every sensor
+void startConversion()
+{
+  conversionWait = sensors.trigger();
+  conversionStartTime = millis();
+  sensorConverting = true;
+}
+
+// Method to collect the conversion once it is due, and publish the sample
+void serviceConversion()
+{
+  unsigned long elapsed = millis() - conversionStartTime;
+  if (!sensorConverting || elapsed < conversionWait)
+    return;
+
+  float values[SENSOR_CHANNELS];
+  SensorStatus status = sensors.collect(values);
+  if (status == SENSOR_BUSY && elapsed < SENSOR_TIMEOUT)
+  {
+    conversionWait = elapsed + SENSOR_POLL_INTERVAL;
+    return;
+  }
+  sensorConverting = false;
+  sensorHealth.sampled(status == SENSOR_READY, millis());
+  if (status == SENSOR_READY)
+    publishSensorData(values);
+  else if (logLevel >= LOG_ERROR)
+    Serial.println("Sensor read failed.");
+}
+
+// Method to add a sample to the batch and publish it, or the batch it
+// completes, to the MQTT topic
+void publishSensorData(const float *values)
+{
+  // Exponential moving average; alpha 1 passes samples through unchanged
+  for (uint8_t i = 0; i < SENSOR_CHANNELS; i++)
+  {
+    filtered[i] = filterPrimed && !isnan(filtered[i]) ? filtered[i] + filterAlpha * (values[i] - filtered[i]) : values[i];
+  }
+  filterPrimed = true;
+
+  // Skip samples inside the deadband on every channel, but still send one now and then
+  bool moved = deadband <= 0 || samplesSinceSent >= DEADBAND_HEARTBEAT;
+  for (uint8_t i = 0; i < SENSOR_CHANNELS && !moved; i++)
+  {
+    moved = fabsf(filtered[i] - lastSent[i]) >= deadband;
+  }
+  if (!moved)
+  {
+    samplesSinceSent++;
+    return;
+  }
+  memcpy(lastSent, filtered, sizeof(lastSent));
+  samplesSinceSent = 0;
+
+  // Sending happens in flushBatch() once the batch is full and the shaper allows it
+  uint32_t seq = nextSequence();
+  Sample &sample = batch[batchCount++];
+  memcpy(sample.value, filtered, sizeof(sample.value));
+  sample.time = millis();
+  sample.count = 1;
+  sample.seq = seq;
+
+  time_t now = time(nullptr);
+  history.add({seq, now > (time_t)CLOCK_VALID_AFTER ? (uint32_t)now : 0,
+               (int16_t)lroundf(channelValue(filtered, temperatureChannel) * 100),
+               (uint16_t)lroundf(channelValue(filtered, humidityChannel) * 100)});
+  if (batchCount == MAX_BATCH)
+  {
+    flushBatch();
+    if (batchCount == MAX_BATCH)
+      rollupBatch();
+  }
+}
+
+// Method to publish the batch once it is complete and the rate allows. The
+// batch is kept (and eventually rolled up) if it cannot be sent. A batch too
+// big for one message goes out over several, each taking its own token.
+void flushBatch()
+{
+  if (batchCount == 0 || (batchCount < batchSize && !batchSplit) || (!snTransport && !mqttConnected()))
+    return;
+  if (!publishShaper.tryConsume(millis()))
+    return;
+
+  uint8_t sent = publishSamples();
+  if (sent == 0)
+  {
+    publishShaper.refund();
+    return;
+  }
+  batchCount -= sent;
+  memmove(batch, batch + sent, batchCount * sizeof(Sample));
+  batchSplit = batchCount > 0;
+}
+
+// Method to halve the batch by averaging neighbouring samples, so a throttled
+// device still covers the whole period, at a coarser resolution
+void rollupBatch()
+{
+  uint8_t merged = 0;
+  for (uint8_t i = 0; i < batchCount; i += 2)
+  {
+    Sample sample = batch[i];
+    if (i + 1 < batchCount)
+    {
+      const Sample &next = batch[i + 1];
+      uint32_t total = sample.count + next.count;
+      for (uint8_t c = 0; c < SENSOR_CHANNELS; c++)
+        sample.value[c] = (sample.value[c] * sample.count + next.value[c] * next.count) / total;
+      sample.time = next.time;
+      sample.count = total > 0xFFFF ? 0xFFFF : total;
+    }
+    batch[merged++] = sample;
+  }
+  batchCount = merged;
+}
+
+// Method to append the sample's channel values to a JSON object, keyed from
+// the channel metadata. A key used by an earlier channel gets a number, so
+// two temperature sensors give "temperature" and "temperature_2". Channels
+// of sensors that were not found (NAN) are left out.
+size_t formatValues(char *buffer, size_t size, const Sample &sample, bool shortKeys, bool leadingComma)
+{
+  size_t len = 0;
+  for (uint8_t i = 0; i < SENSOR_CHANNELS && len < size; i++)
+  {
+    if (isnan(sample.value[i]))
+      continue;
+    const char *key = shortKeys ? Sensors::channel(i).shortKey : Sensors::channel(i).key;
+    uint8_t uses = 1;
+    for (uint8_t j = 0; j < i; j++)
+      uses += strcmp(Sensors::channel(j).key, Sensors::channel(i).key) == 0;
+    const char *separator = len > 0 || leadingComma ? ", " : "";
+    if (uses > 1)
+      len += snprintf(buffer + len, size - len, "%s\"%s_%u\": %.2f", separator, key, (unsigned)uses, sample.value[i]);
+    else
+      len += snprintf(buffer + len, size - len, "%s\"%s\": %.2f", separator, key, sample.value[i]);
+  }
+  return len;
+}
+
+// Method to append the derived values selected by the "derived" setting to a
+// JSON object, with the long keys or the short ones used inside a batch
+size_t formatDerived(char *buffer, size_t size, const Sample &sample, bool shortKeys)
+{
+  if (temperatureChannel < 0 || humidityChannel < 0 || isnan(sample.value[temperatureChannel]) ||
+      isnan(sample.value[humidityChannel]))
+    return 0;
+  int32_t temperature = lroundf(sample.value[temperatureChannel] * 100);
+  int32_t humidity = lroundf(sample.value[humidityChannel] * 100);
+  size_t len = 0;
+  if ((derivedFields & PSYCHRO_DEW_POINT) && len < size)
+    len += snprintf(buffer + len, size - len, shortKeys ? ", \"dp\": %.2f" : ", \"dew_point\": %.2f",
+                    psychroDewPoint(temperature, humidity) / 100.0f);
+  if ((derivedFields & PSYCHRO_ABS_HUMIDITY) && len < size)
+    len += snprintf(buffer + len, size - len, shortKeys ? ", \"ah\": %.2f" : ", \"abs_humidity\": %.2f",
+                    psychroAbsoluteHumidity(temperature, humidity) / 100.0f);
+  if ((derivedFields & PSYCHRO_HEAT_INDEX) && len < size)
+    len += snprintf(buffer + len, size - len, shortKeys ? ", \"hi\": %.2f" : ", \"heat_index\": %.2f",
+                    psychroHeatIndex(temperature, humidity) / 100.0f);
+  return len;
+}
+
+// Method to publish the oldest samples of the batch as one message, as many
+// as fit in the MQTT client's buffer. Returns how many went out, 0 when none
+// did; a document that does not fit is never sent cut short.
+uint8_t publishSamples()
+{
+  static char payload[1024];
+  size_t capacity = min(sizeof(payload), maxReadingPayload() + 1);
+  size_t len;
+  uint8_t count = 0;
+  if (batchCount == 1 && batch[0].count == 1)
+  {
+    len = snprintf(payload, capacity, "{\"device_id\": \"%s\", \"boot\": %lu, \"seq\": %lu", deviceId,
+                   (unsigned long)sequence.boot(), (unsigned long)batch[0].seq);
+    if (len < capacity)
+      len += formatValues(payload + len, capacity - len, batch[0], false, true);
+    if (len < capacity)
+      len += formatDerived(payload + len, capacity - len, batch[0], false);
+    if (len < capacity)
+      len += snprintf(payload + len, capacity - len, "}");
+    count = len < capacity ? 1 : 0;
+  }
+  else
+  {
+    // Each sample is formatted on its own and only added when it still
+    // leaves room to close the document
+    unsigned long now = millis();
+    char entry[320];
+    len = snprintf(payload, capacity, "{\"device_id\": \"%s\", \"boot\": %lu, \"seq\": %lu, \"samples\": [",
+                   deviceId, (unsigned long)sequence.boot(), (unsigned long)batch[0].seq);
+    for (uint8_t i = 0; i < batchCount && len < capacity; i++)
+    {
+      size_t entryLen = snprintf(entry, sizeof(entry), "%s{", i > 0 ? ", " : "");
+      entryLen += formatValues(entry + entryLen, sizeof(entry) - entryLen, batch[i], true, false);
+      if (entryLen < sizeof(entry))
+        entryLen += formatDerived(entry + entryLen, sizeof(entry) - entryLen, batch[i], true);
+      if (entryLen < sizeof(entry))
+        entryLen += snprintf(entry + entryLen, sizeof(entry) - entryLen, ", \"age_ms\": %lu, \"n\": %u}",
+                             now - batch[i].time, batch[i].count);
+      if (entryLen >= sizeof(entry) || len + entryLen + 2 >= capacity)
+        break;
+      memcpy(payload + len, entry, entryLen);
+      len += entryLen;
+      count++;
+    }
+    if (count > 0)
+      len += snprintf(payload + len, capacity - len, "]}");
+  }
+
+  if (count == 0)
+  {
+    Serial.print("Sample document does not fit in ");
+    Serial.print(capacity - 1);
+    Serial.println(" bytes, not sent.");
+    return 0;
+  }
+  if (count < batchCount && logLevel >= LOG_INFO)
+  {
+    Serial.print("Batch split: ");
+    Serial.print(count);
+    Serial.print(" of ");
+    Serial.print(batchCount);
+    Serial.println(" samples in this message.");
+  }
+
+  if (logLevel >= LOG_DEBUG)
+  {
+    Serial.print("Publishing to MQTT: ");
+    Serial.println(payload);
+  }
+  if (!publishReading(payload))
+    return 0;
+  if (firstPublishPending)
+  {
+    firstPublishPending = false;
+    Serial.print("CONNECT-to-first-publish: ");
+    Serial.print(millis() - mqttConnectStartTime);
+    Serial.println(" ms");
+  }
+  return count;
+}
+
+// Method to tell the largest reading payload the transport in use can send in
+// one message
+size_t maxReadingPayload()
+{
+  if (snTransport)
+    return 65535 - 9; // Three-byte length form and the PUBLISH header
+  return maxPayload(mqttTopic);
+}
+
+// Method to tell the largest payload the MQTT client in use can send on a
+// topic: what is left of its buffer after the fixed header, the topic and, on
+// MQTT 5, the publish properties
+size_t maxPayload(const char *topic)
+{
+  size_t topicLength = strlen(topic);
+  if (mqtt5)
+    return MQTT5_BUFFER_SIZE - 5 - 2 - topicLength - 1 - MQTT5_MAX_PUBLISH_PROPERTIES;
+  return client.getBufferSize() - MQTT_MAX_HEADER_SIZE - 2 - topicLength;
+}
+
+// Method to size a QoS 0 MQTT 3.1.1 PUBLISH: fixed header, topic, payload
+size_t mqttPublishSize(size_t topicLength, size_t payloadLength)
+{
+  size_t remaining = 2 + topicLength + payloadLength;
+  size_t lengthBytes = remaining < 128 ? 1 : (remaining < 16384 ? 2 : 3);
+  return 1 + lengthBytes + remaining;
+}
+
+// Method to send one reading over the configured transport, logging its size
+// on the wire next to what the other transport would have needed. The caller
+// has already taken a shaper token for it.
+bool publishReading(const char *payload)
+{
+  size_t length = strlen(payload);
+  size_t mqttBytes = mqttPublishSize(strlen(mqttTopic), length);
+
+  if (snTransport)
+  {
+    if (!snClient.publish(snTopicId, (const uint8_t *)payload, length))
+      return false;
+    if (logLevel < LOG_DEBUG)
+      return true;
+    Serial.print("MQTT-SN publish: ");
+    Serial.print(snClient.lastPacketSize());
+    Serial.print(" bytes (MQTT over TCP: ");
+    Serial.print(mqttBytes);
+    Serial.println(" bytes plus connection overhead)");
+    return true;
+  }
+
+  uint32_t sentBefore = trackingClient.bytesSent();
+  bool sent = mqttPublish(mqttTopic, payload);
+  if (sent && logLevel >= LOG_DEBUG)
+  {
+    Serial.print("MQTT publish: ");
+    Serial.print(trackingClient.bytesSent() - sentBefore);
+    Serial.println(" bytes on the wire");
+  }
+  return sent;
+}
+
+// Method to publish a message with whichever MQTT client is in use
+bool mqttPublish(const char *topic, const char *payload)
+{
+  if (mqtt5)
+    return client5.publish(topic, (const uint8_t *)payload, strlen(payload), false, messageExpiry);
+  return client.publish(topic, payload);
+}
+
+// Method to pick the subscription QoS. A persistent session only queues
+// messages for the device while it is away when they are QoS 1.
+uint8_t mqttSubscribeQos()
+{
+  return mqttPersistentSession[0] == '1' ? 1 : 0;
+}
+
+// Method to subscribe with whichever MQTT client is in use
+bool mqttSubscribe(const char *topic)
+{
+  uint8_t qos = mqttSubscribeQos();
+  return mqtt5 ? client5.subscribe(topic, qos) : client.subscribe(topic, qos);
+}
+
+// Method to dispatch incoming MQTT messages by topic
+void mqttMessageReceived(char *topic, uint8_t *payload, unsigned int length)
+{
+  if (strcmp(topic, configTopic) == 0)
+  {
+    handleConfigMessage(payload, length);
+  }
+  else if (strcmp(topic, controlTopic) == 0)
+  {
+    handleControlMessage(payload, length);
+  }
+  else if (strcmp(topic, otaTopic) == 0)
+  {
+    handleOtaMessage(payload, length);
+  }
+  else if (strcmp(topic, backfillTopic) == 0)
+  {
+    handleBackfillMessage(payload, length);
+  }
+}
+
+// Method to queue a backfill request, e.g. {"id": "r1", "from_seq": 100, "to_seq": 300}
+// or {"id": "r2", "from_time": 1700000000, "to_time": 1700003600}
+void handleBackfillMessage(const uint8_t *payload, unsigned int length)
+{
+  JsonDocument doc;
+  BackfillRequest request = {};
+  const char *error = nullptr;
+  if (deserializeJson(doc, (const char *)payload, length) || !doc.is<JsonObjectConst>())
+  {
+    error = "invalid JSON";
+  }
+  else
+  {
+    strlcpy(request.id, doc["id"] | "", sizeof(request.id));
+    request.byTime = doc["from_time"].is<long>();
+    request.from = doc[request.byTime ? "from_time" : "from_seq"] | 0L;
+    request.to = doc[request.byTime ? "to_time" : "to_seq"] | -1L; // Open end: up to the newest sample
+    if (!request.byTime && !doc["from_seq"].is<long>())
+      error = "from_seq or from_time is required";
+    else if (request.to < request.from)
+      error = "empty range";
+    else if (!backfill.request(request))
+      error = "too many requests";
+  }
+
+  if (error == nullptr)
+  {
+    if (logLevel >= LOG_INFO)
+    {
+      Serial.print("Backfill request queued, history has ");
+      Serial.print(history.size());
+      Serial.println(" samples.");
+    }
+    return;
+  }
+
+  // Best effort: the requester times out if the rejection does not get out
+  char reply[96];
+  snprintf(reply, sizeof(reply), "{\"id\": \"%s\", \"error\": \"%s\"}", request.id, error);
+  if (backfillBucket->tryConsume(millis()) && !mqttPublish(backfillDataTopic, reply))
+  {
+    backfillBucket->refund();
+  }
+  Serial.print("Backfill request rejected: ");
+  Serial.println(error);
+}
+
+// Method to send the next batch of a backfill reply when the backfill rate allows
+void serviceBackfill()
+{
+  if (!backfill.active() || !mqttConnected() || backfillBucket->available(millis()) < 1)
+    return;
+
+  static char payload[640];
+  if (backfill.formatNext(history, payload, sizeof(payload)) == 0 || !backfillBucket->tryConsume(millis()))
+    return;
+  if (!mqttPublish(backfillDataTopic, payload))
+  {
+    backfillBucket->refund();
+    return;
+  }
+  backfill.commitNext();
+}
+
+// Method to size the publish token bucket. Without a configured rate it allows
+// one message per full batch, plus room for relayed leaf readings on a gateway;
+// the fleet rate control scales or overrides it.
+void configureShaper()
+{
+  float rate = controlBucketRate;
+  if (rate <= 0)
+  {
+    rate = shaperRate > 0 ? shaperRate : 1000.0f / ((float)publishInterval * batchSize);
+    if (gatewayMode)
+      rate += LEAF_RELAY_RATE;
+    rate *= rateMultiplier;
+  }
+  publishShaper.configure(rate, controlBucketBurst > 0 ? controlBucketBurst : shaperBurst);
+  backfillShaper.configure(BACKFILL_RATE * rateMultiplier, BACKFILL_BURST);
+
+  // Under a control bucket backfill shares its limit. flushBatch() runs first
+  // in loop(), so a batch that is due still gets the next token.
+  backfillBucket = controlBucketRate > 0 ? &publishShaper : &backfillShaper;
+}
+
+// Method to report how much the shaper held messages back over the last
+// period, in the log and on the shaper status topic
+void reportShaperStats()
+{
+  if (millis() - lastShaperReportTime < SHAPER_REPORT_INTERVAL)
+    return;
+  lastShaperReportTime = millis();
+
+  if (publishShaper.throttled() > 0)
+  {
+    snprintf(shaperStatus, sizeof(shaperStatus),
+             "{\"rate\": %.3f, \"burst\": %.0f, \"sent\": %lu, \"throttled\": %lu, \"throttled_ms\": %lu, "
+             "\"peak_burst\": %.1f, \"period_ms\": %lu}",
+             publishShaper.rate(), publishShaper.burst(), (unsigned long)publishShaper.sent(),
+             (unsigned long)publishShaper.throttled(), (unsigned long)publishShaper.throttleTimeMs(),
+             publishShaper.peakBurst(), (unsigned long)SHAPER_REPORT_INTERVAL);
+    shaperStatusPending = true;
+    if (logLevel >= LOG_INFO)
+    {
+      Serial.print("Shaper: ");
+      Serial.println(shaperStatus);
+    }
+  }
+  publishShaper.resetStats();
+}
+
+// Method to publish a message once the shaper has a token for it
+bool shapedPublish(const char *topic, const char *payload)
+{
+  if (!mqttConnected() || !publishShaper.tryConsume(millis()))
+    return false;
+  if (mqttPublish(topic, payload))
+    return true;
+  publishShaper.refund();
+  return false;
+}
+
+// Method to apply a fleet-wide rate control message, e.g. {"rate": 0.25} or
+// {"bucket_rate": 0.1, "bucket_burst": 2}. An empty object restores normal rate.
+void handleControlMessage(const uint8_t *payload, unsigned int length)
+{
+  JsonDocument doc;
+  if (deserializeJson(doc, (const char *)payload, length) || !doc.is<JsonObjectConst>())
+  {
+    Serial.println("Ignoring invalid control message.");
+    return;
+  }
+
+  float multiplier = doc["rate"] | 1.0f;
+  float bucketRate = doc["bucket_rate"] | 0.0f;
+  float bucketBurst = doc["bucket_burst"] | 0.0f;
+  if (multiplier <= 0 || multiplier > 10 || bucketRate < 0 || bucketRate > 100 || bucketBurst < 0 || bucketBurst > 50)
+  {
+    Serial.println("Ignoring out-of-range control message.");
+    return;
+  }
+
+  rateMultiplier = multiplier;
+  controlBucketRate = bucketRate;
+  controlBucketBurst = bucketBurst;
+  configureShaper();
+
+  // The whole fleet gets this at about the same moment. Buckets that all ran
+  // dry together would then refill and send in step, so each one starts from
+  // a random level below one token (see tools/fleet_rate_sim.cpp)
+  publishShaper.setTokens(random(1000) / 1000.0f);
+  if (logLevel >= LOG_INFO)
+  {
+    Serial.print("Publish rate limited to ");
+    Serial.print(publishShaper.rate(), 3);
+    Serial.print(" msg/s, burst ");
+    Serial.println(publishShaper.burst(), 0);
+  }
+}
+
+// Method to parse the sampling settings into their runtime values
+void applySettings()
+{
+  publishInterval = atol(settingInterval);
+  if (publishInterval < 1000)
+    publishInterval = 5000;
+  deadband = atof(settingDeadband);
+  batchSize = constrain(atoi(settingBatch), 1, MAX_BATCH);
+  logLevel = constrain(atoi(settingLogLevel), 0, LOG_DEBUG);
+  filterAlpha = atof(settingFilterAlpha);
+  if (filterAlpha <= 0 || filterAlpha > 1)
+    filterAlpha = 1;
+  shaperRate = atof(settingShaperRate);
+  shaperBurst = constrain(atoi(settingShaperBurst), 1, 50);
+  derivedFields = constrain(atoi(settingDerived), 0, 7);
+
+  configureShaper();
+}
+
+// Method to hash the effective sampling settings (FNV-1a), so the fleet can
+// tell which devices run which configuration
+uint32_t settingsHash()
+{
+  uint32_t hash = 2166136261UL;
+  for (const RemoteSetting &setting : remoteSettings)
+  {
+    for (const char *c = setting.value; *c != '\0'; c++)
+    {
+      hash ^= (uint8_t)*c;
+      hash *= 16777619UL;
+    }
+    hash ^= '\n';
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+// Method to apply a partial settings update received on the config topic.
+// Every field is validated before anything changes, settings take effect
+// immediately and are only written to flash when a value actually changed.
+void handleConfigMessage(const uint8_t *payload, unsigned int length)
+{
+  const size_t settingCount = sizeof(remoteSettings) / sizeof(remoteSettings[0]);
+  char updated[settingCount][8];
+
+  configAckPending = true;
+  configChanged = false;
+  configError = nullptr;
+
+  JsonDocument doc;
+  if (deserializeJson(doc, (const char *)payload, length) || !doc.is<JsonObjectConst>())
+  {
+    configError = "invalid JSON";
+    return;
+  }
+
+  for (JsonPairConst field : doc.as<JsonObjectConst>())
+  {
+    bool known = false;
+    for (const RemoteSetting &setting : remoteSettings)
+      known = known || strcmp(field.key().c_str(), setting.key) == 0;
+    if (!known)
+    {
+      configError = "unknown setting";
+      return;
+    }
+  }
+
+  for (size_t i = 0; i < settingCount; i++)
+  {
+    const RemoteSetting &setting = remoteSettings[i];
+    strlcpy(updated[i], setting.value, sizeof(updated[i]));
+
+    JsonVariantConst value = doc[setting.key];
+    if (value.isNull())
+      continue;
+    if (setting.integer ? !value.is<long>() : !value.is<float>())
+    {
+      configError = setting.key;
+      return;
+    }
+    float number = value.as<float>();
+    if (number < setting.minValue || number > setting.maxValue)
+    {
+      configError = setting.key;
+      return;
+    }
+    if (setting.integer)
+    {
+      snprintf(updated[i], setting.size, "%ld", value.as<long>());
+      continue;
+    }
+
+    // As many significant digits as the setting has room for, so a small
+    // rate like 0.004 is kept instead of becoming "0.00"
+    for (int precision = 6; precision > 0; precision--)
+    {
+      if ((size_t)snprintf(updated[i], setting.size, "%.*g", precision, number) < setting.size)
+        break;
+    }
+    float stored = atof(updated[i]);
+    if ((stored == 0) != (number == 0) || stored < setting.minValue || stored > setting.maxValue)
+    {
+      configError = setting.key;
+      return;
+    }
+  }
+
+  for (size_t i = 0; i < settingCount; i++)
+  {
+    // Compare numerically so "0" and "0.00" count as the same value
+    if (atof(updated[i]) != atof(remoteSettings[i].value))
+    {
+      strlcpy(remoteSettings[i].value, updated[i], remoteSettings[i].size);
+      configChanged = true;
+    }
+  }
+
+  if (configChanged)
+  {
+    applySettings();
+    saveConfigToFlash();
+  }
+}
+
+// Method to start a firmware update from a message like {"url": "http://...",
+// "md5": "<32 hex>", "size": 412345, "rollback_url": "http://...", "rollback_md5": "..."}
+void handleOtaMessage(const uint8_t *payload, unsigned int length)
+{
+  JsonDocument doc;
+  if (deserializeJson(doc, (const char *)payload, length))
+  {
+    setOtaStatus("rejected", "invalid JSON");
+    return;
+  }
+
+  const char *url = doc["url"] | "";
+  const char *md5 = doc["md5"] | "";
+  if (strncmp(url, "http://", 7) != 0 || strlen(md5) != 32)
+  {
+    setOtaStatus("rejected", "url and md5 are required");
+    return;
+  }
+  if (ota.state() == OtaUpdater::DOWNLOADING)
+  {
+    setOtaStatus("rejected", "update already running");
+    return;
+  }
+
+  const char *rollbackUrl = doc["rollback_url"] | "";
+  const char *rollbackMd5 = doc["rollback_md5"] | "";
+  if (rollbackUrl[0] != '\0' && strlen(rollbackMd5) != 32)
+  {
+    setOtaStatus("rejected", "rollback_url needs rollback_md5");
+    return;
+  }
+
+  strlcpy(otaRollbackUrl, rollbackUrl, sizeof(otaRollbackUrl));
+  strlcpy(otaRollbackMd5, rollbackMd5, sizeof(otaRollbackMd5));
+  bool delta = doc["delta"] | false;
+  if (ota.begin(url, md5, doc["size"] | 0L, delta))
+  {
+    setOtaStatus(delta ? "downloading delta" : "downloading", url);
+  }
+}
+
+// Method to move a running download along and act on its outcome
+void serviceOta()
+{
+  if (otaRestartTime != 0 && (long)(millis() - otaRestartTime) >= 0)
+  {
+    history.flush();
+    ESP.restart();
+  }
+  if (otaUnconfirmed && millis() > OTA_CONFIRM_TIMEOUT)
+  {
+    Serial.println("Updated firmware did not reach the broker, rebooting.");
+    history.flush();
+    ESP.restart();
+  }
+
+  switch (ota.service())
+  {
+  case OtaUpdater::SUCCEEDED:
+  {
+    char detail[96];
+    unsigned long elapsed = ota.elapsedMs();
+    int length = snprintf(detail, sizeof(detail), "%u bytes in %lu ms (%lu bytes/s)", (unsigned)ota.received(), elapsed,
+                          elapsed > 0 ? (unsigned long)(ota.received() * 1000ULL / elapsed) : 0UL);
+    if (ota.delta())
+    {
+      snprintf(detail + length, sizeof(detail) - length, ", %u byte image", (unsigned)ota.imageSize());
+    }
+    setOtaStatus("rebooting", detail);
+
+    // Remember how to undo the update until the new image confirms itself
+    writeOtaState(0);
+    otaRestartTime = millis() + OTA_RESTART_DELAY;
+    ota.reset();
+    break;
+  }
+  case OtaUpdater::FAILED:
+    setOtaStatus("failed", ota.error());
+    ota.reset();
+    break;
+  default:
+    break;
+  }
+}
+
+// Method to queue an OTA status message for the broker and log it
+void setOtaStatus(const char *status, const char *detail)
+{
+  snprintf(otaStatus, sizeof(otaStatus), "{\"status\": \"%s\", \"detail\": \"%s\", \"version\": \"%s\"}",
+           status, detail, FIRMWARE_VERSION);
+  otaStatusPending = true;
+  Serial.print("OTA: ");
+  Serial.println(otaStatus);
+}
+
+// Method to save the unconfirmed-boot count and rollback image to flash
+void writeOtaState(int boots)
+{
+  File stateFile = LittleFS.open(OTA_STATE_FILE, "w");
+  if (!stateFile)
+  {
+    Serial.println("Failed to save OTA state.");
+    return;
+  }
+  stateFile.println(boots);
+  stateFile.println(otaRollbackUrl);
+  stateFile.println(otaRollbackMd5);
+  stateFile.close();
+}
+
+// Method to count boots of an unconfirmed image and decide on a rollback
+void checkOtaBoot()
+{
+  if (!LittleFS.exists(OTA_STATE_FILE))
+    return;
+
+  File stateFile = LittleFS.open(OTA_STATE_FILE, "r");
+  if (!stateFile)
+    return;
+  char boots[6] = "0";
+  readConfigLine(stateFile, boots, sizeof(boots));
+  readConfigLine(stateFile, otaRollbackUrl, sizeof(otaRollbackUrl));
+  readConfigLine(stateFile, otaRollbackMd5, sizeof(otaRollbackMd5));
+  stateFile.close();
+
+  int count = atoi(boots) + 1;
+  if (count > OTA_MAX_UNCONFIRMED_BOOTS)
+  {
+    // Either way this image gets no more chances, so stop counting
+    LittleFS.remove(OTA_STATE_FILE);
+    otaRollbackDue = otaRollbackUrl[0] != '\0';
+    Serial.println(otaRollbackDue ? "Updated firmware failed to confirm, rollback due."
+                                  : "Updated firmware failed to confirm and no rollback image is known.");
+    return;
+  }
+  writeOtaState(count);
+  otaUnconfirmed = true;
+}
+
+// Method to accept the running image once it has reached the broker
+void confirmOtaBoot()
+{
+  if (!otaUnconfirmed)
+    return;
+  otaUnconfirmed = false;
+  LittleFS.remove(OTA_STATE_FILE);
+  setOtaStatus("confirmed", "first boot after update reached the broker");
+}
+
+// Method to acknowledge a config message with the effective settings
+void publishConfigAck()
+{
+  char ack[256];
+  if (configError != nullptr)
+  {
+    snprintf(ack, sizeof(ack), "{\"status\": \"error\", \"error\": \"%s\", \"hash\": \"%08lx\"}",
+             configError, (unsigned long)settingsHash());
+  }
+  else
+  {
+    snprintf(ack, sizeof(ack),
+             "{\"status\": \"ok\", \"changed\": %s, \"hash\": \"%08lx\", \"interval\": %s, \"deadband\": %s, "
+             "\"batch\": %s, \"log_level\": %s, \"filter_alpha\": %s, \"shaper_rate\": %s, \"shaper_burst\": %s, "
+             "\"derived\": %s}",
+             configChanged ? "true" : "false", (unsigned long)settingsHash(), settingInterval, settingDeadband,
+             settingBatch, settingLogLevel, settingFilterAlpha, settingShaperRate, settingShaperBurst, settingDerived);
+  }
+  if (shapedPublish(configAckTopic, ack))
+  {
+    configAckPending = false;
+  }
+}
+
+// Method to check the connection of whichever MQTT client is in use
+bool mqttConnected()
+{
+  return mqtt5 ? client5.connected() : client.connected();
+}
+
+// Method to service keepalives and incoming packets of the MQTT client in use
+void mqttLoop()
+{
+  if (mqtt5)
+    client5.loop();
+  else
+    client.loop();
+}
+
+// Method to save WiFi, MQTT, and device settings to flash (LittleFS)
+bool saveConfigToFlash()
+{
+  File configFile = LittleFS.open("/config.txt", "w");
+  if (!configFile)
+  {
+    Serial.println("Failed to open config file for writing.");
+    return false;
+  }
+
+  // Write each parameter as a separate line
+  for (const ConfigField &field : configFields)
+  {
+    configFile.println(field.value);
+  }
+
+  configFile.close();
+  Serial.println("Config saved to LittleFS.");
+  return true;
+}
+
+// Method to read one config line into a buffer, keeping the current value if
+// the line is missing (older config files have fewer lines)
+void readConfigLine(File &configFile, char *value, size_t size)
+{
+  if (!configFile.available())
+    return;
+
+  // Read the whole line so an over-long value cannot spill into the next field;
+  // println() writes "\r\n" and readBytesUntil() does not terminate the string
+  char line[128];
+  size_t len = configFile.readBytesUntil('\n', line, sizeof(line) - 1);
+  if (len > 0 && line[len - 1] == '\r')
+    len--;
+  line[len] = '\0';
+  strlcpy(value, line, size);
+}
+
+// Method to load WiFi, MQTT, and device settings from flash (LittleFS)
+bool loadConfigFromFlash()
+{
+  if (!LittleFS.exists("/config.txt"))
+  {
+    Serial.println("Config file does not exist. Using default settings.");
+    return false;
+  }
+
+  File configFile = LittleFS.open("/config.txt", "r");
+  if (!configFile)
+  {
+    Serial.println("Failed to open config file for reading.");
+    return false;
+  }
+
+  // Read each line and store it in the corresponding variable
+  for (const ConfigField &field : configFields)
+  {
+    readConfigLine(configFile, field.value, field.size);
+  }
+
+  configFile.close();
+  Serial.println("Config loaded from LittleFS.");
+  return true;
+}
+
+// Method to print the configuration (WiFi, MQTT, and device settings) to the serial console
+void printConfigToSerial()
+{
+  Serial.println("=== Current Configuration ===");
+  for (const ConfigField &field : configFields)
+  {
+    Serial.print(field.label);
+    Serial.print(": ");
+    Serial.println(field.value);
+  }
   Serial.println("=============================");
 }
 
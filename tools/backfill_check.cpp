@@ -0,0 +1,229 @@
+// Host check of the backfill protocol. Live samples keep flowing into the
+// firmware's SampleHistory (kept in memory instead of LittleFS) while
+// overlapping sequence and time range requests are served through
+// BackfillServer with their own rate limit, including a reboot in the middle
+// and a range that has partly rotated out of the history. It fails when a
+// reply misses, repeats or strays outside its range, when a completion
+// marker is missing or miscounts, or when one pass of loop() reads more of
+// the history than BackfillServer::READS_PER_PASS allows.
+//
+//   g++ -O2 -Iinclude tools/backfill_check.cpp src/SampleHistory.cpp src/BackfillServer.cpp -o backfill_check
+//   ./backfill_check
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "SampleHistory.h"
+#include "BackfillServer.h"
+
+#define SAMPLE_INTERVAL 5  // Seconds between live samples
+#define BACKFILL_RATE 2.0  // Backfill messages per second
+#define LOOP_PASSES 50     // Passes of loop() per second that may call formatNext()
+// Segment reads (file opens on the device) per history read: a binary search
+// in up to two segments, and the records themselves
+#define READS_PER_HISTORY_READ (2 * (9 + 1) + 2)
+#define TIME_BASE 1700000000UL
+
+class MemoryStorage : public HistoryStorage
+{
+public:
+  uint16_t count(uint8_t segment) override { return segments[segment].size(); }
+  bool append(uint8_t segment, const HistoryRecord *records, uint16_t n) override
+  {
+    segments[segment].insert(segments[segment].end(), records, records + n);
+    return true;
+  }
+  bool read(uint8_t segment, uint16_t index, HistoryRecord *records, uint16_t n) override
+  {
+    reads++;
+    if (index + n > segments[segment].size())
+      return false;
+    memcpy(records, segments[segment].data() + index, sizeof(HistoryRecord) * n);
+    return true;
+  }
+  void clear(uint8_t segment) override { segments[segment].clear(); }
+
+  std::vector<HistoryRecord> segments[SampleHistory::SEGMENTS];
+  uint32_t reads = 0;
+};
+
+struct Expected
+{
+  BackfillRequest request;
+  uint32_t oldestAtRequest;
+  std::vector<uint32_t> seqs;
+  std::vector<uint32_t> times;
+  bool done = false;
+  uint32_t doneSent = 0;
+  uint32_t doneOldest = 0;
+  uint32_t newestAtDone = 0;
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *id, const char *rule)
+{
+  if (ok)
+    return;
+  if (failures++ < 20)
+    printf("request %s: %s\n", id, rule);
+}
+
+static std::vector<uint32_t> numbersAfter(const char *message, const char *key)
+{
+  std::vector<uint32_t> numbers;
+  size_t keyLength = strlen(key);
+  for (const char *p = message; (p = strstr(p, key)) != nullptr; p += keyLength)
+    numbers.push_back(strtoul(p + keyLength, nullptr, 10));
+  return numbers;
+}
+
+int main()
+{
+  MemoryStorage storage;
+  SampleHistory history;
+  history.begin(storage);
+  BackfillServer server;
+  std::map<std::string, Expected> requests;
+
+  double tokens = 1;
+  uint32_t seq = 0;
+  uint32_t liveSamples = 0, backfillMessages = 0, scanPasses = 0, mostReads = 0;
+  char payload[640];
+
+  auto addRequest = [&](const char *id, bool byTime, uint32_t from, uint32_t to) {
+    Expected expected;
+    memset(&expected.request, 0, sizeof(expected.request));
+    strncpy(expected.request.id, id, sizeof(expected.request.id) - 1);
+    expected.request.byTime = byTime;
+    expected.request.from = from;
+    expected.request.to = to;
+    expected.oldestAtRequest = history.oldestSeq();
+    if (!server.request(expected.request))
+      printf("queue full for %s\n", id);
+    requests[id] = expected;
+  };
+
+  for (uint32_t second = 1; second <= 20000; second++)
+  {
+    // Live sampling carries on regardless of backfill
+    if (second % SAMPLE_INTERVAL == 0)
+    {
+      seq++;
+      HistoryRecord record = {seq, (uint32_t)(TIME_BASE + second), (int16_t)(2000 + seq % 500),
+                              (uint16_t)(4000 + seq % 900)};
+      history.add(record);
+      liveSamples++;
+    }
+
+    // Overlapping requests while sampling goes on
+    if (second == 3000)
+    {
+      addRequest("a", false, 100, 300);
+      addRequest("b", false, 250, 450);
+      addRequest("c", true, TIME_BASE + 1400, TIME_BASE + 1600); // seq 280..320
+      addRequest("d", false, 590, 100000);                       // Up to the newest sample
+    }
+    if (second == 6000)
+    {
+      // Reboot: staged records are flushed by a planned restart
+      history.flush();
+      history = SampleHistory();
+      history.begin(storage);
+      addRequest("e", false, 1150, 1210);
+    }
+    if (second == 15000)
+    {
+      // The history holds about 2048 samples, so this range has rotated out in part
+      addRequest("f", false, 500, 1200);
+      addRequest("g", true, TIME_BASE + 14000, TIME_BASE + 14100);
+    }
+
+    tokens += BACKFILL_RATE;
+    if (tokens > 2)
+      tokens = 2;
+    for (int pass = 0; pass < LOOP_PASSES && server.active() && tokens >= 1; pass++)
+    {
+      uint32_t readsBefore = storage.reads;
+      size_t length = server.formatNext(history, payload, sizeof(payload));
+      uint32_t reads = storage.reads - readsBefore;
+      mostReads = reads > mostReads ? reads : mostReads;
+      if (reads > BackfillServer::READS_PER_PASS * READS_PER_HISTORY_READ)
+      {
+        printf("pass read the history %u times\n", (unsigned)reads);
+        failures++;
+      }
+      if (length == 0)
+      {
+        // Still skipping to a time range; the next pass goes on
+        scanPasses++;
+        continue;
+      }
+      if (length >= sizeof(payload))
+      {
+        printf("message did not fit\n");
+        return 1;
+      }
+      tokens -= 1;
+      server.commitNext();
+      backfillMessages++;
+
+      const char *idStart = strstr(payload, "\"id\": \"") + 7;
+      std::string id(idStart, strchr(idStart, '"') - idStart);
+      Expected &expected = requests[id];
+      check(!expected.done, id.c_str(), "message after the completion marker");
+      if (strstr(payload, "\"done\": true"))
+      {
+        expected.done = true;
+        expected.doneSent = numbersAfter(payload, "\"sent\": ")[0];
+        expected.doneOldest = numbersAfter(payload, "\"oldest_seq\": ")[0];
+        expected.newestAtDone = seq;
+        continue;
+      }
+      std::vector<uint32_t> seqs = numbersAfter(payload, "\"seq\": ");
+      std::vector<uint32_t> times = numbersAfter(payload, "\"time\": ");
+      check(!seqs.empty() && seqs.size() <= BackfillServer::BATCH, id.c_str(), "batch size out of bounds");
+      expected.seqs.insert(expected.seqs.end(), seqs.begin(), seqs.end());
+      expected.times.insert(expected.times.end(), times.begin(), times.end());
+    }
+  }
+
+  for (auto &entry : requests)
+  {
+    const char *id = entry.first.c_str();
+    Expected &expected = entry.second;
+    const BackfillRequest &request = expected.request;
+    check(expected.done, id, "no completion marker");
+    check(expected.doneSent == expected.seqs.size(), id, "completion marker miscounts");
+    check(!expected.seqs.empty(), id, "nothing sent");
+    for (size_t i = 0; i < expected.seqs.size(); i++)
+    {
+      uint32_t key = request.byTime ? expected.times[i] : expected.seqs[i];
+      check(key >= request.from && key <= request.to, id, "sample outside the range");
+      check(i == 0 || expected.seqs[i] == expected.seqs[i - 1] + 1, id, "gap or repeat in the samples");
+    }
+    if (!expected.seqs.empty() && !request.byTime)
+    {
+      // Either the range start, or the oldest sample the history still had
+      uint32_t first = expected.seqs.front();
+      uint32_t start = request.from > expected.oldestAtRequest ? request.from : expected.oldestAtRequest;
+      check(first >= start, id, "sample older than the range or history");
+      check(first == start || expected.doneOldest > request.from, id, "range start missing without rotation");
+      uint32_t end = request.to < expected.newestAtDone ? request.to : expected.newestAtDone;
+      check(expected.seqs.back() == end, id, "range end missing");
+    }
+    printf("request %s: %s %lu..%lu -> %zu samples (%lu..%lu), history from seq %lu\n", id,
+           request.byTime ? "time" : "seq", (unsigned long)request.from, (unsigned long)request.to,
+           expected.seqs.size(), expected.seqs.empty() ? 0UL : (unsigned long)expected.seqs.front(),
+           expected.seqs.empty() ? 0UL : (unsigned long)expected.seqs.back(), (unsigned long)expected.doneOldest);
+  }
+
+  printf("%u live samples, %u backfill messages, %u passes skipping to a time range, at most %u segment reads "
+         "per pass\n",
+         liveSamples, backfillMessages, scanPasses, mostReads);
+  printf(failures == 0 ? "all backfill rules held\n" : "%d rule violations\n", failures);
+  return failures == 0 ? 0 : 1;
+}
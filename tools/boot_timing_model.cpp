@@ -0,0 +1,207 @@
+// Timing model of setup() up to the first published sample, before and
+// after WiFi was started early. Each step takes a fixed time on one of three
+// lanes: the CPU runs its steps one after the other in setup() order, while
+// the radio (joining the network) and the sensor (converting) work on their
+// own once started. A step starts when its lane is free and the steps it
+// waits for have finished. The model prints both schedules and the critical
+// path, the chain of steps the first publish waited on.
+//
+// It then does the same for an ESP-NOW leaf, from reset to the acknowledged
+// send: a cold boot against a deep sleep wake, which restores its settings
+// from RTC memory instead of mounting LittleFS and reading the config, OTA
+// state and sequence files.
+//
+// The step times are assumptions for a D1 mini on a home network, not
+// measurements; the boot report from the device (the "boot" topic) gives
+// the real ones, which can be put in here. Joining is SSID scan, 4-way
+// handshake and DHCP with stored credentials.
+//
+//   g++ -std=gnu++17 -O2 tools/boot_timing_model.cpp -o boot_timing_model
+//   ./boot_timing_model [join ms] [rtt ms] [sample interval ms]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+enum Lane
+{
+  CPU,
+  RADIO,
+  SENSOR
+};
+
+struct Step
+{
+  const char *name;
+  double ms;
+  Lane lane;
+  std::vector<const char *> after; // Steps that must have finished first
+
+  double start = 0;
+  double end = 0;
+  int waitedOn = -1; // Step that decided the start, -1 for the lane or reset
+};
+
+static int find(std::vector<Step> &steps, const char *name)
+{
+  for (size_t i = 0; i < steps.size(); i++)
+    if (strcmp(steps[i].name, name) == 0)
+      return (int)i;
+  fprintf(stderr, "no step %s\n", name);
+  exit(1);
+}
+
+// Schedules the steps in order and returns when the last one ends
+static double schedule(std::vector<Step> &steps)
+{
+  int lastCpu = -1;
+  for (size_t i = 0; i < steps.size(); i++)
+  {
+    Step &step = steps[i];
+    step.start = 0;
+    step.waitedOn = -1;
+    if (step.lane == CPU && lastCpu >= 0)
+    {
+      step.start = steps[lastCpu].end;
+      step.waitedOn = lastCpu;
+    }
+    for (const char *name : step.after)
+    {
+      int dep = find(steps, name);
+      if (steps[dep].end > step.start)
+      {
+        step.start = steps[dep].end;
+        step.waitedOn = dep;
+      }
+    }
+    step.end = step.start + step.ms;
+    if (step.lane == CPU)
+      lastCpu = (int)i;
+  }
+  return steps.back().end;
+}
+
+static void print(const char *title, std::vector<Step> &steps)
+{
+  static const char *lanes[] = {"cpu", "radio", "sensor"};
+  double total = schedule(steps);
+  printf("%s: first publish at %.0f ms\n", title, total);
+
+  std::vector<bool> critical(steps.size(), false);
+  for (int i = (int)steps.size() - 1; i >= 0; i = steps[i].waitedOn)
+    critical[i] = true;
+  for (size_t i = 0; i < steps.size(); i++)
+    printf("  %c %-22s %-6s %6.0f - %6.0f ms\n", critical[i] ? '*' : ' ', steps[i].name, lanes[steps[i].lane],
+           steps[i].start, steps[i].end);
+}
+
+int main(int argc, char **argv)
+{
+  double join = argc > 1 ? atof(argv[1]) : 2500;
+  double rtt = argc > 2 ? atof(argv[2]) : 20;
+  double interval = argc > 3 ? atof(argv[3]) : 5000;
+
+  // Times shared by both versions
+  const double core = 70;     // Reset to setup(): ROM, SDK and core init
+  const double mount = 25;    // LittleFS mount
+  const double config = 12;   // Config file read and parsed
+  const double state = 8;     // OTA boot check, sequence
+  const double probe = 45;    // AHT20 begin() with calibration
+  const double convert = 80;  // AHT20 conversion
+  const double history = 20;  // History index read from LittleFS
+  const double dump = 90;     // About 1 KB of config at 115200 baud
+  const double manager = 60;  // WiFiManager setup and autoConnect() bookkeeping
+  const double save = 35;     // Config file written back to LittleFS
+  const double mqttSetup = 5; // configureMQTT()
+  const double tcp = rtt;     // SYN / SYN-ACK; the broker address is cached in RTC memory
+  const double connect = rtt; // CONNECT / CONNACK
+  const double publish = rtt / 2;
+
+  // Before: WiFiManager joined the network after everything else, and the
+  // first sample was only started by loop() after the broker connect, once
+  // millis() had passed the sample interval (5 s by default)
+  std::vector<Step> before = {
+      {"sample interval", interval, SENSOR, {}},
+      {"core", core, CPU, {}},
+      {"littlefs", mount, CPU, {}},
+      {"config", config, CPU, {}},
+      {"state", state, CPU, {}},
+      {"sensor probe", probe, CPU, {}},
+      {"autoConnect", manager, CPU, {}},
+      {"join", join, RADIO, {"autoConnect"}},
+      {"config save", save, CPU, {"join"}},
+      {"config print", dump, CPU, {}},
+      {"history", history, CPU, {}},
+      {"mqtt setup", mqttSetup, CPU, {}},
+      {"tcp", tcp, RADIO, {"mqtt setup"}},
+      {"connect", connect, RADIO, {"tcp"}},
+      {"trigger", 0.5, CPU, {"connect", "sample interval"}},
+      {"convert", convert, SENSOR, {"trigger"}},
+      {"collect", 0.5, CPU, {"convert"}},
+      {"publish", publish, RADIO, {"collect"}},
+  };
+
+  // After: joining starts once the config says this is not a leaf, and the
+  // sample, history and config print run while the radio works
+  std::vector<Step> after = {
+      {"core", core, CPU, {}},
+      {"littlefs", mount, CPU, {}},
+      {"config", config, CPU, {}},
+      {"WiFi.begin", 1, CPU, {}},
+      {"join", join, RADIO, {"WiFi.begin"}},
+      {"state", state, CPU, {}},
+      {"sensor probe", probe, CPU, {}},
+      {"trigger", 0.5, CPU, {}},
+      {"convert", convert, SENSOR, {"trigger"}},
+      {"history", history, CPU, {}},
+      {"config print", dump, CPU, {}},
+      {"collect", 0.5, CPU, {"convert"}},
+      {"wait for join", 0, CPU, {"join"}},
+      {"mqtt setup", mqttSetup, CPU, {}},
+      {"tcp", tcp, RADIO, {"mqtt setup"}},
+      {"connect", connect, RADIO, {"tcp"}},
+      {"publish", publish, RADIO, {"connect", "collect"}},
+  };
+
+  printf("join %.0f ms, round trip %.0f ms, sample interval %.0f ms (* = critical path)\n\n", join, rtt, interval);
+  print("before", before);
+  printf("\n");
+  print("after", after);
+
+  double joinEnd = after[find(after, "join")].end;
+  double firstPublish = after.back().end;
+  printf("\nafter: joined at %.0f ms, first publish %.0f ms later (%.1f round trips)\n", joinEnd,
+         firstPublish - joinEnd, (firstPublish - joinEnd) / rtt);
+  printf("saved %.0f ms\n", before.back().end - firstPublish);
+
+  // Leaves: the channel list and config dump are skipped on both paths
+  const double espNow = 12; // WiFi.mode(), ESP-NOW init, send and acknowledgement
+  std::vector<Step> leafCold = {
+      {"core", core, CPU, {}},
+      {"littlefs", mount, CPU, {}},
+      {"config", config, CPU, {}},
+      {"state", state, CPU, {}},
+      {"sensor probe", 0.5, CPU, {}}, // One status read, already calibrated
+      {"trigger", 0.5, CPU, {}},
+      {"convert", convert, SENSOR, {"trigger"}},
+      {"collect", 0.5, CPU, {"convert"}},
+      {"send", espNow, RADIO, {"collect"}},
+  };
+  std::vector<Step> leafWake = {
+      {"core", core, CPU, {}},
+      {"restore", 0.1, CPU, {}},
+      {"sensor probe", 0.5, CPU, {}},
+      {"trigger", 0.5, CPU, {}},
+      {"convert", convert, SENSOR, {"trigger"}},
+      {"collect", 0.5, CPU, {"convert"}},
+      {"send", espNow, RADIO, {"collect"}},
+  };
+  printf("\n");
+  print("leaf, cold boot", leafCold);
+  printf("\n");
+  print("leaf, deep sleep wake", leafWake);
+  printf("\nleaf wake saves %.0f ms of %.0f ms awake\n", leafCold.back().end - leafWake.back().end,
+         leafCold.back().end);
+  return 0;
+}
@@ -0,0 +1,213 @@
+// Host check of multi-broker failover and failback with two loopback brokers
+// (tools/net/broker_stub.h). The device side is the firmware's BrokerList and
+// Mqtt5Client, driven the way connectToMQTT() and checkBrokerFailback() drive
+// them. BrokerList takes the time as a parameter, so the 120 s probe interval
+// is crossed by skewing the device's clock instead of waiting. It checks that:
+//   - the device fails over to the second broker quickly when the first goes
+//     down, and stays there while the probe interval has not passed
+//   - once the interval has passed and the probe connects, it fails back
+//   - it fails back even when the preferred broker is slow, with a latency
+//     average above the order penalty, where select() would still pick the
+//     fallback; the select() failback of before is run too, for comparison
+//
+//   g++ -std=gnu++17 -O2 -Iinclude -Itools/net tools/broker_failover_check.cpp src/BrokerList.cpp src/Mqtt5Client.cpp -lpthread -o broker_failover_check
+//   ./broker_failover_check
+
+#include "WiFiClient.h"
+#include "broker_stub.h"
+#include "BrokerList.h"
+#include "Mqtt5Client.h"
+
+#define MQTT_RETRY_INTERVAL 5000          // As in main.cpp
+#define MQTT_FAILOVER_RETRY_INTERVAL 500  // As in main.cpp
+#define PROBE_INTERVAL 120000             // BrokerList::FAILBACK_PROBE_INTERVAL_MS
+#define SLOW_CONNACK 1200                 // More than the order penalty, under the socket timeout
+#define MARGIN 250                        // Scheduling slack, ms
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+  if (ok)
+    return;
+  if (failures++ < 20)
+    printf("FAILED: %s\n", what);
+}
+
+struct Device
+{
+  WiFiClient net;
+  Mqtt5Client mqtt{net};
+  BrokerList brokers;
+  uint8_t currentBroker = 0;
+  bool failbackDirect; // connectToMQTT(0) after the probe, or select() as before
+  unsigned long skew = 0;
+  unsigned long lastAttempt = 0;
+  unsigned long retryDelay = 0;
+  uint8_t failedAttempts = 0;
+  uint32_t connects = 0;
+
+  Device(uint16_t primaryPort, uint16_t fallbackPort, bool direct) : failbackDirect(direct)
+  {
+    char list[64];
+    snprintf(list, sizeof(list), "127.0.0.1:%u,127.0.0.1:%u", primaryPort, fallbackPort);
+    brokers.parse(list, 1883);
+    mqtt.setKeepAlive(15);
+    mqtt.setSocketTimeout(2);
+    net.setTimeout(2000);
+  }
+
+  unsigned long now() const { return millis() + skew; }
+
+  // connectToMQTT()
+  bool connect(int8_t brokerIndex)
+  {
+    lastAttempt = now();
+    currentBroker = brokerIndex >= 0 ? brokerIndex : brokers.select(lastAttempt);
+    const BrokerEndpoint &broker = brokers.endpoint(currentBroker);
+    mqtt.setServer(IPAddress(127, 0, 0, 1), broker.port);
+    if (!mqtt.connect("failover-check", nullptr, nullptr, true, 0))
+    {
+      brokers.reportFailure(currentBroker, now());
+      failedAttempts++;
+      if (failedAttempts < brokers.count())
+      {
+        retryDelay = MQTT_FAILOVER_RETRY_INTERVAL;
+      }
+      else
+      {
+        failedAttempts = 0;
+        retryDelay = MQTT_RETRY_INTERVAL;
+      }
+      return false;
+    }
+    brokers.reportSuccess(currentBroker, now() - lastAttempt);
+    failedAttempts = 0;
+    retryDelay = MQTT_RETRY_INTERVAL;
+    connects++;
+    return true;
+  }
+
+  // checkBrokerFailback()
+  void checkFailback()
+  {
+    if (!brokers.shouldProbePreferred(currentBroker, now()))
+      return;
+    WiFiClient probe;
+    probe.setTimeout(1000);
+    if (!probe.connect(IPAddress(127, 0, 0, 1), brokers.endpoint(0).port))
+    {
+      brokers.reportFailure(0, now());
+      return;
+    }
+    probe.stop();
+    brokers.clearFailures(0);
+    mqtt.disconnect();
+    connect(failbackDirect ? 0 : -1);
+  }
+
+  // The MQTT part of loop()
+  void step()
+  {
+    if (!mqtt.loop())
+    {
+      if (now() - lastAttempt > retryDelay)
+        connect(-1);
+    }
+    else
+    {
+      checkFailback();
+    }
+  }
+
+  // Steps until connected to the given broker; how long that took, or 0
+  unsigned long runUntilOn(uint8_t broker, unsigned long limitMs)
+  {
+    unsigned long start = millis();
+    while (millis() - start < limitMs)
+    {
+      step();
+      if (mqtt.connected() && currentBroker == broker)
+        return millis() - start + 1;
+      delay(5);
+    }
+    return 0;
+  }
+
+  // Steps for a while; true when it stayed on the given broker throughout
+  bool stays(uint8_t broker, unsigned long ms)
+  {
+    unsigned long start = millis();
+    bool stayed = true;
+    while (millis() - start < ms)
+    {
+      step();
+      stayed = stayed && mqtt.connected() && currentBroker == broker;
+      delay(5);
+    }
+    return stayed;
+  }
+};
+
+// Connects to the primary, takes it down, waits for the failover and brings
+// the primary back; the device is left on the fallback
+static unsigned long failOver(Device &device, BrokerStub &primary)
+{
+  check(device.runUntilOn(0, 5000) > 0, "first connect not to the preferred broker");
+  // Connected for a while, so the loss is retried at once
+  device.skew += MQTT_RETRY_INTERVAL;
+  primary.setDown(true);
+  unsigned long took = device.runUntilOn(1, 5000);
+  primary.setDown(false);
+  return took;
+}
+
+int main()
+{
+  BrokerStub primary;
+  BrokerStub fallback;
+  check(primary.start() && fallback.start(), "broker stand-ins did not start");
+
+  // Failover and failback with a healthy primary
+  {
+    Device device(primary.port(), fallback.port(), true);
+    unsigned long failover = failOver(device, primary);
+    check(failover > 0 && failover <= MQTT_FAILOVER_RETRY_INTERVAL + MARGIN, "failover too slow");
+    printf("failover:             on the fallback %lu ms after the preferred broker went down\n", failover);
+
+    check(device.stays(1, 1000), "probed the preferred broker before the interval");
+    device.skew += PROBE_INTERVAL;
+    unsigned long failback = device.runUntilOn(0, 1000);
+    check(failback > 0, "no failback once the probe interval had passed");
+    printf("failback:             on the preferred broker %lu ms after the probe interval\n", failback);
+  }
+
+  // Failback to a slow primary, directly and through select() as before
+  primary.setConnackDelay(SLOW_CONNACK);
+  for (bool direct : {false, true})
+  {
+    Device device(primary.port(), fallback.port(), direct);
+    check(failOver(device, primary) > 0, "no failover from the slow broker");
+    uint32_t preferredScore = device.brokers.score(0, device.now());
+    uint32_t fallbackScore = device.brokers.score(1, device.now());
+    device.skew += PROBE_INTERVAL;
+    uint32_t connectsBefore = device.connects;
+    bool back = device.runUntilOn(0, 3 * SLOW_CONNACK) > 0;
+    printf("slow preferred:       scores %u vs %u, failback through %s %s\n", (unsigned)preferredScore,
+           (unsigned)fallbackScore, direct ? "connectToMQTT(0)" : "select()",
+           back ? "reached the preferred broker" : "reconnected to the fallback");
+    check(preferredScore > fallbackScore, "slow broker did not rank below the fallback");
+    if (direct)
+    {
+      check(back, "no failback to the slow preferred broker");
+      check(device.connects == connectsBefore + 1, "failback took more than one connect");
+    }
+    else
+    {
+      check(!back && device.currentBroker == 1, "select() failback reached the slow broker");
+    }
+  }
+
+  printf(failures == 0 ? "PASS\n" : "FAIL (%d)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
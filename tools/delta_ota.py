@@ -0,0 +1,206 @@
+#!/usr/bin/env python3
+"""Make and check delta OTA patches between two firmware builds.
+
+    delta_ota.py make OLD.bin NEW.bin PATCH   write a patch that turns OLD into NEW
+    delta_ota.py apply OLD.bin PATCH OUT.bin  rebuild NEW from OLD and PATCH
+    delta_ota.py verify OLD.bin NEW.bin PATCH check PATCH rebuilds NEW exactly
+
+OLD must be the image running on the device (e.g. the previous
+.pio/build/d1_mini/firmware.bin); the device refuses patches whose old-image
+MD5 does not match. See include/DeltaPatcher.h for the format.
+"""
+
+import hashlib
+import struct
+import sys
+
+MAGIC = b"SDL1"
+OP_END, OP_COPY, OP_ADD, OP_INSERT = 0, 1, 2, 3
+
+BLOCK = 16         # Bytes hashed to find candidate matches in the old image
+MIN_COPY = 24      # Shorter exact matches are cheaper as literals
+ADD_WINDOW = 32    # An ADD region continues while this window stays similar
+ADD_SIMILAR = 0.5  # Fraction of equal bytes that still makes ADD worthwhile
+
+
+def index_old(old):
+    index = {}
+    for offset in range(0, len(old) - BLOCK + 1):
+        key = old[offset:offset + BLOCK]
+        # Keep a few candidates per block; firmware has many repeated runs
+        bucket = index.setdefault(key, [])
+        if len(bucket) < 4:
+            bucket.append(offset)
+    return index
+
+
+def match_length(old, new, old_pos, new_pos):
+    length = 0
+    limit = min(len(old) - old_pos, len(new) - new_pos)
+    while length < limit and old[old_pos + length] == new[new_pos + length]:
+        length += 1
+    return length
+
+
+def similar_length(old, new, old_pos, new_pos):
+    """Length of the region where new mostly equals old at a fixed displacement."""
+    length = 0
+    limit = min(len(old) - old_pos, len(new) - new_pos)
+    while length + ADD_WINDOW <= limit:
+        window_old = old[old_pos + length:old_pos + length + ADD_WINDOW]
+        window_new = new[new_pos + length:new_pos + length + ADD_WINDOW]
+        same = sum(1 for a, b in zip(window_old, window_new) if a == b)
+        if same < ADD_SIMILAR * ADD_WINDOW:
+            break
+        length += ADD_WINDOW
+    return length
+
+
+def encode_add(old, new, old_pos, new_pos, length):
+    out = bytearray([OP_ADD]) + struct.pack("<II", old_pos, length)
+    i = 0
+    while i < length:
+        unchanged = 0
+        while i < length and unchanged < 255 and old[old_pos + i] == new[new_pos + i]:
+            unchanged += 1
+            i += 1
+        changed = bytearray()
+        while i < length and len(changed) < 255:
+            if old[old_pos + i] == new[new_pos + i]:
+                break
+            changed.append((new[new_pos + i] - old[old_pos + i]) & 0xFF)
+            i += 1
+        out += bytes([unchanged, len(changed)]) + changed
+    return out
+
+
+def make_patch(old, new):
+    index = index_old(old)
+    ops = bytearray()
+    literal = bytearray()
+    displacement = None  # old_pos - new_pos of the last match, tried first
+    pos = 0
+
+    def flush_literal():
+        nonlocal literal
+        if literal:
+            ops.extend(bytes([OP_INSERT]) + struct.pack("<I", len(literal)) + literal)
+            literal = bytearray()
+
+    while pos < len(new):
+        best_old, best_len = None, 0
+        candidates = list(index.get(new[pos:pos + BLOCK], []))
+        if displacement is not None and 0 <= pos + displacement < len(old):
+            candidates.insert(0, pos + displacement)
+        for old_pos in candidates:
+            length = match_length(old, new, old_pos, pos)
+            if length > best_len:
+                best_old, best_len = old_pos, length
+
+        if best_len >= MIN_COPY:
+            flush_literal()
+            ops += bytes([OP_COPY]) + struct.pack("<II", best_old, best_len)
+            displacement = best_old - pos
+            pos += best_len
+            continue
+
+        # Code that moved keeps most bytes but changes addresses: ADD covers it
+        if displacement is not None and 0 <= pos + displacement < len(old):
+            length = similar_length(old, new, pos + displacement, pos)
+            if length > 0:
+                flush_literal()
+                ops += encode_add(old, new, pos + displacement, pos, length)
+                pos += length
+                continue
+
+        literal.append(new[pos])
+        pos += 1
+
+    flush_literal()
+    ops.append(OP_END)
+    header = MAGIC + struct.pack("<II", len(old), len(new)) + hashlib.md5(old).digest()
+    return header + bytes(ops)
+
+
+def apply_patch(old, patch):
+    if patch[:4] != MAGIC:
+        raise ValueError("not a delta patch")
+    old_size, new_size = struct.unpack_from("<II", patch, 4)
+    if old_size != len(old) or patch[12:28] != hashlib.md5(old).digest():
+        raise ValueError("patch was made against a different old image")
+
+    new = bytearray()
+    pos = 28
+    while True:
+        op = patch[pos]
+        pos += 1
+        if op == OP_END:
+            break
+        if op == OP_COPY:
+            old_pos, length = struct.unpack_from("<II", patch, pos)
+            pos += 8
+            new += old[old_pos:old_pos + length]
+        elif op == OP_ADD:
+            old_pos, length = struct.unpack_from("<II", patch, pos)
+            pos += 8
+            done = 0
+            while done < length:
+                unchanged, changed = patch[pos], patch[pos + 1]
+                pos += 2
+                new += old[old_pos + done:old_pos + done + unchanged]
+                done += unchanged
+                for i in range(changed):
+                    new.append((old[old_pos + done + i] + patch[pos + i]) & 0xFF)
+                pos += changed
+                done += changed
+        elif op == OP_INSERT:
+            (length,) = struct.unpack_from("<I", patch, pos)
+            pos += 4
+            new += patch[pos:pos + length]
+            pos += length
+        else:
+            raise ValueError("unknown opcode %d" % op)
+
+    if len(new) != new_size:
+        raise ValueError("rebuilt image has the wrong size")
+    return bytes(new)
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def main(argv):
+    if len(argv) != 5 or argv[1] not in ("make", "apply", "verify"):
+        print(__doc__.strip())
+        return 2
+
+    command = argv[1]
+    if command == "make":
+        old, new = read(argv[2]), read(argv[3])
+        patch = make_patch(old, new)
+        if apply_patch(old, patch) != new:
+            print("internal error: patch does not rebuild the new image")
+            return 1
+        with open(argv[4], "wb") as f:
+            f.write(patch)
+        print("new image %d bytes, patch %d bytes (%.1f%% smaller)"
+              % (len(new), len(patch), 100.0 * (1 - len(patch) / len(new))))
+        print("new image md5 %s" % hashlib.md5(new).hexdigest())
+    elif command == "apply":
+        new = apply_patch(read(argv[2]), read(argv[3]))
+        with open(argv[4], "wb") as f:
+            f.write(new)
+        print("wrote %d bytes, md5 %s" % (len(new), hashlib.md5(new).hexdigest()))
+    else:
+        new, patch = read(argv[3]), read(argv[4])
+        if apply_patch(read(argv[2]), patch) != new:
+            print("patch does NOT rebuild the new image")
+            return 1
+        print("ok: patch %d bytes rebuilds %d byte image" % (len(patch), len(new)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
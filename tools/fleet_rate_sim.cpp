@@ -0,0 +1,274 @@
+// Host simulation of broker-driven rate control across a fleet: a few hundred
+// devices, each with the firmware's TokenBucket and the batch handling of
+// publishSensorData(), flushBatch() and rollupBatch(), on a simulated clock.
+// A controller changes the rate on the fleet-wide control topic three times:
+//   - {"rate": 0.25}                           a quarter of the normal rate
+//   - {}                                       back to normal
+//   - {"bucket_rate": 0.02, "bucket_burst": 1} an exact bucket
+// and each device gets the message after a random broker fan-out delay. The
+// aggregate publish rate at the broker is printed per window next to the
+// target, and it checks that:
+//   - the aggregate settles within 10% of each new target, and how long that
+//     takes from the control message
+//   - no window goes over what the buckets allow (rate * window + burst per
+//     device), including the catch-up after the rate comes back
+//   - no sample is lost: throttled samples are rolled up, and every sample is
+//     either published or still waiting in a batch at the end
+//   - the busiest second stays near the target. Buckets that all run dry on
+//     the same control message refill together and the fleet sends in step;
+//     handleControlMessage() starts each bucket from a random level below one
+//     token. The fleet is run once more without that, for comparison.
+//
+//   g++ -std=gnu++17 -O2 -Iinclude -Itools/net tools/fleet_rate_sim.cpp src/TokenBucket.cpp -o fleet_rate_sim
+//   ./fleet_rate_sim [devices]
+
+#include <math.h>
+#include <vector>
+#include "Arduino.h"
+#include "TokenBucket.h"
+
+// As in main.cpp
+#define PUBLISH_INTERVAL 5000
+#define BATCH_SIZE 1
+#define MAX_BATCH 10
+#define SHAPER_BURST 3
+
+#define LOOP_TICK 100       // Simulated milliseconds per pass of loop()
+#define FANOUT_MAX 500      // Longest broker delay for the control message, ms
+#define WINDOW 30000        // Aggregate rate window, ms
+#define PHASE 600000        // Time between control changes, ms
+#define SETTLE_TOLERANCE 0.1
+#define PEAK_LIMIT 3         // Busiest second against the target, at most
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+  if (ok)
+    return;
+  if (failures++ < 20)
+    printf("FAILED: %s\n", what);
+}
+
+// A control message as handleControlMessage() applies it
+struct Control
+{
+  const char *json;
+  float multiplier;
+  float bucketRate;
+  float bucketBurst;
+};
+
+static const Control controls[] = {
+    {"(boot)", 1, 0, 0},
+    {"{\"rate\": 0.25}", 0.25f, 0, 0},
+    {"{}", 1, 0, 0},
+    {"{\"bucket_rate\": 0.02, \"bucket_burst\": 1}", 1, 0.02f, 1},
+};
+static const int CONTROL_COUNT = sizeof(controls) / sizeof(controls[0]);
+
+struct Device
+{
+  TokenBucket shaper;
+  bool spread = true;          // Random token level on a control message, as in main.cpp
+  unsigned long nextSample;
+  unsigned long controlAt = 0; // When the pending control message arrives, 0 = none
+  int pendingControl = 0;
+  uint16_t batch[MAX_BATCH];   // Sample counts; values do not matter here
+  uint8_t batchCount = 0;
+  uint64_t samplesTaken = 0;
+  uint64_t samplesPublished = 0;
+
+  // configureShaper()
+  void configure(const Control &control)
+  {
+    float rate = control.bucketRate;
+    if (rate <= 0)
+      rate = 1000.0f / ((float)PUBLISH_INTERVAL * BATCH_SIZE) * control.multiplier;
+    shaper.configure(rate, control.bucketBurst > 0 ? control.bucketBurst : SHAPER_BURST);
+  }
+
+  // flushBatch(); true when a message went out
+  bool flush(unsigned long now)
+  {
+    if (batchCount < BATCH_SIZE || !shaper.tryConsume(now))
+      return false;
+    for (uint8_t i = 0; i < batchCount; i++)
+      samplesPublished += batch[i];
+    batchCount = 0;
+    return true;
+  }
+
+  // rollupBatch()
+  void rollup()
+  {
+    uint8_t merged = 0;
+    for (uint8_t i = 0; i < batchCount; i += 2)
+    {
+      uint32_t total = batch[i] + (i + 1 < batchCount ? batch[i + 1] : 0);
+      batch[merged++] = total > 0xFFFF ? 0xFFFF : total;
+    }
+    batchCount = merged;
+  }
+
+  // One pass of loop(); the number of messages published
+  int step(unsigned long now)
+  {
+    int sent = 0;
+    if (controlAt != 0 && now >= controlAt)
+    {
+      // handleControlMessage()
+      configure(controls[pendingControl]);
+      if (spread)
+        shaper.setTokens(rand() % 1000 / 1000.0f);
+      controlAt = 0;
+    }
+    if (now >= nextSample)
+    {
+      nextSample += PUBLISH_INTERVAL;
+      samplesTaken++;
+      batch[batchCount++] = 1;
+      if (batchCount == MAX_BATCH)
+      {
+        sent += flush(now);
+        if (batchCount == MAX_BATCH)
+          rollup();
+      }
+    }
+    sent += flush(now);
+    return sent;
+  }
+};
+
+static float targetRate(const Control &control, int devices)
+{
+  float rate = control.bucketRate > 0 ? control.bucketRate : 1000.0f / PUBLISH_INTERVAL * control.multiplier;
+  return rate * devices;
+}
+
+struct PhaseResult
+{
+  long settledMs = -1;  // From the control message to the first window on target
+  uint32_t peak = 0;    // Messages in the busiest second once settled
+};
+
+// Runs the fleet through every control change; the window table is printed
+// when verbose, and the checks apply then
+static std::vector<PhaseResult> runFleet(int deviceCount, bool spread, bool verbose)
+{
+  srand(34);
+  std::vector<Device> devices(deviceCount);
+  for (Device &device : devices)
+  {
+    device.spread = spread;
+    device.configure(controls[0]);
+    device.nextSample = rand() % PUBLISH_INTERVAL; // Devices boot at different times
+  }
+  if (verbose)
+    printf("%8s %12s %12s %12s\n", "time s", "msg/s", "target", "bucket max");
+
+  std::vector<PhaseResult> results(CONTROL_COUNT);
+  unsigned long end = CONTROL_COUNT * (unsigned long)PHASE;
+  int phase = 0;
+  unsigned long windowStart = 0;
+  uint32_t windowMessages = 0;
+  uint32_t secondMessages = 0;
+  for (unsigned long now = 0; now < end; now += LOOP_TICK)
+  {
+    PhaseResult &result = results[phase];
+
+    // The controller publishes; the broker fans the message out to every device
+    if (now > 0 && now % PHASE == 0)
+    {
+      phase = now / PHASE;
+      if (verbose)
+        printf("%8lu  control %s\n", now / 1000, controls[phase].json);
+      for (Device &device : devices)
+      {
+        device.pendingControl = phase;
+        device.controlAt = now + 1 + rand() % FANOUT_MAX;
+      }
+    }
+
+    for (Device &device : devices)
+    {
+      int sent = device.step(now);
+      windowMessages += sent;
+      secondMessages += sent;
+    }
+
+    if ((now + LOOP_TICK) % 1000 == 0)
+    {
+      if (result.settledMs >= 0 && secondMessages > result.peak)
+        result.peak = secondMessages;
+      secondMessages = 0;
+    }
+
+    if (now + LOOP_TICK - windowStart >= WINDOW)
+    {
+      const Control &control = controls[phase];
+      float rate = windowMessages * 1000.0f / WINDOW;
+      float target = targetRate(control, deviceCount);
+      // Each bucket lets through at most rate * window plus its burst; the
+      // window that saw the change may still run on the previous settings
+      float burst = control.bucketBurst > 0 ? control.bucketBurst : SHAPER_BURST;
+      float previous = phase > 0 ? targetRate(controls[phase - 1], deviceCount) : 0;
+      float limit = (fmaxf(target, previous) * WINDOW / 1000.0f + burst * deviceCount) * 1000.0f / WINDOW;
+      bool within = fabsf(rate - target) <= SETTLE_TOLERANCE * target;
+      if (verbose)
+      {
+        printf("%8lu %12.2f %12.2f %12.2f\n", (now + LOOP_TICK) / 1000, rate, target, limit);
+        check(rate <= limit, "window over what the buckets allow");
+        check(within || result.settledMs < 0, "aggregate left the target after settling");
+      }
+      if (within && result.settledMs < 0)
+        result.settledMs = now + LOOP_TICK - phase * (unsigned long)PHASE;
+      windowMessages = 0;
+      windowStart = now + LOOP_TICK;
+    }
+  }
+
+  if (verbose)
+  {
+    uint64_t taken = 0;
+    uint64_t published = 0;
+    uint64_t waiting = 0;
+    for (Device &device : devices)
+    {
+      taken += device.samplesTaken;
+      published += device.samplesPublished;
+      for (uint8_t i = 0; i < device.batchCount; i++)
+        waiting += device.batch[i];
+    }
+    printf("samples: %llu taken, %llu published, %llu waiting in batches\n", (unsigned long long)taken,
+           (unsigned long long)published, (unsigned long long)waiting);
+    check(published + waiting == taken, "samples lost");
+  }
+  return results;
+}
+
+int main(int argc, char **argv)
+{
+  int deviceCount = argc > 1 ? atoi(argv[1]) : 300;
+  printf("%d devices, %d s sample interval, windows of %d s\n", deviceCount, PUBLISH_INTERVAL / 1000, WINDOW / 1000);
+
+  std::vector<PhaseResult> spread = runFleet(deviceCount, true, true);
+  std::vector<PhaseResult> inStep = runFleet(deviceCount, false, false);
+
+  printf("%-44s %8s %8s %16s %16s\n", "control", "target", "settled", "busiest second", "without spread");
+  for (int phase = 0; phase < CONTROL_COUNT; phase++)
+  {
+    float target = targetRate(controls[phase], deviceCount);
+    char settled[24] = "never";
+    if (spread[phase].settledMs >= 0)
+      snprintf(settled, sizeof(settled), "%lds", spread[phase].settledMs / 1000);
+    printf("%-44s %8.2f %8s %16u %16u\n", controls[phase].json, target, settled, (unsigned)spread[phase].peak,
+           (unsigned)inStep[phase].peak);
+    check(spread[phase].settledMs >= 0 && spread[phase].settledMs <= PHASE / 2,
+          "aggregate rate did not settle on the target");
+    check(spread[phase].peak <= PEAK_LIMIT * target + SHAPER_BURST, "fleet sent in step");
+  }
+
+  printf(failures == 0 ? "PASS\n" : "FAIL (%d)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
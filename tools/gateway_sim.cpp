@@ -0,0 +1,141 @@
+// Host simulation of an ESP-NOW gateway relaying for many leaves. It runs the
+// firmware's LeafTable against leaves that wake on a fixed interval with clock
+// drift, radio loss and retransmitted copies, publishing combined documents
+// the way serviceGateway() does, and reports how many MQTT messages and bytes
+// that takes compared to every leaf publishing on its own.
+//
+//   g++ -O2 -Iinclude tools/gateway_sim.cpp src/LeafTable.cpp -o gateway_sim
+//   ./gateway_sim [leaves] [leaf_interval_s] [gateway_interval_s] [minutes] [loss_percent]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "LeafTable.h"
+
+#define PAYLOAD_SIZE 896 // LEAF_PAYLOAD_SIZE in main.cpp
+#define DUPLICATE_PERCENT 1
+
+// Mirrors TokenBucket for the host, which has no Arduino.h
+struct HostBucket
+{
+  double rate, burst, tokens;
+  uint32_t last;
+  double available(uint32_t now)
+  {
+    tokens += (now - last) * rate / 1000.0;
+    if (tokens > burst)
+      tokens = burst;
+    last = now;
+    return tokens;
+  }
+  bool tryConsume(uint32_t now)
+  {
+    if (available(now) < 1)
+      return false;
+    tokens -= 1;
+    return true;
+  }
+};
+
+struct Leaf
+{
+  uint8_t mac[6];
+  uint32_t seq;
+  uint32_t nextWake;
+  uint32_t period; // Interval with this leaf's clock drift
+};
+
+static size_t mqttPublishSize(size_t topicLength, size_t payloadLength)
+{
+  size_t remaining = 2 + topicLength + payloadLength;
+  size_t lengthBytes = remaining < 128 ? 1 : (remaining < 16384 ? 2 : 3);
+  return 1 + lengthBytes + remaining;
+}
+
+int main(int argc, char **argv)
+{
+  int leafCount = argc > 1 ? atoi(argv[1]) : 40;
+  uint32_t leafInterval = (argc > 2 ? atoi(argv[2]) : 60) * 1000U;
+  uint32_t gatewayInterval = (argc > 3 ? atoi(argv[3]) : 30) * 1000U;
+  uint32_t duration = (argc > 4 ? atoi(argv[4]) : 60) * 60000U;
+  int lossPercent = argc > 5 ? atoi(argv[5]) : 2;
+  const char *topic = "sensor/aht20";
+
+  srand(1);
+  std::vector<Leaf> leaves(leafCount);
+  for (int i = 0; i < leafCount; i++)
+  {
+    Leaf &leaf = leaves[i];
+    uint8_t mac[6] = {0x5C, 0xCF, 0x7F, (uint8_t)(i >> 16), (uint8_t)(i >> 8), (uint8_t)i};
+    memcpy(leaf.mac, mac, sizeof(mac));
+    leaf.seq = 0;
+    leaf.nextWake = rand() % leafInterval;
+    leaf.period = leafInterval + (rand() % 201) - 100; // +-100 ms of RC clock drift
+  }
+
+  LeafTable table;
+  // Three quarters full at most, as on the device
+  table.begin(leafCount + leafCount / 3 + 1);
+  // Default gateway shaper: one own message per interval plus the relay allowance
+  HostBucket bucket = {1000.0 / gatewayInterval + 1.0, 3, 3, 0};
+
+  uint32_t sent = 0, lost = 0, copies = 0, publishes = 0, bytes = 0;
+  uint32_t lastRound = 0;
+  char payload[PAYLOAD_SIZE];
+
+  for (uint32_t now = 0; now < duration; now += 10)
+  {
+    for (Leaf &leaf : leaves)
+    {
+      if (now < leaf.nextWake)
+        continue;
+      leaf.nextWake += leaf.period;
+      leaf.seq++;
+      sent++;
+      if (rand() % 100 < lossPercent)
+      {
+        lost++;
+        continue;
+      }
+      int16_t temperature = 2150 + rand() % 100;
+      uint16_t humidity = 4500 + rand() % 300;
+      table.update(leaf.mac, leaf.seq, temperature, humidity, now);
+      if (rand() % 100 < DUPLICATE_PERCENT)
+      {
+        copies++;
+        table.update(leaf.mac, leaf.seq, temperature, humidity, now);
+      }
+    }
+
+    if (!table.roundActive())
+    {
+      if (now - lastRound < gatewayInterval)
+        continue;
+      lastRound = now;
+      table.startRound();
+    }
+    if (bucket.available(now) < 1)
+      continue;
+    size_t length = table.formatNext(payload, sizeof(payload), "ESP8266-GATEWAY", now);
+    if (length == 0 || !bucket.tryConsume(now))
+      continue;
+    table.commitNext();
+    publishes++;
+    bytes += mqttPublishSize(strlen(topic), length);
+  }
+
+  // A directly connected leaf publishes one single-reading message per wake
+  size_t directPayload = strlen("{\"device_id\": \"ESP8266-000000\", \"temperature\": 21.50, \"humidity\": 45.00}");
+  uint32_t directBytes = sent * mqttPublishSize(strlen(topic), directPayload);
+
+  printf("leaves %d every %u s, gateway publishes every %u s, %u min, loss %d%%\n", leafCount, leafInterval / 1000,
+         gatewayInterval / 1000, duration / 60000, lossPercent);
+  printf("readings: sent %u, lost on air %u, copies %u, duplicates dropped %u, table full %u\n", sent, lost, copies,
+         table.duplicates(), table.rejected());
+  printf("gateway publishes: %u (%.2f per minute), MQTT bytes %u, %.1f per reading\n", publishes,
+         publishes * 60000.0 / duration, bytes, (double)bytes / sent);
+  printf("direct publishing: %u messages from %d TCP sessions, MQTT bytes %u, %.1f per reading\n", sent, leafCount,
+         directBytes, (double)directBytes / sent);
+  return 0;
+}
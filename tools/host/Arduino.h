@@ -0,0 +1,61 @@
+// Host stand-in for the few Arduino calls WireBus.h makes, driving the lines
+// of SimI2cBus from sim_sensors.h. The pins are WireBus's defaults. Time is
+// simNow; delays shorter than a millisecond are not counted.
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sim_sensors.h"
+
+#define LOW 0
+#define HIGH 1
+#define INPUT_PULLUP 2
+#define OUTPUT_OPEN_DRAIN 3
+
+static const uint8_t HOST_SDA_PIN = 4;
+static const uint8_t HOST_SCL_PIN = 5;
+
+struct HostPins
+{
+  uint8_t sdaDriven = HIGH; // What the master drives, HIGH = released
+  uint8_t sclDriven = HIGH;
+};
+
+static HostPins hostPins;
+
+inline unsigned long millis() { return simNow; }
+inline void delay(unsigned long ms) { simNow += ms; }
+inline void delayMicroseconds(unsigned int) {}
+
+inline void pinMode(uint8_t pin, uint8_t mode)
+{
+  if (mode == INPUT_PULLUP && pin == HOST_SDA_PIN)
+    hostPins.sdaDriven = HIGH;
+  if (mode == INPUT_PULLUP && pin == HOST_SCL_PIN)
+    hostPins.sclDriven = HIGH;
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t value)
+{
+  if (pin == HOST_SCL_PIN)
+  {
+    if (hostPins.sclDriven == LOW && value == HIGH)
+      SimI2cBus::shared().sclPulse();
+    hostPins.sclDriven = value;
+  }
+  if (pin == HOST_SDA_PIN)
+    hostPins.sdaDriven = value;
+}
+
+inline int digitalRead(uint8_t pin)
+{
+  if (pin == HOST_SDA_PIN)
+    return hostPins.sdaDriven == LOW || SimI2cBus::shared().sdaHeldClocks > 0 ? LOW : HIGH;
+  if (pin == HOST_SCL_PIN)
+    return hostPins.sclDriven;
+  return HIGH;
+}
+
+#endif
@@ -0,0 +1,65 @@
+// Host stand-in for the Arduino Wire library on SimI2cBus, with the return
+// codes of the ESP8266 core: endTransmission() gives 2 for an address NACK
+// and 4 when the lines failed; requestFrom() gives 0 for either.
+
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+
+#include <string.h>
+#include "Arduino.h"
+
+class TwoWire
+{
+public:
+  void begin(int sda, int scl)
+  {
+    (void)sda;
+    (void)scl;
+    begins++;
+  }
+  void setClock(uint32_t hz) { SimI2cBus::shared().clockHz = hz; }
+  void setClockStretchLimit(uint32_t us) { SimI2cBus::shared().stretchLimitUs = us; }
+
+  void beginTransmission(uint8_t address)
+  {
+    _address = address;
+    _length = 0;
+  }
+
+  size_t write(const uint8_t *data, size_t length)
+  {
+    length = length < sizeof(_buffer) - _length ? length : sizeof(_buffer) - _length;
+    memcpy(_buffer + _length, data, length);
+    _length += length;
+    return length;
+  }
+
+  uint8_t endTransmission()
+  {
+    SimI2cBus &bus = SimI2cBus::shared();
+    if (bus.write(_address, _buffer, _length))
+      return 0;
+    return bus.busError ? 4 : 2;
+  }
+
+  uint8_t requestFrom(uint8_t address, uint8_t length)
+  {
+    _position = 0;
+    _length = length <= sizeof(_buffer) && SimI2cBus::shared().read(address, _buffer, length) ? length : 0;
+    return _length;
+  }
+
+  int read() { return _position < _length ? _buffer[_position++] : -1; }
+
+  uint32_t begins = 0;
+
+private:
+  uint8_t _buffer[32];
+  uint8_t _address = 0;
+  size_t _length = 0;
+  size_t _position = 0;
+};
+
+static TwoWire Wire;
+
+#endif
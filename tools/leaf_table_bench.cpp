@@ -0,0 +1,87 @@
+// Host benchmark of the gateway's LeafTable: update throughput with 500
+// simulated leaves (a few percent of them retransmitted copies), lookups,
+// a full combined-publish round, and the table's RAM footprint.
+//
+//   g++ -O2 -Iinclude tools/leaf_table_bench.cpp src/LeafTable.cpp -o leaf_table_bench
+//   ./leaf_table_bench [leaves] [updates]
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "LeafTable.h"
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+  int leafCount = argc > 1 ? atoi(argv[1]) : 500;
+  long updates = argc > 2 ? atol(argv[2]) : 20000000;
+
+  struct Leaf
+  {
+    uint8_t mac[6];
+    uint32_t seq;
+  };
+  std::vector<Leaf> leaves(leafCount);
+  srand(1);
+  for (Leaf &leaf : leaves)
+  {
+    // Espressif OUI, random lower half like real chip IDs
+    uint8_t mac[6] = {0x5C, 0xCF, 0x7F, (uint8_t)rand(), (uint8_t)rand(), (uint8_t)rand()};
+    memcpy(leaf.mac, mac, sizeof(mac));
+    leaf.seq = 0;
+  }
+
+  // Pre-draw the sequence of leaves so the timing covers the table only
+  std::vector<uint16_t> order(1 << 20);
+  for (uint16_t &index : order)
+    index = rand() % leafCount;
+
+  LeafTable table;
+  table.begin(leafCount + leafCount / 3 + 1);
+
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < updates; i++)
+  {
+    Leaf &leaf = leaves[order[i & (order.size() - 1)]];
+    // Every 32nd update repeats the last sequence number, like a retransmit
+    if ((i & 31) != 0)
+      leaf.seq++;
+    table.update(leaf.mac, leaf.seq, 2150 + (i & 63), 4500 + (i & 127), (uint32_t)i);
+  }
+  double updateTime = secondsSince(start);
+
+  start = std::chrono::steady_clock::now();
+  long found = 0;
+  for (long i = 0; i < updates; i++)
+    found += table.find(leaves[order[i & (order.size() - 1)]].mac) != nullptr;
+  double findTime = secondsSince(start);
+
+  char payload[896];
+  int messages = 0;
+  size_t bytes = 0;
+  start = std::chrono::steady_clock::now();
+  table.startRound();
+  while (size_t length = table.formatNext(payload, sizeof(payload), "ESP8266-GATEWAY", (uint32_t)updates))
+  {
+    table.commitNext();
+    messages++;
+    bytes += length;
+  }
+  double roundTime = secondsSince(start);
+
+  printf("leaves %d in %u slots (load %.2f), %ld updates\n", table.size(), table.capacity(),
+         (double)table.size() / table.capacity(), updates);
+  printf("update: %.1f ns each, %.1f M/s, %u duplicates dropped, %u rejected\n", updateTime * 1e9 / updates,
+         updates / updateTime / 1e6, table.duplicates(), table.rejected());
+  printf("find: %.1f ns each (%ld found)\n", findTime * 1e9 / updates, found);
+  printf("publish round: %d messages, %zu bytes, %.3f ms\n", messages, bytes, roundTime * 1e3);
+  printf("RAM: %zu bytes per leaf, %zu bytes of slots + %zu bytes of table object\n", sizeof(LeafState),
+         table.memoryUsed(), sizeof(LeafTable));
+  return 0;
+}
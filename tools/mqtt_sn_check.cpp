@@ -0,0 +1,159 @@
+// Host check of the MQTT-SN transport: the firmware's MqttSnClient sends over a
+// real UDP socket to the gateway stand-in in tools/net, and the same payloads go
+// over MQTT 3.1.1 through the PubSubClient 2.8 stand-in and TrackingClient to
+// the broker stand-in, for a bytes-per-message comparison. It checks that
+//   - every reading reaches the gateway under the topic name its pre-defined
+//     topic ID maps to, with the payload intact
+//   - the one-byte length field is used up to 255 bytes and the three-byte one
+//     above, and each datagram matches its length field
+//   - lastPacketSize() is the size of the datagram the gateway got
+//   - a topic ID the gateway does not know is dropped there, not delivered
+// The payloads are the firmware's: a single reading, one with the derived
+// values, a batch, a gateway leaf document and the length field boundary.
+//
+// The comparison counts what each client writes and reads, at the MQTT layer;
+// IP, UDP and TCP headers come on top (28 bytes per datagram, 40 per TCP
+// segment plus the ACKs coming back). The TCP steady state is measured with
+// the firmware's ratio of keepalive to publish interval (15 s to 5 s), scaled
+// down to 3 s and 1 s, so the PINGREQ/PINGRESP share per reading is included.
+//
+//   g++ -std=gnu++17 -O2 -Iinclude -Itools/net tools/mqtt_sn_check.cpp src/MqttSnClient.cpp src/TrackingClient.cpp -lpthread -o mqtt_sn_check
+//   ./mqtt_sn_check
+
+#include "WiFiClient.h"
+#include "WiFiUdp.h"
+#include "broker_stub.h"
+#include "sn_gateway_stub.h"
+#include "MqttSnClient.h"
+#include "PubSubClient.h"
+#include "TrackingClient.h"
+
+#define TOPIC "sensor/aht20" // mqttTopic default
+#define TOPIC_ID 1           // mqttSnTopicId default
+#define KEEPALIVE 3          // Seconds, firmware default 15 scaled down
+#define INTERVAL 1000        // Milliseconds, firmware default 5000 scaled down
+#define STEADY_READINGS 12
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+  if (ok)
+    return;
+  if (failures++ < 20)
+    printf("FAILED: %s\n", what);
+}
+
+struct Payload
+{
+  const char *name;
+  std::string text;
+};
+
+static std::vector<Payload> payloads()
+{
+  std::string batch = "{\"device_id\": \"a1b2c3\", \"boot\": 12, \"seq\": 3456, \"samples\": [";
+  for (int i = 0; i < 5; i++)
+    batch += std::string(i > 0 ? ", " : "") + "{\"t\": 21.37, \"h\": 45.12, \"age_ms\": " + std::to_string(20000 - i * 5000) +
+             ", \"n\": 1}";
+  batch += "]}";
+  std::string boundary = "{\"device_id\": \"a1b2c3\", \"pad\": \"";
+  std::string over = boundary;
+  boundary += std::string(255 - 7 - boundary.size() - 2, 'x') + "\"}";
+  over += std::string(256 - 7 - over.size() - 2, 'x') + "\"}";
+  return {
+      {"reading", "{\"device_id\": \"a1b2c3\", \"boot\": 12, \"seq\": 3456, \"temperature\": 21.37, \"humidity\": 45.12}"},
+      {"with derived",
+       "{\"device_id\": \"a1b2c3\", \"boot\": 12, \"seq\": 3456, \"temperature\": 21.37, \"humidity\": 45.12, "
+       "\"dew_point\": 8.78, \"abs_humidity\": 8.54, \"heat_index\": 21.01}"},
+      {"batch of 5", batch},
+      {"leaf document",
+       "{\"gateway\": \"esp-a1b2c3\", \"leaf\": \"d4e5f6\", \"seq\": 88, \"t\": 19.87, \"h\": 52.3, \"n\": 3, "
+       "\"t_avg\": 19.8, \"h_avg\": 52.1, \"t_min\": 19.7, \"t_max\": 19.9, \"age_ms\": 1200}"},
+      {"255-byte datagram", boundary},
+      {"256 bytes, long form", over},
+  };
+}
+
+int main()
+{
+  SnGatewayStub gateway;
+  BrokerStub broker;
+  check(gateway.start(), "gateway stand-in did not start");
+  check(broker.start(), "broker stand-in did not start");
+  gateway.setTopic(TOPIC_ID, TOPIC);
+  std::vector<Payload> list = payloads();
+
+  // MQTT-SN: one datagram per reading, nothing else on the wire
+  WiFiUDP udp;
+  MqttSnClient sn(udp);
+  sn.setGateway(IPAddress(127, 0, 0, 1), gateway.port());
+  std::vector<size_t> snSizes;
+  for (const Payload &payload : list)
+  {
+    check(sn.publish(TOPIC_ID, (const uint8_t *)payload.text.data(), payload.text.size()), "MQTT-SN publish failed");
+    snSizes.push_back(sn.lastPacketSize());
+  }
+  check(gateway.waitFor(list.size(), 1000), "not every datagram reached the gateway");
+  std::vector<SnGatewayStub::Message> received = gateway.messages();
+  check(received.size() == list.size(), "gateway did not deliver every reading");
+  for (size_t i = 0; i < received.size() && i < list.size(); i++)
+  {
+    check(received[i].topic == TOPIC, "reading delivered under the wrong topic");
+    check(received[i].payload == list[i].text, "payload changed on the way");
+    check(received[i].datagramSize == snSizes[i], "lastPacketSize() differs from the datagram");
+    check((snSizes[i] <= 255) == (list[i].text.size() + 7 <= 255), "wrong length field form");
+  }
+  check(gateway.stats().malformed == 0, "gateway got a malformed datagram");
+  check(udp.bytesSent() == gateway.stats().bytesIn, "bytes sent and received differ");
+
+  uint32_t datagrams = gateway.stats().datagrams;
+  check(sn.publish(TOPIC_ID + 1, (const uint8_t *)"{}", 2), "MQTT-SN publish to an unknown ID failed");
+  check(gateway.waitFor(datagrams + 1, 1000), "datagram for an unknown ID did not arrive");
+  check(gateway.stats().unknownTopic == 1 && gateway.messages().size() == list.size(),
+        "unknown topic ID was not dropped");
+
+  // MQTT over TCP, as configureMQTT() and connectToMQTT() set it up
+  WiFiClient net;
+  TrackingClient tracking(net);
+  PubSubClient mqtt(tracking);
+  mqtt.setServer(IPAddress(127, 0, 0, 1), broker.port());
+  mqtt.setBufferSize(1024);
+  mqtt.setKeepAlive(KEEPALIVE);
+  check(mqtt.connect("esp-a1b2c3", nullptr, nullptr, nullptr, 0, false, nullptr, true), "MQTT connect failed");
+  uint32_t connectBytes = tracking.bytesSent() + tracking.bytesReceived();
+
+  printf("%-22s %8s %10s %10s\n", "payload", "bytes", "MQTT-SN", "MQTT/TCP");
+  for (size_t i = 0; i < list.size(); i++)
+  {
+    uint32_t before = tracking.bytesSent();
+    check(mqtt.publish(TOPIC, (const uint8_t *)list[i].text.data(), list[i].text.size(), false), "MQTT publish failed");
+    uint32_t tcpBytes = tracking.bytesSent() - before;
+    check(snSizes[i] < tcpBytes, "MQTT-SN datagram not smaller than the MQTT PUBLISH");
+    printf("%-22s %8zu %10zu %10u\n", list[i].name, list[i].text.size(), snSizes[i], tcpBytes);
+  }
+
+  // Steady state: readings at the publish interval with keepalives in between
+  tracking.resetCounters();
+  const std::string &reading = list[0].text;
+  for (int i = 0; i < STEADY_READINGS; i++)
+  {
+    unsigned long start = millis();
+    check(mqtt.publish(TOPIC, (const uint8_t *)reading.data(), reading.size(), false), "MQTT publish failed");
+    while (millis() - start < INTERVAL)
+    {
+      mqtt.loop();
+      delay(5);
+    }
+  }
+  check(mqtt.connected(), "MQTT connection dropped");
+  float tcpPerReading = (float)(tracking.bytesSent() + tracking.bytesReceived()) / STEADY_READINGS;
+  printf("\nSingle reading, steady state, per reading: MQTT-SN %zu bytes in 1 datagram; MQTT/TCP %.1f bytes "
+         "with keepalives (%u bytes to connect)\n",
+         snSizes[0], tcpPerReading, connectBytes);
+  printf("Plus headers: MQTT-SN +28 per datagram; MQTT/TCP +40 per segment and its ACK\n");
+  check(snSizes[0] < tcpPerReading, "MQTT-SN not smaller per reading");
+
+  printf(failures == 0 ? "PASS\n" : "FAIL (%d)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,65 @@
+// Host stand-in for the Arduino calls the network modules make (Mqtt5Client,
+// TrackingClient, BrokerList, TokenBucket, OtaUpdater), on the Linux clock. Together with
+// Client.h and WiFiClient.h here, the firmware's own MQTT code runs against
+// real sockets: tools/net/broker_stub.h or a local broker.
+
+#ifndef NET_ARDUINO_H
+#define NET_ARDUINO_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+inline uint64_t hostMicros()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  static const uint64_t start = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000 - start;
+}
+
+inline unsigned long millis() { return (unsigned long)(hostMicros() / 1000); }
+inline unsigned long micros() { return (unsigned long)hostMicros(); }
+
+inline void delay(unsigned long ms)
+{
+  struct timespec wait = {(time_t)(ms / 1000), (long)(ms % 1000) * 1000000};
+  nanosleep(&wait, nullptr);
+}
+
+inline void yield() {}
+
+// In the ESP8266 core's libc, not in glibc before 2.38
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+inline size_t strlcpy(char *dst, const char *src, size_t size)
+{
+  size_t length = strlen(src);
+  if (size > 0)
+  {
+    size_t copy = length < size - 1 ? length : size - 1;
+    memcpy(dst, src, copy);
+    dst[copy] = '\0';
+  }
+  return length;
+}
+#endif
+
+class IPAddress
+{
+public:
+  IPAddress() : _address(0) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address(a | b << 8 | c << 16 | (uint32_t)d << 24) {}
+  IPAddress(uint32_t address) : _address(address) {}
+
+  operator uint32_t() const { return _address; }
+  uint8_t operator[](int index) const { return _address >> (8 * index); }
+
+private:
+  uint32_t _address; // Network byte order, as on the ESP8266
+};
+
+#endif
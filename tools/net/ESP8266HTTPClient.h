@@ -0,0 +1,112 @@
+// Host stand-in for the ESP8266 HTTPClient, enough for a plain http:// GET
+// streamed through getStreamPtr() as OtaUpdater reads it. GET() sends the
+// request and reads the status line and headers; the body is left on the
+// socket. Return codes are the core's: the HTTP status, or a negative
+// HTTPC_ERROR_* when the connection or the response failed.
+
+#ifndef NET_ESP8266_HTTP_CLIENT_H
+#define NET_ESP8266_HTTP_CLIENT_H
+
+#include <strings.h>
+#include "ESP8266WiFi.h"
+
+#define HTTP_CODE_OK 200
+#define HTTPC_ERROR_CONNECTION_FAILED (-1)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+class HTTPClient
+{
+public:
+  bool begin(WiFiClient &client, const char *url)
+  {
+    end();
+    _client = &client;
+    _size = -1;
+    const char *prefix = "http://";
+    if (strncmp(url, prefix, strlen(prefix)) != 0)
+      return false;
+    const char *host = url + strlen(prefix);
+    const char *path = strchr(host, '/');
+    if (path == nullptr)
+      path = host + strlen(host);
+    const char *colon = (const char *)memchr(host, ':', path - host);
+    size_t hostLength = (colon ? colon : path) - host;
+    if (hostLength == 0 || hostLength >= sizeof(_host))
+      return false;
+    memcpy(_host, host, hostLength);
+    _host[hostLength] = '\0';
+    _port = colon ? atoi(colon + 1) : 80;
+    strlcpy(_path, *path ? path : "/", sizeof(_path));
+    return _port > 0;
+  }
+
+  int GET()
+  {
+    if (_client == nullptr || !_client->connect(_host, _port))
+      return HTTPC_ERROR_CONNECTION_FAILED;
+    char request[320];
+    int length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", _path,
+                          _host);
+    if (_client->write((const uint8_t *)request, length) != (size_t)length)
+      return HTTPC_ERROR_CONNECTION_FAILED;
+
+    char line[256];
+    int code = 0;
+    while (readLine(line, sizeof(line)))
+    {
+      if (code == 0)
+      {
+        if (sscanf(line, "HTTP/1.%*d %d", &code) != 1)
+          return HTTPC_ERROR_READ_TIMEOUT;
+      }
+      else if (line[0] == '\0')
+      {
+        return code;
+      }
+      else if (strncasecmp(line, "Content-Length:", 15) == 0)
+      {
+        _size = atoi(line + 15);
+      }
+    }
+    return HTTPC_ERROR_READ_TIMEOUT;
+  }
+
+  int getSize() const { return _size; }
+  WiFiClient *getStreamPtr() { return _client && _client->connected() ? _client : nullptr; }
+
+  void end()
+  {
+    if (_client)
+      _client->stop();
+    _client = nullptr;
+  }
+
+private:
+  // One header line without the CRLF; false on a timeout or a closed socket
+  bool readLine(char *line, size_t size)
+  {
+    size_t length = 0;
+    uint8_t c;
+    while (_client->readBytes(&c, 1) == 1)
+    {
+      if (c == '\n')
+      {
+        if (length > 0 && line[length - 1] == '\r')
+          length--;
+        line[length] = '\0';
+        return true;
+      }
+      if (length + 1 < size)
+        line[length++] = c;
+    }
+    return false;
+  }
+
+  WiFiClient *_client = nullptr;
+  char _host[64] = "";
+  char _path[192] = "";
+  uint16_t _port = 80;
+  int _size = -1;
+};
+
+#endif
@@ -0,0 +1,41 @@
+// Host stand-in for <ESP8266WiFi.h> as OtaUpdater uses it: WiFiClient, and
+// the ESP calls that read the running image for delta patches. The running
+// image is whatever the host program puts in ESP.sketch; it sits at flash
+// offset 0, as the sketch does on the device.
+
+#ifndef NET_ESP8266_WIFI_H
+#define NET_ESP8266_WIFI_H
+
+#include <string>
+#include <vector>
+#include "WiFiClient.h"
+#include "md5.h"
+
+class EspClass
+{
+public:
+  bool flashRead(uint32_t offset, uint8_t *data, size_t length)
+  {
+    if (offset > sketch.size() || length > sketch.size() - offset)
+      return false;
+    memcpy(data, sketch.data() + offset, length);
+    return true;
+  }
+
+  uint32_t getSketchSize() const { return sketch.size(); }
+
+  std::string getSketchMD5() const
+  {
+    Md5 md5;
+    md5.add(sketch.data(), sketch.size());
+    char hex[33];
+    md5.hex(hex);
+    return hex;
+  }
+
+  std::vector<uint8_t> sketch;
+};
+
+inline EspClass ESP;
+
+#endif
@@ -0,0 +1,389 @@
+// Host stand-in for PubSubClient 2.8 (knolleary/PubSubClient), which is a
+// platformio.ini dependency and not part of the tree. It follows the
+// library's connect(), readByte(), readPacket(), loop(), write(), publish()
+// and connected() for what the firmware uses: MQTT 3.1.1, QoS 0 publishes,
+// QoS 0/1 subscriptions and the callback. The timing rules are the
+// library's:
+//   - connect() waits for the CONNACK up to the socket timeout, and each byte
+//     of a packet is also waited for up to the socket timeout
+//   - loop() sends PINGREQ once nothing came in or went out for a keepalive
+//     period, and drops the connection when the next period passes with the
+//     PINGRESP still outstanding
+//   - a write that comes back short fails the publish but keeps the
+//     connection; the network client's own timeout bounds how long it blocks
+//   - packets are read a byte at a time through Client::read(), which is the
+//     path TrackingClient watches for the CONNACK
+// A change to the library's rules has to be carried over here by hand.
+
+#ifndef NET_PUB_SUB_CLIENT_H
+#define NET_PUB_SUB_CLIENT_H
+
+#include <functional>
+#include "Client.h"
+
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTION_LOST -3
+#define MQTT_CONNECT_FAILED -2
+#define MQTT_DISCONNECTED -1
+#define MQTT_CONNECTED 0
+
+#define MQTT_MAX_HEADER_SIZE 5
+
+class PubSubClient
+{
+public:
+  typedef std::function<void(char *, uint8_t *, unsigned int)> Callback;
+
+  explicit PubSubClient(Client &client) : _client(&client) { setBufferSize(256); }
+  ~PubSubClient() { free(_buffer); }
+
+  PubSubClient &setServer(IPAddress ip, uint16_t port)
+  {
+    _ip = ip;
+    _port = port;
+    return *this;
+  }
+  PubSubClient &setCallback(Callback callback)
+  {
+    _callback = callback;
+    return *this;
+  }
+  PubSubClient &setKeepAlive(uint16_t keepAlive)
+  {
+    _keepAlive = keepAlive;
+    return *this;
+  }
+  PubSubClient &setSocketTimeout(uint16_t timeout)
+  {
+    _socketTimeout = timeout;
+    return *this;
+  }
+  bool setBufferSize(uint16_t size)
+  {
+    uint8_t *buffer = (uint8_t *)realloc(_buffer, size);
+    if (buffer == nullptr)
+      return false;
+    _buffer = buffer;
+    _bufferSize = size;
+    return true;
+  }
+  uint16_t getBufferSize() const { return _bufferSize; }
+
+  bool connect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos,
+               bool willRetain, const char *willMessage, bool cleanSession)
+  {
+    if (connected())
+      return true;
+    int result = _client->connected() ? 1 : _client->connect(_ip, _port);
+    if (result != 1)
+    {
+      _state = MQTT_CONNECT_FAILED;
+      return false;
+    }
+
+    uint16_t length = MQTT_MAX_HEADER_SIZE;
+    const uint8_t header[7] = {0x00, 0x04, 'M', 'Q', 'T', 'T', 4};
+    for (uint8_t b : header)
+      _buffer[length++] = b;
+    uint8_t flags = willTopic ? 0x04 | willQos << 3 | willRetain << 5 : 0x00;
+    if (cleanSession)
+      flags |= 0x02;
+    if (user != nullptr)
+    {
+      flags |= 0x80;
+      if (pass != nullptr)
+        flags |= 0x40;
+    }
+    _buffer[length++] = flags;
+    _buffer[length++] = _keepAlive >> 8;
+    _buffer[length++] = _keepAlive & 0xFF;
+    length = writeString(id, length);
+    if (willTopic)
+    {
+      length = writeString(willTopic, length);
+      length = writeString(willMessage, length);
+    }
+    if (user != nullptr)
+    {
+      length = writeString(user, length);
+      if (pass != nullptr)
+        length = writeString(pass, length);
+    }
+    write(0x10, length - MQTT_MAX_HEADER_SIZE);
+
+    _lastInActivity = _lastOutActivity = millis();
+    while (!_client->available())
+    {
+      unsigned long t = millis();
+      if (t - _lastInActivity >= _socketTimeout * 1000UL)
+      {
+        _state = MQTT_CONNECTION_TIMEOUT;
+        _client->stop();
+        return false;
+      }
+      delay(0);
+    }
+    uint8_t lengthLength;
+    uint32_t packetLength = readPacket(&lengthLength);
+    if (packetLength == 4)
+    {
+      if (_buffer[3] == 0)
+      {
+        _lastInActivity = millis();
+        _pingOutstanding = false;
+        _state = MQTT_CONNECTED;
+        return true;
+      }
+      _state = _buffer[3];
+    }
+    _client->stop();
+    return false;
+  }
+
+  void disconnect()
+  {
+    _buffer[0] = 0xE0;
+    _buffer[1] = 0;
+    _client->write(_buffer, 2);
+    _state = MQTT_DISCONNECTED;
+    _client->flush();
+    _client->stop();
+    _lastInActivity = _lastOutActivity = millis();
+  }
+
+  bool publish(const char *topic, const char *payload) { return publish(topic, (const uint8_t *)payload, strlen(payload), false); }
+
+  bool publish(const char *topic, const uint8_t *payload, unsigned int payloadLength, bool retained)
+  {
+    if (!connected())
+      return false;
+    if (_bufferSize < MQTT_MAX_HEADER_SIZE + 2 + strnlen(topic, _bufferSize) + payloadLength)
+      return false; // Too long
+    uint16_t length = writeString(topic, MQTT_MAX_HEADER_SIZE);
+    memcpy(_buffer + length, payload, payloadLength);
+    length += payloadLength;
+    return write(retained ? 0x31 : 0x30, length - MQTT_MAX_HEADER_SIZE);
+  }
+
+  bool subscribe(const char *topic, uint8_t qos = 0)
+  {
+    if (qos > 1 || _bufferSize < 9 + strnlen(topic, _bufferSize) || !connected())
+      return false;
+    uint16_t length = MQTT_MAX_HEADER_SIZE;
+    _nextMsgId = _nextMsgId == 0 ? 1 : _nextMsgId + 1;
+    _buffer[length++] = _nextMsgId >> 8;
+    _buffer[length++] = _nextMsgId & 0xFF;
+    length = writeString(topic, length);
+    _buffer[length++] = qos;
+    return write(0x82, length - MQTT_MAX_HEADER_SIZE);
+  }
+
+  bool loop()
+  {
+    if (!connected())
+      return false;
+    unsigned long t = millis();
+    if (t - _lastInActivity > _keepAlive * 1000UL || t - _lastOutActivity > _keepAlive * 1000UL)
+    {
+      if (_pingOutstanding)
+      {
+        _state = MQTT_CONNECTION_TIMEOUT;
+        _client->stop();
+        return false;
+      }
+      _buffer[0] = 0xC0;
+      _buffer[1] = 0;
+      _client->write(_buffer, 2);
+      _lastOutActivity = t;
+      _lastInActivity = t;
+      _pingOutstanding = true;
+    }
+    if (_client->available())
+    {
+      uint8_t lengthLength;
+      uint16_t length = readPacket(&lengthLength);
+      if (length > 0)
+      {
+        _lastInActivity = t;
+        uint8_t type = _buffer[0] & 0xF0;
+        if (type == 0x30)
+        {
+          if (_callback)
+          {
+            uint16_t topicLength = (_buffer[lengthLength + 1] << 8) + _buffer[lengthLength + 2];
+            memmove(_buffer + lengthLength + 2, _buffer + lengthLength + 3, topicLength);
+            _buffer[lengthLength + 2 + topicLength] = 0;
+            char *topic = (char *)_buffer + lengthLength + 2;
+            if ((_buffer[0] & 0x06) == 0x02)
+            {
+              uint16_t msgId = (_buffer[lengthLength + 3 + topicLength] << 8) + _buffer[lengthLength + 3 + topicLength + 1];
+              uint8_t *payload = _buffer + lengthLength + 3 + topicLength + 2;
+              _callback(topic, payload, length - lengthLength - 3 - topicLength - 2);
+              _buffer[0] = 0x40;
+              _buffer[1] = 2;
+              _buffer[2] = msgId >> 8;
+              _buffer[3] = msgId & 0xFF;
+              _client->write(_buffer, 4);
+              _lastOutActivity = t;
+            }
+            else
+            {
+              uint8_t *payload = _buffer + lengthLength + 3 + topicLength;
+              _callback(topic, payload, length - lengthLength - 3 - topicLength);
+            }
+          }
+        }
+        else if (type == 0xC0)
+        {
+          _buffer[0] = 0xD0;
+          _buffer[1] = 0;
+          _client->write(_buffer, 2);
+        }
+        else if (type == 0xD0)
+        {
+          _pingOutstanding = false;
+        }
+      }
+      else if (!connected())
+      {
+        return false; // readPacket() closed the connection
+      }
+    }
+    return true;
+  }
+
+  bool connected()
+  {
+    if (_client == nullptr)
+      return false;
+    if (_client->connected())
+      return _state == MQTT_CONNECTED;
+    if (_state == MQTT_CONNECTED)
+    {
+      _state = MQTT_CONNECTION_LOST;
+      _client->flush();
+      _client->stop();
+    }
+    return false;
+  }
+
+  int state() const { return _state; }
+
+private:
+  bool readByte(uint8_t *result)
+  {
+    unsigned long previous = millis();
+    while (!_client->available())
+    {
+      delay(0);
+      if (millis() - previous >= _socketTimeout * 1000UL)
+        return false;
+    }
+    *result = _client->read();
+    return true;
+  }
+
+  bool readByte(uint16_t *index)
+  {
+    if (!readByte(_buffer + *index))
+      return false;
+    (*index)++;
+    return true;
+  }
+
+  uint32_t readPacket(uint8_t *lengthLength)
+  {
+    uint16_t length = 0;
+    if (!readByte(&length))
+      return 0;
+    bool isPublish = (_buffer[0] & 0xF0) == 0x30;
+    uint32_t multiplier = 1;
+    uint32_t remaining = 0;
+    uint8_t digit = 0;
+    uint32_t start = 0;
+    do
+    {
+      if (length == 5)
+      {
+        // Invalid remaining length encoding
+        _state = MQTT_DISCONNECTED;
+        _client->stop();
+        return 0;
+      }
+      if (!readByte(&digit))
+        return 0;
+      _buffer[length++] = digit;
+      remaining += (digit & 127) * multiplier;
+      multiplier <<= 7;
+    } while ((digit & 128) != 0);
+    *lengthLength = length - 1;
+
+    if (isPublish)
+    {
+      // Topic length
+      if (!readByte(&length) || !readByte(&length))
+        return 0;
+      start = 2;
+    }
+    uint32_t index = length;
+    for (uint32_t i = start; i < remaining; i++)
+    {
+      if (!readByte(&digit))
+        return 0;
+      if (length < _bufferSize)
+        _buffer[length++] = digit;
+      index++;
+    }
+    if (index > _bufferSize)
+      length = 0; // Too long for the buffer, ignored
+    return length;
+  }
+
+  bool write(uint8_t header, uint16_t length)
+  {
+    // Remaining length in front of the body, ending right before it
+    uint8_t lengthBytes[4];
+    uint8_t count = 0;
+    uint16_t remaining = length;
+    do
+    {
+      uint8_t digit = remaining & 127;
+      remaining >>= 7;
+      lengthBytes[count++] = remaining > 0 ? digit | 0x80 : digit;
+    } while (remaining > 0);
+    uint8_t headerLength = count + 1;
+    uint8_t *packet = _buffer + MQTT_MAX_HEADER_SIZE - headerLength;
+    packet[0] = header;
+    memcpy(packet + 1, lengthBytes, count);
+    size_t written = _client->write(packet, length + headerLength);
+    _lastOutActivity = millis();
+    return written == (size_t)(length + headerLength);
+  }
+
+  uint16_t writeString(const char *string, uint16_t pos)
+  {
+    uint16_t start = pos;
+    pos += 2;
+    for (const char *c = string; *c && pos < _bufferSize; c++)
+      _buffer[pos++] = *c;
+    _buffer[start] = (pos - start - 2) >> 8;
+    _buffer[start + 1] = (pos - start - 2) & 0xFF;
+    return pos;
+  }
+
+  Client *_client;
+  IPAddress _ip;
+  uint16_t _port = 1883;
+  uint8_t *_buffer = nullptr;
+  uint16_t _bufferSize = 0;
+  uint16_t _keepAlive = 15;
+  uint16_t _socketTimeout = 15;
+  uint16_t _nextMsgId = 0;
+  unsigned long _lastOutActivity = 0;
+  unsigned long _lastInActivity = 0;
+  bool _pingOutstanding = false;
+  int _state = MQTT_DISCONNECTED;
+  Callback _callback;
+};
+
+#endif
@@ -0,0 +1,20 @@
+// Host stand-in for the Arduino UDP interface, the part MqttSnClient uses
+
+#ifndef NET_UDP_H
+#define NET_UDP_H
+
+#include "Arduino.h"
+
+class UDP
+{
+public:
+  virtual ~UDP() {}
+  virtual uint8_t begin(uint16_t port) = 0;
+  virtual void stop() = 0;
+  virtual int beginPacket(IPAddress ip, uint16_t port) = 0;
+  virtual int endPacket() = 0;
+  virtual size_t write(uint8_t b) = 0;
+  virtual size_t write(const uint8_t *buf, size_t size) = 0;
+};
+
+#endif
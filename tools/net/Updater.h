@@ -0,0 +1,99 @@
+// Host stand-in for the ESP8266 Updater: the update partition is a byte
+// vector, and end() follows the core's UpdaterClass::end():
+//   - end() with bytes still missing, or after a write error, aborts the
+//     update and marks nothing
+//   - end(true) cuts the image to the bytes written so far and goes on as
+//     if it were complete
+//   - the image is checked against the MD5 given to setMD5(), when there is
+//     one, and marked for the bootloader if it matches
+// A partial image only passes with end(true) and no MD5; those are counted.
+
+#ifndef NET_UPDATER_H
+#define NET_UPDATER_H
+
+#include <strings.h>
+#include <vector>
+#include "Arduino.h"
+#include "md5.h"
+
+class UpdaterClass
+{
+public:
+  bool begin(size_t size)
+  {
+    if (size == 0 || size > maxSize)
+      return false;
+    _size = size;
+    _image.clear();
+    _md5[0] = '\0';
+    _error = false;
+    _running = true;
+    return true;
+  }
+
+  bool setMD5(const char *md5)
+  {
+    if (strlen(md5) != 32)
+      return false;
+    memcpy(_md5, md5, sizeof(_md5));
+    return true;
+  }
+
+  size_t write(uint8_t *data, size_t length)
+  {
+    if (!_running || _image.size() + length > _size)
+    {
+      _error = true;
+      return 0;
+    }
+    _image.insert(_image.end(), data, data + length);
+    return length;
+  }
+
+  bool end(bool evenIfRemaining = false)
+  {
+    if (!_running)
+      return false;
+    _running = false;
+    if (_error || (_image.size() != _size && !evenIfRemaining))
+      return false; // Aborted; nothing is marked for the bootloader
+    if (_image.size() != _size)
+    {
+      truncated++;
+      _size = _image.size();
+    }
+    if (_md5[0])
+    {
+      Md5 md5;
+      md5.add(_image.data(), _image.size());
+      char hex[33];
+      md5.hex(hex);
+      if (strcasecmp(hex, _md5) != 0)
+      {
+        _error = true;
+        return false;
+      }
+    }
+    accepted++;
+    return true;
+  }
+
+  bool isRunning() const { return _running; }
+  bool hasError() const { return _error; }
+  const std::vector<uint8_t> &image() const { return _image; }
+
+  size_t maxSize = 1 << 20; // Free sketch space
+  uint32_t accepted = 0;    // Images end() marked for the bootloader
+  uint32_t truncated = 0;   // Partial images end(true) went on with
+
+private:
+  std::vector<uint8_t> _image;
+  size_t _size = 0;
+  char _md5[33] = "";
+  bool _error = false;
+  bool _running = false;
+};
+
+inline UpdaterClass Update;
+
+#endif
@@ -0,0 +1,202 @@
+// Host stand-in for the ESP8266 WiFiClient on a non-blocking POSIX socket.
+// As on the device, setTimeout() bounds connect() and each write(): a peer
+// that stops reading makes write() return short once the timeout has passed
+// instead of blocking. The send buffer is held to about what lwIP has on the
+// ESP8266 (two segments), so a stalled peer is felt as soon as on the device.
+
+#ifndef NET_WIFI_CLIENT_H
+#define NET_WIFI_CLIENT_H
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Client.h"
+
+class WiFiClient : public Client
+{
+public:
+  static const int SEND_BUFFER = 2 * 1460;
+
+  ~WiFiClient() { stop(); }
+
+  void setTimeout(unsigned long ms) { _timeout = ms; }
+  void setNoDelay(bool noDelay) { _noDelay = noDelay; }
+
+  int connect(IPAddress ip, uint16_t port) override
+  {
+    stop();
+    _fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (_fd < 0)
+      return 0;
+    fcntl(_fd, F_SETFL, O_NONBLOCK);
+    int flag = _noDelay ? 1 : 0;
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    int sendBuffer = SEND_BUFFER;
+    setsockopt(_fd, SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = (uint32_t)ip;
+    if (::connect(_fd, (sockaddr *)&address, sizeof(address)) != 0)
+    {
+      int error = 0;
+      socklen_t length = sizeof(error);
+      if (errno != EINPROGRESS || !waitFor(POLLOUT, _timeout) ||
+          getsockopt(_fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0)
+      {
+        stop();
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  int connect(const char *host, uint16_t port) override
+  {
+    IPAddress ip;
+    if (!resolve(host, ip))
+      return 0;
+    return connect(ip, port);
+  }
+
+  static bool resolve(const char *host, IPAddress &ip)
+  {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    addrinfo *result = nullptr;
+    if (getaddrinfo(host, nullptr, &hints, &result) != 0 || result == nullptr)
+      return false;
+    ip = IPAddress((uint32_t)((sockaddr_in *)result->ai_addr)->sin_addr.s_addr);
+    freeaddrinfo(result);
+    return true;
+  }
+
+  size_t write(uint8_t b) override { return write(&b, 1); }
+
+  size_t write(const uint8_t *buf, size_t size) override
+  {
+    if (_fd < 0)
+      return 0;
+    size_t sent = 0;
+    unsigned long start = millis();
+    while (sent < size)
+    {
+      ssize_t n = send(_fd, buf + sent, size - sent, MSG_NOSIGNAL);
+      if (n > 0)
+      {
+        sent += n;
+        continue;
+      }
+      if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+      {
+        _closed = true;
+        break;
+      }
+      unsigned long elapsed = millis() - start;
+      if (elapsed >= _timeout || !waitFor(POLLOUT, _timeout - elapsed))
+        break;
+    }
+    return sent;
+  }
+
+  int available() override
+  {
+    if (_fd < 0)
+      return 0;
+    int count = 0;
+    if (ioctl(_fd, FIONREAD, &count) != 0)
+      return 0;
+    if (count == 0)
+      checkClosed();
+    return count;
+  }
+
+  int read() override
+  {
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+  }
+
+  int read(uint8_t *buf, size_t size) override
+  {
+    if (_fd < 0)
+      return -1;
+    ssize_t n = recv(_fd, buf, size, 0);
+    if (n == 0)
+      _closed = true;
+    return n > 0 ? (int)n : -1;
+  }
+
+  // Stream::readBytes(): waits up to the timeout for the rest
+  size_t readBytes(uint8_t *buf, size_t size)
+  {
+    size_t got = 0;
+    unsigned long start = millis();
+    while (got < size)
+    {
+      int n = read(buf + got, size - got);
+      if (n > 0)
+      {
+        got += n;
+        continue;
+      }
+      unsigned long elapsed = millis() - start;
+      if (_fd < 0 || _closed || elapsed >= _timeout || !waitFor(POLLIN, _timeout - elapsed))
+        break;
+    }
+    return got;
+  }
+
+  int peek() override
+  {
+    uint8_t b;
+    if (_fd < 0 || recv(_fd, &b, 1, MSG_PEEK) != 1)
+      return -1;
+    return b;
+  }
+
+  void flush() override {}
+
+  void stop() override
+  {
+    if (_fd >= 0)
+      close(_fd);
+    _fd = -1;
+    _closed = false;
+  }
+
+  // As on the device, still connected while unread data is left
+  uint8_t connected() override { return _fd >= 0 && (available() > 0 || !_closed); }
+  operator bool() override { return _fd >= 0; }
+
+private:
+  // True when the socket is ready or has failed; errors show up on the next call
+  bool waitFor(short events, unsigned long ms)
+  {
+    pollfd entry = {_fd, events, 0};
+    return poll(&entry, 1, (int)ms) == 1;
+  }
+
+  void checkClosed()
+  {
+    uint8_t b;
+    ssize_t n = recv(_fd, &b, 1, MSG_PEEK);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+      _closed = true;
+  }
+
+  int _fd = -1;
+  bool _closed = false;
+  bool _noDelay = true;
+  unsigned long _timeout = 1000; // Stream default
+};
+
+#endif
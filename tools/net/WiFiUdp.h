@@ -0,0 +1,89 @@
+// Host stand-in for the ESP8266 WiFiUDP on a POSIX datagram socket. As on the
+// device, a packet is collected between beginPacket() and endPacket() and goes
+// out as one datagram; it counts what was sent so a check can compare it with
+// what reached the other end.
+
+#ifndef NET_WIFI_UDP_H
+#define NET_WIFI_UDP_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include "Udp.h"
+
+class WiFiUDP : public UDP
+{
+public:
+  ~WiFiUDP() { stop(); }
+
+  uint8_t begin(uint16_t port) override
+  {
+    stop();
+    _fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (_fd < 0)
+      return 0;
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (bind(_fd, (sockaddr *)&address, sizeof(address)) != 0)
+    {
+      stop();
+      return 0;
+    }
+    return 1;
+  }
+
+  void stop() override
+  {
+    if (_fd >= 0)
+      close(_fd);
+    _fd = -1;
+  }
+
+  int beginPacket(IPAddress ip, uint16_t port) override
+  {
+    if (_fd < 0 && !begin(0))
+      return 0;
+    _ip = ip;
+    _port = port;
+    _packet.clear();
+    return 1;
+  }
+
+  size_t write(uint8_t b) override { return write(&b, 1); }
+
+  size_t write(const uint8_t *buf, size_t size) override
+  {
+    _packet.append((const char *)buf, size);
+    return size;
+  }
+
+  int endPacket() override
+  {
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(_port);
+    address.sin_addr.s_addr = (uint32_t)_ip;
+    ssize_t n = sendto(_fd, _packet.data(), _packet.size(), 0, (sockaddr *)&address, sizeof(address));
+    if (n != (ssize_t)_packet.size())
+      return 0;
+    _datagramsSent++;
+    _bytesSent += n;
+    return 1;
+  }
+
+  uint32_t datagramsSent() const { return _datagramsSent; }
+  uint64_t bytesSent() const { return _bytesSent; }
+
+private:
+  int _fd = -1;
+  IPAddress _ip;
+  uint16_t _port = 0;
+  std::string _packet;
+  uint32_t _datagramsSent = 0;
+  uint64_t _bytesSent = 0;
+};
+
+#endif
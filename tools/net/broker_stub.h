@@ -0,0 +1,655 @@
+// Local MQTT broker stand-in for the host checks in tools/. It runs on its own
+// thread on a loopback port and speaks enough MQTT 3.1.1 and 5 for the
+// firmware's clients: CONNECT with clean or persistent sessions (session
+// present in CONNACK, QoS 1 messages queued while a persistent client is
+// away and unacknowledged ones sent again when it is back), SUBSCRIBE with + and # filters, QoS 0 and 1 PUBLISH with topic
+// aliases, PINGREQ and DISCONNECT. Faults can be switched on from the test:
+//   - setDown(): listener closed and clients dropped, connects are refused
+//   - setSilent(): connections are accepted and read, but nothing is answered
+//   - setStopReading(): nothing is read, so the client's TCP window fills
+//   - setConnackDelay(): a slow broker, the CONNACK comes late
+// It counts what it receives so a check can tell what the client sent.
+
+#ifndef BROKER_STUB_H
+#define BROKER_STUB_H
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class BrokerStub
+{
+public:
+  struct Stats
+  {
+    uint32_t connects = 0;
+    uint32_t sessionsResumed = 0;
+    uint32_t subscribePackets = 0;
+    uint32_t publishesIn = 0;
+    uint32_t publishBytesIn = 0; // Whole PUBLISH packets, fixed header included
+    uint64_t bytesIn = 0;
+  };
+
+  ~BrokerStub() { stop(); }
+
+  // Port 0 picks a free one; port() tells which
+  bool start(uint16_t port = 0)
+  {
+    if (!listenOn(port))
+      return false;
+    _running = true;
+    _thread = std::thread([this] { run(); });
+    return true;
+  }
+
+  void stop()
+  {
+    if (!_running)
+      return;
+    _running = false;
+    _thread.join();
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (Connection &connection : _connections)
+      close(connection.fd);
+    _connections.clear();
+    if (_listener >= 0)
+      close(_listener);
+    _listener = -1;
+  }
+
+  uint16_t port() const { return _port; }
+
+  void setDown(bool down)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (down && _listener >= 0)
+    {
+      // Shut down first: the thread may still be polling it, which would keep
+      // it listening for a moment after close()
+      shutdown(_listener, SHUT_RDWR);
+      close(_listener);
+      _listener = -1;
+      dropAll();
+    }
+    else if (!down && _listener < 0)
+      listenOn(_port);
+  }
+
+  void setSilent(bool silent)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _silent = silent;
+  }
+
+  void setStopReading(bool stopReading)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopReading = stopReading;
+  }
+
+  void setConnackDelay(unsigned long ms)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _connackDelay = ms;
+  }
+
+  // Close every client connection without a DISCONNECT, as a network drop would
+  void dropClients()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    dropAll();
+  }
+
+  Stats stats()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+  }
+
+  size_t queued(const std::string &clientId)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto session = _sessions.find(clientId);
+    return session == _sessions.end() ? 0 : session->second.queue.size();
+  }
+
+private:
+  struct Message
+  {
+    std::string topic;
+    std::string payload;
+    uint8_t qos;
+  };
+
+  struct Session
+  {
+    std::vector<std::pair<std::string, uint8_t>> subscriptions;
+    std::deque<Message> queue;              // QoS 1 messages for a persistent client that is away
+    std::map<uint16_t, Message> inflight; // QoS 1 messages sent but not acknowledged yet
+    bool persistent = false;
+    int fd = -1;
+    uint16_t nextPacketId = 1;
+  };
+
+  struct Connection
+  {
+    int fd;
+    std::string input;
+    std::string clientId; // Empty until CONNECT
+    uint8_t version = 4;
+    std::map<uint16_t, std::string> aliases;
+    unsigned long connackAt = 0; // Pending CONNACK is sent at this time
+    std::string connack;
+  };
+
+  static unsigned long nowMs()
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000UL + now.tv_nsec / 1000000;
+  }
+
+  bool listenOn(uint16_t port)
+  {
+    _listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (_listener < 0)
+      return false;
+    int yes = 1;
+    setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    int receiveBuffer = 4096; // Small, so a broker that stops reading is felt quickly
+    setsockopt(_listener, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(_listener, (sockaddr *)&address, sizeof(address)) != 0 || listen(_listener, 16) != 0 ||
+        getsockname(_listener, (sockaddr *)&address, &length) != 0)
+    {
+      close(_listener);
+      _listener = -1;
+      return false;
+    }
+    fcntl(_listener, F_SETFL, O_NONBLOCK);
+    _port = ntohs(address.sin_port);
+    return true;
+  }
+
+  void run()
+  {
+    while (_running)
+    {
+      std::vector<pollfd> fds;
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_listener >= 0)
+          fds.push_back({_listener, POLLIN, 0});
+        if (!_stopReading)
+          for (Connection &connection : _connections)
+            fds.push_back({connection.fd, POLLIN, 0});
+      }
+      poll(fds.data(), fds.size(), 2);
+
+      std::lock_guard<std::mutex> lock(_mutex);
+      for (const pollfd &entry : fds)
+      {
+        if (!(entry.revents & (POLLIN | POLLHUP | POLLERR)))
+          continue;
+        if (entry.fd == _listener)
+          acceptClient();
+        else
+          readClient(entry.fd);
+      }
+      sendDueConnacks();
+    }
+  }
+
+  void acceptClient()
+  {
+    int fd = accept(_listener, nullptr, nullptr);
+    if (fd < 0)
+      return;
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    _connections.push_back({fd, "", "", 4, {}, 0, ""});
+  }
+
+  Connection *find(int fd)
+  {
+    for (Connection &connection : _connections)
+      if (connection.fd == fd)
+        return &connection;
+    return nullptr;
+  }
+
+  void readClient(int fd)
+  {
+    Connection *connection = find(fd);
+    if (connection == nullptr)
+      return;
+    uint8_t buffer[2048];
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0)
+    {
+      if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        drop(fd);
+      return;
+    }
+    _stats.bytesIn += n;
+    if (_silent)
+      return;
+    connection->input.append((const char *)buffer, n);
+
+    // Handle every whole packet in the input
+    while (true)
+    {
+      connection = find(fd);
+      if (connection == nullptr)
+        return;
+      const std::string &input = connection->input;
+      uint32_t length = 0;
+      size_t pos = 1;
+      bool complete = false;
+      for (uint8_t shift = 0; pos < input.size() && shift < 28; shift += 7)
+      {
+        uint8_t b = input[pos++];
+        length |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+        {
+          complete = true;
+          break;
+        }
+      }
+      if (!complete || input.size() < pos + length)
+        return;
+      std::string body = input.substr(pos, length);
+      uint8_t header = input[0];
+      connection->input.erase(0, pos + length);
+      handle(*connection, header, body, pos + length);
+    }
+  }
+
+  static uint16_t u16(const std::string &data, size_t pos)
+  {
+    return pos + 1 < data.size() ? ((uint8_t)data[pos] << 8) | (uint8_t)data[pos + 1] : 0;
+  }
+
+  static std::string str(const std::string &data, size_t &pos)
+  {
+    uint16_t length = u16(data, pos);
+    pos += 2;
+    std::string value = pos + length <= data.size() ? data.substr(pos, length) : "";
+    pos += length;
+    return value;
+  }
+
+  static uint32_t varInt(const std::string &data, size_t &pos)
+  {
+    uint32_t value = 0;
+    for (uint8_t shift = 0; pos < data.size() && shift < 28; shift += 7)
+    {
+      uint8_t b = data[pos++];
+      value |= (uint32_t)(b & 0x7F) << shift;
+      if (!(b & 0x80))
+        break;
+    }
+    return value;
+  }
+
+  static void putVarInt(std::string &out, uint32_t value)
+  {
+    do
+    {
+      uint8_t b = value & 0x7F;
+      value >>= 7;
+      out += (char)(value ? b | 0x80 : b);
+    } while (value);
+  }
+
+  static std::string packet(uint8_t header, const std::string &body)
+  {
+    std::string out(1, (char)header);
+    putVarInt(out, body.size());
+    return out + body;
+  }
+
+  static std::string u16String(uint16_t value) { return std::string{(char)(value >> 8), (char)value}; }
+
+  static std::string strField(const std::string &value) { return u16String(value.size()) + value; }
+
+  void sendTo(int fd, const std::string &data)
+  {
+    // Best effort: a client that stops reading loses what does not fit
+    if (fd >= 0)
+      send(fd, data.data(), data.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+  }
+
+  void handle(Connection &connection, uint8_t header, const std::string &body, size_t packetLength)
+  {
+    switch (header & 0xF0)
+    {
+    case 0x10:
+      handleConnect(connection, body);
+      break;
+    case 0x30:
+      _stats.publishesIn++;
+      _stats.publishBytesIn += packetLength;
+      handlePublish(connection, header, body);
+      break;
+    case 0x80:
+      handleSubscribe(connection, body);
+      break;
+    case 0xC0:
+      sendTo(connection.fd, std::string{(char)0xD0, 0});
+      break;
+    case 0xE0:
+    {
+      // A clean DISCONNECT: the session stays if it is persistent
+      int fd = connection.fd;
+      drop(fd);
+      break;
+    }
+    case 0x40:
+    {
+      auto session = _sessions.find(connection.clientId);
+      if (session != _sessions.end())
+        session->second.inflight.erase(u16(body, 0));
+      break;
+    }
+    default:
+      break; // The rest needs nothing back
+    }
+  }
+
+  void handleConnect(Connection &connection, const std::string &body)
+  {
+    size_t pos = 0;
+    str(body, pos); // "MQTT"
+    connection.version = pos < body.size() ? body[pos++] : 4;
+    uint8_t flags = pos < body.size() ? body[pos++] : 0;
+    pos += 2; // Keepalive
+    uint32_t sessionExpiry = 0;
+    if (connection.version == 5)
+    {
+      uint32_t propsLength = varInt(body, pos);
+      size_t end = pos + propsLength;
+      while (pos < end)
+      {
+        uint8_t id = body[pos++];
+        if (id == 0x11 && pos + 4 <= end)
+          sessionExpiry = ((uint32_t)u16(body, pos) << 16) | u16(body, pos + 2);
+        pos = id == 0x11 ? pos + 4 : end; // Only the session expiry is expected here
+      }
+    }
+    std::string clientId = str(body, pos);
+    bool clean = flags & 0x02;
+    bool persistent = connection.version == 5 ? sessionExpiry > 0 : !clean;
+
+    _stats.connects++;
+    auto existing = _sessions.find(clientId);
+    if (existing != _sessions.end() && existing->second.fd >= 0 && existing->second.fd != connection.fd)
+    {
+      // Session takeover: the older connection is closed
+      int old = existing->second.fd;
+      existing->second.fd = -1;
+      closeConnection(old);
+    }
+    existing = _sessions.find(clientId);
+    if (clean && existing != _sessions.end())
+    {
+      _sessions.erase(existing);
+      existing = _sessions.end();
+    }
+    bool present = existing != _sessions.end();
+    _stats.sessionsResumed += present;
+    Session &session = _sessions[clientId];
+    session.persistent = persistent;
+    session.fd = connection.fd;
+    connection.clientId = clientId;
+
+    std::string connack{(char)(present ? 1 : 0), 0};
+    if (connection.version == 5)
+      connack += std::string{3, 0x22, 0, 10}; // Topic Alias Maximum 10
+    connection.connack = packet(0x20, connack);
+    connection.connackAt = nowMs() + _connackDelay;
+    sendDueConnacks();
+  }
+
+  void sendDueConnacks()
+  {
+    unsigned long now = nowMs();
+    for (Connection &connection : _connections)
+    {
+      if (connection.connack.empty() || (long)(now - connection.connackAt) < 0)
+        continue;
+      sendTo(connection.fd, connection.connack);
+      connection.connack.clear();
+
+      // Then whatever waited for the session: unacknowledged messages first, as
+      // a resumed session sends them again
+      Session &session = _sessions[connection.clientId];
+      for (auto &entry : session.inflight)
+        sendTo(connection.fd, publishPacket(connection.version, entry.first, entry.second, true));
+      while (!session.queue.empty())
+      {
+        Message message = session.queue.front();
+        session.queue.pop_front();
+        deliver(session, connection.version, message);
+      }
+    }
+  }
+
+  static bool matches(const std::string &filter, const std::string &topic)
+  {
+    size_t f = 0, t = 0;
+    while (f < filter.size())
+    {
+      if (filter[f] == '#')
+        return true;
+      if (filter[f] == '+')
+      {
+        while (t < topic.size() && topic[t] != '/')
+          t++;
+        f++;
+        continue;
+      }
+      if (t >= topic.size() || filter[f] != topic[t])
+        return false;
+      f++;
+      t++;
+    }
+    return t == topic.size();
+  }
+
+  uint8_t versionOf(int fd)
+  {
+    Connection *connection = find(fd);
+    return connection ? connection->version : 4;
+  }
+
+  static std::string publishPacket(uint8_t version, uint16_t packetId, const Message &message, bool dup)
+  {
+    std::string body = strField(message.topic);
+    if (message.qos > 0)
+      body += u16String(packetId);
+    if (version == 5)
+      body += '\0'; // No properties
+    body += message.payload;
+    return packet(0x30 | (dup ? 0x08 : 0) | message.qos << 1, body);
+  }
+
+  void deliver(Session &session, uint8_t version, const Message &message)
+  {
+    uint16_t packetId = 0;
+    if (message.qos > 0)
+    {
+      packetId = session.nextPacketId++;
+      if (session.nextPacketId == 0)
+        session.nextPacketId = 1;
+      session.inflight[packetId] = message;
+    }
+    sendTo(session.fd, publishPacket(version, packetId, message, false));
+  }
+
+  void handlePublish(Connection &connection, uint8_t header, const std::string &body)
+  {
+    uint8_t qos = (header >> 1) & 0x03;
+    size_t pos = 0;
+    std::string topic = str(body, pos);
+    uint16_t packetId = 0;
+    if (qos > 0)
+    {
+      packetId = u16(body, pos);
+      pos += 2;
+    }
+    if (connection.version == 5)
+    {
+      uint32_t propsLength = varInt(body, pos);
+      size_t end = pos + propsLength;
+      while (pos < end)
+      {
+        uint8_t id = body[pos++];
+        if (id == 0x23)
+        {
+          uint16_t alias = u16(body, pos);
+          if (topic.empty())
+            topic = connection.aliases[alias];
+          else
+            connection.aliases[alias] = topic;
+          pos += 2;
+        }
+        else if (id == 0x02)
+          pos += 4;
+        else if (id == 0x01)
+          pos += 1;
+        else
+          pos = end;
+      }
+      pos = end;
+    }
+    Message message = {topic, pos <= body.size() ? body.substr(pos) : "", qos};
+    if (qos == 1)
+    {
+      std::string ack = u16String(packetId);
+      sendTo(connection.fd, packet(0x40, ack));
+    }
+
+    for (auto &entry : _sessions)
+    {
+      Session &session = entry.second;
+      for (const auto &subscription : session.subscriptions)
+      {
+        if (!matches(subscription.first, topic))
+          continue;
+        Message copy = message;
+        copy.qos = message.qos < subscription.second ? message.qos : subscription.second;
+        if (session.fd >= 0)
+          deliver(session, versionOf(session.fd), copy);
+        else if (session.persistent && copy.qos > 0 && session.queue.size() < 100)
+          session.queue.push_back(copy);
+        break;
+      }
+    }
+  }
+
+  void handleSubscribe(Connection &connection, const std::string &body)
+  {
+    _stats.subscribePackets++;
+    size_t pos = 0;
+    uint16_t packetId = u16(body, pos);
+    pos += 2;
+    if (connection.version == 5)
+    {
+      uint32_t propsLength = varInt(body, pos);
+      pos += propsLength;
+    }
+    Session &session = _sessions[connection.clientId];
+    std::string codes;
+    while (pos < body.size())
+    {
+      std::string filter = str(body, pos);
+      uint8_t qos = pos < body.size() ? body[pos++] & 0x03 : 0;
+      if (qos > 1)
+        qos = 1;
+      bool replaced = false;
+      for (auto &subscription : session.subscriptions)
+      {
+        if (subscription.first == filter)
+        {
+          subscription.second = qos;
+          replaced = true;
+        }
+      }
+      if (!replaced)
+        session.subscriptions.push_back({filter, qos});
+      codes += (char)qos;
+    }
+    std::string ack = u16String(packetId);
+    if (connection.version == 5)
+      ack += '\0';
+    sendTo(connection.fd, packet(0x90, ack + codes));
+  }
+
+  void closeConnection(int fd)
+  {
+    for (auto connection = _connections.begin(); connection != _connections.end(); ++connection)
+    {
+      if (connection->fd == fd)
+      {
+        close(fd);
+        _connections.erase(connection);
+        return;
+      }
+    }
+  }
+
+  // The client is gone; a clean session goes with it
+  void drop(int fd)
+  {
+    Connection *connection = find(fd);
+    if (connection != nullptr && !connection->clientId.empty())
+    {
+      auto session = _sessions.find(connection->clientId);
+      if (session != _sessions.end() && session->second.fd == fd)
+      {
+        session->second.fd = -1;
+        if (!session->second.persistent)
+          _sessions.erase(session);
+      }
+    }
+    closeConnection(fd);
+  }
+
+  void dropAll()
+  {
+    while (!_connections.empty())
+      drop(_connections.front().fd);
+  }
+
+  std::thread _thread;
+  volatile bool _running = false;
+  std::mutex _mutex;
+  int _listener = -1;
+  uint16_t _port = 0;
+  bool _silent = false;
+  bool _stopReading = false;
+  unsigned long _connackDelay = 0;
+  std::list<Connection> _connections; // A list, so handlers keep their reference while others close
+  std::map<std::string, Session> _sessions;
+  Stats _stats;
+};
+
+#endif
@@ -0,0 +1,242 @@
+// Local HTTP server stand-in for the host checks in tools/: serves one body
+// for any GET on a loopback port, from its own thread, one connection at a
+// time. serve() sets the body and how the link behaves for the next request:
+//   - rate: the body goes out at about this many bytes per second, in
+//     segments of 1460 bytes, as a slow Wi-Fi link would deliver it
+//   - dropAfter: the connection is closed after this many body bytes
+//   - stallAfter: nothing more is sent after this many body bytes, but the
+//     connection stays open
+//   - contentLength: the header announces another length than the body's
+//   - status: another HTTP status, with no body
+// It counts requests and body bytes sent.
+
+#ifndef HTTP_STUB_H
+#define HTTP_STUB_H
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class HttpStub
+{
+public:
+  struct Settings
+  {
+    std::vector<uint8_t> body;
+    uint32_t rate = 0;           // Bytes per second, 0 = as fast as the socket takes them
+    size_t dropAfter = SIZE_MAX; // Body bytes sent before the connection is closed
+    size_t stallAfter = SIZE_MAX;
+    long contentLength = -1;     // -1 = the body's length
+    int status = 200;
+  };
+
+  ~HttpStub() { stop(); }
+
+  // Port 0 picks a free one; port() tells which
+  bool start(uint16_t port = 0)
+  {
+    _listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (_listener < 0)
+      return false;
+    int yes = 1;
+    setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(_listener, (sockaddr *)&address, sizeof(address)) != 0 || listen(_listener, 4) != 0 ||
+        getsockname(_listener, (sockaddr *)&address, &length) != 0)
+    {
+      close(_listener);
+      _listener = -1;
+      return false;
+    }
+    fcntl(_listener, F_SETFL, O_NONBLOCK);
+    _port = ntohs(address.sin_port);
+    _running = true;
+    _thread = std::thread([this] { run(); });
+    return true;
+  }
+
+  void stop()
+  {
+    if (!_running)
+      return;
+    _running = false;
+    _thread.join();
+    close(_listener);
+    _listener = -1;
+  }
+
+  uint16_t port() const { return _port; }
+
+  // Applies to the next request; the default settings serve the body as is
+  void serve(const Settings &settings)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _settings = settings;
+  }
+
+  uint32_t requests()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _requests;
+  }
+
+  uint64_t bodyBytesSent()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _bodyBytesSent;
+  }
+
+private:
+  static unsigned long nowMs()
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000UL + now.tv_nsec / 1000000;
+  }
+
+  bool waitFor(int fd, short events)
+  {
+    while (_running)
+    {
+      pollfd entry = {fd, events, 0};
+      int ready = poll(&entry, 1, 2);
+      if (ready < 0)
+        return false;
+      if (ready == 1)
+        return !(entry.revents & (POLLERR | POLLHUP | POLLNVAL)) || (entry.revents & events);
+    }
+    return false;
+  }
+
+  // Sends all of it unless the server stops or the client goes away
+  bool sendAll(int fd, const uint8_t *data, size_t length)
+  {
+    while (length > 0)
+    {
+      ssize_t n = send(fd, data, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (n > 0)
+      {
+        data += n;
+        length -= n;
+        continue;
+      }
+      if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        return false;
+      if (!waitFor(fd, POLLOUT))
+        return false;
+    }
+    return true;
+  }
+
+  void run()
+  {
+    while (_running)
+    {
+      if (!waitFor(_listener, POLLIN))
+        continue;
+      int fd = accept(_listener, nullptr, nullptr);
+      if (fd < 0)
+        continue;
+      fcntl(fd, F_SETFL, O_NONBLOCK);
+      handle(fd);
+      close(fd);
+    }
+  }
+
+  void handle(int fd)
+  {
+    std::string request;
+    while (request.find("\r\n\r\n") == std::string::npos)
+    {
+      char buffer[512];
+      if (!waitFor(fd, POLLIN))
+        return;
+      ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+      if (n <= 0)
+        return;
+      request.append(buffer, n);
+    }
+
+    Settings settings;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      settings = _settings;
+      _requests++;
+    }
+    if (settings.status != 200)
+    {
+      char header[128];
+      int length = snprintf(header, sizeof(header), "HTTP/1.1 %d Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+                            settings.status);
+      sendAll(fd, (const uint8_t *)header, length);
+      return;
+    }
+    long contentLength = settings.contentLength >= 0 ? settings.contentLength : (long)settings.body.size();
+    char header[160];
+    int length = snprintf(header, sizeof(header),
+                          "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %ld\r\n"
+                          "Connection: close\r\n\r\n",
+                          contentLength);
+    if (!sendAll(fd, (const uint8_t *)header, length))
+      return;
+
+    const size_t SEGMENT = 1460;
+    unsigned long start = nowMs();
+    size_t sent = 0;
+    size_t end = settings.body.size();
+    end = settings.dropAfter < end ? settings.dropAfter : end;
+    end = settings.stallAfter < end ? settings.stallAfter : end;
+    while (sent < end && _running)
+    {
+      if (settings.rate > 0)
+      {
+        // Hold the segment back until the link would have carried it
+        unsigned long due = start + (unsigned long)((uint64_t)sent * 1000 / settings.rate);
+        while (_running && (long)(nowMs() - due) < 0)
+          usleep(500);
+      }
+      size_t take = end - sent < SEGMENT ? end - sent : SEGMENT;
+      if (!sendAll(fd, settings.body.data() + sent, take))
+        return;
+      sent += take;
+      std::lock_guard<std::mutex> lock(_mutex);
+      _bodyBytesSent += take;
+    }
+    if (settings.stallAfter < settings.body.size() && settings.stallAfter < settings.dropAfter)
+    {
+      // Stalled: keep the connection open until the client gives up
+      char buffer[64];
+      while (waitFor(fd, POLLIN) && recv(fd, buffer, sizeof(buffer), 0) > 0)
+        ;
+      return;
+    }
+    // Let the client read the rest before the close
+    shutdown(fd, SHUT_WR);
+    char buffer[64];
+    while (waitFor(fd, POLLIN) && recv(fd, buffer, sizeof(buffer), 0) > 0)
+      ;
+  }
+
+  std::thread _thread;
+  volatile bool _running = false;
+  std::mutex _mutex;
+  int _listener = -1;
+  uint16_t _port = 0;
+  Settings _settings;
+  uint32_t _requests = 0;
+  uint64_t _bodyBytesSent = 0;
+};
+
+#endif
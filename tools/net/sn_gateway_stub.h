@@ -0,0 +1,174 @@
+// Local MQTT-SN gateway stand-in for the host checks in tools/. It runs on its
+// own thread on a loopback UDP port and takes what the firmware's MqttSnClient
+// sends: QoS -1 PUBLISH to a pre-defined topic ID, with the one-byte or the
+// three-byte length field. A topic ID is mapped to its topic name with
+// setTopic(), as a gateway does from its own configuration. Each datagram is
+// checked against its length field; one that does not match, is not a QoS -1
+// PUBLISH or names an unknown topic ID is counted and dropped. The messages
+// that pass are kept for the check to read back.
+
+#ifndef SN_GATEWAY_STUB_H
+#define SN_GATEWAY_STUB_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class SnGatewayStub
+{
+public:
+  struct Stats
+  {
+    uint32_t datagrams = 0;
+    uint64_t bytesIn = 0;  // Whole datagrams, MQTT-SN header included
+    uint32_t malformed = 0; // Length field wrong, or not a QoS -1 PUBLISH
+    uint32_t unknownTopic = 0;
+  };
+
+  struct Message
+  {
+    std::string topic;
+    std::string payload;
+    size_t datagramSize;
+  };
+
+  ~SnGatewayStub() { stop(); }
+
+  // Port 0 picks a free one; port() tells which
+  bool start(uint16_t port = 0)
+  {
+    _fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (_fd < 0)
+      return false;
+    int receiveBuffer = 1 << 20; // Room for a burst, so no datagram is lost on loopback
+    setsockopt(_fd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(_fd, (sockaddr *)&address, sizeof(address)) != 0 ||
+        getsockname(_fd, (sockaddr *)&address, &length) != 0)
+    {
+      close(_fd);
+      _fd = -1;
+      return false;
+    }
+    _port = ntohs(address.sin_port);
+    _running = true;
+    _thread = std::thread([this] { run(); });
+    return true;
+  }
+
+  void stop()
+  {
+    if (!_running)
+      return;
+    _running = false;
+    _thread.join();
+    close(_fd);
+    _fd = -1;
+  }
+
+  uint16_t port() const { return _port; }
+
+  void setTopic(uint16_t topicId, const std::string &topic)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _topics[topicId] = topic;
+  }
+
+  Stats stats()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+  }
+
+  std::vector<Message> messages()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _messages;
+  }
+
+  // Waits up to timeoutMs for count datagrams to have come in
+  bool waitFor(uint32_t count, unsigned long timeoutMs)
+  {
+    for (unsigned long waited = 0; waited < timeoutMs; waited++)
+    {
+      if (stats().datagrams >= count)
+        return true;
+      usleep(1000);
+    }
+    return false;
+  }
+
+private:
+  static const uint8_t PUBLISH = 0x0C;
+
+  void run()
+  {
+    static uint8_t datagram[65536];
+    while (_running)
+    {
+      pollfd entry = {_fd, POLLIN, 0};
+      if (poll(&entry, 1, 2) != 1)
+        continue;
+      ssize_t n = recv(_fd, datagram, sizeof(datagram), 0);
+      if (n <= 0)
+        continue;
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stats.datagrams++;
+      _stats.bytesIn += n;
+      handle(datagram, n);
+    }
+  }
+
+  void handle(const uint8_t *data, size_t size)
+  {
+    // Length(1 or 3) MsgType Flags TopicId(2) MsgId(2) Data
+    size_t length;
+    size_t pos;
+    if (size >= 3 && data[0] == 0x01)
+    {
+      length = data[1] << 8 | data[2];
+      pos = 3;
+    }
+    else
+    {
+      length = data[0];
+      pos = 1;
+    }
+    if (length != size || size < pos + 6 || data[pos] != PUBLISH || (data[pos + 1] & 0x63) != 0x61)
+    {
+      _stats.malformed++;
+      return;
+    }
+    uint16_t topicId = data[pos + 2] << 8 | data[pos + 3];
+    auto topic = _topics.find(topicId);
+    if (topic == _topics.end())
+    {
+      _stats.unknownTopic++;
+      return;
+    }
+    pos += 6;
+    _messages.push_back({topic->second, std::string((const char *)data + pos, size - pos), size});
+  }
+
+  int _fd = -1;
+  uint16_t _port = 0;
+  bool _running = false;
+  std::thread _thread;
+  std::mutex _mutex;
+  std::map<uint16_t, std::string> _topics;
+  std::vector<Message> _messages;
+  Stats _stats;
+};
+
+#endif
@@ -0,0 +1,291 @@
+// Host check of the OTA download path: the firmware's OtaUpdater fetches an
+// image from a loopback HTTP server (tools/net/http_stub.h) through host
+// stand-ins for WiFiClient, HTTPClient and Update, while a loop like main.cpp's
+// spends some time on other work between service() calls. The link is shaped
+// to a few Wi-Fi-like rates and the transfer throughput is measured. On the
+// device the TCP window and the flash writes set the ceiling; what is checked
+// here is that the chunked reader keeps up with the link without holding the
+// loop. It checks that:
+//   - the image written to the update partition is the one served, byte for
+//     byte, and Update accepts it against its MD5
+//   - on a shaped link the throughput is at least 90% of the link rate
+//   - no service() call takes much longer than its 20 ms budget, and the loop
+//     keeps running: the longest gap between passes stays within the budget
+//     plus the other work
+//   - a delta patch made by tools/delta_ota.py rebuilds the new image (needs
+//     python3; skipped when the patch cannot be made)
+//   - a dropped connection, a corrupted image, a wrong Content-Length, an
+//     HTTP error and a stalled server each fail with their error, and the
+//     update is aborted: the partial image is dropped, never cut short and
+//     marked for the bootloader (Update follows the core's end() rules). The
+//     stall takes the 15 s stall timeout.
+//   - an update without an MD5 is refused before anything is written
+//
+//   g++ -std=gnu++17 -O2 -Iinclude -Itools/net tools/ota_fetch_check.cpp src/OtaUpdater.cpp src/DeltaPatcher.cpp -lpthread -o ota_fetch_check
+//   ./ota_fetch_check [loop work ms]
+
+#include <string>
+#include <vector>
+#include "ESP8266WiFi.h"
+#include "Updater.h"
+#include "http_stub.h"
+#include "OtaUpdater.h"
+
+#define IMAGE_SIZE (320 * 1024) // About the size of this sketch
+#define SERVICE_BUDGET 20       // OTA_SERVICE_BUDGET_MS in OtaUpdater.cpp
+#define STALL_TIMEOUT 15000     // OTA_STALL_TIMEOUT in OtaUpdater.cpp
+#define MARGIN 10               // Scheduling slack on the host, ms
+#define RATE_SHARE 0.9          // Least throughput against a shaped link
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+  if (ok)
+    return;
+  if (failures++ < 20)
+    printf("FAILED: %s\n", what);
+}
+
+static std::string md5Of(const std::vector<uint8_t> &data)
+{
+  Md5 md5;
+  md5.add(data.data(), data.size());
+  char hex[33];
+  md5.hex(hex);
+  return hex;
+}
+
+struct Fetch
+{
+  OtaUpdater::State state = OtaUpdater::IDLE;
+  std::string error;
+  size_t received = 0;
+  unsigned long elapsedMs = 0;
+  unsigned long longestCall = 0; // Longest single service(), ms
+  unsigned long longestGap = 0;  // Longest time between the starts of two passes, ms
+  double serviceShare = 0;       // Share of the download time spent in service()
+};
+
+// Starts an update and runs loop() passes until it ends: service(), then the
+// rest of the loop's work
+static Fetch runFetch(HttpStub &server, const std::string &md5, size_t expectedSize, bool delta,
+                      unsigned long loopWorkMs)
+{
+  char url[64];
+  snprintf(url, sizeof(url), "http://127.0.0.1:%u/firmware.bin", server.port());
+  OtaUpdater ota;
+  Fetch fetch;
+  unsigned long start = millis();
+  ota.begin(url, md5.c_str(), expectedSize, delta);
+  unsigned long inService = 0;
+  unsigned long lastPass = millis();
+  while (ota.state() == OtaUpdater::DOWNLOADING)
+  {
+    unsigned long passStart = millis();
+    fetch.longestGap = passStart - lastPass > fetch.longestGap ? passStart - lastPass : fetch.longestGap;
+    lastPass = passStart;
+    ota.service();
+    unsigned long call = millis() - passStart;
+    inService += call;
+    fetch.longestCall = call > fetch.longestCall ? call : fetch.longestCall;
+    if (loopWorkMs > 0)
+      delay(loopWorkMs);
+  }
+  unsigned long total = millis() - start;
+  fetch.state = ota.state();
+  fetch.error = ota.error();
+  fetch.received = ota.received();
+  fetch.elapsedMs = ota.elapsedMs();
+  fetch.serviceShare = total > 0 ? (double)inService / total : 0;
+  return fetch;
+}
+
+static void printFetch(const char *name, const Fetch &fetch, const char *result)
+{
+  unsigned long bytesPerSecond = fetch.elapsedMs > 0 ? (unsigned long)(fetch.received * 1000ULL / fetch.elapsedMs) : 0;
+  printf("%-26s %8zu %8lu %10lu %10lu %10lu %8.0f%%  %s\n", name, fetch.received, fetch.elapsedMs, bytesPerSecond,
+         fetch.longestCall, fetch.longestGap, fetch.serviceShare * 100, result);
+}
+
+// Old and new images for the delta run: the new one has code moved by an
+// insertion, a patched region and a changed tail, as a rebuild would
+static void makeImages(std::vector<uint8_t> &oldImage, std::vector<uint8_t> &newImage)
+{
+  oldImage.resize(IMAGE_SIZE);
+  for (uint8_t &b : oldImage)
+    b = rand();
+  newImage = oldImage;
+  std::vector<uint8_t> inserted(3000);
+  for (uint8_t &b : inserted)
+    b = rand();
+  newImage.insert(newImage.begin() + 40000, inserted.begin(), inserted.end());
+  for (size_t i = 120000; i < 128000; i += 7)
+    newImage[i] += 4;
+  for (size_t i = newImage.size() - 5000; i < newImage.size(); i++)
+    newImage[i] = rand();
+}
+
+static bool makePatch(const std::vector<uint8_t> &oldImage, const std::vector<uint8_t> &newImage,
+                      std::vector<uint8_t> &patch)
+{
+  char dir[] = "/tmp/ota_fetch_checkXXXXXX";
+  if (mkdtemp(dir) == nullptr)
+    return false;
+  std::string oldPath = std::string(dir) + "/old.bin";
+  std::string newPath = std::string(dir) + "/new.bin";
+  std::string patchPath = std::string(dir) + "/patch.bin";
+  bool ok = false;
+  FILE *file = fopen(oldPath.c_str(), "wb");
+  if (file)
+  {
+    fwrite(oldImage.data(), 1, oldImage.size(), file);
+    fclose(file);
+  }
+  file = fopen(newPath.c_str(), "wb");
+  if (file)
+  {
+    fwrite(newImage.data(), 1, newImage.size(), file);
+    fclose(file);
+  }
+  std::string command = "python3 tools/delta_ota.py make " + oldPath + " " + newPath + " " + patchPath + " > /dev/null";
+  if (system(command.c_str()) == 0 && (file = fopen(patchPath.c_str(), "rb")) != nullptr)
+  {
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+      patch.insert(patch.end(), buffer, buffer + n);
+    fclose(file);
+    ok = !patch.empty();
+  }
+  remove(oldPath.c_str());
+  remove(newPath.c_str());
+  remove(patchPath.c_str());
+  rmdir(dir);
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long loopWorkMs = argc > 1 ? atol(argv[1]) : 10;
+  srand(36);
+
+  HttpStub server;
+  check(server.start(), "HTTP stand-in did not start");
+
+  std::vector<uint8_t> image(IMAGE_SIZE);
+  for (uint8_t &b : image)
+    b = rand();
+  std::string md5 = md5Of(image);
+  HttpStub::Settings settings;
+  settings.body = image;
+
+  printf("%u byte image, %lu ms of other work per loop pass\n", IMAGE_SIZE, loopWorkMs);
+  printf("%-26s %8s %8s %10s %10s %10s %9s\n", "link", "bytes", "ms", "bytes/s", "longest", "max gap", "in OTA");
+
+  // Full images over links of several speeds
+  for (uint32_t rate : {0u, 1000000u, 250000u, 50000u})
+  {
+    settings.rate = rate;
+    server.serve(settings);
+    uint32_t accepted = Update.accepted;
+    Fetch fetch = runFetch(server, md5, 0, false, loopWorkMs);
+    char name[32];
+    if (rate > 0)
+      snprintf(name, sizeof(name), "%u bytes/s", (unsigned)rate);
+    else
+      snprintf(name, sizeof(name), "loopback, unshaped");
+    printFetch(name, fetch, fetch.state == OtaUpdater::SUCCEEDED ? "ok" : fetch.error.c_str());
+
+    check(fetch.state == OtaUpdater::SUCCEEDED, "download failed");
+    check(Update.accepted == accepted + 1 && Update.image() == image, "written image differs from the one served");
+    if (rate > 0)
+      check(fetch.received * 1000.0 / fetch.elapsedMs >= RATE_SHARE * rate, "throughput under 90% of the link");
+    check(fetch.longestCall <= SERVICE_BUDGET + MARGIN, "a service() call ran past its budget");
+    check(fetch.longestGap <= SERVICE_BUDGET + loopWorkMs + MARGIN, "the loop was held between passes");
+  }
+
+  // A delta patch against the running image
+  {
+    std::vector<uint8_t> oldImage, newImage, patch;
+    makeImages(oldImage, newImage);
+    if (makePatch(oldImage, newImage, patch))
+    {
+      ESP.sketch = oldImage;
+      HttpStub::Settings delta;
+      delta.body = patch;
+      delta.rate = 50000;
+      server.serve(delta);
+      Fetch fetch = runFetch(server, md5Of(newImage), patch.size(), true, loopWorkMs);
+      char name[48];
+      snprintf(name, sizeof(name), "delta, %u bytes/s", (unsigned)delta.rate);
+      char result[64];
+      snprintf(result, sizeof(result), "%zu byte image", Update.image().size());
+      printFetch(name, fetch, fetch.state == OtaUpdater::SUCCEEDED ? result : fetch.error.c_str());
+
+      check(fetch.state == OtaUpdater::SUCCEEDED, "delta update failed");
+      check(Update.image() == newImage, "rebuilt image differs from the new image");
+      check(fetch.received * 1000.0 / fetch.elapsedMs >= RATE_SHARE * delta.rate,
+            "delta throughput under 90% of the link");
+      check(fetch.longestCall <= SERVICE_BUDGET + MARGIN, "a delta service() call ran past its budget");
+
+      // A patch for another image is refused before anything is written
+      ESP.sketch = newImage;
+      fetch = runFetch(server, md5Of(newImage), patch.size(), true, loopWorkMs);
+      printFetch("delta, other image", fetch, fetch.error.c_str());
+      check(fetch.state == OtaUpdater::FAILED && fetch.error == "patch is for a different image",
+            "patch for another image accepted");
+    }
+    else
+    {
+      printf("delta: skipped, tools/delta_ota.py could not make the patch\n");
+    }
+  }
+
+  // Faults: each fails with its error, and the partition is not accepted
+  struct Fault
+  {
+    const char *name;
+    const char *error;
+    size_t expectedSize;
+    HttpStub::Settings settings;
+  };
+  std::vector<Fault> faults;
+  settings.rate = 250000;
+  faults.push_back({"dropped half way", "connection lost", 0, settings});
+  faults.back().settings.dropAfter = IMAGE_SIZE / 2;
+  faults.push_back({"one byte corrupted", "verification failed", 0, settings});
+  faults.back().settings.body[IMAGE_SIZE / 3] ^= 0x01;
+  faults.push_back({"Content-Length wrong", "size mismatch", IMAGE_SIZE, settings});
+  faults.back().settings.contentLength = IMAGE_SIZE - 1;
+  faults.push_back({"HTTP 404", "HTTP error", 0, settings});
+  faults.back().settings.status = 404;
+  faults.push_back({"stalled half way", "download stalled", 0, settings});
+  faults.back().settings.stallAfter = IMAGE_SIZE / 2;
+  faults.push_back({"no MD5", "MD5 required", 0, settings});
+  for (const Fault &fault : faults)
+  {
+    server.serve(fault.settings);
+    uint32_t accepted = Update.accepted;
+    uint32_t truncated = Update.truncated;
+    Fetch fetch = runFetch(server, fault.error == std::string("MD5 required") ? "" : md5, fault.expectedSize, false,
+                           loopWorkMs);
+    printFetch(fault.name, fetch, fetch.error.c_str());
+    check(fetch.state == OtaUpdater::FAILED && fetch.error == fault.error, fault.name);
+    check(Update.accepted == accepted && !Update.isRunning(), "failed update not aborted");
+    check(Update.truncated == truncated, "partial image went on to be installed");
+    check(fetch.longestGap <= SERVICE_BUDGET + loopWorkMs + MARGIN, "the loop was held during a fault");
+    if (fault.settings.stallAfter < IMAGE_SIZE)
+    {
+      // The first half arrives at the link rate, then nothing
+      unsigned long halfMs = fault.settings.stallAfter * 1000UL / fault.settings.rate;
+      check(fetch.elapsedMs >= halfMs + STALL_TIMEOUT &&
+                fetch.elapsedMs <= halfMs + STALL_TIMEOUT + SERVICE_BUDGET + loopWorkMs + 100,
+            "stall not detected after the stall timeout");
+    }
+  }
+
+  server.stop();
+  printf(failures == 0 ? "PASS\n" : "FAIL (%d)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
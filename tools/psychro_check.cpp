@@ -0,0 +1,157 @@
+// Host check of the fixed-point psychrometrics against the reference
+// formulas in double precision, over every input the firmware can pass in:
+// -40.00..85.00 degC and 0.00..100.00 %RH (the AHT20 range) in steps of
+// 0.01. Fails when the dew point or heat index is off by more than 0.1 degC
+// or the absolute humidity by more than 0.1 g/m3, then times the fixed-point
+// functions against the same formulas in float.
+//
+// The timings are for the host, which has an FPU. On the ESP8266 every float
+// operation, logf() and expf() is a software routine, so the gap is wider.
+//
+//   g++ -O2 -Iinclude tools/psychro_check.cpp src/Psychrometrics.cpp -o psychro_check
+//   ./psychro_check
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+#include "Psychrometrics.h"
+
+#define TOLERANCE 0.1
+
+static double refDewPoint(double t, double rh)
+{
+  double gamma = log(rh / 100) + 17.62 * t / (243.12 + t);
+  return 243.12 * gamma / (17.62 - gamma);
+}
+
+static double refAbsoluteHumidity(double t, double rh)
+{
+  double es = 6.112 * exp(17.62 * t / (243.12 + t));
+  return 216.7 * es * rh / 100 / (t + 273.15);
+}
+
+static double refHeatIndex(double t, double rh)
+{
+  double f = t * 9 / 5 + 32;
+  double hi = 0.5 * (f + 61 + (f - 68) * 1.2 + rh * 0.094);
+  if ((hi + f) / 2 >= 80)
+  {
+    hi = -42.379 + 2.04901523 * f + 10.14333127 * rh - 0.22475541 * f * rh - 6.83783e-3 * f * f -
+         5.481717e-2 * rh * rh + 1.22874e-3 * f * f * rh + 8.5282e-4 * f * rh * rh - 1.99e-6 * f * f * rh * rh;
+    if (rh < 13 && f >= 80 && f <= 112)
+      hi -= (13 - rh) / 4 * sqrt((17 - fabs(f - 95)) / 17);
+    else if (rh > 85 && f >= 80 && f <= 87)
+      hi += (rh - 85) / 10 * (87 - f) / 5;
+  }
+  return (hi - 32) * 5 / 9;
+}
+
+// What the firmware would otherwise run: the same formulas in float
+static float floatDewPoint(float t, float rh)
+{
+  float gamma = logf(rh / 100) + 17.62f * t / (243.12f + t);
+  return 243.12f * gamma / (17.62f - gamma);
+}
+
+static float floatAbsoluteHumidity(float t, float rh)
+{
+  return 216.7f * 6.112f * expf(17.62f * t / (243.12f + t)) * rh / 100 / (t + 273.15f);
+}
+
+static float floatHeatIndex(float t, float rh)
+{
+  float f = t * 9 / 5 + 32;
+  float hi = 0.5f * (f + 61 + (f - 68) * 1.2f + rh * 0.094f);
+  if ((hi + f) / 2 >= 80)
+  {
+    hi = -42.379f + 2.04901523f * f + 10.14333127f * rh - 0.22475541f * f * rh - 6.83783e-3f * f * f -
+         5.481717e-2f * rh * rh + 1.22874e-3f * f * f * rh + 8.5282e-4f * f * rh * rh - 1.99e-6f * f * f * rh * rh;
+    if (rh < 13 && f >= 80 && f <= 112)
+      hi -= (13 - rh) / 4 * sqrtf((17 - fabsf(f - 95)) / 17);
+    else if (rh > 85 && f >= 80 && f <= 87)
+      hi += (rh - 85) / 10 * (87 - f) / 5;
+  }
+  return (hi - 32) * 5 / 9;
+}
+
+struct Worst
+{
+  const char *name;
+  const char *unit;
+  double error;
+  int t;
+  int h;
+};
+
+static void track(Worst &worst, double error, int t, int h)
+{
+  if (error > worst.error)
+  {
+    worst.error = error;
+    worst.t = t;
+    worst.h = h;
+  }
+}
+
+static double seconds()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main()
+{
+  Worst worst[3] = {{"dew point", "degC", 0, 0, 0}, {"absolute humidity", "g/m3", 0, 0, 0}, {"heat index", "degC", 0, 0, 0}};
+  long points = 0;
+
+  for (int t = -4000; t <= 8500; t++)
+  {
+    for (int h = 0; h <= 10000; h++)
+    {
+      double tc = t / 100.0;
+      double rh = h / 100.0;
+      if (h > 0) // No dew point at 0 %RH
+        track(worst[0], fabs(psychroDewPoint(t, h) / 100.0 - refDewPoint(tc, rh)), t, h);
+      track(worst[1], fabs(psychroAbsoluteHumidity(t, h) / 100.0 - refAbsoluteHumidity(tc, rh)), t, h);
+      track(worst[2], fabs(psychroHeatIndex(t, h) / 100.0 - refHeatIndex(tc, rh)), t, h);
+      points++;
+    }
+  }
+
+  bool ok = true;
+  printf("%ld inputs checked\n", points);
+  for (const Worst &w : worst)
+  {
+    printf("%-18s max error %.4f %s at %.2f degC %.2f %%RH\n", w.name, w.error, w.unit, w.t / 100.0, w.h / 100.0);
+    ok = ok && w.error <= TOLERANCE;
+  }
+
+  // Micro-benchmark over a grid of typical indoor and outdoor readings
+  const int runs = 20;
+  volatile int32_t fixedSink = 0;
+  volatile float floatSink = 0;
+  double start = seconds();
+  for (int run = 0; run < runs; run++)
+    for (int t = -4000; t <= 8500; t += 7)
+      for (int h = 1; h <= 10000; h += 13)
+        fixedSink = psychroDewPoint(t, h) + psychroAbsoluteHumidity(t, h) + psychroHeatIndex(t, h);
+  double fixedTime = seconds() - start;
+
+  start = seconds();
+  for (int run = 0; run < runs; run++)
+    for (int t = -4000; t <= 8500; t += 7)
+      for (int h = 1; h <= 10000; h += 13)
+        floatSink = floatDewPoint(t / 100.0f, h / 100.0f) + floatAbsoluteHumidity(t / 100.0f, h / 100.0f) +
+                    floatHeatIndex(t / 100.0f, h / 100.0f);
+  double floatTime = seconds() - start;
+
+  long calls = (long)runs * ((12500 / 7) + 1) * ((9999 / 13) + 1);
+  printf("all three values: fixed %.1f ns, float %.1f ns per reading\n", fixedTime / calls * 1e9,
+         floatTime / calls * 1e9);
+  (void)fixedSink;
+  (void)floatSink;
+
+  printf(ok ? "PASS\n" : "FAIL\n");
+  return ok ? 0 : 1;
+}
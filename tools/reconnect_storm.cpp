@@ -0,0 +1,323 @@
+// Reconnect storm against a local broker: a device drops its connection over
+// and over and reconnects the way connectToMQTT() does, once with a clean
+// session and once with a persistent one. While it is away a controller sends
+// it a QoS 1 message on its control topic. For each reconnect it measures the
+// CONNECT-to-first-publish latency (until the controller has the first sample)
+// and the bytes the device sent, and counts subscription rounds and the
+// messages that reached it. It runs once with PubSubClient and MQTT 3.1.1, the
+// default, where the session-present flag comes from TrackingClient watching
+// the CONNACK bytes, and once with Mqtt5Client. It checks that:
+//   - the session-present flag is set on every resumed persistent session and
+//     never on a clean one
+//   - a persistent session subscribes once, not on every reconnect
+//   - a changed topic set is subscribed again on a resumed session
+//   - QoS 1 messages sent while a persistent device was away are delivered on
+//     reconnect, and a clean session loses them
+//
+// The device side is the firmware's own TrackingClient and Mqtt5Client on
+// real sockets, and tools/net/PubSubClient.h in place of the PubSubClient
+// library, which is not part of the tree. With no broker given it starts
+// tools/net/broker_stub.h on a loopback port; with a host and port it runs
+// against a real broker (e.g. mosquitto), where the subscription count comes
+// from the device side only.
+//
+//   g++ -std=gnu++17 -O2 -Iinclude -Itools/net tools/reconnect_storm.cpp src/Mqtt5Client.cpp src/TrackingClient.cpp -lpthread -o reconnect_storm
+//   ./reconnect_storm [cycles] [host port]
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "WiFiClient.h"
+#include "broker_stub.h"
+#include "Mqtt5Client.h"
+#include "PubSubClient.h"
+#include "TrackingClient.h"
+
+#define SESSION_EXPIRY 86400 // MQTT5_SESSION_EXPIRY in main.cpp
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+  if (ok)
+    return;
+  if (failures++ < 20)
+    printf("FAILED: %s\n", what);
+}
+
+static IPAddress brokerIp;
+static uint16_t brokerPort;
+
+// Everything connectToMQTT() does up to the first publish
+struct Device
+{
+  WiFiClient net;
+  TrackingClient tracking{net};
+  PubSubClient mqtt3{tracking};
+  Mqtt5Client mqtt5{tracking};
+  bool v5;
+  std::string id;
+  bool persistent;
+  std::vector<std::string> topics;
+  uint32_t storedHash = 0; // rtcData.mqttSubscriptionHash
+  uint32_t subscriptionRounds = 0;
+  uint32_t received = 0;
+  uint32_t sessionsPresent = 0; // Connects that found the session kept
+
+  Device(const char *clientId, bool persistentSession, bool mqtt5Client)
+      : v5(mqtt5Client), id(clientId), persistent(persistentSession)
+  {
+    topics = {"fleet/" + id + "/config", "fleet/control/" + id};
+    net.setTimeout(5000);
+    mqtt3.setCallback([this](char *, uint8_t *, unsigned int) { received++; });
+    mqtt5.setCallback([this](char *, uint8_t *, unsigned int) { received++; });
+  }
+
+  // As subscriptionHash() in main.cpp, with the broker left out
+  uint32_t hash(uint8_t qos) const
+  {
+    uint32_t hash = 2166136261UL;
+    std::vector<std::string> parts = topics;
+    parts.insert(parts.begin(), id);
+    for (const std::string &part : parts)
+    {
+      for (char c : part)
+      {
+        hash ^= (uint8_t)c;
+        hash *= 16777619UL;
+      }
+      hash ^= '\n';
+      hash *= 16777619UL;
+    }
+    hash ^= qos;
+    hash *= 16777619UL;
+    return hash;
+  }
+
+  bool connect()
+  {
+    bool connected;
+    if (v5)
+    {
+      mqtt5.setServer(brokerIp, brokerPort);
+      connected = mqtt5.connect(id.c_str(), nullptr, nullptr, !persistent, persistent ? SESSION_EXPIRY : 0);
+    }
+    else
+    {
+      mqtt3.setServer(brokerIp, brokerPort);
+      connected = mqtt3.connect(id.c_str(), nullptr, nullptr, nullptr, 0, false, nullptr, !persistent);
+    }
+    if (!connected)
+      return false;
+    // As connectToMQTT(): PubSubClient does not report the flag itself
+    bool reported = v5 ? mqtt5.sessionPresent() : tracking.sessionPresent();
+    sessionsPresent += reported;
+    bool sessionPresent = persistent && reported;
+
+    // subscribeTopics()
+    uint8_t qos = persistent ? 1 : 0;
+    uint32_t wanted = hash(qos);
+    if (!sessionPresent || storedHash != wanted)
+    {
+      bool subscribed = true;
+      for (const std::string &topic : topics)
+        subscribed = (v5 ? mqtt5.subscribe(topic.c_str(), qos) : mqtt3.subscribe(topic.c_str(), qos)) && subscribed;
+      storedHash = subscribed ? wanted : 0;
+      subscriptionRounds++;
+    }
+    return true;
+  }
+
+  bool publish(const char *topic, const char *payload)
+  {
+    return v5 ? mqtt5.publish(topic, (const uint8_t *)payload, strlen(payload), false, 0) : mqtt3.publish(topic, payload);
+  }
+
+  bool loop() { return v5 ? mqtt5.loop() : mqtt3.loop(); }
+
+  // A dropped link: no DISCONNECT, the broker just sees the socket close
+  void drop() { tracking.stop(); }
+};
+
+// The controller's QoS 1 message, written by hand: the firmware's client only
+// publishes at QoS 0
+static bool publishQos1(Client &client, const std::string &topic, const std::string &payload)
+{
+  static uint16_t packetId = 1;
+  std::string body;
+  body += (char)(topic.size() >> 8);
+  body += (char)topic.size();
+  body += topic;
+  body += (char)(packetId >> 8);
+  body += (char)packetId;
+  packetId = packetId == 0xFFFF ? 1 : packetId + 1;
+  body += '\0'; // No MQTT 5 properties
+  body += payload;
+  std::string packet(1, (char)0x32);
+  size_t length = body.size();
+  do
+  {
+    uint8_t b = length & 0x7F;
+    length >>= 7;
+    packet += (char)(length ? b | 0x80 : b);
+  } while (length);
+  packet += body;
+  return client.write((const uint8_t *)packet.data(), packet.size()) == packet.size();
+}
+
+struct Result
+{
+  std::vector<double> latencyMs;
+  uint64_t bytes = 0;
+  uint32_t delivered = 0;
+  uint32_t failedConnects = 0;
+};
+
+static double percentile(std::vector<double> values, double p)
+{
+  if (values.empty())
+    return 0;
+  std::sort(values.begin(), values.end());
+  return values[(size_t)(p * (values.size() - 1) + 0.5)];
+}
+
+static Result storm(Device &device, int cycles, uint32_t runId)
+{
+  Result result;
+  WiFiClient controllerNet;
+  controllerNet.setTimeout(5000);
+  Mqtt5Client controller(controllerNet);
+  std::string dataTopic = "fleet/" + device.id + "/data";
+  std::string lastSample;
+  unsigned long lastArrival = 0;
+  controller.setCallback([&](char *, uint8_t *payload, unsigned int length) {
+    lastSample.assign((const char *)payload, length);
+    lastArrival = micros();
+  });
+  controller.setServer(brokerIp, brokerPort);
+  char controllerId[32];
+  snprintf(controllerId, sizeof(controllerId), "storm-controller-%u", (unsigned)runId);
+  check(controller.connect(controllerId, nullptr, nullptr, true, 0), "controller could not connect");
+  controller.subscribe(dataTopic.c_str());
+
+  device.connect();
+  for (int cycle = 0; cycle < cycles; cycle++)
+  {
+    device.drop();
+    char payload[32];
+    snprintf(payload, sizeof(payload), "%d", cycle);
+    publishQos1(controllerNet, device.topics[1], payload);
+    controller.loop();
+    delay(10 + rand() % 10); // Away for a moment; the broker sees the drop
+
+    uint32_t receivedBefore = device.received;
+    device.tracking.resetCounters();
+    unsigned long start = micros();
+    if (!device.connect())
+    {
+      result.failedConnects++;
+      continue;
+    }
+    snprintf(payload, sizeof(payload), "sample %d", cycle);
+    device.publish(dataTopic.c_str(), payload);
+    uint64_t bytes = device.tracking.bytesSent();
+
+    unsigned long waitStart = millis();
+    while (lastSample != payload && millis() - waitStart < 2000)
+    {
+      controller.loop();
+      device.loop();
+      delay(0);
+    }
+    check(lastSample == payload, "first sample not delivered");
+    result.latencyMs.push_back((lastArrival - start) / 1000.0);
+    result.bytes += bytes;
+
+    // Whatever the broker kept for the device comes right after CONNACK
+    waitStart = millis();
+    while (device.received == receivedBefore && millis() - waitStart < 100)
+    {
+      device.loop();
+      delay(1);
+    }
+    result.delivered += device.received - receivedBefore;
+  }
+  device.drop();
+  controller.disconnect();
+  return result;
+}
+
+static void report(const char *name, const Result &result, const Device &device, int cycles)
+{
+  printf("%-11s CONNECT to first publish: median %.2f ms, p95 %.2f ms, max %.2f ms; %.0f bytes sent per "
+         "reconnect; %u subscription rounds; %u of %d messages sent while away delivered\n",
+         name, percentile(result.latencyMs, 0.5), percentile(result.latencyMs, 0.95),
+         percentile(result.latencyMs, 1), cycles ? (double)result.bytes / cycles : 0,
+         (unsigned)device.subscriptionRounds, (unsigned)result.delivered, cycles);
+}
+
+int main(int argc, char **argv)
+{
+  int cycles = argc > 1 ? atoi(argv[1]) : 100;
+  srand(26);
+
+  BrokerStub stub;
+  bool local = argc <= 3;
+  if (local)
+  {
+    check(stub.start(), "broker stand-in did not start");
+    brokerIp = IPAddress(127, 0, 0, 1);
+    brokerPort = stub.port();
+  }
+  else
+  {
+    check(WiFiClient::resolve(argv[2], brokerIp), "broker host not resolved");
+    brokerPort = atoi(argv[3]);
+  }
+  uint32_t runId = (uint32_t)time(nullptr);
+  char id[48];
+
+  for (bool v5 : {false, true})
+  {
+    const char *version = v5 ? "5" : "3";
+    printf("%s\n", v5 ? "Mqtt5Client, MQTT 5" : "PubSubClient and TrackingClient, MQTT 3.1.1");
+    snprintf(id, sizeof(id), "storm-clean-%s-%u", version, (unsigned)runId);
+    Device clean(id, false, v5);
+    BrokerStub::Stats before = stub.stats();
+    Result cleanResult = storm(clean, cycles, runId);
+    uint32_t cleanSubscribes = stub.stats().subscribePackets - before.subscribePackets;
+    report("clean", cleanResult, clean, cycles);
+
+    snprintf(id, sizeof(id), "storm-persistent-%s-%u", version, (unsigned)runId);
+    Device persistent(id, true, v5);
+    before = stub.stats();
+    Result persistentResult = storm(persistent, cycles, runId);
+    uint32_t persistentSubscribes = stub.stats().subscribePackets - before.subscribePackets;
+    report("persistent", persistentResult, persistent, cycles);
+
+    check(cleanResult.failedConnects == 0 && persistentResult.failedConnects == 0, "reconnect failed");
+    check(clean.sessionsPresent == 0, "session present reported on a clean session");
+    check(persistent.sessionsPresent == (uint32_t)cycles, "session present not reported on every resumed session");
+    check(clean.subscriptionRounds == (uint32_t)cycles + 1, "clean session not subscribed on every connect");
+    check(persistent.subscriptionRounds == 1, "persistent session subscribed again");
+    check(persistentResult.delivered == (uint32_t)cycles, "messages for a persistent session lost");
+    check(cleanResult.delivered == 0, "clean session received messages sent while away");
+    if (local)
+    {
+      // Plus one for the controller's own subscription
+      check(cleanSubscribes == (cycles + 1) * clean.topics.size() + 1, "broker saw the wrong clean subscriptions");
+      check(persistentSubscribes == persistent.topics.size() + 1, "broker saw the wrong persistent subscriptions");
+    }
+
+    // A new topic on a resumed session: subscribed once more, then left alone
+    persistent.topics.push_back("fleet/" + persistent.id + "/ota");
+    Result changed = storm(persistent, 5, runId);
+    check(persistent.subscriptionRounds == 2, "changed topic set not subscribed exactly once");
+    check(changed.delivered == 5, "messages lost after the topic set changed");
+    printf("topic set changed: %u subscription rounds in total; session present on %u of %u connects\n",
+           (unsigned)persistent.subscriptionRounds, (unsigned)persistent.sessionsPresent, (unsigned)cycles + 7);
+  }
+
+  printf(failures == 0 ? "PASS\n" : "FAIL (%d)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
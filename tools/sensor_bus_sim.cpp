@@ -0,0 +1,159 @@
+// Host run of SensorBus with 1, 4 and 8 simulated AHT20s behind a TCA9548A
+// mux (the single sensor also directly on the bus), reading them the way
+// loop() does: trigger, wait the conversion time, then collect every
+// SENSOR_POLL_INTERVAL until ready. It checks that:
+//   - begin() finds every sensor on its own mux channel
+//   - each combined sample carries every sensor's values in channel order,
+//     and NAN for the slots no sensor was found for
+//   - a sensor on the main bus is not also looked for behind the mux
+//   - a sensor that vanishes makes collect() report an error
+// and prints, per cycle, the I2C bus time at 100 kHz and the time from
+// trigger to the combined sample, next to reading the same sensors one
+// after the other.
+//
+//   g++ -std=gnu++17 -O2 -Iinclude tools/sensor_bus_sim.cpp -o sensor_bus_sim
+//   ./sensor_bus_sim [cycles]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "sim_sensors.h"
+#include "Aht20Driver.h"
+#include "SensorBus.h"
+
+#define MAX_SENSORS 9
+#define POLL_INTERVAL 5 // As SENSOR_POLL_INTERVAL in main.cpp
+
+typedef SensorBus<SimI2cBus, Aht20Driver, MAX_SENSORS> Aht20Bus;
+typedef Aht20Driver<MuxChannelBus<SimI2cBus>> Single;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what, long cycle)
+{
+  if (ok)
+    return;
+  if (failures++ < 20)
+    printf("cycle %ld: %s\n", cycle, what);
+}
+
+static double randomIn(double low, double high)
+{
+  return low + (high - low) * (rand() / (double)RAND_MAX);
+}
+
+// Collect as loop() does; returns the status, time runs on in simNow
+template <class Sensor>
+static SensorStatus collectWhenDue(Sensor &sensor, uint32_t wait, float *values)
+{
+  uint32_t start = simNow;
+  simNow += wait;
+  SensorStatus status;
+  while ((status = sensor.collect(values)) == SENSOR_BUSY && simNow - start < 1000)
+    simNow += POLL_INTERVAL;
+  return status;
+}
+
+static void run(uint8_t count, bool behindMux, long cycles)
+{
+  SimI2cBus &bus = SimI2cBus::shared();
+  bus.clear();
+  SimTca9548a mux;
+  SimAht20 sims[8];
+  if (behindMux)
+    bus.attachMux(&mux);
+  for (uint8_t i = 0; i < count; i++)
+    bus.attach(&sims[i], behindMux ? i : -1);
+
+  Aht20Bus sensors;
+  check(sensors.begin() && sensors.count() == count, "not every sensor found", 0);
+  for (uint8_t i = 0; i < sensors.count(); i++)
+    check(sensors.muxChannel(i) == (behindMux ? i : 0xFF), "sensor found on the wrong channel", 0);
+
+  float values[Aht20Bus::CHANNELS];
+  double busTime = 0;
+  double latency = 0;
+  uint32_t transactions = 0;
+  for (long cycle = 0; cycle < cycles; cycle++)
+  {
+    for (uint8_t i = 0; i < count; i++)
+    {
+      sims[i].temperature = randomIn(-40, 85);
+      sims[i].humidity = randomIn(0, 100);
+    }
+    bus.resetStats();
+    uint32_t start = simNow;
+    SensorStatus status = collectWhenDue(sensors, sensors.trigger(), values);
+    check(status == SENSOR_READY, "combined sample not ready", cycle);
+    latency += simNow - start + bus.busTimeUs / 1000;
+    busTime += bus.busTimeUs;
+    transactions += bus.transactions;
+
+    for (uint8_t i = 0; i < MAX_SENSORS; i++)
+    {
+      if (i >= count)
+      {
+        check(isnan(values[i * 2]) && isnan(values[i * 2 + 1]), "empty slot not NAN", cycle);
+        continue;
+      }
+      check(fabs(values[i * 2] - sims[i].temperature) < 0.001 && fabs(values[i * 2 + 1] - sims[i].humidity) < 0.001,
+            "values of the wrong sensor", cycle);
+    }
+  }
+
+  // The same sensors read one after the other
+  uint8_t selected = 0xFF;
+  double serialBusTime = 0;
+  double serialLatency = 0;
+  for (long cycle = 0; cycle < cycles; cycle++)
+  {
+    bus.resetStats();
+    uint32_t start = simNow;
+    for (uint8_t i = 0; i < count; i++)
+    {
+      MuxChannelBus<SimI2cBus> view(bus, TCA9548A_ADDRESS, behindMux ? i : 0xFF, &selected);
+      Single single(view);
+      float single_values[2];
+      collectWhenDue(single, single.trigger(), single_values);
+    }
+    serialLatency += simNow - start + bus.busTimeUs / 1000;
+    serialBusTime += bus.busTimeUs;
+  }
+
+  // A vanished sensor
+  if (count > 1)
+  {
+    sims[count - 1].present = false;
+    check(collectWhenDue(sensors, sensors.trigger(), values) == SENSOR_ERROR, "vanished sensor not reported", cycles);
+  }
+
+  printf("%u sensor%s %-10s bus %5.2f ms in %2.0f transfers, sample after %6.1f ms (one by one: bus %5.2f ms, %6.1f ms)\n",
+         count, count > 1 ? "s" : " ", behindMux ? "behind mux" : "on the bus", busTime / cycles / 1000,
+         (double)transactions / cycles, latency / cycles, serialBusTime / cycles / 1000, serialLatency / cycles);
+}
+
+int main(int argc, char **argv)
+{
+  long cycles = argc > 1 ? atol(argv[1]) : 500;
+  srand(7);
+
+  run(1, false, cycles);
+  run(1, true, cycles);
+  run(4, true, cycles);
+  run(8, true, cycles);
+
+  // One AHT20 on the main bus shadows the mux channels
+  SimI2cBus &bus = SimI2cBus::shared();
+  bus.clear();
+  SimTca9548a mux;
+  SimAht20 direct;
+  SimAht20 behind;
+  bus.attachMux(&mux);
+  bus.attach(&direct);
+  bus.attach(&behind, 2);
+  Aht20Bus sensors;
+  check(sensors.begin() && sensors.count() == 1 && sensors.muxChannel(0) == 0xFF, "main bus sensor not kept alone", 0);
+
+  printf(failures == 0 ? "PASS\n" : "FAIL (%d)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,237 @@
+// Host run of the sensor fault handling: SensorHealth driving a simulated
+// AHT20 with the same steps as loop() in main.cpp (probe when due, sample at
+// the interval, report each sample's outcome). The sensor is missing at
+// boot, then disappears and reappears at random for a simulated week, and
+// its CRC is corrupted now and then. It checks that:
+//   - the loop never blocks and never samples a sensor in fault
+//   - every absence longer than SENSOR_FAILURES_TO_FAULT samples gives one
+//     fault, and a single bad reading gives none
+//   - the sensor is back in use within SENSOR_RETRY_MAX of reappearing
+//   - probes back off: no more than one per SENSOR_RETRY_MAX once it is long
+//     gone
+//   - a status message goes out on every change of state
+// and prints how long faults took to detect and to recover from.
+//
+//   g++ -std=gnu++17 -O2 -Iinclude tools/sensor_health_sim.cpp src/SensorHealth.cpp -o sensor_health_sim
+//   ./sensor_health_sim [days]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim_sensors.h"
+#include "Aht20Driver.h"
+#include "SensorHealth.h"
+
+// As in main.cpp
+#define SENSOR_RETRY_MIN 1000
+#define SENSOR_RETRY_MAX 60000
+#define SENSOR_FAILURES_TO_FAULT 3
+#define SENSOR_POLL_INTERVAL 5
+#define SENSOR_TIMEOUT 1000
+#define PUBLISH_INTERVAL 10000
+#define LOOP_TICK 5 // Milliseconds one pass of loop() takes
+
+typedef SensorSet<Aht20Driver<SimI2cBus>> Set;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+  if (ok)
+    return;
+  if (failures++ < 20)
+    printf("at %lu ms: %s\n", (unsigned long)simNow, what);
+}
+
+struct Device
+{
+  Set sensors;
+  SensorHealth health;
+  bool converting = false;
+  uint32_t conversionStart = 0;
+  uint32_t conversionWait = 0;
+  uint32_t lastSample = 0;
+
+  uint32_t samples = 0;
+  uint32_t probes = 0;
+  uint32_t statusMessages = 0;
+  char lastStatus[16] = "";
+  bool sampledInFault = false;
+
+  void setup()
+  {
+    health.configure(SENSOR_RETRY_MIN, SENSOR_RETRY_MAX, SENSOR_FAILURES_TO_FAULT);
+    probe();
+  }
+
+  void probe()
+  {
+    probes++;
+    health.probed(sensors.begin(), simNow);
+  }
+
+  // One pass of loop(), sensor part only
+  void loop()
+  {
+    if (!converting && health.probeDue(simNow))
+      probe();
+    if (health.changed())
+    {
+      health.clearChanged();
+      strcpy(lastStatus, health.stateName());
+      statusMessages++;
+    }
+
+    if (health.ok() && !converting && simNow - lastSample > PUBLISH_INTERVAL)
+    {
+      conversionWait = sensors.trigger();
+      conversionStart = simNow;
+      converting = true;
+      lastSample = simNow;
+    }
+    uint32_t elapsed = simNow - conversionStart;
+    if (converting && elapsed >= conversionWait)
+    {
+      float values[Set::CHANNELS];
+      SensorStatus status = sensors.collect(values);
+      if (status == SENSOR_BUSY && elapsed < SENSOR_TIMEOUT)
+        conversionWait = elapsed + SENSOR_POLL_INTERVAL;
+      else
+      {
+        converting = false;
+        sampledInFault = sampledInFault || !health.ok();
+        health.sampled(status == SENSOR_READY, simNow);
+        samples += status == SENSOR_READY;
+      }
+    }
+  }
+};
+
+int main(int argc, char **argv)
+{
+  double days = argc > 1 ? atof(argv[1]) : 7;
+  srand(46);
+
+  SimI2cBus &bus = SimI2cBus::shared();
+  SimAht20 chip;
+  bus.clear();
+  bus.attach(&chip);
+
+  // Missing at boot for 95 s
+  chip.present = false;
+  Device device;
+  device.setup();
+  device.loop();
+  check(strcmp(device.lastStatus, "probing") == 0, "no status for a sensor missing at boot");
+  while (simNow < 95000)
+  {
+    simNow += LOOP_TICK;
+    device.loop();
+  }
+  uint32_t bootProbes = device.probes;
+  check(device.samples == 0, "sampled a missing sensor");
+  // Probes at 0, 1, 3, 7, 15, 31 and 63 s
+  check(bootProbes == 7, "probes did not back off");
+  chip.present = true;
+  uint32_t appeared = simNow;
+  while (!device.health.ok() && simNow - appeared < 2 * SENSOR_RETRY_MAX)
+  {
+    simNow += LOOP_TICK;
+    device.loop();
+  }
+  check(device.health.ok() && simNow - appeared <= SENSOR_RETRY_MAX, "sensor found late after appearing at boot");
+  printf("missing at boot: %u probes in 95 s, found %.1f s after it appeared\n", (unsigned)bootProbes,
+         (simNow - appeared) / 1000.0);
+
+  // Outages at random for a simulated week, with the odd corrupted reading
+  uint32_t end = simNow + (uint32_t)(days * 86400000.0);
+  uint32_t nextEvent = simNow + 600000;
+  uint32_t outageStart = 0;
+  uint32_t outageLength = 0;
+  uint32_t outages = 0;
+  uint32_t longOutages = 0;
+  uint32_t glitches = 0;
+  uint32_t faultsBefore = device.health.faults();
+  uint32_t messagesBefore = device.statusMessages;
+  double detectTotal = 0, recoverTotal = 0;
+  uint32_t detectWorst = 0, recoverWorst = 0, detected = 0, recovered = 0;
+  bool inFault = false;
+  bool wasOk = true;
+  uint32_t reappeared = 0;
+  uint32_t probesInLongOutage = 0;
+
+  while (simNow < end)
+  {
+    simNow += LOOP_TICK;
+    if (chip.present && simNow >= nextEvent)
+    {
+      if (rand() % 4 == 0)
+      {
+        // One corrupted reading
+        chip.corrupt = true;
+        glitches++;
+        nextEvent = simNow + 60000 + rand() % 600000;
+      }
+      else
+      {
+        chip.present = false;
+        outageStart = simNow;
+        // From one missed sample to a few hours
+        outageLength = rand() % 3 == 0 ? 5000 + rand() % 15000 : 60000 + rand() % 10800000;
+        outages++;
+        longOutages += outageLength > (SENSOR_FAILURES_TO_FAULT + 1) * PUBLISH_INTERVAL;
+        nextEvent = outageStart + outageLength;
+        probesInLongOutage = device.probes;
+      }
+    }
+    else if (!chip.present && simNow >= nextEvent)
+    {
+      chip.present = true;
+      reappeared = simNow;
+      // Long gone: at most one probe per SENSOR_RETRY_MAX after the backoff grew
+      if (outageLength > 600000)
+        check(device.probes - probesInLongOutage <= 10 + outageLength / SENSOR_RETRY_MAX, "probing too often");
+      nextEvent = simNow + 60000 + rand() % 3600000;
+    }
+    uint32_t failedBefore = device.health.failedReads();
+    device.loop();
+    // The corrupted reading lasts for one sample
+    if (device.health.failedReads() != failedBefore)
+      chip.corrupt = false;
+
+    bool ok = device.health.ok();
+    if (wasOk && !ok)
+    {
+      inFault = true;
+      uint32_t latency = simNow - outageStart;
+      detectTotal += latency;
+      detectWorst = latency > detectWorst ? latency : detectWorst;
+      detected++;
+    }
+    if (!wasOk && ok && inFault)
+    {
+      inFault = false;
+      check(chip.present, "back in use while missing");
+      uint32_t latency = simNow - reappeared;
+      check(latency <= SENSOR_RETRY_MAX + PUBLISH_INTERVAL, "recovery slower than the longest backoff");
+      recoverTotal += latency;
+      recoverWorst = latency > recoverWorst ? latency : recoverWorst;
+      recovered++;
+    }
+    wasOk = ok;
+  }
+
+  uint32_t faults = device.health.faults() - faultsBefore;
+  check(!device.sampledInFault, "sampled while in fault");
+  check(faults >= longOutages && faults <= outages, "faults do not match the outages");
+  check(device.statusMessages - messagesBefore == 2 * faults - (inFault ? 1 : 0), "status not sent on every change");
+  printf("%.0f days: %u outages (%u long), %u corrupted readings, %u faults, %u status messages\n", days,
+         (unsigned)outages, (unsigned)longOutages, (unsigned)glitches, (unsigned)faults,
+         (unsigned)(device.statusMessages - messagesBefore));
+  printf("fault detected after %.1f s on average (worst %.1f s), back in use %.1f s after reappearing (worst %.1f s)\n",
+         detected ? detectTotal / detected / 1000 : 0, detectWorst / 1000.0,
+         recovered ? recoverTotal / recovered / 1000 : 0, recoverWorst / 1000.0);
+
+  printf(failures == 0 ? "PASS\n" : "FAIL (%d)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
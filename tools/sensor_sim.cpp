@@ -0,0 +1,193 @@
+// Host run of the sensor drivers against the simulated chips in
+// sim_sensors.h, in each build configuration the firmware can be compiled
+// with. For every configuration it checks that:
+//   - begin() finds all the chips, and names the missing one when a chip is
+//     absent
+//   - collect() reports SENSOR_BUSY before the conversion time is up
+//   - after the time trigger() returned, every channel carries the simulated
+//     value, to within the chip's resolution
+//   - a corrupted CRC or a chip that vanished gives SENSOR_ERROR
+//
+//   g++ -O2 -Iinclude tools/sensor_sim.cpp -o sensor_sim
+//   ./sensor_sim [cycles]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "sim_sensors.h"
+#include "Aht20Driver.h"
+#include "Sht3xDriver.h"
+
+typedef Aht20Driver<SimI2cBus> Aht20;
+typedef Sht3xDriver<SimI2cBus> Sht3x;
+typedef Bme280Driver<SimI2cBus> Bme280;
+typedef Ds18b20Driver<SimOneWireBus> Ds18b20;
+
+static int failures = 0;
+
+static void check(bool ok, const char *config, const char *what, long cycle)
+{
+  if (ok)
+    return;
+  if (failures++ < 20)
+    printf("%s, cycle %ld: %s\n", config, cycle, what);
+}
+
+static double randomIn(double low, double high)
+{
+  return low + (high - low) * (rand() / (double)RAND_MAX);
+}
+
+// The simulated chips; attach() puts the selected ones on the buses
+struct Bench
+{
+  SimAht20 aht20;
+  SimSht3x sht3x;
+  SimBme280 bme280;
+  SimOneWireBus &oneWire = SimOneWireBus::shared();
+
+  void attach(bool aht, bool sht, bool bme, bool ds)
+  {
+    SimI2cBus &bus = SimI2cBus::shared();
+    bus.clear();
+    if (aht)
+      bus.attach(&aht20);
+    if (sht)
+      bus.attach(&sht3x);
+    if (bme)
+      bus.attach(&bme280);
+    oneWire.present = ds;
+  }
+
+  void randomize()
+  {
+    aht20.temperature = randomIn(-40, 85);
+    aht20.humidity = randomIn(0, 100);
+    sht3x.temperature = randomIn(-40, 85);
+    sht3x.humidity = randomIn(0, 100);
+    bme280.temperature = randomIn(-40, 85);
+    bme280.humidity = randomIn(0, 100);
+    bme280.pressure = randomIn(300, 1100);
+    oneWire.temperature = randomIn(-55, 125);
+  }
+};
+
+// Expected values and tolerances, in channel order, for one driver type
+static void expect(const Aht20 *, Bench &b, double *v, double *tol)
+{
+  v[0] = b.aht20.temperature, tol[0] = 0.001;
+  v[1] = b.aht20.humidity, tol[1] = 0.001;
+}
+
+static void expect(const Sht3x *, Bench &b, double *v, double *tol)
+{
+  v[0] = b.sht3x.temperature, tol[0] = 0.002;
+  v[1] = b.sht3x.humidity, tol[1] = 0.002;
+}
+
+static void expect(const Bme280 *, Bench &b, double *v, double *tol)
+{
+  v[0] = b.bme280.temperature, tol[0] = 0.011;
+  v[1] = b.bme280.humidity, tol[1] = 0.02; // One humidity ADC step is about 0.012 %RH
+  v[2] = b.bme280.pressure, tol[2] = 0.011;
+}
+
+static void expect(const Ds18b20 *, Bench &b, double *v, double *tol)
+{
+  v[0] = b.oneWire.temperature, tol[0] = 0.0313;
+}
+
+static void expect(const NoSensor *, Bench &, double *, double *)
+{
+}
+
+template <class... Drivers>
+static void expectAll(Bench &b, double *v, double *tol)
+{
+  size_t offset = 0;
+  // Expands to one expect() per driver, in order
+  int unused[] = {0, (expect((const Drivers *)nullptr, b, v + offset, tol + offset), offset += Drivers::CHANNELS, 0)...};
+  (void)unused;
+}
+
+template <class... Drivers>
+static void run(const char *config, bool aht, bool sht, bool bme, bool ds, long cycles)
+{
+  typedef SensorSet<Drivers...> Set;
+  const uint8_t n = Set::CHANNELS;
+  Bench bench;
+  bench.attach(aht, sht, bme, ds);
+  Set sensors;
+  check(sensors.begin(), config, "begin() failed with every chip present", 0);
+
+  float values[n];
+  double expected[n];
+  double tolerance[n];
+  double worst = 0;
+  uint32_t longestWait = 0;
+
+  for (long cycle = 0; cycle < cycles; cycle++)
+  {
+    bench.randomize();
+    uint32_t wait = sensors.trigger();
+    longestWait = wait > longestWait ? wait : longestWait;
+    check(sensors.collect(values) == SENSOR_BUSY, config, "ready before the conversion time", cycle);
+    simNow += wait;
+    SensorStatus status = sensors.collect(values);
+    check(status == SENSOR_READY, config, "not ready after the conversion time", cycle);
+    if (status != SENSOR_READY)
+      continue;
+
+    expectAll<Drivers...>(bench, expected, tolerance);
+    for (uint8_t i = 0; i < n; i++)
+    {
+      double error = fabs(values[i] - expected[i]);
+      worst = error / tolerance[i] > worst ? error / tolerance[i] : worst;
+      if (error > tolerance[i])
+      {
+        char what[96];
+        snprintf(what, sizeof(what), "channel %s: got %.4f, simulated %.4f", Set::channel(i).key, values[i],
+                 expected[i]);
+        check(false, config, what, cycle);
+      }
+    }
+  }
+
+  // Corrupted CRCs
+  bench.aht20.corrupt = bench.sht3x.corrupt = bench.oneWire.corrupt = true;
+  if (aht || sht || ds)
+  {
+    simNow += sensors.trigger();
+    check(sensors.collect(values) == SENSOR_ERROR, config, "corrupted CRC not detected", cycles);
+  }
+  bench.aht20.corrupt = bench.sht3x.corrupt = bench.oneWire.corrupt = false;
+
+  // A chip disappearing between cycles, and missing at begin()
+  bench.attach(false, false, false, false);
+  simNow += sensors.trigger();
+  check(sensors.collect(values) == SENSOR_ERROR, config, "vanished chip not reported", cycles);
+  Set missing;
+  check(!missing.begin() && missing.failed() != nullptr, config, "missing chip not reported by begin()", cycles);
+
+  printf("%-34s %u channels, %3u bytes (host), %3lu ms per sample, worst error %.2f of resolution\n", config, n,
+         (unsigned)sizeof(Set), (unsigned long)longestWait, worst);
+}
+
+int main(int argc, char **argv)
+{
+  long cycles = argc > 1 ? atol(argv[1]) : 2000;
+  srand(42);
+
+  run<Aht20>("AHT20", true, false, false, false, cycles);
+  run<Sht3x>("SHT3x", false, true, false, false, cycles);
+  run<Bme280>("BME280", false, false, true, false, cycles);
+  run<Ds18b20>("DS18B20", false, false, false, true, cycles);
+  run<Aht20, Sht3x, Bme280, Ds18b20>("AHT20 + SHT3x + BME280 + DS18B20", true, true, true, true, cycles);
+  // Unselected slots, as Sensors.h builds them, cost nothing
+  run<NoSensor, Sht3x, NoSensor, NoSensor>("SHT3x with three empty slots", false, true, false, false, cycles);
+  check(sizeof(SensorSet<NoSensor, Sht3x, NoSensor, NoSensor>) == sizeof(SensorSet<Sht3x>), "SHT3x", "empty slots use RAM",
+        0);
+
+  printf(failures == 0 ? "PASS\n" : "FAIL (%d)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
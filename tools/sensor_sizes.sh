@@ -0,0 +1,62 @@
+#!/bin/sh
+# Code size of each sensor driver selection.
+#
+# With PlatformIO installed, builds the d1_mini environments from
+# platformio.ini and prints their flash and RAM use. Without it, builds the
+# same Sensors.h selection on the host against the simulated buses in
+# tools/sim_sensors.h and prints the code the drivers add over an empty
+# program; the host numbers are x86-64, so only the differences between
+# configurations carry over to the ESP8266.
+#
+#   tools/sensor_sizes.sh
+
+cd "$(dirname "$0")/.." || exit 1
+
+CONFIGS="d1_mini:-DSENSOR_AHT20
+d1_mini_sht3x:-DSENSOR_SHT3X
+d1_mini_bme280:-DSENSOR_BME280
+d1_mini_ds18b20:-DSENSOR_DS18B20
+d1_mini_all_sensors:-DSENSOR_AHT20 -DSENSOR_SHT3X -DSENSOR_BME280 -DSENSOR_DS18B20
+d1_mini_aht20_mux:-DSENSOR_AHT20=8"
+
+if command -v pio >/dev/null 2>&1; then
+  echo "$CONFIGS" | while IFS=: read -r env flags; do
+    printf '%-22s ' "$env"
+    pio run -e "$env" 2>&1 | grep -E '^(RAM|Flash):' | tr -s ' ' | tr '\n' ' '
+    echo
+  done
+  exit 0
+fi
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cat >"$dir/probe.cpp" <<'EOF'
+#include "sim_sensors.h"
+#ifdef BASELINE
+int main() { return (int)simNow; }
+#else
+#define SENSOR_I2C_BUS SimI2cBus
+#define SENSOR_ONEWIRE_BUS SimOneWireBus
+#include "Sensors.h"
+Sensors sensors;
+float values[Sensors::CHANNELS];
+int main()
+{
+  sensors.begin();
+  simNow += sensors.trigger();
+  return sensors.collect(values);
+}
+#endif
+EOF
+
+build() {
+  g++ -std=gnu++17 -Os -ffunction-sections -fdata-sections -Wl,--gc-sections -Iinclude -Itools $1 \
+    "$dir/probe.cpp" -o "$dir/probe" && size "$dir/probe" | awk 'NR == 2 { print $1 }'
+}
+
+base=$(build -DBASELINE) || exit 1
+echo "host build, bytes of code over an empty program:"
+echo "$CONFIGS" | while IFS=: read -r env flags; do
+  text=$(build "$flags") || exit 1
+  printf '  %-22s %6d  (%s)\n' "$env" $((text - base)) "$flags"
+done
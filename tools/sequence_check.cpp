@@ -0,0 +1,112 @@
+// Host check of the sample sequence rules across resets. It drives the
+// firmware's SampleSequence through random runs of samples, deep sleep wakes,
+// resets and power losses, with flash and RTC memory kept the way main.cpp
+// keeps them, and fails on any broken rule:
+//   - published sequence numbers strictly increase, across everything
+//   - within a boot they increase by exactly one per sample
+//   - the boot counter goes up by one on every reset and power loss, and
+//     stays the same across a deep sleep wake
+//   - a power loss skips at most RESERVE_BLOCK numbers
+//   - flash is written at most once per boot plus once per reserved block
+//
+//   g++ -O2 -Iinclude tools/sequence_check.cpp src/SampleSequence.cpp -o sequence_check
+//   ./sequence_check [events]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "SampleSequence.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char *rule, long event)
+{
+  if (ok)
+    return;
+  if (failures++ < 10)
+    printf("event %ld: %s\n", event, rule);
+}
+
+int main(int argc, char **argv)
+{
+  long events = argc > 1 ? atol(argv[1]) : 1000000;
+
+  // Device storage: flash survives everything, RTC memory survives resets
+  uint32_t flashBoot = 0, flashReserved = 0;
+  bool rtcValid = false;
+  uint32_t rtcSeq = 0;
+  long flashWrites = 0, boots = 0, samples = 0;
+
+  SampleSequence sequence;
+  uint32_t lastSeq = 0, lastBoot = 0;
+  bool anyPublished = false, powerLost = false;
+
+  srand(1);
+  for (long event = 0; event < events; event++)
+  {
+    if (event == 0 || rand() % 100 < 3)
+    {
+      // Boot: cold start first, then a mix of deep sleep wakes, resets and power losses
+      int kind = event == 0 ? 2 : rand() % 3;
+      bool deepSleepWake = kind == 0;
+      if (kind == 2)
+      {
+        rtcValid = false;
+        powerLost = true;
+      }
+      sequence.begin(rtcValid, rtcSeq, deepSleepWake, flashBoot, flashReserved);
+      if (sequence.storeDue())
+      {
+        flashBoot = sequence.boot();
+        flashReserved = sequence.reserved();
+        sequence.stored();
+        flashWrites++;
+      }
+      rtcValid = true;
+      rtcSeq = sequence.current();
+      boots++;
+
+      if (anyPublished)
+      {
+        if (deepSleepWake)
+          check(sequence.boot() == lastBoot, "boot counter changed across a deep sleep wake", event);
+        else
+          check(sequence.boot() == lastBoot + 1, "boot counter did not go up by one on reset", event);
+      }
+      lastBoot = sequence.boot();
+      continue;
+    }
+
+    // Sample: reserve in flash first, then keep the number in RTC, then publish
+    uint32_t seq = sequence.next();
+    if (sequence.storeDue())
+    {
+      flashBoot = sequence.boot();
+      flashReserved = sequence.reserved();
+      sequence.stored();
+      flashWrites++;
+    }
+    rtcSeq = seq;
+    samples++;
+
+    if (anyPublished)
+    {
+      check(seq > lastSeq, "sequence did not increase", event);
+      if (powerLost)
+        check(seq - lastSeq <= SampleSequence::RESERVE_BLOCK, "power loss skipped more than one block", event);
+      else
+        check(seq == lastSeq + 1, "sequence skipped a number without a power loss", event);
+    }
+    check(sequence.boot() == lastBoot, "boot counter changed between samples", event);
+    anyPublished = true;
+    powerLost = false;
+    lastSeq = seq;
+  }
+
+  long writeLimit = boots + samples / SampleSequence::RESERVE_BLOCK + 1;
+  check(flashWrites <= writeLimit, "too many flash writes", events);
+
+  printf("%ld events: %ld samples, %ld boots, last seq %lu, boot %lu, %ld flash writes (limit %ld)\n", events,
+         samples, boots, (unsigned long)lastSeq, (unsigned long)lastBoot, flashWrites, writeLimit);
+  printf(failures == 0 ? "all sequence rules held\n" : "%d rule violations\n", failures);
+  return failures == 0 ? 0 : 1;
+}
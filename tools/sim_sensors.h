@@ -0,0 +1,457 @@
+// Simulated sensor buses and chips for running the firmware's sensor drivers
+// on the host. The chips model what the drivers depend on: command bytes,
+// conversion times, busy flags or NACKs while converting, data layout and
+// CRCs. Time only moves when someone calls wait() or sets simNow.
+//
+// Used by tools/sensor_sim.cpp, tools/sensor_bus_sim.cpp,
+// tools/wire_bus_sim.cpp (through tools/host/Wire.h) and
+// tools/sensor_sizes.sh.
+
+#ifndef SIM_SENSORS_H
+#define SIM_SENSORS_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "SensorDriver.h"
+#include "Bme280Driver.h"
+#include "Ds18b20Driver.h"
+
+static uint32_t simNow = 0; // Milliseconds
+
+class SimI2cDevice
+{
+public:
+  explicit SimI2cDevice(uint8_t address) : address(address) {}
+  virtual ~SimI2cDevice() {}
+  virtual bool write(const uint8_t *data, size_t length) = 0;
+  virtual bool read(uint8_t *data, size_t length) = 0;
+
+  uint8_t address;
+  bool present = true;
+  int8_t muxChannel = -1; // TCA9548A channel the device sits behind, -1 = main bus
+  uint32_t stretchUs = 0; // Clock stretching per transfer
+};
+
+// TCA9548A mux: one control byte, a bit per downstream channel
+class SimTca9548a : public SimI2cDevice
+{
+public:
+  explicit SimTca9548a(uint8_t address = 0x70) : SimI2cDevice(address) {}
+
+  bool write(const uint8_t *data, size_t length) override
+  {
+    if (length != 1)
+      return false;
+    mask = data[0];
+    return true;
+  }
+
+  bool read(uint8_t *data, size_t length) override
+  {
+    memset(data, mask, length);
+    return true;
+  }
+
+  uint8_t mask = 0; // All channels off at power-up
+};
+
+// I2C bus with an optional mux. Two devices answering one address (such as
+// the same address on two enabled mux channels) make the transfer fail, as
+// the collision would on a real bus. Bus time is counted at clockHz.
+//
+// The lines are modelled as far as the bus recovery needs: a slave left
+// mid-byte holds SDA low (sdaHeldClocks > 0) until SCL has been pulsed that
+// many times, and every transfer fails meanwhile; a slave stretching the
+// clock past stretchLimitUs fails the transfer. busError tells those failures
+// apart from a NACK.
+class SimI2cBus
+{
+public:
+  static SimI2cBus &shared()
+  {
+    static SimI2cBus bus;
+    return bus;
+  }
+
+  void attach(SimI2cDevice *device, int8_t muxChannel = -1)
+  {
+    device->muxChannel = muxChannel;
+    _devices.push_back(device);
+  }
+  void attachMux(SimTca9548a *mux)
+  {
+    _mux = mux;
+    _devices.push_back(mux);
+  }
+  void clear()
+  {
+    _devices.clear();
+    _mux = nullptr;
+  }
+
+  void begin() {}
+
+  bool write(uint8_t address, const uint8_t *data, size_t length)
+  {
+    SimI2cDevice *device = start(address, length);
+    return device != nullptr && device->write(data, length);
+  }
+
+  bool read(uint8_t address, uint8_t *data, size_t length)
+  {
+    SimI2cDevice *device = start(address, length);
+    return device != nullptr && device->read(data, length);
+  }
+
+  // SCL driven by the master outside a transfer
+  void sclPulse()
+  {
+    if (sdaHeldClocks > 0)
+      sdaHeldClocks--;
+  }
+
+  void wait(uint32_t ms) { simNow += ms; }
+
+  void resetStats()
+  {
+    transactions = 0;
+    bytes = 0;
+    busTimeUs = 0;
+  }
+
+  uint32_t clockHz = 100000;
+  uint32_t stretchLimitUs = UINT32_MAX;
+  uint8_t sdaHeldClocks = 0;
+  bool busError = false; // Last transfer failed on the lines, not by a NACK
+  uint32_t transactions = 0;
+  uint32_t bytes = 0;   // Including address bytes
+  double busTimeUs = 0; // START, 9 clocks per byte with its ACK, STOP
+
+private:
+  // Counts the transfer and finds the device for it, nullptr if it fails
+  SimI2cDevice *start(uint8_t address, size_t length)
+  {
+    transactions++;
+    bytes += length + 1;
+    busTimeUs += (2 + 9.0 * (length + 1)) * 1e6 / clockHz;
+    busError = sdaHeldClocks > 0;
+    if (busError)
+      return nullptr;
+    SimI2cDevice *device = find(address);
+    if (device == nullptr)
+      return nullptr;
+    busTimeUs += device->stretchUs < stretchLimitUs ? device->stretchUs : stretchLimitUs;
+    busError = device->stretchUs > stretchLimitUs;
+    return busError ? nullptr : device;
+  }
+
+  SimI2cDevice *find(uint8_t address)
+  {
+    SimI2cDevice *found = nullptr;
+    for (SimI2cDevice *device : _devices)
+    {
+      if (device->address != address || !device->present)
+        continue;
+      if (device->muxChannel >= 0 &&
+          (_mux == nullptr || !_mux->present || !(_mux->mask & (1 << device->muxChannel))))
+        continue;
+      if (found != nullptr)
+        return nullptr;
+      found = device;
+    }
+    return found;
+  }
+
+  std::vector<SimI2cDevice *> _devices;
+  SimTca9548a *_mux = nullptr;
+};
+
+// AHT20: status bit 7 busy, bit 3 calibrated; 20-bit humidity and
+// temperature packed into 5 bytes, then a CRC
+class SimAht20 : public SimI2cDevice
+{
+public:
+  explicit SimAht20(uint8_t address = 0x38) : SimI2cDevice(address) {}
+
+  bool write(const uint8_t *data, size_t length) override
+  {
+    if (length == 3 && data[0] == 0xBE)
+      calibrated = true;
+    else if (length == 3 && data[0] == 0xAC && data[1] == 0x33)
+      _start = simNow, _measured = true;
+    return true;
+  }
+
+  bool read(uint8_t *data, size_t length) override
+  {
+    uint8_t out[7];
+    bool busy = _measured && simNow - _start < 80;
+    out[0] = (busy ? 0x80 : 0) | (calibrated ? 0x08 : 0) | 0x10;
+    uint32_t h = (uint32_t)lround(humidity / 100 * 1048576);
+    uint32_t t = (uint32_t)lround((temperature + 50) / 200 * 1048576);
+    h = h > 0xFFFFF ? 0xFFFFF : h;
+    t = t > 0xFFFFF ? 0xFFFFF : t;
+    out[1] = h >> 12;
+    out[2] = h >> 4;
+    out[3] = (h << 4) | (t >> 16);
+    out[4] = t >> 8;
+    out[5] = t;
+    out[6] = sensorCrc8(out, 6) ^ (corrupt ? 0x55 : 0);
+    memcpy(data, out, length < sizeof(out) ? length : sizeof(out));
+    return true;
+  }
+
+  double temperature = 21.5;
+  double humidity = 45.0;
+  bool calibrated = false;
+  bool corrupt = false;
+
+private:
+  uint32_t _start = 0;
+  bool _measured = false;
+};
+
+// SHT3x in single shot mode without clock stretching: NACKs reads until the
+// conversion is done, and the result can be read once
+class SimSht3x : public SimI2cDevice
+{
+public:
+  explicit SimSht3x(uint8_t address = 0x44) : SimI2cDevice(address) {}
+
+  bool write(const uint8_t *data, size_t length) override
+  {
+    if (length == 2 && data[0] == 0x24 && data[1] == 0x00)
+      _start = simNow, _pending = true;
+    else if (length == 2 && data[0] == 0x30 && data[1] == 0xA2)
+      _pending = false;
+    return true;
+  }
+
+  bool read(uint8_t *data, size_t length) override
+  {
+    if (!_pending || simNow - _start < 16 || length != 6)
+      return false;
+    _pending = false;
+    uint16_t t = (uint16_t)lround((temperature + 45) / 175 * 65535);
+    uint16_t h = (uint16_t)lround(humidity / 100 * 65535);
+    data[0] = t >> 8;
+    data[1] = t;
+    data[2] = sensorCrc8(data, 2);
+    data[3] = h >> 8;
+    data[4] = h;
+    data[5] = sensorCrc8(data + 3, 2) ^ (corrupt ? 0x55 : 0);
+    return true;
+  }
+
+  double temperature = 22.0;
+  double humidity = 50.0;
+  bool corrupt = false;
+
+private:
+  uint32_t _start = 0;
+  bool _pending = false;
+};
+
+// BME280 register file with the calibration of a real chip. Raw values are
+// found by searching for the ADC reading the datasheet formulas turn into
+// the wanted value.
+class SimBme280 : public SimI2cDevice
+{
+public:
+  typedef Bme280Driver<SimI2cBus> Driver;
+
+  explicit SimBme280(uint8_t address = 0x76) : SimI2cDevice(address)
+  {
+    memset(_regs, 0, sizeof(_regs));
+    _regs[0xD0] = 0x60;
+    static const uint8_t cal[26] = {0x70, 0x6B, 0x43, 0x67, 0x18, 0xFC, 0x7D, 0x8E, 0x43, 0xD6, 0xD0, 0x0B,
+                                    0x27, 0x0B, 0x8C, 0x00, 0xF9, 0xFF, 0x8C, 0x3C, 0xF8, 0xC6, 0x70, 0x17,
+                                    0x00, 0x4B};
+    static const uint8_t calH[7] = {0x6A, 0x01, 0x00, 0x13, 0x2A, 0x03, 0x1E};
+    memcpy(_regs + 0x88, cal, sizeof(cal));
+    memcpy(_regs + 0xE1, calH, sizeof(calH));
+  }
+
+  bool write(const uint8_t *data, size_t length) override
+  {
+    if (length == 0)
+      return false;
+    _pointer = data[0];
+    if (length == 2)
+    {
+      _regs[_pointer] = data[1];
+      if (_pointer == 0xF4 && (data[1] & 0x03) == 0x01)
+      {
+        _start = simNow;
+        _measured = true;
+        convert();
+      }
+    }
+    return true;
+  }
+
+  bool read(uint8_t *data, size_t length) override
+  {
+    _regs[0xF3] = _measured && simNow - _start < 10 ? 0x08 : 0;
+    for (size_t i = 0; i < length; i++)
+      data[i] = _regs[(uint8_t)(_pointer + i)];
+    return true;
+  }
+
+  double temperature = 19.0;
+  double humidity = 55.0;
+  double pressure = 1013.25;
+
+private:
+  void convert()
+  {
+    Driver::Calibration cal = calibration();
+    int32_t tFine = 0;
+    int32_t adcT = search(0, 0xFFFFF, [&](int32_t adc) {
+      int32_t fine;
+      return Driver::compensateTemperature(cal, adc, fine) >= lround(temperature * 100);
+    });
+    Driver::compensateTemperature(cal, adcT, tFine);
+    int32_t adcP = search(0, 0xFFFFF, [&](int32_t adc) {
+      return Driver::compensatePressure(cal, adc, tFine) <= (uint32_t)lround(pressure * 25600);
+    });
+    int32_t adcH = search(0, 0xFFFF, [&](int32_t adc) {
+      return Driver::compensateHumidity(cal, adc, tFine) >= (uint32_t)lround(humidity * 1024);
+    });
+    _regs[0xF7] = adcP >> 12;
+    _regs[0xF8] = adcP >> 4;
+    _regs[0xF9] = adcP << 4;
+    _regs[0xFA] = adcT >> 12;
+    _regs[0xFB] = adcT >> 4;
+    _regs[0xFC] = adcT << 4;
+    _regs[0xFD] = adcH >> 8;
+    _regs[0xFE] = adcH;
+  }
+
+  // Smallest ADC value in [low, high] for which reached() holds
+  template <class Predicate>
+  static int32_t search(int32_t low, int32_t high, Predicate reached)
+  {
+    while (low < high)
+    {
+      int32_t mid = low + (high - low) / 2;
+      if (reached(mid))
+        high = mid;
+      else
+        low = mid + 1;
+    }
+    return low;
+  }
+
+  Driver::Calibration calibration() const
+  {
+    const uint8_t *c = _regs + 0x88;
+    const uint8_t *h = _regs + 0xE1;
+    Driver::Calibration cal;
+    cal.t1 = c[0] | (c[1] << 8);
+    cal.t2 = c[2] | (c[3] << 8);
+    cal.t3 = c[4] | (c[5] << 8);
+    cal.p1 = c[6] | (c[7] << 8);
+    cal.p2 = c[8] | (c[9] << 8);
+    cal.p3 = c[10] | (c[11] << 8);
+    cal.p4 = c[12] | (c[13] << 8);
+    cal.p5 = c[14] | (c[15] << 8);
+    cal.p6 = c[16] | (c[17] << 8);
+    cal.p7 = c[18] | (c[19] << 8);
+    cal.p8 = c[20] | (c[21] << 8);
+    cal.p9 = c[22] | (c[23] << 8);
+    cal.h1 = c[25];
+    cal.h2 = h[0] | (h[1] << 8);
+    cal.h3 = h[2];
+    cal.h4 = (int16_t)((int8_t)h[3] * 16) | (h[4] & 0x0F);
+    cal.h5 = (int16_t)((int8_t)h[5] * 16) | (h[4] >> 4);
+    cal.h6 = (int8_t)h[6];
+    return cal;
+  }
+
+  uint8_t _regs[256];
+  uint8_t _pointer = 0;
+  uint32_t _start = 0;
+  bool _measured = false;
+};
+
+// 1-Wire bus with one DS18B20 on it
+class SimOneWireBus
+{
+public:
+  static SimOneWireBus &shared()
+  {
+    static SimOneWireBus bus;
+    return bus;
+  }
+
+  void begin() {}
+
+  bool reset()
+  {
+    _command = 0;
+    _readPos = 0;
+    return present;
+  }
+
+  void skip() {}
+
+  void write(uint8_t value)
+  {
+    if (!present)
+      return;
+    _command = value;
+    if (value == 0x44)
+      _start = simNow, _converted = false;
+    if (value == 0xBE)
+    {
+      if (!_converted && simNow - _start >= 750)
+      {
+        _raw = (int16_t)lround(temperature * 16);
+        _converted = true;
+      }
+      _scratchpad[0] = _raw;
+      _scratchpad[1] = _raw >> 8;
+      _scratchpad[2] = 0x4B;
+      _scratchpad[3] = 0x46;
+      _scratchpad[4] = 0x7F; // 12-bit resolution
+      _scratchpad[5] = 0xFF;
+      _scratchpad[6] = 0x0C;
+      _scratchpad[7] = 0x10;
+      _scratchpad[8] = Ds18b20Driver<SimOneWireBus>::crc8(_scratchpad, 8) ^ (corrupt ? 0x55 : 0);
+    }
+  }
+
+  // Read slot right after CONVERT T: 0 while converting, 1 when done
+  bool readBit()
+  {
+    if (!present)
+      return true;
+    return _command != 0x44 || simNow - _start >= 750;
+  }
+
+  uint8_t read()
+  {
+    if (!present || _command != 0xBE || _readPos >= sizeof(_scratchpad))
+      return 0xFF;
+    return _scratchpad[_readPos++];
+  }
+
+  void wait(uint32_t ms) { simNow += ms; }
+
+  double temperature = 18.25;
+  bool present = true;
+  bool corrupt = false;
+
+private:
+  uint8_t _command = 0;
+  uint8_t _readPos = 0;
+  uint8_t _scratchpad[9] = {};
+  int16_t _raw = 0x0550; // 85 degC, the power-on value
+  uint32_t _start = 0;
+  bool _converted = false;
+};
+
+#endif
@@ -0,0 +1,186 @@
+// Host check of dead-peer detection with the keepalive and socket timeout set
+// as configureMQTT() sets them, on real sockets against the broker stand-in in
+// tools/net. The broker is black-holed three ways:
+//   - silent from the start: TCP connects, CONNECT gets no CONNACK
+//   - silent once connected: nothing comes back, not even PINGRESP
+//   - no longer reading: the device's TCP send buffer fills up
+// and the time from the fault to the client giving up is measured. It checks
+// that connect() gives up after the socket timeout, that a silent peer is
+// dropped within two keepalive periods, that a stalled write gives up after
+// the socket timeout, and that no single loop() or publish() call blocks for
+// longer than the socket timeout.
+//
+// Each fault runs against both clients configureMQTT() sets up: PubSubClient,
+// the default, and Mqtt5Client. PubSubClient is a platformio.ini dependency and
+// not part of the tree, so it runs as the 2.8 stand-in in tools/net; a change
+// to the library's timing rules has to be carried over there. PubSubClient
+// fails a short write but keeps the connection, so a stalled peer is only
+// dropped by the keepalive, up to two socket timeouts later than Mqtt5Client,
+// which closes on the short write. The firmware treats the connection as gone when
+// connected() says so, and so does this check.
+//
+//   g++ -std=gnu++17 -O2 -Iinclude -Itools/net tools/socket_timeout_check.cpp src/Mqtt5Client.cpp -lpthread -o socket_timeout_check
+//   ./socket_timeout_check [keepalive s] [socket timeout s]
+
+#include "WiFiClient.h"
+#include "broker_stub.h"
+#include "Mqtt5Client.h"
+#include "PubSubClient.h"
+
+#define PUBLISH_INTERVAL 100 // Milliseconds between publishes while connected
+#define MARGIN 250           // Scheduling slack allowed on top of the limits, ms
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+  if (ok)
+    return;
+  if (failures++ < 20)
+    printf("FAILED: %s\n", what);
+}
+
+struct Device
+{
+  WiFiClient net;
+  PubSubClient mqtt3{net};
+  Mqtt5Client mqtt5{net};
+  bool v5;
+  unsigned long longestCall = 0; // Longest single loop() or publish(), ms
+
+  // configureMQTT()
+  Device(uint16_t port, uint16_t keepAlive, uint16_t socketTimeout, bool v5) : v5(v5)
+  {
+    mqtt3.setServer(IPAddress(127, 0, 0, 1), port);
+    mqtt3.setBufferSize(1024);
+    mqtt3.setKeepAlive(keepAlive);
+    mqtt3.setSocketTimeout(socketTimeout);
+    mqtt5.setServer(IPAddress(127, 0, 0, 1), port);
+    mqtt5.setKeepAlive(keepAlive);
+    mqtt5.setSocketTimeout(socketTimeout);
+    net.setTimeout(socketTimeout * 1000UL);
+  }
+
+  bool connect()
+  {
+    if (v5)
+      return mqtt5.connect("timeout-check", nullptr, nullptr, true, 0);
+    return mqtt3.connect("timeout-check", nullptr, nullptr, nullptr, 0, false, nullptr, true);
+  }
+  bool connected() { return v5 ? mqtt5.connected() : mqtt3.connected(); }
+  bool loop() { return v5 ? mqtt5.loop() : mqtt3.loop(); }
+  int state() { return v5 ? mqtt5.state() : mqtt3.state(); }
+  bool timedOut() { return state() == (v5 ? MQTT5_CONNECTION_TIMEOUT : MQTT_CONNECTION_TIMEOUT); }
+
+  bool publish(const uint8_t *payload, size_t length)
+  {
+    if (v5)
+      return mqtt5.publish("timeout/check", payload, length, false, 0);
+    return mqtt3.publish("timeout/check", payload, length, false);
+  }
+
+  void note(unsigned long call) { longestCall = call > longestCall ? call : longestCall; }
+
+  // Runs loop() and publishes until the client reports the connection gone;
+  // returns how long that took, or 0 if it never did within limitMs
+  unsigned long runUntilDead(unsigned long limitMs, size_t payloadSize)
+  {
+    static uint8_t payload[512];
+    unsigned long start = millis();
+    unsigned long lastPublish = 0;
+    while (millis() - start < limitMs)
+    {
+      unsigned long callStart = millis();
+      loop();
+      note(millis() - callStart);
+      if (connected() && millis() - lastPublish >= PUBLISH_INTERVAL)
+      {
+        lastPublish = callStart = millis();
+        publish(payload, payloadSize);
+        note(millis() - callStart);
+      }
+      if (!connected())
+        return millis() - start;
+      delay(5);
+    }
+    return 0;
+  }
+};
+
+int main(int argc, char **argv)
+{
+  uint16_t keepAlive = argc > 1 ? atoi(argv[1]) : 2;
+  uint16_t socketTimeout = argc > 2 ? atoi(argv[2]) : 1;
+  unsigned long keepAliveMs = keepAlive * 1000UL;
+  unsigned long timeoutMs = socketTimeout * 1000UL;
+
+  BrokerStub broker;
+  check(broker.start(), "broker stand-in did not start");
+  printf("keepalive %u s, socket timeout %u s\n", keepAlive, socketTimeout);
+
+  for (bool v5 : {false, true})
+  {
+    const char *name = v5 ? "Mqtt5Client" : "PubSubClient";
+    printf("%s\n", name);
+
+    // Silent from the start
+    {
+      Device device(broker.port(), keepAlive, socketTimeout, v5);
+      broker.setSilent(true);
+      unsigned long start = millis();
+      bool connected = device.connect();
+      unsigned long took = millis() - start;
+      broker.setSilent(false);
+      check(!connected && device.timedOut(), "connect to a silent broker succeeded");
+      check(took >= timeoutMs && took <= timeoutMs + MARGIN, "connect did not give up after the socket timeout");
+      printf("  no CONNACK:      connect gave up after %lu ms\n", took);
+    }
+
+    // Silent once connected, with publishes still going out
+    {
+      Device device(broker.port(), keepAlive, socketTimeout, v5);
+      check(device.connect(), "connect failed");
+      check(device.runUntilDead(keepAliveMs, 16) == 0, "healthy connection dropped");
+      broker.setSilent(true);
+      unsigned long took = device.runUntilDead(4 * keepAliveMs, 16);
+      broker.setSilent(false);
+      check(took > 0 && took <= 2 * keepAliveMs + MARGIN, "silent peer not dropped within two keepalive periods");
+      check(device.longestCall <= timeoutMs + MARGIN, "a call blocked past the socket timeout");
+      printf("  silent peer:     dropped after %lu ms (state %d), longest call %lu ms\n", took, device.state(),
+             device.longestCall);
+    }
+
+    // No longer reading: the writes stall once the buffers are full. On
+    // PubSubClient the keepalive does the drop, and both the PINGREQ and the
+    // check that drops the connection can wait behind a stalled publish, which
+    // adds up to two socket timeouts.
+    {
+      Device device(broker.port(), keepAlive, socketTimeout, v5);
+      check(device.connect(), "connect failed");
+      broker.setStopReading(true);
+      unsigned long took = device.runUntilDead(4 * keepAliveMs, 512);
+      broker.setStopReading(false);
+      unsigned long limit = 2 * keepAliveMs + (v5 ? 0 : 2 * timeoutMs) + MARGIN;
+      check(took > 0 && took <= limit, "stalled peer not dropped");
+      check(device.longestCall >= timeoutMs && device.longestCall <= timeoutMs + MARGIN,
+            "stalled write did not give up after the socket timeout");
+      printf("  stalled peer:    dropped after %lu ms (state %d), longest call %lu ms\n", took, device.state(),
+             device.longestCall);
+    }
+
+    // Refused: the broker is down
+    {
+      Device device(broker.port(), keepAlive, socketTimeout, v5);
+      broker.setDown(true);
+      unsigned long start = millis();
+      bool connected = device.connect();
+      unsigned long took = millis() - start;
+      broker.setDown(false);
+      check(!connected && took <= MARGIN, "refused connect did not fail at once");
+      printf("  broker down:     connect failed after %lu ms\n", took);
+    }
+  }
+
+  printf(failures == 0 ? "PASS\n" : "FAIL (%d)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+// Host check of the publish shaper (TokenBucket) under a backlog drain, on a
+// simulated clock. A device comes back from a long disconnect with more queued
+// messages than it can send, and each pass of loop(), 1 to 50 ms apart, sends
+// as many as the bucket allows. For several rate and burst settings it
+// checks that:
+//   - the bucket never holds more than the burst, also when the burst is
+//     lowered while it is full
+//   - no window of 1, 10 or 60 s lets through more than rate * window + burst
+//   - the average rate over the whole run is the configured rate when the
+//     burst covers a pass of loop() worth of refill (burst >= 1 + rate *
+//     LOOP_MAX). With less, a pass that comes late finds the bucket capped
+//     at the burst and the excess is gone: the rate then falls short, by at
+//     most one pass per message, which is checked instead
+//   - peakBurst() stays within the burst, and throttleTimeMs() and
+//     throttled() match the waits the caller actually saw
+//   - a refunded token can be taken again, is not counted in sent() and
+//     never fills the bucket over the burst
+//
+//   g++ -std=gnu++17 -O2 -Iinclude -Itools/net tools/token_bucket_check.cpp src/TokenBucket.cpp -o token_bucket_check
+//   ./token_bucket_check [seconds]
+
+#include <math.h>
+#include <vector>
+#include "Arduino.h"
+#include "TokenBucket.h"
+
+#define LOOP_MIN 1   // Shortest pass of loop(), ms
+#define LOOP_MAX 50  // Longest pass of loop(), ms
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+  if (ok)
+    return;
+  if (failures++ < 20)
+    printf("FAILED: %s\n", what);
+}
+
+struct Setting
+{
+  float rate;
+  float burst;
+};
+
+static const Setting settings[] = {{0.2f, 3}, {1, 1}, {5, 10}, {0.02f, 1}, {50, 50}, {100, 1}};
+
+// Most sends in any window of the given length
+static uint32_t busiestWindow(const std::vector<unsigned long> &sends, unsigned long windowMs)
+{
+  uint32_t most = 0;
+  size_t first = 0;
+  for (size_t last = 0; last < sends.size(); last++)
+  {
+    while (sends[last] - sends[first] >= windowMs)
+      first++;
+    if (last - first + 1 > most)
+      most = last - first + 1;
+  }
+  return most;
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long seconds = argc > 1 ? atol(argv[1]) : 3600;
+  unsigned long runMs = seconds * 1000;
+  srand(35);
+
+  printf("%8s %6s %10s %10s %12s %12s %12s\n", "rate", "burst", "sent", "expected", "avg rate", "busiest 10s",
+         "throttled s");
+  for (const Setting &setting : settings)
+  {
+    TokenBucket bucket;
+    bucket.configure(setting.rate, setting.burst);
+    // Disconnected for a while: the bucket is full when the drain starts
+    unsigned long now = 600000;
+    bucket.available(now);
+    bucket.resetStats();
+
+    // More backlog than the run can drain, so the caller always wants a token
+    std::vector<unsigned long> sends;
+    unsigned long start = now;
+    unsigned long lastPass = now;
+    unsigned long waitStart = 0;
+    bool waiting = false;
+    uint32_t waits = 0;
+    uint64_t waitedMs = 0;
+    bool overBurst = false;
+    while (now - start < runMs)
+    {
+      while (bucket.tryConsume(now))
+      {
+        sends.push_back(now);
+        if (waiting)
+        {
+          waiting = false;
+          waitedMs += now - waitStart;
+        }
+      }
+      if (!waiting)
+      {
+        waiting = true;
+        waitStart = now;
+        waits++;
+      }
+      overBurst = overBurst || bucket.available(now) > setting.burst;
+      lastPass = now;
+      now += LOOP_MIN + rand() % (LOOP_MAX - LOOP_MIN + 1);
+    }
+
+    // The full bucket goes out at once, then the refill sets the pace; the
+    // next message may be just short of its token when the run ends
+    double expected = setting.burst + setting.rate * (lastPass - start) / 1000.0;
+    double average = (sends.size() - setting.burst) * 1000.0 / (lastPass - start);
+    double oneMessage = 1000.0 / (lastPass - start);
+    uint32_t busiest = busiestWindow(sends, 10000);
+    printf("%8.2f %6.0f %10zu %10.1f %12.4f %12u %12.1f\n", setting.rate, setting.burst, sends.size(), expected,
+           average, (unsigned)busiest, bucket.throttleTimeMs() / 1000.0);
+
+    check(!overBurst, "bucket held more than the burst");
+    for (unsigned long windowMs : {1000UL, 10000UL, 60000UL})
+      check(busiestWindow(sends, windowMs) <= setting.rate * windowMs / 1000.0 + setting.burst,
+            "window over rate * window + burst");
+    check(sends.size() <= expected, "sent more than the configured rate allows");
+    if (setting.burst >= 1 + setting.rate * LOOP_MAX / 1000.0)
+    {
+      check(sends.size() + 1 >= expected, "sent count off the configured rate");
+      check(fabs(average - setting.rate) <= fmax(setting.rate * 0.01, oneMessage),
+            "average rate off by more than 1%");
+    }
+    else
+    {
+      check(average + oneMessage >= 1 / (1 / setting.rate + LOOP_MAX / 1000.0),
+            "rate short by more than one pass per message");
+    }
+    check(bucket.peakBurst() <= setting.burst, "peak burst over the burst");
+    check(bucket.throttled() == waits, "throttled() does not match the waits");
+    check(bucket.throttleTimeMs() == waitedMs, "throttleTimeMs() does not match the time waited");
+    check(bucket.sent() == sends.size(), "sent() does not match");
+  }
+
+  // A lower burst clamps a full bucket straight away
+  TokenBucket bucket;
+  bucket.configure(1, 10);
+  bucket.available(100000);
+  bucket.configure(1, 2);
+  check(bucket.available(100000) <= 2, "lowered burst not applied to a full bucket");
+  int burst = 0;
+  while (bucket.tryConsume(100000))
+    burst++;
+  check(burst == 2, "lowered burst let more through");
+  printf("burst lowered from 10 to 2 on a full bucket: %d sent at once\n", burst);
+
+  // A refunded token can be used again and is not counted as sent
+  bucket.configure(0.001, 3);
+  bucket.setTokens(3);
+  bucket.resetStats();
+  for (int i = 0; i < 3; i++)
+    bucket.tryConsume(200000);
+  bucket.refund();
+  check(bucket.sent() == 2 && bucket.tryConsume(200000) && !bucket.tryConsume(200000), "refunded token not usable");
+  bucket.refund();
+  bucket.refund();
+  bucket.refund();
+  bucket.refund();
+  check(bucket.available(200000) <= 3, "refunds filled the bucket over the burst");
+
+  printf(failures == 0 ? "PASS\n" : "FAIL (%d)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
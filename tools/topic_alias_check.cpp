@@ -0,0 +1,141 @@
+// Host check of Mqtt5Client's topic aliases against the broker stand-in in
+// tools/net, which offers a Topic Alias Maximum of 10. The client keeps 4
+// (MQTT5_MAX_ALIASES). The device replays what the firmware publishes after a
+// connect: the sensor, shaper and OTA status, the boot report and a config
+// ack, then readings with a shaper status now and then, with a reconnect
+// halfway. It runs once handing out aliases first come, first served, as
+// before reserveAlias(), and once with the data topic reserved, as
+// configureMQTT() now does. It checks that
+//   - a subscriber gets every message under its own topic, so each alias was
+//     named before it was used, also again after the reconnect
+//   - with the reservation, every reading but the first on a connection goes
+//     out without its topic name
+//   - the reservation makes readings smaller and costs nothing in total
+// and prints the bytes per publish both ways.
+//
+//   g++ -std=gnu++17 -O2 -Iinclude -Itools/net tools/topic_alias_check.cpp src/Mqtt5Client.cpp src/TrackingClient.cpp -lpthread -o topic_alias_check
+//   ./topic_alias_check
+
+#include <vector>
+#include "WiFiClient.h"
+#include "broker_stub.h"
+#include "Mqtt5Client.h"
+#include "PubSubClient.h"
+#include "TrackingClient.h"
+
+#define DATA_TOPIC "sensor/aht20" // mqttTopic default
+#define DEVICE "sensor/aht20/esp-a1b2c3"
+#define READINGS 40
+#define SHAPER_EVERY 10 // Readings between shaper status reports
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+  if (ok)
+    return;
+  if (failures++ < 20)
+    printf("FAILED: %s\n", what);
+}
+
+static const char *READING = "{\"device_id\": \"a1b2c3\", \"boot\": 12, \"seq\": 3456, \"temperature\": 21.37, \"humidity\": 45.12}";
+
+// What the firmware publishes once connected, before the first reading
+static const char *STARTUP[][2] = {
+    {DEVICE "/sensor", "{\"status\": \"ok\", \"sensors\": 1}"},
+    {DEVICE "/shaper", "{\"rate\": 0.2, \"tokens\": 3}"},
+    {DEVICE "/ota/status", "{\"status\": \"idle\"}"},
+    {DEVICE "/boot", "{\"phases\": [], \"total_ms\": 2140}"},
+    {DEVICE "/config/ack", "{\"applied\": 1}"},
+};
+
+struct Result
+{
+  uint32_t readingBytes = 0;
+  uint32_t readings = 0;
+  uint32_t namedReadings = 0; // Readings that carried the topic name
+  uint32_t totalBytes = 0;
+};
+
+static Result run(BrokerStub &broker, bool reserve)
+{
+  Result result;
+  std::vector<std::string> sent;
+  std::vector<std::string> received;
+
+  WiFiClient subscriberNet;
+  PubSubClient subscriber(subscriberNet);
+  subscriber.setServer(IPAddress(127, 0, 0, 1), broker.port());
+  subscriber.setBufferSize(1024);
+  subscriber.setCallback([&](char *topic, uint8_t *, unsigned int) { received.push_back(topic); });
+  check(subscriber.connect("subscriber", nullptr, nullptr, nullptr, 0, false, nullptr, true), "subscriber connect failed");
+  check(subscriber.subscribe("sensor/#"), "subscribe failed");
+
+  WiFiClient net;
+  TrackingClient tracking(net);
+  Mqtt5Client device(tracking);
+  device.setServer(IPAddress(127, 0, 0, 1), broker.port());
+  if (reserve)
+    device.reserveAlias(DATA_TOPIC);
+
+  auto publish = [&](const char *topic, const char *payload) {
+    uint32_t before = tracking.bytesSent();
+    check(device.publish(topic, (const uint8_t *)payload, strlen(payload), false, 0), "publish failed");
+    uint32_t bytes = tracking.bytesSent() - before;
+    sent.push_back(topic);
+    result.totalBytes += bytes;
+    if (strcmp(topic, DATA_TOPIC) == 0)
+    {
+      result.readingBytes += bytes;
+      result.readings++;
+      // Fixed header (2), empty topic (2), properties (1 + 3 for the alias)
+      result.namedReadings += bytes != 2 + 2 + 4 + strlen(payload);
+    }
+    subscriber.loop();
+  };
+
+  for (int connection = 0; connection < 2; connection++)
+  {
+    check(device.connect("esp-a1b2c3", nullptr, nullptr, true, 0), "device connect failed");
+    for (const auto &message : STARTUP)
+      publish(message[0], message[1]);
+    for (int i = 0; i < READINGS / 2; i++)
+    {
+      publish(DATA_TOPIC, READING);
+      if (i % SHAPER_EVERY == SHAPER_EVERY - 1)
+        publish(STARTUP[1][0], STARTUP[1][1]);
+    }
+    device.disconnect();
+  }
+
+  for (unsigned long start = millis(); received.size() < sent.size() && millis() - start < 1000;)
+  {
+    subscriber.loop();
+    delay(1);
+  }
+  check(received == sent, "subscriber did not get every message under its topic");
+  subscriber.disconnect();
+  return result;
+}
+
+int main()
+{
+  BrokerStub broker;
+  check(broker.start(), "broker stand-in did not start");
+
+  Result before = run(broker, false);
+  Result after = run(broker, true);
+
+  printf("%-28s %10s %10s\n", "", "before", "after");
+  printf("%-28s %10.1f %10.1f\n", "bytes per reading", (float)before.readingBytes / before.readings,
+         (float)after.readingBytes / after.readings);
+  printf("%-28s %10u %10u\n", "readings with topic name", before.namedReadings, after.namedReadings);
+  printf("%-28s %10u %10u\n", "bytes of all publishes", before.totalBytes, after.totalBytes);
+
+  check(after.namedReadings == 2, "readings after the first on a connection still carry the topic name");
+  check(after.readingBytes < before.readingBytes, "reserving the alias did not make readings smaller");
+  check(after.totalBytes < before.totalBytes, "reserving the alias cost more in total");
+
+  printf(failures == 0 ? "PASS\n" : "FAIL (%d)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
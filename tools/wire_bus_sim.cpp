@@ -0,0 +1,127 @@
+// Host run of WireBus.h, the I2C path of the AHT20 driver, on the simulated
+// bus through the Wire and Arduino stand-ins in tools/host. It checks that:
+//   - begin() sets the fast-mode clock and the clock-stretch limit
+//   - readings come through unchanged at 100 and 400 kHz
+//   - a slave holding SDA low, from any bit of a byte, is clocked free and
+//     the transfer retried, so the sample still arrives
+//   - a missing sensor, or one stretching the clock past the limit, fails
+//     the read without a recovery, and the time on the bus stays bounded
+//   - a line that never comes free fails the read instead of hanging
+// and prints the bus time of one AHT20 sample at both clocks.
+//
+//   g++ -std=gnu++17 -O2 -Iinclude -Itools -Itools/host tools/wire_bus_sim.cpp -o wire_bus_sim
+//   ./wire_bus_sim [cycles]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "WireBus.h"
+#include "Aht20Driver.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char *what, long cycle)
+{
+  if (ok)
+    return;
+  if (failures++ < 20)
+    printf("cycle %ld: %s\n", cycle, what);
+}
+
+static double randomIn(double low, double high)
+{
+  return low + (high - low) * (rand() / (double)RAND_MAX);
+}
+
+// One sample as loop() takes it; returns the status
+static SensorStatus sample(Aht20Driver<WireBus> &sensor, float *values)
+{
+  simNow += sensor.trigger();
+  return sensor.collect(values);
+}
+
+int main(int argc, char **argv)
+{
+  long cycles = argc > 1 ? atol(argv[1]) : 2000;
+  srand(45);
+
+  SimI2cBus &sim = SimI2cBus::shared();
+  SimAht20 chip;
+  sim.clear();
+  sim.attach(&chip);
+
+  WireBus &bus = WireBus::shared();
+  Aht20Driver<WireBus> sensor(bus);
+  check(sensor.begin(), "begin() failed", 0);
+  check(sim.clockHz == SENSOR_I2C_CLOCK, "clock not set", 0);
+  check(sim.stretchLimitUs == SENSOR_I2C_STRETCH_LIMIT, "clock-stretch limit not set", 0);
+
+  float values[2];
+  static const uint32_t clocks[] = {100000, SENSOR_I2C_CLOCK};
+  for (uint32_t clock : clocks)
+  {
+    bus.setClock(clock);
+    sim.resetStats();
+    for (long cycle = 0; cycle < cycles; cycle++)
+    {
+      chip.temperature = randomIn(-40, 85);
+      chip.humidity = randomIn(0, 100);
+      check(sample(sensor, values) == SENSOR_READY, "sample not ready", cycle);
+      check(fabs(values[0] - chip.temperature) < 0.001 && fabs(values[1] - chip.humidity) < 0.001, "wrong values",
+            cycle);
+    }
+    printf("%3lu kHz: bus %.3f ms per sample in %.0f transfers\n", (unsigned long)clock / 1000,
+           sim.busTimeUs / cycles / 1000, (double)sim.transactions / cycles);
+  }
+
+  // SDA held from every bit position, before the trigger and before the read
+  uint32_t recoveries = bus.recoveries();
+  uint32_t begins = Wire.begins;
+  long stuck = 0;
+  for (long cycle = 0; cycle < cycles; cycle++)
+  {
+    uint8_t held = 1 + rand() % 9;
+    chip.temperature = randomIn(-40, 85);
+    if (cycle % 2)
+    {
+      sim.sdaHeldClocks = held;
+      check(sample(sensor, values) == SENSOR_READY, "no sample after SDA held before the trigger", cycle);
+    }
+    else
+    {
+      simNow += sensor.trigger();
+      sim.sdaHeldClocks = held;
+      check(sensor.collect(values) == SENSOR_READY, "no sample after SDA held before the read", cycle);
+    }
+    check(sim.sdaHeldClocks == 0, "SDA not clocked free", cycle);
+    check(fabs(values[0] - chip.temperature) < 0.001, "wrong values after recovery", cycle);
+    stuck++;
+  }
+  check(bus.recoveries() - recoveries == (uint32_t)stuck, "recoveries not counted", cycles);
+  check(Wire.begins - begins == (uint32_t)stuck, "Wire not restarted after recovery", cycles);
+
+  // NACKs and clock stretching are not bus faults
+  recoveries = bus.recoveries();
+  chip.present = false;
+  check(sample(sensor, values) == SENSOR_ERROR, "missing sensor not reported", cycles);
+  chip.present = true;
+  chip.stretchUs = SENSOR_I2C_STRETCH_LIMIT / 2;
+  check(sample(sensor, values) == SENSOR_READY, "stretch within the limit failed", cycles);
+  chip.stretchUs = SENSOR_I2C_STRETCH_LIMIT * 50;
+  sim.resetStats();
+  check(sample(sensor, values) == SENSOR_ERROR, "stretch past the limit not reported", cycles);
+  check(sim.busTimeUs < 3 * SENSOR_I2C_STRETCH_LIMIT, "stretch past the limit held the bus", cycles);
+  chip.stretchUs = 0;
+  check(bus.recoveries() == recoveries, "recovery without a held line", cycles);
+
+  // A line that stays low for good
+  sim.sdaHeldClocks = 255;
+  sim.resetStats();
+  check(sample(sensor, values) == SENSOR_ERROR, "held line not reported", cycles);
+  check(sim.transactions <= 4, "held line retried without bound", cycles);
+  sim.sdaHeldClocks = 0;
+  check(sample(sensor, values) == SENSOR_READY, "no sample once the line came free", cycles);
+
+  printf(failures == 0 ? "PASS\n" : "FAIL (%d)\n", failures);
+  return failures == 0 ? 0 : 1;
+}